@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/param.h>
@@ -15,18 +17,24 @@
 #include "esp_log.h"
 #include "esp_tls.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "protocol_examples_common.h"
 #include "recorder.h" 
 #include "peer.h"
 #include "wifimanager.h"
 #include "events.h"
+#include "clip_upload.h"
+#include "journal.h"
+#include "audio.h"
+#include "audio_tx.h"
+#include "trace.h"
+#include "camera.h"
+#include "video_tx.h"
+#include "latency.h"
 
 
 
-#define PLAYBACK_STACK_SIZE 6144
-#define PLAYBACK_PRIORITY 4
-
 static const char *TAG = "webrtc";
 
 static TaskHandle_t xPcTaskHandle = NULL;
@@ -36,7 +44,6 @@ static TaskHandle_t xPsTaskHandle = NULL;
 // static TaskHandle_t xUartTaskHandle = NULL; // If needed
 static TaskHandle_t xRecordTaskHandle = NULL; // Handle for the *recording* part (captureTask in recorder.cpp)
 static TaskHandle_t xUnifiedCameraTaskHandle = NULL;
-static TaskHandle_t xPlaybackTaskHandle = NULL; // ADD THIS LINE
 
 // ... extern declarations ...
 extern esp_err_t camera_init();
@@ -48,7 +55,6 @@ extern void unified_camera_task(void *pvParameters);
 // extern void camera_task(void *pvParameters); // Old camera task
 // extern void streaming_task(void *pvParameters); // Old streaming task
 extern void upload_image_task(void* pvParameters); // Keep if separate task used
-extern void playback_task(void *pvParameters); // Declaration for playback task
 extern bool prepRecording(); // Ensure prepRecording is available
 SemaphoreHandle_t xSemaphore = NULL;
 extern TaskHandle_t captureHandle;
@@ -56,6 +62,7 @@ extern TaskHandle_t captureHandle;
 PeerConnection *g_pc;
 PeerConnectionState eState = PEER_CONNECTION_CLOSED;
 int gDataChannelOpened = 0;
+int gRtpVideoOpened = 0;
 
 int64_t get_timestamp() {
 
@@ -69,27 +76,333 @@ static void oniceconnectionstatechange(PeerConnectionState state, void *user_dat
   ESP_LOGI(TAG, "PeerConnectionState: %d", state);
   eState = state;
 
+  // Either loop may be sleeping for its idle period, let them pick up the new cadence
+  if (xPcTaskHandle) xTaskNotifyGive(xPcTaskHandle);
+  if (xPsTaskHandle) xTaskNotifyGive(xPsTaskHandle);
+  frame_scheduler_wake(); // Streaming starts or stops, the camera sleeps until told
+
   // not support datachannel close event
   if (eState != PEER_CONNECTION_COMPLETED) {
     gDataChannelOpened = 0;
+    gRtpVideoOpened = 0;
+    stop_playback(-1); // Nobody left to watch
+    video_tx_reset();
+    audio_tx_reset();
+  }
+}
+
+// Replies on the stream the request came in on. Called from the data channel
+// callback, which already runs inside peer_connection_loop.
+static void datachannel_reply(uint16_t sid, const char *fmt, ...) {
+
+  char reply[128];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(reply, sizeof(reply), fmt, args);
+  va_end(args);
+  if (len > 0) {
+    peer_connection_datachannel_send_sid(g_pc, reply, MIN(len, (int)sizeof(reply) - 1), sid);
+  }
+}
+
+// Clip export copies several MB of video, so it runs in its own task
+// instead of the data channel callback. One export at a time.
+typedef struct {
+  time_t from;
+  time_t to;
+  uint16_t sid;
+} clip_request_t;
+
+static clip_request_t clip_request;
+static volatile bool clip_running = false;
+
+static void clip_task(void *arg) {
+
+  char path[FILE_NAME_LEN];
+  time_t end = clip_request.to;
+  esp_err_t res = export_clip(clip_request.from, clip_request.to, path, sizeof(path), &end);
+  if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
+    if (res == ESP_OK && end < clip_request.to) {
+      datachannel_reply(clip_request.sid, "clip:%s cut:%lld", path, (long long)end);
+    } else if (res == ESP_OK) {
+      datachannel_reply(clip_request.sid, "clip:%s", path);
+    } else {
+      datachannel_reply(clip_request.sid, "error:clip %s", esp_err_to_name(res));
+    }
+    xSemaphoreGive(xSemaphore);
+  }
+  clip_running = false;
+  vTaskDelete(NULL);
+}
+
+// Journal queries read the SD card and can return many lines, so they also
+// run in their own task. Events are sent as
+//   "event:<time_ms> <type> <score> <file> <frame>"  (file "-" if no closed recording holds it)
+// and the query ends with "events:<count>", plus " more" if it was cut at EVENTS_QUERY_MAX.
+#define EVENTS_QUERY_MAX 100
+
+typedef struct {
+  time_t from;
+  time_t to;
+  uint32_t types;
+  uint16_t sid;
+} events_request_t;
+
+typedef struct {
+  uint16_t sid;
+  uint32_t sent;
+  uint32_t recording; // Recording the cached path belongs to
+  char path[FILE_NAME_LEN];
+} events_reply_t;
+
+static events_request_t events_request;
+static volatile bool events_running = false;
+
+static bool events_reply(const journal_event_t *ev, void *arg) {
+
+  events_reply_t *r = (events_reply_t *)arg;
+  // Consecutive events are usually in the same recording, so its file is looked up once
+  if (ev->recording != r->recording) {
+    r->recording = ev->recording;
+    if (ev->recording == 0 || find_recording((time_t)ev->recording, r->path, sizeof(r->path)) != ESP_OK) {
+      strcpy(r->path, "-");
+    }
   }
+  if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
+    datachannel_reply(r->sid, "event:%lld %s %u %s %u", ev->time_ms, journal_type_name(ev->type),
+                      ev->score, r->path, ev->frame);
+    xSemaphoreGive(xSemaphore);
+  }
+  return ++r->sent < EVENTS_QUERY_MAX;
 }
 
+static void events_task(void *arg) {
+
+  events_reply_t reply = { .sid = events_request.sid, .sent = 0, .recording = 0, .path = "-" };
+  esp_err_t res = journal_query(events_request.from, events_request.to, events_request.types, events_reply, &reply);
+  if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
+    if (res == ESP_OK) {
+      datachannel_reply(reply.sid, "events:%lu%s", reply.sent, reply.sent >= EVENTS_QUERY_MAX ? " more" : "");
+    } else {
+      datachannel_reply(reply.sid, "error:events %s", esp_err_to_name(res));
+    }
+    xSemaphoreGive(xSemaphore);
+  }
+  events_running = false;
+  vTaskDelete(NULL);
+}
+
+// Writing the trace ring to the SD card takes a while, so the dump gets a task too
+static volatile bool trace_dump_running = false;
+static uint16_t trace_dump_sid;
+
+static void trace_dump_task(void *arg) {
+
+  uint32_t records = 0;
+  esp_err_t res = trace_dump(&records);
+  if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
+    if (res == ESP_OK) {
+      datachannel_reply(trace_dump_sid, "trace:%s %lu", TRACE_DUMP_PATH, records);
+    } else {
+      datachannel_reply(trace_dump_sid, "error:trace %s", esp_err_to_name(res));
+    }
+    xSemaphoreGive(xSemaphore);
+  }
+  trace_dump_running = false;
+  vTaskDelete(NULL);
+}
+
+// Text commands from the app:
+//   "play [file [frame]]"  start a playback session sending on this stream, optionally at a frame of the file
+//   "rewind <s>"   play from <s> seconds ago, following the recording in progress (reaches back into the recording it rolled over from, no further)
+//   "stop [id]"    stop session <id>, or every session on this stream
+//   "clip <from> <to>"  export [from, to) (epoch seconds) to a new AVI, replies with its path, plus "cut:<t>" if it stops at t (CLIP_MAX_FRAMES)
+//   "events <from> <to> [type]"  journaled events in [from, to) (epoch seconds), all types or one ("pir", "motion", "sound")
+//   "stats [reset]"     live video counters and per-stage latency, one line each
+//   "stats trace <n>"   log the stamps of every n-th live frame (0 stops)
+//   "snapshot [max_age_ms]"  send the latest still on this stream as snapshot-flagged fragments (cached up to max_age_ms, default SNAPSHOT_MAX_AGE_MS)
+//   "audio on|off"      live Opus audio on the WebRTC audio track (on by default)
+//   "trace [on|off|dump]"  hot-path trace ring: state, switch, or write it to the SD card (decode with tools/trace_decode.py)
 static void onmessage(char *msg, size_t len, void *userdata, uint16_t sid) {
 
   ESP_LOGI(TAG, "Datachannel message: %.*s", len, msg);
+
+  char cmd[FILE_NAME_LEN * 2];
+  size_t cmd_len = MIN(len, sizeof(cmd) - 1);
+  memcpy(cmd, msg, cmd_len);
+  cmd[cmd_len] = '\0';
+
+  if (strncmp(cmd, "play", 4) == 0) {
+    char file[FILE_NAME_LEN * 2] = "";
+    unsigned frame = 0;
+    sscanf(cmd + 4, "%127s %u", file, &frame);
+    int session = start_playback(*file ? file : NULL, (uint16_t)frame, sid);
+    if (session < 0) {
+      datachannel_reply(sid, "error:no free playback session");
+    } else {
+      datachannel_reply(sid, "session:%d", session);
+    }
+  } else if (strncmp(cmd, "rewind", 6) == 0) {
+    int seconds = atoi(cmd + 6);
+    int session = start_timeshift(seconds > 0 ? seconds : 30, sid);
+    if (session < 0) {
+      datachannel_reply(sid, "error:timeshift unavailable");
+    } else {
+      datachannel_reply(sid, "session:%d", session);
+    }
+  } else if (strncmp(cmd, "clip", 4) == 0) {
+    long long from = 0, to = 0;
+    if (sscanf(cmd + 4, "%lld %lld", &from, &to) != 2 || to <= from) {
+      datachannel_reply(sid, "error:usage clip <from> <to>");
+    } else if (clip_running) {
+      datachannel_reply(sid, "error:clip export busy");
+    } else {
+      clip_request.from = (time_t)from;
+      clip_request.to = (time_t)to;
+      clip_request.sid = sid;
+      clip_running = true;
+      if (xTaskCreatePinnedToCore(clip_task, "clip", 6144, NULL, 3, NULL, 1) != pdPASS) {
+        clip_running = false;
+        datachannel_reply(sid, "error:clip export busy");
+      }
+    }
+  } else if (strncmp(cmd, "events", 6) == 0) {
+    long long from = 0, to = 0;
+    char type[16] = "";
+    int type_id = -1;
+    if (sscanf(cmd + 6, "%lld %lld %15s", &from, &to, type) < 2 || to <= from
+        || (type[0] && (type_id = journal_type_parse(type)) < 0)) {
+      datachannel_reply(sid, "error:usage events <from> <to> [pir|motion|sound]");
+    } else if (events_running) {
+      datachannel_reply(sid, "error:events query busy");
+    } else {
+      events_request.from = (time_t)from;
+      events_request.to = (time_t)to;
+      events_request.types = type_id < 0 ? JOURNAL_ALL_TYPES : JOURNAL_TYPE_BIT(type_id);
+      events_request.sid = sid;
+      events_running = true;
+      if (xTaskCreatePinnedToCore(events_task, "events", 6144, NULL, 3, NULL, 1) != pdPASS) {
+        events_running = false;
+        datachannel_reply(sid, "error:events query busy");
+      }
+    }
+  } else if (strncmp(cmd, "stats", 5) == 0) {
+    const char *arg = cmd + 5;
+    while (*arg == ' ') arg++;
+    if (strncmp(arg, "reset", 5) == 0) {
+      latency_reset();
+      datachannel_reply(sid, "stats:reset");
+    } else if (strncmp(arg, "trace", 5) == 0) {
+      int every = atoi(arg + 5);
+      latency_set_trace(every > 0 ? every : 0);
+      datachannel_reply(sid, "stats:trace %d", every > 0 ? every : 0);
+    } else {
+      video_tx_stats_t vs;
+      video_tx_get_stats(&vs);
+      datachannel_reply(sid, "video pub=%lu stale=%lu sent=%lu drop=%lu rate=%lu fail=%lu",
+                        vs.published, vs.superseded, vs.sent, vs.dropped, vs.pacer_rate, vs.pacer_failures);
+      audio_stats_t as;
+      audio_get_stats(&as);
+      datachannel_reply(sid, "audio blocks=%lu ovf=%lu events=%lu busy=%luus level=%d floor=%d stack=%lu",
+                        as.blocks, as.overruns, as.events, as.busy_us_max, as.level_dbfs, as.floor_dbfs, as.stack_free);
+      audio_tx_stats_t ats;
+      audio_tx_get_stats(&ats);
+      datachannel_reply(sid, "opus enc=%lu err=%lu enc_us=%lu/%lu sent=%lu full=%lu stale=%lu fail=%lu",
+                        ats.encoded, ats.encode_errors, ats.encode_us_avg, ats.encode_us_max,
+                        ats.sent, ats.dropped_full, ats.dropped_stale, ats.send_failures);
+      for (int stage = 0; stage < LAT_STAGE_COUNT; stage++) {
+        char line[96];
+        if (latency_format(stage, line, sizeof(line)) > 0) datachannel_reply(sid, "%s", line);
+      }
+    }
+  } else if (strncmp(cmd, "snapshot", 8) == 0) {
+    int max_age = atoi(cmd + 8);
+    if (video_tx_snapshot(sid, max_age > 0 ? max_age : SNAPSHOT_MAX_AGE_MS) != ESP_OK) {
+      datachannel_reply(sid, "error:snapshot busy");
+    }
+  } else if (strncmp(cmd, "audio", 5) == 0) {
+    const char *arg = cmd + 5;
+    while (*arg == ' ') arg++;
+    if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) {
+      audio_tx_set_enabled(arg[1] == 'n');
+      datachannel_reply(sid, "audio:%s", arg);
+    } else {
+      datachannel_reply(sid, "error:usage audio on|off");
+    }
+  } else if (strncmp(cmd, "trace", 5) == 0) {
+    const char *arg = cmd + 5;
+    while (*arg == ' ') arg++;
+    if (strcmp(arg, "dump") == 0) {
+      if (trace_dump_running) {
+        datachannel_reply(sid, "error:trace dump busy");
+      } else {
+        trace_dump_sid = sid;
+        trace_dump_running = true;
+        if (xTaskCreatePinnedToCore(trace_dump_task, "trace_dump", 4096, NULL, 3, NULL, 1) != pdPASS) {
+          trace_dump_running = false;
+          datachannel_reply(sid, "error:trace dump busy");
+        }
+      }
+    } else {
+      if (strcmp(arg, "on") == 0 || strcmp(arg, "off") == 0) trace_set_enabled(arg[1] == 'n');
+      trace_stats_t ts;
+      trace_get_stats(&ts);
+      datachannel_reply(sid, "trace:%s written=%lu lost=%lu", ts.enabled ? "on" : "off", ts.written, ts.lost);
+    }
+  } else if (strncmp(cmd, "stop", 4) == 0) {
+    const char *arg = cmd + 4;
+    while (*arg == ' ') arg++;
+    if (*arg) {
+      stop_playback(atoi(arg));
+    } else {
+      stop_playback_sid(sid);
+    }
+  }
 }
 
 void onopen(void *userdata) {
  
   ESP_LOGI(TAG, "Datachannel opened");
   gDataChannelOpened = 1;
+  frame_scheduler_wake();
+
+  // Runs inside peer_connection_loop, so the WebRTC mutex is already held
+  if (!gRtpVideoOpened) {
+    if (peer_connection_create_datachannel_sid(g_pc, DATA_CHANNEL_PARTIAL_RELIABLE_REXMIT_UNORDERED, 0, 0,
+                                               RTP_VIDEO_LABEL, "rtp/jpeg", RTP_VIDEO_SID) >= 0) {
+      gRtpVideoOpened = 1;
+      ESP_LOGI(TAG, "RTP video channel opened on sid %d", RTP_VIDEO_SID);
+    } else {
+      ESP_LOGW(TAG, "Failed to open RTP video channel, live view stays on the main channel");
+    }
+  }
 }
 
 static void onclose(void *userdata) {
  
 }
 
+// --- Loop Cadence ---
+// libpeer doesn't expose its sockets, so the loops can't block on them.
+// Instead each loop sleeps on its task notification: briefly while a peer is
+// negotiating or connected, longer when nobody is connected. State changes
+// and new video frames wake the tasks early.
+#define SIGNALING_ACTIVE_MS 10  // Offer/answer and candidates in flight
+#define SIGNALING_IDLE_MS 50    // Waiting for an offer, MQTT keep-alive
+#define CONNECTION_ACTIVE_MS 5  // ICE/DTLS/SCTP timers and incoming data
+#define CONNECTION_IDLE_MS 200  // No peer
+
+// pdMS_TO_TICKS rounds down, so short waits would become 0 ticks and spin
+static TickType_t wait_ticks(uint32_t ms) {
+  TickType_t ticks = (ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+  return ticks ? ticks : 1;
+}
+
+static bool peer_active(void) {
+  return eState == PEER_CONNECTION_NEW || eState == PEER_CONNECTION_CHECKING ||
+         eState == PEER_CONNECTION_CONNECTED || eState == PEER_CONNECTION_COMPLETED;
+}
+
 void peer_signaling_task(void *arg) {
 
   ESP_LOGI(TAG, "peer_signaling_task started");
@@ -98,7 +411,8 @@ void peer_signaling_task(void *arg) {
 
     peer_signaling_loop();
 
-    vTaskDelay(pdMS_TO_TICKS(1));
+    bool negotiating = peer_active() && eState != PEER_CONNECTION_COMPLETED;
+    ulTaskNotifyTake(pdTRUE, wait_ticks(negotiating ? SIGNALING_ACTIVE_MS : SIGNALING_IDLE_MS));
   }
 
 }
@@ -109,15 +423,42 @@ void peer_connection_task(void *arg) {
 
   for(;;) {
 
+    int64_t video_wait_us = -1;
     if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
         peer_connection_loop(g_pc);
+        audio_tx_service(); // Opus frames first, they are small and late ones are useless
+        video_wait_us = video_tx_service(); // Freshest live frame and queued playback frames, as far as the pacer allows
         xSemaphoreGive(xSemaphore);
     }
 
-    vTaskDelay(pdMS_TO_TICKS(1));
+    TickType_t wait = wait_ticks(peer_active() ? CONNECTION_ACTIVE_MS : CONNECTION_IDLE_MS);
+    if (video_wait_us >= 0) wait = MIN(wait, wait_ticks((video_wait_us + 999) / 1000));
+    ulTaskNotifyTake(pdTRUE, wait);
   }
 }
 
+// Share of time each core spent in its idle task since the last call. Needs
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS (sdkconfig.defaults).
+static void log_cpu_idle(void) {
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+  static configRUN_TIME_COUNTER_TYPE last_idle[portNUM_PROCESSORS];
+  static int64_t last_us = 0;
+  int64_t now = esp_timer_get_time();
+  char line[48];
+  int len = 0;
+  for (int core = 0; core < portNUM_PROCESSORS; core++) {
+    configRUN_TIME_COUNTER_TYPE idle = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+    if (last_us) {
+      len += snprintf(line + len, sizeof(line) - len, " core%d %lld%%", core,
+                      (long long)(idle - last_idle[core]) * 100 / (now - last_us));
+    }
+    last_idle[core] = idle;
+  }
+  if (last_us) ESP_LOGI(TAG, "CPU idle:%s (%d Hz tick)", line, configTICK_RATE_HZ);
+  last_us = now;
+#endif
+}
+
 void sync_time()
 {
     ESP_LOGI(TAG, "Initializing SNTP");
@@ -150,6 +491,7 @@ void sync_time()
 
 void app_main(void) {
 
+  trace_init(); // Before any task that traces
   handle_wifi_connect();
   
 
@@ -185,6 +527,7 @@ void app_main(void) {
   
   PeerConfiguration config = {
     .ice_servers = {{ .urls = "stun:stun.l.google.com:19302" }},
+    .audio_codec = CODEC_OPUS, // Live microphone audio (audio_tx.c), video stays on the data channels
     .datachannel = DATA_CHANNEL_BINARY,
   };
 
@@ -194,7 +537,10 @@ void app_main(void) {
 
 
   // Initialize Event Handling (PIR sensor, upload init)
-  upload_image_init(); // Configure PIR pin, create semaphore
+  upload_image_init(); // PIR sensor on interrupts
+  if (audio_init() != ESP_OK) { // PDM microphone and sound events
+    ESP_LOGW(TAG, "No microphone, sound events are off.");
+  }
   ESP_LOGI(TAG, "Event system initialized.");
 
   // Create Global Mutex for WebRTC sending
@@ -263,12 +609,17 @@ void app_main(void) {
     // Unified Camera/Streaming/Recording/Event Task
     xTaskCreatePinnedToCore(unified_camera_task, "unified_camera", 8192, NULL, 5, &xUnifiedCameraTaskHandle, 0); // Core 0 for camera
 
-    // Playback Task (Handles reading AVI and feeding streamingQueue)
+    // Playback reader tasks are created per session by start_playback()
     // Note: captureTask (recording) is created inside prepRecording()
-    xTaskCreatePinnedToCore(playback_task, "playback", PLAYBACK_STACK_SIZE, NULL, PLAYBACK_PRIORITY, &playbackTaskHandle, 1); // Core 1 for file I/O
 
-    // Event Upload Task (if running separately)
-    // xTaskCreatePinnedToCore(upload_image_task, "upload", 4096, NULL, 6, NULL, 1); // Example priority
+    // Event Upload Worker (HTTP POSTs stay off the camera task)
+    xTaskCreatePinnedToCore(upload_image_task, "upload", 6144, NULL, 3, NULL, 1);
+
+    // Event Clip Upload Worker (exports and streams the recording around events)
+    xTaskCreatePinnedToCore(clip_upload_task, "clip_upload", 6144, NULL, 2, NULL, 1);
+
+    // Event Journal Writer (time-indexed event records on the SD card)
+    xTaskCreatePinnedToCore(journal_task, "journal", 4096, NULL, 2, NULL, 1);
 
     ESP_LOGI(TAG, "[APP] Free memory after task creation: %d bytes", esp_get_free_heap_size());
 
@@ -277,6 +628,7 @@ void app_main(void) {
     while (1) {
         vTaskDelay(pdMS_TO_TICKS(5000));
          ESP_LOGD(TAG, "Main loop tick. Free heap: %d", esp_get_free_heap_size());
+         log_cpu_idle();
          // You could add logic here to check task states, restart if needed, etc.
     }
 }
@@ -0,0 +1,172 @@
+// audio.c
+
+#include "audio.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/i2s_pdm.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "sound_detect.h"
+#include "audio_tx.h"
+
+static const char *TAG = "audio";
+
+#define AUDIO_MAX_SUBSCRIBERS 4
+#define AUDIO_PRIORITY 5 // Below the PIR and WebRTC tasks on core 1, above the uploads
+#define AUDIO_STACK_SIZE (12 * 1024) // The Opus encoder runs on it
+#define AUDIO_STACK_CHECK_BLOCKS 250 // High-water mark read every 5 s
+#define AUDIO_BLOCK_US (AUDIO_BLOCK_SAMPLES * 1000000LL / AUDIO_SAMPLE_RATE)
+
+typedef struct {
+    sound_callback_t cb;
+    void *arg;
+} sound_subscriber_t;
+
+static i2s_chan_handle_t rx_chan = NULL;
+static sound_detector_t detector; // Only used by audio_task
+static int16_t block[AUDIO_BLOCK_SAMPLES];
+static volatile bool sound_level = false;
+static portMUX_TYPE audio_lock = portMUX_INITIALIZER_UNLOCKED; // Guards stats and subscribers
+static sound_subscriber_t subscribers[AUDIO_MAX_SUBSCRIBERS];
+static audio_stats_t stats;
+
+static bool IRAM_ATTR audio_overrun_isr(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
+    stats.overruns++; // Written only here
+    return false;
+}
+
+bool sound_active(void) {
+    return sound_level;
+}
+
+esp_err_t sound_subscribe(sound_callback_t cb, void *arg) {
+    esp_err_t res = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&audio_lock);
+    for (int i = 0; i < AUDIO_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].cb == NULL) {
+            subscribers[i].cb = cb;
+            subscribers[i].arg = arg;
+            res = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&audio_lock);
+    return res;
+}
+
+void audio_get_stats(audio_stats_t *out) {
+    taskENTER_CRITICAL(&audio_lock);
+    *out = stats;
+    taskEXIT_CRITICAL(&audio_lock);
+}
+
+static void sound_commit(bool active, int64_t at_us, uint16_t score) {
+    sound_subscriber_t subs[AUDIO_MAX_SUBSCRIBERS];
+    sound_level = active;
+    taskENTER_CRITICAL(&audio_lock);
+    if (active) stats.events++;
+    memcpy(subs, subscribers, sizeof(subs));
+    taskEXIT_CRITICAL(&audio_lock);
+
+    if (active) {
+        ESP_LOGI(TAG, "Sound event, %u dB over the floor (event %lu)", score, stats.events);
+    } else {
+        ESP_LOGI(TAG, "Sound event over");
+    }
+    for (int i = 0; i < AUDIO_MAX_SUBSCRIBERS; i++) {
+        if (subs[i].cb) subs[i].cb(active, at_us, score, subs[i].arg);
+    }
+}
+
+// One block per DMA buffer: the read blocks until the driver has filled it,
+// so the task sleeps for all but the detector (and encoder) step of every 20 ms.
+// Block times run on the sample clock: each block starts AUDIO_BLOCK_US after
+// the one before, so a late wake-up doesn't put jitter into the block times.
+// The timeline is re-anchored to the read time after an overrun or a stall.
+static void audio_task(void *arg) {
+    ESP_LOGI(TAG, "Audio task started on Core %d", xPortGetCoreID());
+    int64_t block_us = 0; // esp_timer time of the first sample of the block just read
+    for (;;) {
+        size_t got = 0;
+        esp_err_t res = i2s_channel_read(rx_chan, block, sizeof(block), &got, pdMS_TO_TICKS(1000));
+        if (res != ESP_OK || got == 0) {
+            ESP_LOGW(TAG, "PDM read failed: %s", esp_err_to_name(res));
+            block_us = 0;
+            continue;
+        }
+
+        int64_t start = esp_timer_get_time();
+        int64_t latest = start - AUDIO_BLOCK_US; // The block can't have started later than this
+        int64_t expected = block_us + AUDIO_BLOCK_US;
+        block_us = (block_us == 0 || expected > latest || expected < latest - AUDIO_BLOCK_US * AUDIO_DMA_BLOCKS)
+                   ? latest : expected;
+
+        sound_result_t r;
+        sound_detect_process(&detector, block, got / sizeof(int16_t), &r);
+        if (audio_tx_wanted()) audio_tx_encode(block, got / sizeof(int16_t), block_us);
+        uint32_t busy_us = (uint32_t)(esp_timer_get_time() - start);
+        uint32_t stack_free = stats.blocks % AUDIO_STACK_CHECK_BLOCKS == 0 ? uxTaskGetStackHighWaterMark(NULL) : 0;
+
+        taskENTER_CRITICAL(&audio_lock);
+        stats.blocks++;
+        if (stack_free) stats.stack_free = stack_free;
+        if (busy_us > stats.busy_us_max) stats.busy_us_max = busy_us;
+        stats.level_dbfs = r.level_dbfs;
+        stats.floor_dbfs = r.floor_dbfs;
+        taskEXIT_CRITICAL(&audio_lock);
+
+        // The sound began with the first of the attack blocks
+        if (r.started) {
+            int64_t at_us = block_us - AUDIO_BLOCK_US * (detector.cfg.attack_blocks - 1);
+            sound_commit(true, at_us, (uint16_t)(r.level_dbfs - r.floor_dbfs));
+        } else if (r.ended) {
+            sound_commit(false, block_us, 0);
+        }
+    }
+}
+
+esp_err_t audio_init(void) {
+    sound_config_t cfg = SOUND_CONFIG_DEFAULT();
+    sound_detect_init(&detector, &cfg, AUDIO_SAMPLE_RATE);
+
+    i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_NUM_0, I2S_ROLE_MASTER);
+    chan_cfg.dma_desc_num = AUDIO_DMA_BLOCKS;
+    chan_cfg.dma_frame_num = AUDIO_BLOCK_SAMPLES;
+    esp_err_t res = i2s_new_channel(&chan_cfg, NULL, &rx_chan);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create I2S channel: %s", esp_err_to_name(res));
+        return res;
+    }
+
+    i2s_pdm_rx_config_t pdm_cfg = {
+        .clk_cfg = I2S_PDM_RX_CLK_DEFAULT_CONFIG(AUDIO_SAMPLE_RATE),
+        .slot_cfg = I2S_PDM_RX_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+        .gpio_cfg = {
+            .clk = MIC_PDM_CLK_PIN,
+            .din = MIC_PDM_DATA_PIN,
+            .invert_flags = { .clk_inv = false },
+        },
+    };
+    res = i2s_channel_init_pdm_rx_mode(rx_chan, &pdm_cfg);
+    if (res == ESP_OK) {
+        i2s_event_callbacks_t cbs = { .on_recv_q_ovf = audio_overrun_isr };
+        res = i2s_channel_register_event_callback(rx_chan, &cbs, NULL);
+    }
+    if (res == ESP_OK) res = i2s_channel_enable(rx_chan);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start PDM microphone: %s", esp_err_to_name(res));
+        i2s_del_channel(rx_chan);
+        rx_chan = NULL;
+        return res;
+    }
+
+    if (audio_tx_init() != ESP_OK) {
+        ESP_LOGW(TAG, "No live audio, sound detection only");
+    }
+    if (xTaskCreatePinnedToCore(audio_task, "audio", AUDIO_STACK_SIZE, NULL, AUDIO_PRIORITY, NULL, 1) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "PDM microphone on CLK GPIO %d, DATA GPIO %d, %d Hz", MIC_PDM_CLK_PIN, MIC_PDM_DATA_PIN, AUDIO_SAMPLE_RATE);
+    return ESP_OK;
+}
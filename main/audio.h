@@ -0,0 +1,47 @@
+// audio.h
+// PDM microphone capture and sound events. The I2S driver fills a ring of
+// AUDIO_DMA_BLOCKS DMA buffers; a task on core 1 reads one
+// AUDIO_BLOCK_SAMPLES block at a time and runs the sound detector on it
+// (see sound_detect.h), which costs a small fixed slice of each block, and
+// hands it to the Opus encoder while live audio is wanted (see audio_tx.h).
+// Sound events reach subscribers the same way PIR edges do.
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define MIC_PDM_CLK_PIN     42
+#define MIC_PDM_DATA_PIN    41
+#define AUDIO_SAMPLE_RATE   16000
+#define AUDIO_BLOCK_SAMPLES 320   // 20 ms, one detector step and one DMA buffer
+#define AUDIO_DMA_BLOCKS    6     // Samples are lost if the task falls 120 ms behind
+
+typedef struct {
+    uint32_t blocks;        // Read and analysed
+    uint32_t overruns;      // DMA ring overflows (samples lost)
+    uint32_t events;        // Sound events started
+    uint32_t busy_us_max;   // Longest detector and encoder step
+    uint32_t stack_free;    // Audio task stack high-water mark, bytes
+    int16_t level_dbfs;     // Last block
+    int16_t floor_dbfs;     // Noise floor
+} audio_stats_t;
+
+// Runs on the audio task; at_us is the esp_timer time the sound started and
+// score its level over the noise floor in dB (0 on the end). Keep it short.
+typedef void (*sound_callback_t)(bool active, int64_t at_us, uint16_t score, void *arg);
+
+esp_err_t audio_init(void); // Starts the PDM channel and the audio task
+bool sound_active(void);
+esp_err_t sound_subscribe(sound_callback_t cb, void *arg); // May be called before audio_init
+void audio_get_stats(audio_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_H
@@ -0,0 +1,164 @@
+// audio_tx.c
+
+#include "audio_tx.h"
+#include "audio.h"
+#include "video_tx.h"
+#include "trace.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_opus_enc.h"
+#include "peer_connection.h"
+
+extern PeerConnection *g_pc;
+extern PeerConnectionState eState;
+static const char *TAG = "audio_tx";
+
+typedef struct {
+    int64_t capture_us;
+    uint16_t len;
+    uint8_t data[AUDIO_OPUS_MAX_FRAME];
+} opus_slot_t;
+
+static void *encoder = NULL;
+static int enc_in_bytes = 0;          // PCM bytes per Opus frame
+static int enc_out_bytes = 0;
+static uint8_t *enc_out = NULL;       // Encoder output, allocated once; audio task only
+static uint64_t encode_us_total = 0;
+static volatile bool enabled = true;
+
+// Frames written / taken since boot, the slot of frame n is ring[n % AUDIO_TX_SLOTS]
+static opus_slot_t ring[AUDIO_TX_SLOTS];
+static uint32_t ring_head = 0;
+static uint32_t ring_tail = 0;
+static portMUX_TYPE ring_lock = portMUX_INITIALIZER_UNLOCKED; // Guards the ring and stats
+static audio_tx_stats_t stats;
+
+// Connection task only
+static uint8_t frame[AUDIO_OPUS_MAX_FRAME];
+
+esp_err_t audio_tx_init(void) {
+    esp_opus_enc_config_t cfg = ESP_OPUS_ENC_CONFIG_DEFAULT();
+    cfg.sample_rate = ESP_AUDIO_SAMPLE_RATE_16K;
+    cfg.channel = ESP_AUDIO_MONO;
+    cfg.bits_per_sample = ESP_AUDIO_BIT16;
+    cfg.bitrate = AUDIO_OPUS_BITRATE;
+    cfg.frame_duration = ESP_OPUS_ENC_FRAME_DURATION_20_MS;
+    cfg.application_mode = ESP_OPUS_ENC_APPLICATION_VOIP;
+    cfg.complexity = AUDIO_OPUS_COMPLEXITY;
+    cfg.enable_fec = false;
+    cfg.enable_dtx = false;
+    cfg.enable_vbr = false;
+    if (esp_opus_enc_open(&cfg, sizeof(cfg), &encoder) != ESP_AUDIO_ERR_OK) {
+        ESP_LOGE(TAG, "Failed to open the Opus encoder");
+        encoder = NULL;
+        return ESP_FAIL;
+    }
+    esp_opus_enc_get_frame_size(encoder, &enc_in_bytes, &enc_out_bytes);
+    if (enc_in_bytes != AUDIO_BLOCK_SAMPLES * (int)sizeof(int16_t)) {
+        ESP_LOGE(TAG, "Opus wants %d PCM bytes per frame, blocks have %d", enc_in_bytes,
+                 AUDIO_BLOCK_SAMPLES * (int)sizeof(int16_t));
+        esp_opus_enc_close(encoder);
+        encoder = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+    enc_out = (uint8_t *)heap_caps_malloc(enc_out_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (!enc_out) {
+        esp_opus_enc_close(encoder);
+        encoder = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Opus encoder ready: %d kbps, complexity %d", AUDIO_OPUS_BITRATE / 1000, AUDIO_OPUS_COMPLEXITY);
+    return ESP_OK;
+}
+
+bool audio_tx_wanted(void) {
+    return encoder != NULL && enabled && eState == PEER_CONNECTION_COMPLETED;
+}
+
+void audio_tx_set_enabled(bool on) {
+    enabled = on;
+    if (!on) audio_tx_reset();
+}
+
+void audio_tx_encode(const int16_t *pcm, size_t samples, int64_t capture_us) {
+    if (!encoder || samples * sizeof(int16_t) != (size_t)enc_in_bytes) return;
+    esp_audio_enc_in_frame_t in = { .buffer = (uint8_t *)pcm, .len = (uint32_t)enc_in_bytes };
+    esp_audio_enc_out_frame_t out = { .buffer = enc_out, .len = (uint32_t)enc_out_bytes };
+    int64_t start = esp_timer_get_time();
+    esp_audio_err_t res = esp_opus_enc_process(encoder, &in, &out);
+    uint32_t took_us = (uint32_t)(esp_timer_get_time() - start);
+    bool ok = res == ESP_AUDIO_ERR_OK && out.encoded_bytes > 0 && out.encoded_bytes <= AUDIO_OPUS_MAX_FRAME;
+
+    taskENTER_CRITICAL(&ring_lock);
+    if (ok) {
+        stats.encoded++;
+        encode_us_total += took_us;
+        if (took_us > stats.encode_us_max) stats.encode_us_max = took_us;
+        if (ring_head - ring_tail == AUDIO_TX_SLOTS) { // Sender stalled, the oldest frame goes
+            ring_tail++;
+            stats.dropped_full++;
+        }
+        opus_slot_t *slot = &ring[ring_head % AUDIO_TX_SLOTS];
+        slot->capture_us = capture_us;
+        slot->len = (uint16_t)out.encoded_bytes;
+        memcpy(slot->data, enc_out, out.encoded_bytes);
+        ring_head++;
+    } else {
+        stats.encode_errors++;
+    }
+    taskEXIT_CRITICAL(&ring_lock);
+
+    if (ok) {
+        trace(TRACE_OPUS_ENC, took_us, out.encoded_bytes);
+        video_tx_kick(); // Wakes the connection task
+    } else {
+        ESP_LOGW(TAG, "Opus encode failed (%d, %lu bytes)", res, out.encoded_bytes);
+    }
+}
+
+// Audio is a few kB/s, so it skips the video pacer and goes out first. libpeer
+// wraps each frame in RTP on the Opus track and advances the timestamp by
+// 20 ms per frame, so a dropped frame is a gap the receiver's jitter buffer
+// conceals, not a late one.
+void audio_tx_service(void) {
+    int64_t now = esp_timer_get_time();
+    for (;;) {
+        int64_t capture_us = 0;
+        uint16_t len = 0;
+        taskENTER_CRITICAL(&ring_lock);
+        bool have = ring_tail != ring_head;
+        if (have) {
+            opus_slot_t *slot = &ring[ring_tail % AUDIO_TX_SLOTS];
+            capture_us = slot->capture_us;
+            len = slot->len;
+            memcpy(frame, slot->data, len);
+            ring_tail++;
+            if (now - capture_us > AUDIO_TX_MAX_AGE_MS * 1000LL) stats.dropped_stale++;
+        }
+        taskEXIT_CRITICAL(&ring_lock);
+        if (!have) return;
+        if (now - capture_us > AUDIO_TX_MAX_AGE_MS * 1000LL || eState != PEER_CONNECTION_COMPLETED) continue;
+
+        bool sent = peer_connection_send_audio(g_pc, frame, len) >= 0;
+        taskENTER_CRITICAL(&ring_lock);
+        if (sent) stats.sent++; else stats.send_failures++;
+        taskEXIT_CRITICAL(&ring_lock);
+    }
+}
+
+void audio_tx_reset(void) {
+    taskENTER_CRITICAL(&ring_lock);
+    ring_tail = ring_head;
+    taskEXIT_CRITICAL(&ring_lock);
+}
+
+void audio_tx_get_stats(audio_tx_stats_t *out) {
+    taskENTER_CRITICAL(&ring_lock);
+    *out = stats;
+    out->encode_us_avg = stats.encoded ? (uint32_t)(encode_us_total / stats.encoded) : 0;
+    taskEXIT_CRITICAL(&ring_lock);
+}
@@ -0,0 +1,49 @@
+// audio_tx.h
+// Live audio: every 20 ms microphone block is encoded to one Opus frame on
+// the audio task and sent on the peer connection's Opus audio track
+// (peer_connection_send_audio), so a browser plays it like any WebRTC audio.
+// Encoded frames wait in a ring of AUDIO_TX_SLOTS preallocated slots for
+// peer_connection_task. A full ring drops its oldest frame, and frames older
+// than AUDIO_TX_MAX_AGE_MS when the sender gets to them are dropped rather
+// than sent late. Nothing is allocated per frame.
+#ifndef AUDIO_TX_H
+#define AUDIO_TX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define AUDIO_OPUS_BITRATE 24000   // CBR, 60 bytes per frame
+#define AUDIO_OPUS_COMPLEXITY 0    // Cheapest encoder setting, it shares core 1 with the WebRTC tasks
+#define AUDIO_OPUS_MAX_FRAME 160   // Slot size, larger frames are counted as errors
+#define AUDIO_TX_SLOTS 8           // 160 ms of frames between encoder and sender
+#define AUDIO_TX_MAX_AGE_MS 200    // Older frames are dropped, not sent
+
+typedef struct {
+    uint32_t encoded;        // Frames encoded
+    uint32_t encode_errors;  // Encoder failures or oversized frames
+    uint32_t encode_us_avg;  // Per frame
+    uint32_t encode_us_max;
+    uint32_t sent;
+    uint32_t dropped_full;   // Pushed out of a full ring
+    uint32_t dropped_stale;  // Older than AUDIO_TX_MAX_AGE_MS at send time
+    uint32_t send_failures;
+} audio_tx_stats_t;
+
+esp_err_t audio_tx_init(void);      // Opens the encoder and sizes its buffers once
+bool audio_tx_wanted(void);         // Audio task: enabled and a peer is connected
+void audio_tx_encode(const int16_t *pcm, size_t samples, int64_t capture_us); // Audio task, one 20 ms block
+void audio_tx_service(void);        // Connection task, xSemaphore held: send what is waiting
+void audio_tx_reset(void);          // Drop everything waiting
+void audio_tx_set_enabled(bool on); // "audio on|off" from the app
+void audio_tx_get_stats(audio_tx_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // AUDIO_TX_H
@@ -1,31 +1,39 @@
 // camera.c
 
-#include "recorder.h" // Include recorder.h to get playback_active flag
+#include "recorder.h" // Include recorder.h to get the playback sessions
+#include "camera.h"
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_log.h"
 #include "esp_camera.h"
 #include "esp_timer.h"
-#include "driver/gpio.h" // Include for gpio_get_level
+#include "esp_heap_caps.h"
 
 #include "peer_connection.h"
-#include "events.h" // Include events.h for upload_image and PIR_SENSOR_PIN
+#include "events.h" // Include events.h for event bursts
+#include "pir.h"
+#include "audio.h"
+#include "clip_upload.h"
+#include "journal.h"
+#include "video_tx.h"
+#include "snapshot.h"
+#include "motion.h"
+#include "trace.h"
 
-extern PeerConnection *g_pc;
 extern int gDataChannelOpened;
 extern PeerConnectionState eState;
 extern int get_timestamp(); // Assuming this exists elsewhere
-extern SemaphoreHandle_t xSemaphore; // WebRTC send semaphore
 static const char *TAG = "Camera";
 
 // Queues (Ensure they are initialized in camera_init)
-QueueHandle_t streamingQueue = NULL;
 QueueHandle_t recordingQueue = NULL;
 QueueHandle_t eventQueue = NULL;
+static motion_detector_t motion; // Only used by unified_camera_task
 
 #define CAM_PIN_PWDN -1
 #define CAM_PIN_RESET -1
@@ -68,7 +76,7 @@ static camera_config_t camera_config = {
     .frame_size = FRAMESIZE_SVGA,
     .jpeg_quality = 15,
     .fb_count = 4,
-    .grab_mode = CAMERA_GRAB_WHEN_EMPTY
+    .grab_mode = CAMERA_GRAB_LATEST // Frames are pulled on schedule, so always hand out the newest
 };
 
 esp_err_t camera_init() {
@@ -78,214 +86,241 @@ esp_err_t camera_init() {
         return err;
     }
 
-    streamingQueue = xQueueCreate(10, sizeof(camera_fb_t*));
-    if (streamingQueue == NULL) {
-        ESP_LOGE(TAG, "Failed to create streaming queue");
-        return ESP_FAIL;
-    }
     recordingQueue = xQueueCreate(100, sizeof(camera_fb_t*));
     if (recordingQueue == NULL) {
         ESP_LOGE(TAG, "Failed to create recording queue");
         return ESP_FAIL;
     }
 
-    eventQueue = xQueueCreate(1, sizeof(camera_fb_t*));
-    if (recordingQueue == NULL) {
-        ESP_LOGE(TAG, "Failed to create recording queue");
+    eventQueue = xQueueCreate(EVENT_QUEUE_LEN, sizeof(uint8_t*));
+    if (eventQueue == NULL) {
+        ESP_LOGE(TAG, "Failed to create event queue");
         return ESP_FAIL;
     }
-    
+
+    video_tx_init();
+    snapshot_init();
+    motion_config_t motion_cfg = MOTION_CONFIG_DEFAULT();
+    motion_init(&motion, &motion_cfg);
 
     return ESP_OK;
 }
 
 
 
+// --- Frame Scheduler ---
+// Each consumer keeps its own phase-locked schedule (next_due += interval), so
+// it sees a stable interval whatever the others run at. The task sleeps on a
+// one-shot timer until the earliest consumer is due and grabs nothing between.
+#define STREAM_FPS 15
+#define EVENT_INTERVAL_US (5 * 1000000) // Between event bursts while motion lasts
+#define SNAPSHOT_RETRY_US 200000        // Next grab if an on-request capture wasn't usable
+#define MOTION_INTERVAL_US 1000000      // Motion analysis when no other consumer grabs frames
+#define MOTION_EVERY_N 3                // ...otherwise every Nth grabbed frame is analysed
+#define MOTION_HOLD_US (3 * 1000000)    // Event uploads continue this long after the last motion
+
+// Idle motion watch: with nothing else grabbing, the camera still wakes every
+// MOTION_INTERVAL_US to look for motion, so it never sleeps fully. Build with
+// MOTION_IDLE_WATCH 0 to leave idle wake-ups to the PIR and the microphone.
+#ifndef MOTION_IDLE_WATCH
+#define MOTION_IDLE_WATCH 1
+#endif
+
+static uint32_t consumer_interval_us[FRAME_CONSUMER_COUNT] = {
+    [FRAME_CONSUMER_STREAM] = 1000000 / STREAM_FPS,
+    [FRAME_CONSUMER_RECORD] = 100000, // Replaced by setFPS
+    [FRAME_CONSUMER_EVENT] = EVENT_INTERVAL_US,
+    [FRAME_CONSUMER_SNAPSHOT] = SNAPSHOT_RETRY_US,
+    [FRAME_CONSUMER_MOTION] = MOTION_INTERVAL_US,
+    [FRAME_CONSUMER_BURST] = EVENT_BURST_WINDOW_MS * 1000 / (EVENT_BURST_FRAMES > 1 ? EVENT_BURST_FRAMES - 1 : 1),
+};
+static uint64_t consumer_next_due[FRAME_CONSUMER_COUNT];
+static uint32_t consumers_active = 0;
+static esp_timer_handle_t sched_timer = NULL;
+static TaskHandle_t sched_task = NULL;
+
+static void sched_timer_cb(void *arg) {
+    if (sched_task) xTaskNotifyGive(sched_task);
+}
+
+void frame_scheduler_set_interval(frame_consumer_t consumer, uint32_t interval_us) {
+    if (consumer >= FRAME_CONSUMER_COUNT) return;
+    consumer_interval_us[consumer] = interval_us;
+    if (sched_task) xTaskNotifyGive(sched_task); // Recompute the next wake-up
+}
+
+void frame_scheduler_wake(void) {
+    if (sched_task) xTaskNotifyGive(sched_task);
+}
+
+// Starts a consumer one interval from now instead of serving it right away
+static void frame_scheduler_defer(frame_consumer_t consumer) {
+    consumer_next_due[consumer] = esp_timer_get_time() + consumer_interval_us[consumer];
+    consumers_active |= FRAME_CONSUMER_BIT(consumer);
+}
+
+// Returns the consumers due now. If none is, sleeps until the earliest one
+// (or a frame_scheduler_wake) and returns 0 so the caller re-evaluates who
+// is active.
+static uint32_t frame_scheduler_wait(uint32_t active) {
+    uint64_t now = esp_timer_get_time();
+    uint64_t earliest = UINT64_MAX;
+    uint32_t due = 0;
+
+    for (int c = 0; c < FRAME_CONSUMER_COUNT; c++) {
+        uint32_t bit = FRAME_CONSUMER_BIT(c);
+        uint32_t interval = consumer_interval_us[c];
+        if (!(active & bit) || interval == 0) continue;
+        if (!(consumers_active & bit)) consumer_next_due[c] = now; // Just became active, serve it right away
+        if (consumer_next_due[c] <= now) {
+            due |= bit;
+            consumer_next_due[c] += interval;
+            if (consumer_next_due[c] <= now) consumer_next_due[c] = now + interval; // Fell behind, don't burst
+        }
+        if (consumer_next_due[c] < earliest) earliest = consumer_next_due[c];
+    }
+    consumers_active = active;
+    if (due) return due;
+
+    if (earliest != UINT64_MAX) {
+        esp_timer_stop(sched_timer); // Not running is fine
+        esp_timer_start_once(sched_timer, earliest - now);
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    return 0;
+}
+
+// --- Motion ---
+// Runs on the driver's buffer before it is returned, decoding only DC
+// coefficients, so it costs no copy and a fraction of a frame interval.
+static int64_t motion_until_us = 0; // Vision motion counts as an event until then
+static uint32_t frames_since_motion = 0;
+
+static void analyse_motion(const camera_fb_t *fb) {
+    motion_result_t res;
+    frames_since_motion = 0;
+    int64_t start = esp_timer_get_time();
+    int err = motion_process(&motion, fb->buf, fb->len, &res);
+    if (err != MOTION_OK) {
+        ESP_LOGW(TAG, "Motion analysis skipped: %s", motion_err_name(err));
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    trace(TRACE_CAM_MOTION, (uint32_t)(now - start), res.score);
+    if (!res.motion) return;
+    if (now >= motion_until_us) {
+        ESP_LOGI(TAG, "Motion: score %u, %lu blocks, cells %012llx", res.score, res.changed, res.mask);
+        journal_log(JOURNAL_MOTION, res.score, start); // New episode, not every frame of it
+    }
+    motion_until_us = now + MOTION_HOLD_US;
+}
+
+// Copies a live frame for captureTask, which frees it after writing
+static void queue_recording_frame(camera_fb_t *fb) {
+    camera_fb_t *fb_copy_rec = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_SPIRAM);
+    if (!fb_copy_rec) {
+        ESP_LOGE(TAG, "Failed to allocate fb_copy_rec struct!");
+        return;
+    }
+    *fb_copy_rec = *fb; // Copy metadata
+    fb_copy_rec->buf = (uint8_t*)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
+    if (!fb_copy_rec->buf) {
+        ESP_LOGE(TAG, "Failed to allocate buffer for recording copy!");
+        heap_caps_free(fb_copy_rec);
+        return;
+    }
+    memcpy(fb_copy_rec->buf, fb->buf, fb->len);
+    trace(TRACE_REC_QUEUED, fb_copy_rec->len, uxQueueMessagesWaiting(recordingQueue));
+    if (xQueueSend(recordingQueue, &fb_copy_rec, pdMS_TO_TICKS(50)) != pdTRUE) {
+        ESP_LOGW(TAG, "Failed to enqueue frame for recording (queue full?).");
+        heap_caps_free(fb_copy_rec->buf); // Free copy if queue fails
+        heap_caps_free(fb_copy_rec);
+    }
+}
+
+// PIR edges and sound events only wake the task; the loop reads pir_active() and sound_active() itself
+static void pir_changed(bool active, int64_t at_us, void *arg) {
+    frame_scheduler_wake();
+}
+
+static void sound_changed(bool active, int64_t at_us, uint16_t score, void *arg) {
+    frame_scheduler_wake();
+}
+
 void unified_camera_task(void *pvParameters) {
     ESP_LOGI(TAG, "Unified camera task started on Core %d", xPortGetCoreID());
 
-    const TickType_t EVENT_INTERVAL = pdMS_TO_TICKS(5000);  // 5s between event uploads if PIR stays high
-    TickType_t last_event_tick = 0;
-
-    // --- Initial Playback Start (for testing) ---
-    // Wait a bit for system to stabilize before starting playback
-    vTaskDelay(pdMS_TO_TICKS(15000));
-    ESP_LOGI(TAG, "Attempting to start playback...");
-    // --- IMPORTANT: Replace with an actual AVI file path on your SD card ---
-    // start_playback("/sdcard/2023-10-27_10-30-00_SVGA_10_30.avi");
-    // start_playback(NULL); // Start from beginning of list
-    start_playback(NULL); // Start specific file
+    sched_task = xTaskGetCurrentTaskHandle();
+    const esp_timer_create_args_t sched_timer_args = {
+        .callback = &sched_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "frame_sched",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&sched_timer_args, &sched_timer));
+    pir_subscribe(pir_changed, NULL);
+    sound_subscribe(sound_changed, NULL);
 
+    // Playback sessions are started by data channel requests (see app_main.c),
+    // their frames are sent by peer_connection_task (video_tx.c)
 
     for (;;) {
-        TickType_t now = xTaskGetTickCount();
         bool streaming_needed = (eState == PEER_CONNECTION_COMPLETED) && gDataChannelOpened;
         bool recording_needed = doRecording && forceRecord; // Simplified condition
-        bool event_needed = (gpio_get_level(PIR_SENSOR_PIN) == 1) && ((now - last_event_tick) >= EVENT_INTERVAL);
-
-        // --- Handle Streaming ---
-        if (streaming_needed) {
-            if (playback_active) {
-                // Consume from playback task via streamingQueue
-                camera_fb_t *fb_playback = NULL;
-                ESP_LOGD(TAG, "Waiting for playback frame...");
-                if (xQueueReceive(streamingQueue, &fb_playback, pdMS_TO_TICKS(100)) == pdTRUE) { // Use timeout
-                    if (fb_playback && fb_playback->buf && fb_playback->len > 0) {
-                        ESP_LOGI(TAG, "Streaming playback frame %zu bytes", fb_playback->len);
-                        if (xSemaphoreTake(xSemaphore, pdMS_TO_TICKS(500)) == pdTRUE) { // Use timeout for semaphore
-                            peer_connection_datachannel_send(g_pc, (char*)fb_playback->buf, fb_playback->len);
-                            xSemaphoreGive(xSemaphore);
-                        } else {
-                            ESP_LOGW(TAG, "Failed to get WebRTC semaphore for playback frame.");
-                        }
-                        // Free the frame buffer allocated by playback_task
-                        heap_caps_free(fb_playback->buf);
-                        heap_caps_free(fb_playback);
-                    } else {
-                         ESP_LOGW(TAG, "Received invalid frame from playback queue.");
-                         if(fb_playback) heap_caps_free(fb_playback); // Free struct if buf was null
-                    }
-                } else {
-                    // Queue empty or timeout - maybe playback paused or ended?
-                     ESP_LOGD(TAG, "Playback streaming queue empty or timed out.");
-                     if (!playback_active) {
-                         ESP_LOGI(TAG, "Playback seems to have stopped.");
-                         // Optionally add logic here if needed when playback stops
-                     }
-                }
-            } else {
-                // Consume from live camera
-                camera_fb_t *fb = esp_camera_fb_get();
-                if (!fb) {
-                    ESP_LOGE(TAG, "Live camera capture failed");
-                    vTaskDelay(pdMS_TO_TICKS(100)); // Delay on failure
-                    continue;
-                }
+        bool event_needed = pir_active() || sound_active() || esp_timer_get_time() < motion_until_us;
+        bool snapshot_needed = snapshot_wanted();
+        bool motion_needed = MOTION_IDLE_WATCH && !streaming_needed && !recording_needed; // Those grab often enough to share
+        bool burst_needed = event_burst_open(); // Runs to the end of its window even if the event is over
+        uint32_t active = (streaming_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_STREAM) : 0)
+                        | (recording_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_RECORD) : 0)
+                        | (event_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_EVENT) : 0)
+                        | (snapshot_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_SNAPSHOT) : 0)
+                        | (motion_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_MOTION) : 0)
+                        | (burst_needed ? FRAME_CONSUMER_BIT(FRAME_CONSUMER_BURST) : 0);
 
-                ESP_LOGD(TAG, "Live Streaming frame %d bytes", fb->len);
-                if (xSemaphoreTake(xSemaphore, pdMS_TO_TICKS(500)) == pdTRUE) {
-                    peer_connection_datachannel_send(g_pc, (char*)fb->buf, fb->len);
-                    xSemaphoreGive(xSemaphore);
-                } else {
-                    ESP_LOGW(TAG, "Failed to get WebRTC semaphore for live frame.");
-                }
+        uint32_t due = frame_scheduler_wait(active);
 
-                // --- Handle Recording (from live camera frame) ---
-                if (recording_needed) {
-                    // Need to copy the frame buffer for the recording queue
-                    camera_fb_t *fb_copy_rec = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_SPIRAM);
-                    if (fb_copy_rec) {
-                        *fb_copy_rec = *fb; // Copy metadata
-                        fb_copy_rec->buf = (uint8_t*)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
-                        if (fb_copy_rec->buf) {
-                            memcpy(fb_copy_rec->buf, fb->buf, fb->len);
-                            ESP_LOGD(TAG, "Enqueuing frame for recording (%zu bytes)", fb_copy_rec->len);
-                            if (xQueueSend(recordingQueue, &fb_copy_rec, pdMS_TO_TICKS(50)) != pdTRUE) {
-                                ESP_LOGW(TAG, "Failed to enqueue frame for recording (queue full?).");
-                                heap_caps_free(fb_copy_rec->buf); // Free copy if queue fails
-                                heap_caps_free(fb_copy_rec);
-                            }
-                            // Recorder task is responsible for freeing the buffer after processing
-                        } else {
-                            ESP_LOGE(TAG, "Failed to allocate buffer for recording copy!");
-                            heap_caps_free(fb_copy_rec);
-                        }
-                    } else {
-                         ESP_LOGE(TAG, "Failed to allocate fb_copy_rec struct!");
-                    }
-                }
+        if (due) {
+            camera_fb_t *fb = esp_camera_fb_get();
+            int64_t grab_us = esp_timer_get_time();
+            if (!fb) {
+                ESP_LOGE(TAG, "Live camera capture failed");
+                vTaskDelay(pdMS_TO_TICKS(100)); // Delay on failure
+                continue;
+            }
+            trace(TRACE_CAM_GRAB, fb->len, due);
 
-                // --- Handle Event Upload (from live camera frame) ---
-                if (event_needed) {
-                    last_event_tick = now; // Update last sent time immediately
-                    // Need to copy the frame buffer for the event queue/upload function
-                     camera_fb_t *fb_copy_evt = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_DEFAULT); // Use default memory for event?
-                    if (fb_copy_evt) {
-                        *fb_copy_evt = *fb; // Copy metadata
-                        // Use default malloc for event upload task if it doesn't need PSRAM? Check upload_image constraints.
-                        // Let's assume default memory is okay for upload task.
-                        fb_copy_evt->buf = (uint8_t*)malloc(fb->len);
-                        if (fb_copy_evt->buf) {
-                            memcpy(fb_copy_evt->buf, fb->buf, fb->len);
-                            ESP_LOGI(TAG, "Processing frame for event upload (%zu bytes)", fb_copy_evt->len);
-
-                            // Directly call upload function (simpler than queue if task structure allows)
-                            if (upload_image(fb_copy_evt) == ESP_OK) {
-                                ESP_LOGI(TAG, "Event image upload successful");
-                            } else {
-                                ESP_LOGE(TAG, "Event image upload failed");
-                            }
-                            free(fb_copy_evt->buf); // Free copy after upload attempt
-                            free(fb_copy_evt);
-                        } else {
-                            ESP_LOGE(TAG, "Failed to allocate buffer for event copy!");
-                            free(fb_copy_evt);
-                        }
-                    } else {
-                         ESP_LOGE(TAG, "Failed to allocate fb_copy_evt struct!");
-                    }
+            // --- Handle Streaming (sent by peer_connection_task, no WebRTC lock here) ---
+            if (due & FRAME_CONSUMER_BIT(FRAME_CONSUMER_STREAM)) {
+                video_tx_publish(fb, grab_us);
+            }
+
+            // --- Handle Recording ---
+            if (due & FRAME_CONSUMER_BIT(FRAME_CONSUMER_RECORD)) queue_recording_frame(fb);
+
+            // --- Handle Event Bursts (copied here, uploaded by the upload worker) ---
+            if (due & FRAME_CONSUMER_BIT(FRAME_CONSUMER_EVENT)) {
+                esp_err_t res = event_burst_begin(fb);
+                if (res == ESP_OK) {
+                    clip_upload_note_event(); // The recording around it goes up as a clip later
+                } else if (res != ESP_ERR_NOT_ALLOWED) { // Not allowed: same scene as a recent burst, or rate limited
+                    ESP_LOGE(TAG, "Failed to start event burst!");
                 }
+                if (event_burst_open()) frame_scheduler_defer(FRAME_CONSUMER_BURST);
+            } else if (due & FRAME_CONSUMER_BIT(FRAME_CONSUMER_BURST)) {
+                if (event_burst_add(fb) != ESP_OK) ESP_LOGW(TAG, "Event burst ended early");
+            }
 
-                // Return the original live camera frame buffer
-                esp_camera_fb_return(fb);
-
-            } // End if/else playback_active
-        } else {
-             // --- No Streaming Needed ---
-             // Still capture frames if recording or event detection is needed, but don't stream.
-             if (recording_needed || event_needed) {
-                  camera_fb_t *fb = esp_camera_fb_get();
-                  if (!fb) {
-                      ESP_LOGE(TAG, "Live camera capture failed (no streaming)");
-                      vTaskDelay(pdMS_TO_TICKS(100));
-                      continue;
-                  }
-
-                  // Handle Recording (Copy needed)
-                  if (recording_needed) {
-                      camera_fb_t *fb_copy_rec = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_SPIRAM);
-                      if (fb_copy_rec) {
-                         *fb_copy_rec = *fb;
-                         fb_copy_rec->buf = (uint8_t*)heap_caps_malloc(fb->len, MALLOC_CAP_SPIRAM);
-                         if (fb_copy_rec->buf) {
-                             memcpy(fb_copy_rec->buf, fb->buf, fb->len);
-                             if (xQueueSend(recordingQueue, &fb_copy_rec, pdMS_TO_TICKS(50)) != pdTRUE) {
-                                  ESP_LOGW(TAG, "Failed to enqueue frame for recording (no stream).");
-                                  heap_caps_free(fb_copy_rec->buf);
-                                  heap_caps_free(fb_copy_rec);
-                             }
-                         } else { heap_caps_free(fb_copy_rec); ESP_LOGE(TAG, "Failed alloc rec buf (no stream)"); }
-                      } else { ESP_LOGE(TAG, "Failed alloc rec struct (no stream)"); }
-                  }
-
-                  // Handle Event Upload (Copy needed)
-                  if (event_needed) {
-                      last_event_tick = now;
-                      camera_fb_t *fb_copy_evt = (camera_fb_t*)malloc(sizeof(camera_fb_t));
-                      if (fb_copy_evt) {
-                          *fb_copy_evt = *fb;
-                          fb_copy_evt->buf = (uint8_t*)malloc(fb->len);
-                          if (fb_copy_evt->buf) {
-                               memcpy(fb_copy_evt->buf, fb->buf, fb->len);
-                               if (upload_image(fb_copy_evt) == ESP_OK) ESP_LOGI(TAG, "Event upload OK (no stream)");
-                               else ESP_LOGE(TAG, "Event upload FAIL (no stream)");
-                               free(fb_copy_evt->buf);
-                               free(fb_copy_evt);
-                          } else { free(fb_copy_evt); ESP_LOGE(TAG, "Failed alloc evt buf (no stream)"); }
-                      } else { ESP_LOGE(TAG, "Failed alloc evt struct (no stream)"); }
-                  }
-
-                  esp_camera_fb_return(fb); // Return the live frame
-             } else {
-                  // Neither streaming, recording, nor event needed. Maybe idle or just delay?
-                  // To avoid constant polling of camera if nothing is needed:
-                  vTaskDelay(pdMS_TO_TICKS(100)); // Add delay if no activity needed
-             }
-        }
+            // --- Refresh the snapshot cache (any grab will do, no extra capture) ---
+            if (snapshot_offer(fb)) video_tx_kick(); // A data channel snapshot may be waiting for it
 
-        // General task delay (adjust as needed)
-        // A small delay helps prevent high CPU usage if loops run very fast (e.g., during playback queue waits)
-        vTaskDelay(pdMS_TO_TICKS(5));
+            // --- Motion analysis on the driver's buffer ---
+            if ((due & FRAME_CONSUMER_BIT(FRAME_CONSUMER_MOTION)) || ++frames_since_motion >= MOTION_EVERY_N) {
+                analyse_motion(fb);
+            }
+
+            // Return the live camera frame buffer
+            esp_camera_fb_return(fb);
+        }
 
     } // End for(;;)
-}
\ No newline at end of file
+}
@@ -0,0 +1,35 @@
+// camera.h
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "esp_err.h"
+
+// Consumers of live frames. unified_camera_task grabs a frame only when at
+// least one of them is due and hands it to every consumer due at that moment.
+typedef enum {
+    FRAME_CONSUMER_STREAM = 0,  // Live view over the data channel
+    FRAME_CONSUMER_RECORD,      // AVI recording (interval follows setFPS)
+    FRAME_CONSUMER_EVENT,       // Event uploads while the PIR or vision motion is active
+    FRAME_CONSUMER_SNAPSHOT,    // Snapshot requested and the cached frame is too old
+    FRAME_CONSUMER_MOTION,      // Vision motion detection while nothing else grabs frames
+    FRAME_CONSUMER_BURST,       // Remaining frames of an event burst
+    FRAME_CONSUMER_COUNT
+} frame_consumer_t;
+
+#define FRAME_CONSUMER_BIT(c) (1UL << (c))
+
+// Live video goes out as RTP/JPEG on its own unordered data channel with no
+// retransmissions, so a lost packet costs one frame rather than stalling the
+// stream. The channel is opened by the device once the client's channel is up.
+#define RTP_VIDEO_SID 7
+#define RTP_VIDEO_LABEL "video-rtp"
+
+esp_err_t camera_init();
+void unified_camera_task(void *pvParameters);
+void frame_scheduler_set_interval(frame_consumer_t consumer, uint32_t interval_us); // 0 disables the consumer
+void frame_scheduler_wake(void); // Re-evaluate which consumers are active now
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <sys/stat.h>
+#include "recorder.h"
+#include <dirent.h> // For directory listing
+#include <vector>   // For storing filenames (requires C++)
+#include <string>   // For std::string (requires C++)
+#include <algorithm> // For std::sort (requires C++)
+
+static const char *TAG_CLIP = "clip";
+
+#define CLIP_COPY_BLOCK (32 * 1024) // movi bytes copied per read/write
+#define RECORDING_MATCH_S 3 // Start times taken from names are off by up to a couple of seconds
+
+extern uint8_t aviHeader[AVI_HEADER_LEN];
+extern SemaphoreHandle_t aviMutex;
+
+static SemaphoreHandle_t clipMutex = NULL; // One export at a time, it owns the isTL index slot
+
+// A recording overlapping the requested range
+typedef struct {
+    std::string path;
+    time_t start;
+    time_t end;
+    uint16_t frames;   // From its header, read by plan_source
+    uint8_t fps;
+    uint8_t dims[8];   // Width and height from the avih, frameSizeData only knows a few sizes
+    long first;        // Frames [first, last) go into the clip
+    long last;
+} clip_source_t;
+
+esp_err_t clip_init() {
+    if (clipMutex == NULL) clipMutex = xSemaphoreCreateMutex();
+    return (clipMutex != NULL) ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+// Recording names are YYYY-MM-DD_HH-MM-SS_FMT_FPS_DURs.avi, stamped when the
+// file was closed, so the recording started DUR seconds before that.
+static bool parse_recording_time(const char *name, time_t *start, time_t *end) {
+    struct tm tm = {};
+    char fmt[8];
+    unsigned fps;
+    unsigned long dur;
+    if (sscanf(name, "%4d-%2d-%2d_%2d-%2d-%2d_%7[^_]_%u_%lus.avi", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+               &tm.tm_hour, &tm.tm_min, &tm.tm_sec, fmt, &fps, &dur) != 9) return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    *end = mktime(&tm);
+    *start = *end - (time_t)dur;
+    return true;
+}
+
+// Collects the recordings overlapping [from, to) from the date directories, oldest first
+static void find_clip_sources(time_t from, time_t to, std::vector<clip_source_t> &sources) {
+    DIR *root = opendir(MOUNT_POINT);
+    if (!root) {
+        ESP_LOGE(TAG_CLIP, "Failed to open directory: %s", MOUNT_POINT);
+        return;
+    }
+    struct dirent *day;
+    while ((day = readdir(root)) != NULL) {
+        if (day->d_name[0] == '.' || strlen(day->d_name) != 10) continue; // Only YYYY-MM-DD
+        std::string day_path = std::string(MOUNT_POINT) + "/" + day->d_name;
+        DIR *dir = opendir(day_path.c_str());
+        if (!dir) continue;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            clip_source_t src;
+            if (!parse_recording_time(entry->d_name, &src.start, &src.end)) continue;
+            // The start from the name is only as good as the whole seconds in it, plan_source has the frames
+            if (src.end <= from || src.start - RECORDING_MATCH_S >= to) continue;
+            src.path = day_path + "/" + entry->d_name;
+            sources.push_back(src);
+        }
+        closedir(dir);
+    }
+    closedir(root);
+    std::sort(sources.begin(), sources.end(),
+              [](const clip_source_t &a, const clip_source_t &b) { return a.start < b.start; });
+}
+
+// Finds the recording opened at `started` (see getRecordingPosition). Its
+// name only carries the close time and the whole seconds recorded, so the
+// start derived from it is matched within RECORDING_MATCH_S. A recording is
+// filed under the day it closed, which is the day it started or the next one.
+esp_err_t find_recording(time_t started, char *path, size_t pathLen) {
+    std::string best;
+    time_t best_diff = RECORDING_MATCH_S + 1;
+    for (int d = 0; d < 2; d++) {
+        struct tm tm;
+        localtime_r(&started, &tm);
+        tm.tm_mday += d;
+        tm.tm_hour = 12;
+        tm.tm_isdst = -1;
+        time_t day = mktime(&tm);
+        localtime_r(&day, &tm);
+        char dir_name[12];
+        strftime(dir_name, sizeof(dir_name), "%Y-%m-%d", &tm);
+        std::string day_path = std::string(MOUNT_POINT) + "/" + dir_name;
+        DIR *dir = opendir(day_path.c_str());
+        if (!dir) continue;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            time_t start, end;
+            if (!parse_recording_time(entry->d_name, &start, &end)) continue;
+            time_t diff = start > started ? start - started : started - start;
+            if (diff < best_diff) {
+                best_diff = diff;
+                best = day_path + "/" + entry->d_name;
+            }
+        }
+        closedir(dir);
+    }
+    if (best.empty() || best.size() >= pathLen) return ESP_ERR_NOT_FOUND;
+    strcpy(path, best.c_str());
+    return ESP_OK;
+}
+
+// Copies [pos, pos + len) from one file to another in large blocks
+static bool copy_range(FILE *in, FILE *out, long pos, size_t len, uint8_t *buf) {
+    if (fseek(in, pos, SEEK_SET) != 0) return false;
+    while (len > 0) {
+        size_t block = std::min(len, (size_t)CLIP_COPY_BLOCK);
+        if (fread(buf, 1, block, in) != block || fwrite(buf, 1, block, out) != block) return false;
+        len -= block;
+    }
+    return true;
+}
+
+// Reads a source's frame count and fps and picks its frames inside [from, to).
+// The name stamps the close time, and the frames run back from it at the
+// header fps, so clip edges land on the right frame rather than somewhere in
+// the second the duration in the name was rounded down to.
+static bool plan_source(clip_source_t &src, time_t from, time_t to) {
+    uint8_t header[AVI_HEADER_LEN];
+    FILE *pf = fopen(src.path.c_str(), "rb");
+    if (!pf) {
+        ESP_LOGE(TAG_CLIP, "Failed to open %s (errno: %d)", src.path.c_str(), errno);
+        return false;
+    }
+    bool ok = fread(header, 1, AVI_HEADER_LEN, pf) == AVI_HEADER_LEN;
+    fclose(pf);
+    if (!ok) return false;
+    memcpy(&src.frames, header + 0x30, 2);
+    src.fps = header[0x84];
+    memcpy(src.dims, header + 0x40, 8);
+    if (src.frames == 0 || src.fps == 0 || src.fps > 60) {
+        ESP_LOGW(TAG_CLIP, "No frame count or fps in %s, skipping it", src.path.c_str());
+        return false;
+    }
+    int64_t first = (int64_t)src.frames - (int64_t)(src.end - from) * src.fps;
+    int64_t last = (int64_t)src.frames - (int64_t)(src.end - to) * src.fps;
+    src.first = (long)std::max(first, (int64_t)0);
+    src.last = (long)std::min(last, (int64_t)src.frames);
+    return src.first < src.last;
+}
+
+// Appends the planned frames of one recording. Runs of chunks that are
+// contiguous in the source are copied in one go, and each frame is added to
+// the clip index with buildAviIdx.
+static esp_err_t append_source(const clip_source_t &src, FILE *out, uint8_t *buf, uint16_t *clipFrames) {
+    FILE *pf = fopen(src.path.c_str(), "rb");
+    if (!pf) {
+        ESP_LOGE(TAG_CLIP, "Failed to open %s (errno: %d)", src.path.c_str(), errno);
+        return ESP_FAIL;
+    }
+    uint16_t frames = 0;
+    uint8_t *index = load_avi_index(pf, &frames);
+    if (!index) {
+        ESP_LOGW(TAG_CLIP, "No usable index in %s, skipping it", src.path.c_str());
+        fclose(pf);
+        return ESP_ERR_NOT_FOUND;
+    }
+    long last = std::min(src.last, (long)frames);
+
+    esp_err_t res = ESP_OK;
+    long runStart = -1;
+    size_t runLen = 0;
+    for (long i = src.first; i < last && res == ESP_OK; i++) {
+        uint32_t offset, size;
+        memcpy(&offset, index + i * IDX_ENTRY + 8, 4);
+        memcpy(&size, index + i * IDX_ENTRY + 12, 4);
+        long chunkPos = AVI_HEADER_LEN - 4 + offset; // idx1 offsets are relative to the 'movi' fourcc
+        if (runStart >= 0 && chunkPos != runStart + (long)runLen) {
+            if (!copy_range(pf, out, runStart, runLen, buf)) res = ESP_FAIL;
+            runStart = -1;
+        }
+        if (runStart < 0) {
+            runStart = chunkPos;
+            runLen = 0;
+        }
+        runLen += CHUNK_HDR + size;
+        buildAviIdx(size, true, true);
+        (*clipFrames)++;
+    }
+    if (res == ESP_OK && runStart >= 0 && !copy_range(pf, out, runStart, runLen, buf)) res = ESP_FAIL;
+
+    ESP_LOGI(TAG_CLIP, "Took frames %ld-%ld of %u from %s", src.first, last, frames, src.path.c_str());
+    heap_caps_free(index);
+    fclose(pf);
+    return res;
+}
+
+esp_err_t export_clip(time_t from, time_t to, char *outPath, size_t outLen, time_t *clipEnd) {
+    if (clipMutex == NULL || to <= from) return ESP_ERR_INVALID_ARG;
+    if (xSemaphoreTake(clipMutex, 0) != pdTRUE) return ESP_ERR_INVALID_STATE; // Another export running
+
+    std::vector<clip_source_t> sources;
+    find_clip_sources(from, to, sources);
+
+    // Frames per source, cut at a whole second once CLIP_MAX_FRAMES is reached
+    std::vector<clip_source_t> used;
+    size_t total = 0;
+    time_t end = to;
+    for (size_t i = 0; i < sources.size() && end == to; i++) {
+        clip_source_t &src = sources[i];
+        if (!plan_source(src, from, to)) continue;
+        if (total + (src.last - src.first) > CLIP_MAX_FRAMES) {
+            long room = CLIP_MAX_FRAMES - total;
+            end = src.end - (time_t)((src.frames - (src.first + room) + src.fps - 1) / src.fps);
+            src.last = std::max((long)src.frames - (long)(src.end - end) * src.fps, src.first);
+            if (src.last == src.first) break;
+        }
+        total += src.last - src.first;
+        used.push_back(src);
+    }
+    if (used.empty()) {
+        ESP_LOGW(TAG_CLIP, "No recordings between %lld and %lld", (long long)from, (long long)to);
+        xSemaphoreGive(clipMutex);
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (end < to) {
+        ESP_LOGW(TAG_CLIP, "Clip from %lld cut at %lld (%d frames), %lld s short", (long long)from, (long long)end,
+                 CLIP_MAX_FRAMES, (long long)(to - end));
+    }
+    if (clipEnd) *clipEnd = end;
+
+    // Clips live outside the date directories so playback does not pick them up
+    struct stat st;
+    if (stat(CLIP_DIR, &st) != 0) STORAGE_mkdir(CLIP_DIR);
+    struct tm tm;
+    localtime_r(&from, &tm);
+    char stamp[20];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d_%H-%M-%S", &tm);
+    snprintf(outPath, outLen, "%s/clip_%s_%llds.avi", CLIP_DIR, stamp, (long long)(end - from));
+
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(CLIP_COPY_BLOCK, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    FILE *out = fopen(outPath, "wb");
+    bool indexed = sizeAviIndex(std::max(total, (size_t)maxFrames), true);
+    if (!buf || !out || !indexed) {
+        ESP_LOGE(TAG_CLIP, "Failed to start clip %s (%u frames)", outPath, (unsigned)total);
+        if (buf) heap_caps_free(buf);
+        if (out) {
+            fclose(out);
+            remove(outPath);
+        }
+        xSemaphoreGive(clipMutex);
+        return indexed ? ESP_FAIL : ESP_ERR_NO_MEM;
+    }
+
+    // Header placeholder, rewritten once the frame count is known
+    uint8_t header[AVI_HEADER_LEN];
+    memset(header, 0, sizeof(header));
+    fwrite(header, 1, AVI_HEADER_LEN, out);
+    prepAviIndex(true);
+
+    esp_err_t res = ESP_OK;
+    uint16_t clipFrames = 0;
+    for (size_t i = 0; i < used.size() && res == ESP_OK; i++) {
+        esp_err_t srcRes = append_source(used[i], out, buf, &clipFrames);
+        if (srcRes == ESP_FAIL) res = ESP_FAIL; // Unindexed sources are skipped
+    }
+
+    if (res == ESP_OK && clipFrames == 0) res = ESP_ERR_NOT_FOUND;
+    if (res == ESP_OK) {
+        // Index, then the real header
+        finalizeAviIndex(clipFrames, true);
+        size_t len;
+        while ((len = writeAviIndex(buf, CLIP_COPY_BLOCK, true)) > 0) {
+            if (fwrite(buf, 1, len, out) != len) res = ESP_FAIL;
+        }
+        xSemaphoreTake(aviMutex, portMAX_DELAY); // aviHeader is shared with the recorder
+        buildAviHdr(used[0].fps, fsizePtr, clipFrames, true);
+        memcpy(header, aviHeader, AVI_HEADER_LEN);
+        xSemaphoreGive(aviMutex);
+        const uint8_t *dims = used[0].dims;
+        if (dims[0] || dims[1]) {
+            memcpy(header + 0x40, dims, 2); // Width (avih)
+            memcpy(header + 0xA8, dims, 2); // Width (strf)
+            memcpy(header + 0x44, dims + 4, 2); // Height (avih)
+            memcpy(header + 0xAC, dims + 4, 2); // Height (strf)
+        }
+        if (fseek(out, 0, SEEK_SET) != 0 || fwrite(header, 1, AVI_HEADER_LEN, out) != AVI_HEADER_LEN) res = ESP_FAIL;
+    }
+
+    fclose(out);
+    heap_caps_free(buf);
+    if (total > (size_t)maxFrames) sizeAviIndex(maxFrames, true); // Give the PSRAM of a long clip's index back
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG_CLIP, "Clip export failed: %s", esp_err_to_name(res));
+        remove(outPath);
+    } else {
+        ESP_LOGI(TAG_CLIP, "Exported %u frames from %d recordings to %s", clipFrames, (int)used.size(), outPath);
+    }
+    xSemaphoreGive(clipMutex);
+    return res;
+}
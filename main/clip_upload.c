@@ -0,0 +1,304 @@
+// clip_upload.c
+
+#include "clip_upload.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_camera.h"
+#include "recorder.h"
+#include "events.h"
+#include "pir.h"
+#include "audio.h"
+#include "wifimanager.h"
+
+static const char *TAG = "clip_upload";
+
+#define CLIP_UPLOAD_TIMEOUT_MS 20000
+#define CLIP_UPLOAD_ATTEMPTS 6            // Failed attempts in a row without the server's offset moving
+#define CLIP_RETRY_MIN_MS 2000
+#define CLIP_RETRY_MAX_MS 60000
+#define CLIP_SETTLE_MAX_S 600             // Longest wait for the recording holding the event to close
+#define CLIP_POLL_MS 2000
+#define CHUNK_HEAD_MAX 8                  // "8000\r\n" for a full block, room to spare
+
+static portMUX_TYPE clip_lock = portMUX_INITIALIZER_UNLOCKED; // Guards event_first and event_last
+static time_t event_first = 0; // Event frames not yet covered by a clip, 0 if none
+static time_t event_last = 0;
+static TaskHandle_t clip_task_handle = NULL;
+
+void clip_upload_note_event(void) {
+    if (!clip_task_handle || !(doRecording && forceRecord)) return; // Nothing on the card to cut a clip from
+    time_t now = time(NULL);
+    taskENTER_CRITICAL(&clip_lock);
+    if (event_first == 0) event_first = now;
+    event_last = now;
+    taskEXIT_CRITICAL(&clip_lock);
+    xTaskNotifyGive(clip_task_handle);
+}
+
+// Picks up Upload-Offset from the response headers
+static esp_err_t clip_http_event(esp_http_client_event_t *evt) {
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, "Upload-Offset") == 0) {
+        *(int64_t *)evt->user_data = strtoll(evt->header_value, NULL, 10);
+    }
+    return ESP_OK;
+}
+
+// Maps a finished request's status, leaving the connection clean for the next one
+static esp_err_t finish_request(esp_http_client_handle_t client, bool head) {
+    if (esp_http_client_fetch_headers(client) < 0) {
+        ESP_LOGE(TAG, "HTTP client fetch headers failed");
+        return ESP_FAIL;
+    }
+    int status = esp_http_client_get_status_code(client);
+    if (!head) esp_http_client_flush_response(client, NULL);
+    if (!esp_http_client_is_complete_data_received(client)) esp_http_client_close(client);
+
+    if (status >= 200 && status < 300) return ESP_OK;
+    if (status == 404 && head) return ESP_ERR_NOT_FOUND;
+    ESP_LOGE(TAG, "Clip upload request failed with server status: %d", status);
+    if (status == 409) return ESP_ERR_INVALID_STATE; // Offset mismatch, ask the server again
+    if (status >= 400 && status < 500 && status != 408 && status != 429) return ESP_ERR_INVALID_ARG;
+    return ESP_ERR_INVALID_RESPONSE;
+}
+
+// Bytes of the clip the server already has
+static esp_err_t query_offset(esp_http_client_handle_t client, int64_t *server_offset, int64_t *offset) {
+    esp_http_client_set_method(client, HTTP_METHOD_HEAD);
+    esp_http_client_delete_header(client, "Transfer-Encoding");
+    esp_http_client_delete_header(client, "Upload-Offset");
+    esp_http_client_delete_header(client, "Upload-Length");
+    *server_offset = -1;
+    esp_err_t res = esp_http_client_open(client, 0);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+    res = finish_request(client, true);
+    if (res == ESP_ERR_NOT_FOUND) {
+        *offset = 0; // Nothing stored yet
+        return ESP_OK;
+    }
+    if (res == ESP_OK) *offset = *server_offset > 0 ? *server_offset : 0;
+    return res;
+}
+
+// Streams the file from *offset to the end as one chunked PATCH. Each block
+// is read with its chunk framing around it, so a chunk is a single write.
+static esp_err_t send_range(esp_http_client_handle_t client, FILE *fp, int64_t size, uint8_t *buf,
+                            int64_t *server_offset, int64_t *offset) {
+    char value[24];
+    esp_http_client_set_method(client, HTTP_METHOD_PATCH);
+    snprintf(value, sizeof(value), "%lld", *offset);
+    esp_http_client_set_header(client, "Upload-Offset", value);
+    snprintf(value, sizeof(value), "%lld", size);
+    esp_http_client_set_header(client, "Upload-Length", value);
+    if (fseek(fp, (long)*offset, SEEK_SET) != 0) return ESP_ERR_INVALID_SIZE;
+
+    esp_err_t res = esp_http_client_open(client, -1); // Transfer-Encoding: chunked
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(res));
+        return ESP_FAIL;
+    }
+    uint8_t *data = buf + CHUNK_HEAD_MAX;
+    for (int64_t pos = *offset; pos < size; ) {
+        size_t block = (size - pos < CLIP_UPLOAD_BLOCK) ? (size_t)(size - pos) : CLIP_UPLOAD_BLOCK;
+        if (fread(data, 1, block, fp) != block) {
+            ESP_LOGE(TAG, "Clip read failed at %lld", pos);
+            esp_http_client_close(client); // Request is half sent
+            return ESP_ERR_INVALID_SIZE;
+        }
+        char head[CHUNK_HEAD_MAX + 1];
+        int head_len = snprintf(head, sizeof(head), "%x\r\n", (unsigned)block);
+        memcpy(data - head_len, head, head_len);
+        data[block] = '\r';
+        data[block + 1] = '\n';
+        int chunk_len = head_len + (int)block + 2;
+        if (esp_http_client_write(client, (const char *)data - head_len, chunk_len) != chunk_len) {
+            ESP_LOGE(TAG, "Failed to write clip chunk at %lld", pos);
+            return ESP_FAIL;
+        }
+        pos += block;
+    }
+    if (esp_http_client_write(client, "0\r\n\r\n", 5) != 5) {
+        ESP_LOGE(TAG, "Failed to write final chunk");
+        return ESP_FAIL;
+    }
+
+    *server_offset = -1;
+    res = finish_request(client, false);
+    if (res == ESP_OK) *offset = *server_offset >= 0 ? *server_offset : size;
+    return res;
+}
+
+esp_err_t clip_upload_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(fp, 0, SEEK_END);
+    int64_t size = ftell(fp);
+    uint8_t *buf = (uint8_t *)heap_caps_malloc(CHUNK_HEAD_MAX + CLIP_UPLOAD_BLOCK + 2, MALLOC_CAP_SPIRAM);
+    if (size <= 0 || !buf) {
+        if (buf) heap_caps_free(buf);
+        fclose(fp);
+        return size <= 0 ? ESP_ERR_INVALID_SIZE : ESP_ERR_NO_MEM;
+    }
+
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char url[160];
+    snprintf(url, sizeof(url), "http://%s:%d%s/%s", CONFIG_UPLOAD_SERVER_IP, CONFIG_UPLOAD_SERVER_PORT,
+             CONFIG_CLIP_UPLOAD_PATH, name);
+    int64_t server_offset = -1;
+    esp_http_client_config_t config = {
+        .url = url,
+        .event_handler = clip_http_event,
+        .user_data = &server_offset,
+        .timeout_ms = CLIP_UPLOAD_TIMEOUT_MS,
+        .keep_alive_enable = true,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (!client) {
+        heap_caps_free(buf);
+        fclose(fp);
+        return ESP_FAIL;
+    }
+    esp_http_client_set_header(client, "X-User-Id", CONFIG_USER_ID);
+    esp_http_client_set_header(client, "X-Camera-Id", CONFIG_CAMERA_ID);
+    esp_http_client_set_header(client, "Content-Type", "video/x-msvideo");
+
+    int64_t start_us = esp_timer_get_time();
+    int64_t offset = 0;      // Where the next PATCH starts
+    int64_t progress = 0;    // Offset the failure count was last reset at
+    bool known = true;       // offset agrees with the server (a new clip starts at 0)
+    int failures = 0;
+    uint32_t delay_ms = CLIP_RETRY_MIN_MS;
+    esp_err_t res = ESP_FAIL;
+    while (failures < CLIP_UPLOAD_ATTEMPTS) {
+        if (!known) {
+            res = query_offset(client, &server_offset, &offset);
+            known = res == ESP_OK;
+            if (known && offset > progress) { // Some of it got through, keep going
+                progress = offset;
+                failures = 0;
+                delay_ms = CLIP_RETRY_MIN_MS;
+            }
+        }
+        if (known) {
+            if (offset >= size) {
+                res = ESP_OK;
+                break;
+            }
+            if (offset > 0) ESP_LOGI(TAG, "Resuming %s at %lld of %lld bytes", name, offset, size);
+            res = send_range(client, fp, size, buf, &server_offset, &offset);
+            if (res == ESP_OK && offset >= size) break;
+            if (res == ESP_ERR_INVALID_ARG || res == ESP_ERR_INVALID_SIZE) break; // Retrying won't help
+            if (res == ESP_OK && offset > progress) { // Server kept part of it, send the rest
+                progress = offset;
+                failures = 0;
+                continue;
+            }
+            known = res == ESP_OK; // After an error, find out how much the server kept
+        }
+        esp_http_client_close(client);
+        failures++;
+        ESP_LOGW(TAG, "Clip upload interrupted (%s), retry %d in %lu ms", esp_err_to_name(res), failures, delay_ms);
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        delay_ms = (delay_ms * 2 < CLIP_RETRY_MAX_MS) ? delay_ms * 2 : CLIP_RETRY_MAX_MS;
+    }
+
+    if (res == ESP_OK) {
+        int64_t ms = (esp_timer_get_time() - start_us) / 1000;
+        ESP_LOGI(TAG, "Uploaded %s: %lld bytes in %lld ms", name, size, ms);
+    } else if (failures >= CLIP_UPLOAD_ATTEMPTS) {
+        res = ESP_ERR_TIMEOUT;
+    }
+    esp_http_client_cleanup(client);
+    heap_caps_free(buf);
+    fclose(fp);
+    return res;
+}
+
+// Waits until the recording in progress, which holds the end of the event,
+// has been closed and renamed so export_clip can find it
+static void wait_for_recording(void) {
+    uint32_t generation;
+    uint16_t frames;
+    if (!getLiveRecording(&generation, &frames)) return;
+    int64_t give_up = esp_timer_get_time() + CLIP_SETTLE_MAX_S * 1000000LL;
+    while (esp_timer_get_time() < give_up) {
+        char path[FILE_NAME_LEN];
+        esp_err_t res = getClosedRecording(generation, path, sizeof(path));
+        if (res != ESP_ERR_INVALID_STATE && res != ESP_ERR_NOT_FINISHED) return;
+        vTaskDelay(pdMS_TO_TICKS(CLIP_POLL_MS));
+    }
+    ESP_LOGW(TAG, "Recording still open after %d s, exporting what is on the card", CLIP_SETTLE_MAX_S);
+}
+
+// Both PIR edges extend the window, so a clip runs to CLIP_POST_S after the fall.
+// Sound events do the same from their start and their end.
+static void pir_changed(bool active, int64_t at_us, void *arg) {
+    clip_upload_note_event();
+}
+
+static void sound_changed(bool active, int64_t at_us, uint16_t score, void *arg) {
+    clip_upload_note_event();
+}
+
+// Clip worker: collects event frames and PIR edges into a window, then exports and uploads
+// the video of that window once the recording covering it is on the card.
+void clip_upload_task(void *pvParameters) {
+    clip_task_handle = xTaskGetCurrentTaskHandle();
+    pir_subscribe(pir_changed, NULL);
+    sound_subscribe(sound_changed, NULL);
+    ESP_LOGI(TAG, "Clip upload worker started");
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000));
+        time_t now = time(NULL);
+        time_t from = 0, to = 0;
+        taskENTER_CRITICAL(&clip_lock);
+        if (event_first != 0 && (now >= event_last + CLIP_POST_S || now >= event_first - CLIP_PRE_S + CLIP_MAX_S)) {
+            from = event_first - CLIP_PRE_S;
+            to = event_last + CLIP_POST_S;
+            if (to > from + CLIP_MAX_S) to = from + CLIP_MAX_S;
+            event_first = event_last = 0;
+        }
+        taskEXIT_CRITICAL(&clip_lock);
+        if (from == 0) continue;
+
+        wait_for_recording();
+        // export_clip stops at CLIP_MAX_FRAMES and reports where; the rest of
+        // the window goes out as the next clip
+        while (from < to) {
+            char path[FILE_NAME_LEN];
+            time_t end = to;
+            esp_err_t res;
+            for (int i = 0; (res = export_clip(from, to, path, sizeof(path), &end)) == ESP_ERR_INVALID_STATE && i < 30; i++) {
+                vTaskDelay(pdMS_TO_TICKS(CLIP_POLL_MS)); // A data channel export is running
+            }
+            if (res != ESP_OK) {
+                ESP_LOGW(TAG, "No event clip for %lld-%lld: %s", (long long)from, (long long)to, esp_err_to_name(res));
+                break;
+            }
+            if (end < to) ESP_LOGI(TAG, "Event clip cut at %lld, %lld s follow in the next one", (long long)end, (long long)(to - end));
+            res = clip_upload_file(path);
+            if (res == ESP_OK) {
+                remove(path);
+            } else {
+                ESP_LOGE(TAG, "Event clip not uploaded (%s), kept as %s", esp_err_to_name(res), path);
+            }
+            if (end <= from) break; // No progress, don't spin on the same range
+            from = end;
+        }
+    }
+}
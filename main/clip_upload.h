@@ -0,0 +1,33 @@
+// clip_upload.h
+// Event clips: the recorded video around an event, exported from the SD
+// recordings with export_clip and streamed to the upload server straight
+// from the file. The body goes out with chunked transfer encoding in
+// CLIP_UPLOAD_BLOCK reads, so a clip is never held in RAM. A dropped
+// connection resumes at the byte offset the server reports:
+//   HEAD  /upload/clip/<name>  -> Upload-Offset: <bytes already stored>, 404 if none
+//   PATCH /upload/clip/<name>  Upload-Offset: <start>, Upload-Length: <file size>,
+//                              body = file[start, end) -> 2xx, Upload-Offset: <bytes stored>
+// Both carry X-User-Id and X-Camera-Id.
+#ifndef CLIP_UPLOAD_H
+#define CLIP_UPLOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "esp_err.h"
+
+#define CLIP_PRE_S 5             // Clip starts this long before the first event frame
+#define CLIP_POST_S 10           // ...and ends this long after the last one
+#define CLIP_MAX_S 60            // Longer events are cut into clips of this length (and at CLIP_MAX_FRAMES)
+#define CLIP_UPLOAD_BLOCK (32 * 1024) // File bytes read and sent per chunk
+
+void clip_upload_note_event(void); // An event frame was taken now; never blocks
+esp_err_t clip_upload_file(const char *path); // Uploads (or resumes) one clip file, blocks until done
+void clip_upload_task(void *pvParameters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CLIP_UPLOAD_H
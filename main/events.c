@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/time.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -14,11 +15,18 @@
 #include "driver/gpio.h" // Added for GPIO control
 #include "esp_task_wdt.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
 #include "esp_http_client.h"
 // #include "esp_http_server.h" // Removed - No longer streaming
 #include "esp_timer.h"
 #include "esp_tls.h"
+#include "esp_random.h"
 #include "events.h"
+#include "jpeg_inspect.h"
+#include "motion.h"
+#include "phash.h"
+#include "pir.h"
+#include "spool.h"
 #include "wifimanager.h"
 
 // Define MIN macro
@@ -32,17 +40,11 @@
 #define CONFIG_ESP_WIFI_PASSWORD  "Duf1e@9723"
 #define CONFIG_ESP_MAXIMUM_RETRY  5
 
-// Upload Server
-#define CONFIG_UPLOAD_SERVER_IP   "192.168.173.152"
-#define CONFIG_UPLOAD_SERVER_PORT 3001
-#define CONFIG_UPLOAD_PATH        "/upload"
-#define CONFIG_USER_ID            stored_user_id
-#define CONFIG_CAMERA_ID          stored_camera_id // Replace with ESP32 Cam ID
+// Upload Server (address and ids in events.h)
 #define CONFIG_EVENT_DESC         "Motion detected"
 // #define UPLOAD_INTERVAL_MS        10000 // Removed - No longer periodic upload
 
-// PIR Sensor
- // Using GPIO43 for PIR input
+// PIR Sensor (pir.c)
 #define MOTION_DETECT_COOLDOWN_MS 1000 // 5 seconds cooldown after detection/upload attempt
 
 
@@ -57,8 +59,11 @@ bool event_recieved = false;
 extern QueueHandle_t eventQueue; // Queue for event handling
 extern SemaphoreHandle_t xSemaphore; // Semaphore for synchronization
 
-// Semaphore to signal motion detection from ISR
-static SemaphoreHandle_t pirSemaphore = NULL;
+// Upload worker counters
+static uint32_t events_uploaded = 0;
+static uint32_t events_failed = 0;
+static uint32_t events_coalesced = 0; // Bursts dropped because a newer one replaced them
+static uint32_t events_suppressed = 0; // Bursts not started: same scene as a recent one, or over the rate
 
 // --- WiFi Event Handler (Unchanged) ---
 static void event_handler(void* arg, esp_event_base_t event_base,
@@ -222,243 +227,514 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt) {
 }
 
 
-// --- Upload Function (Modified from task) ---
-// Takes a captured frame buffer and uploads it
-esp_err_t upload_image(camera_fb_t *fb) {
-    if (!fb || !fb->buf || fb->len == 0) {
-        ESP_LOGE(TAG, "Invalid frame buffer for upload");
-        return ESP_ERR_INVALID_ARG;
+// --- Upload Client ---
+// One esp_http_client lives for the whole run and keeps its connection open
+// between uploads, so a run of events pays for one TCP handshake. The
+// multipart prefix (userId, cameraId, event) and footer only depend on the
+// ids, so they are built once with a per-boot boundary and rebuilt only if
+// the ids change. Only the upload worker calls upload_event.
+#define UPLOAD_TIMEOUT_MS 20000
+#define UPLOAD_KEEPALIVE_MS 4000 // Below the server's idle timeout (Node's default is 5 s), reconnect after
+#define UPLOAD_PREFIX_SIZE 512
+#define UPLOAD_PART_HEAD_SIZE 160
+
+static esp_http_client_handle_t upload_client = NULL;
+static bool upload_connected = false;
+static int64_t upload_last_us = 0;
+static char upload_boundary[40];
+static char upload_prefix[UPLOAD_PREFIX_SIZE];
+static int upload_prefix_len = 0;
+static char upload_footer[64];
+static int upload_footer_len = 0;
+static char upload_prefix_user[sizeof(stored_user_id)];     // Ids the prefix was built with
+static char upload_prefix_camera[sizeof(stored_camera_id)];
+
+static esp_err_t upload_client_prepare(void) {
+    if (!upload_client) {
+        snprintf(upload_boundary, sizeof(upload_boundary), "----ESP32CamBoundary%08lx%08lx", esp_random(), esp_random());
+        upload_footer_len = snprintf(upload_footer, sizeof(upload_footer), "\r\n--%s--\r\n", upload_boundary);
+
+        char upload_url[128];
+        snprintf(upload_url, sizeof(upload_url), "http://%s:%d%s",
+                 CONFIG_UPLOAD_SERVER_IP, CONFIG_UPLOAD_SERVER_PORT, CONFIG_UPLOAD_PATH);
+        esp_http_client_config_t config = {
+            .url = upload_url,
+            .method = HTTP_METHOD_POST,
+            .event_handler = _http_event_handler,
+            .timeout_ms = UPLOAD_TIMEOUT_MS,
+            .keep_alive_enable = true, // TCP keep-alive probes, so a dead peer is noticed while idle
+        };
+        upload_client = esp_http_client_init(&config);
+        if (!upload_client) {
+            ESP_LOGE(TAG, "Failed to initialise HTTP client");
+            return ESP_FAIL;
+        }
+        char content_type_header[96];
+        snprintf(content_type_header, sizeof(content_type_header), "multipart/form-data; boundary=%s", upload_boundary);
+        esp_http_client_set_header(upload_client, "Content-Type", content_type_header);
+        esp_http_client_set_header(upload_client, "Connection", "keep-alive");
     }
 
-    // Check WiFi connection bit one last time before attempting upload
-    //EventBits_t bits = xEventGroupGetBits(s_wifi_event_group);
-    // if (!(bits & WIFI_CONNECTED_BIT)) {
-    //     ESP_LOGE(TAG, "WiFi not connected, skipping upload.");
-    //     return ESP_FAIL;
-    // }
+    if (upload_prefix_len == 0 || strcmp(upload_prefix_user, CONFIG_USER_ID) != 0 ||
+        strcmp(upload_prefix_camera, CONFIG_CAMERA_ID) != 0) {
+        int len = snprintf(upload_prefix, sizeof(upload_prefix),
+                           "--%s\r\n"
+                           "Content-Disposition: form-data; name=\"userId\"\r\n\r\n"
+                           "%s\r\n"
+                           "--%s\r\n"
+                           "Content-Disposition: form-data; name=\"cameraId\"\r\n\r\n"
+                           "%s\r\n"
+                           "--%s\r\n"
+                           "Content-Disposition: form-data; name=\"event\"\r\n\r\n"
+                           "%s",
+                           upload_boundary, CONFIG_USER_ID,
+                           upload_boundary, CONFIG_CAMERA_ID,
+                           upload_boundary, CONFIG_EVENT_DESC);
+        if (len >= (int)sizeof(upload_prefix)) {
+            ESP_LOGE(TAG, "Multipart prefix buffer too small!");
+            upload_prefix_len = 0;
+            return ESP_ERR_INVALID_SIZE;
+        }
+        upload_prefix_len = len;
+        snprintf(upload_prefix_user, sizeof(upload_prefix_user), "%s", CONFIG_USER_ID);
+        snprintf(upload_prefix_camera, sizeof(upload_prefix_camera), "%s", CONFIG_CAMERA_ID);
+    }
+    return ESP_OK;
+}
 
+static void upload_client_disconnect(void) {
+    if (upload_connected) esp_http_client_close(upload_client);
+    upload_connected = false;
+}
 
-    ESP_LOGI(TAG, "Uploading image: %zu bytes", fb->len);
-    esp_err_t res = ESP_OK;
+// Checks that a burst's header matches its length
+static const event_burst_hdr_t *burst_header(const uint8_t *burst, size_t len) {
+    if (!burst || len < sizeof(event_burst_hdr_t)) return NULL;
+    const event_burst_hdr_t *hdr = (const event_burst_hdr_t *)burst;
+    if (hdr->count == 0 || hdr->count > EVENT_BURST_FRAMES) return NULL;
+    size_t total = sizeof(event_burst_hdr_t);
+    for (uint32_t i = 0; i < hdr->count; i++) total += hdr->len[i];
+    return total == len ? hdr : NULL;
+}
 
-    // Construct URL
-    char upload_url[128];
-    snprintf(upload_url, sizeof(upload_url), "http://%s:%d%s",
-             CONFIG_UPLOAD_SERVER_IP, CONFIG_UPLOAD_SERVER_PORT, CONFIG_UPLOAD_PATH);
+// One POST on the current connection (opened if needed). The prefix, each
+// frame's part header and JPEG, and the footer go to the socket straight
+// from their own buffers, back to back.
+static esp_err_t upload_post_once(const event_burst_hdr_t *hdr) {
+    char heads[EVENT_BURST_FRAMES][UPLOAD_PART_HEAD_SIZE];
+    int head_len[EVENT_BURST_FRAMES];
+    int total_len = upload_prefix_len + upload_footer_len;
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        head_len[i] = snprintf(heads[i], UPLOAD_PART_HEAD_SIZE,
+                               "\r\n--%s\r\n" // Ends the previous field or file
+                               "Content-Disposition: form-data; name=\"file\"; filename=\"image%lu.jpg\"\r\n"
+                               "Content-Type: image/jpeg\r\n\r\n",
+                               upload_boundary, i);
+        total_len += head_len[i] + (int)hdr->len[i];
+    }
 
-    // Construct boundary string (needs to be unique for each request)
-    char boundary[64];
-    snprintf(boundary, sizeof(boundary), "----ESP32CamBoundary%lld", esp_timer_get_time());
+    esp_err_t res = esp_http_client_open(upload_client, total_len);
+    if (res != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(res));
+        return res;
+    }
+    upload_connected = true;
 
-    // Reusable buffer for multipart headers/footers
-    // Static to avoid repeated malloc/free if function is called often,
-    // but be mindful if threading changes. For single upload trigger, malloc/free is ok too.
-    #define POST_BUFFER_SIZE 1024
-    char *post_data_buffer = (char *)malloc(POST_BUFFER_SIZE);
-    if (!post_data_buffer) {
-        ESP_LOGE(TAG, "Failed to allocate buffer for upload");
-        return ESP_ERR_NO_MEM;
+    if (esp_http_client_write(upload_client, upload_prefix, upload_prefix_len) != upload_prefix_len) {
+        ESP_LOGE(TAG, "Failed to write multipart prefix");
+        return ESP_FAIL;
+    }
+    const char *jpeg = (const char *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->count; i++) {
+        if (esp_http_client_write(upload_client, heads[i], head_len[i]) != head_len[i]) {
+            ESP_LOGE(TAG, "Failed to write part header %lu", i);
+            return ESP_FAIL;
+        }
+        int written = esp_http_client_write(upload_client, jpeg, hdr->len[i]);
+        if (written != (int)hdr->len[i]) {
+            ESP_LOGE(TAG, "Failed to write frame %lu (written %d, expected %lu)", i, written, hdr->len[i]);
+            return ESP_FAIL;
+        }
+        jpeg += hdr->len[i];
+    }
+    if (esp_http_client_write(upload_client, upload_footer, upload_footer_len) != upload_footer_len) {
+        ESP_LOGE(TAG, "Failed to write multipart footer");
+        return ESP_FAIL;
     }
 
-    // Construct multipart form data prefix
-    int head_len = snprintf(post_data_buffer, POST_BUFFER_SIZE,
-                            "--%s\r\n"
-                            "Content-Disposition: form-data; name=\"userId\"\r\n\r\n"
-                            "%s\r\n"
-                            "--%s\r\n"
-                            "Content-Disposition: form-data; name=\"cameraId\"\r\n\r\n"
-                            "%s\r\n"
-                            "--%s\r\n"
-                            "Content-Disposition: form-data; name=\"event\"\r\n\r\n"
-                            "%s\r\n"
-                            "--%s\r\n"
-                            "Content-Disposition: form-data; name=\"file\"; filename=\"image.jpg\"\r\n"
-                            "Content-Type: image/jpeg\r\n\r\n",
-                            boundary, CONFIG_USER_ID,
-                            boundary, CONFIG_CAMERA_ID,
-                            boundary, CONFIG_EVENT_DESC,
-                            boundary);
-    if (head_len >= POST_BUFFER_SIZE) {
-         ESP_LOGE(TAG, "Post data buffer too small for headers!");
-         free(post_data_buffer);
-         return ESP_ERR_INVALID_SIZE;
-    }
-
-    // Construct multipart form data suffix
-    char footer[128];
-    int foot_len = snprintf(footer, sizeof(footer), "\r\n--%s--\r\n", boundary);
-
-    // Calculate total content length
-    int total_len = head_len + fb->len + foot_len;
-
-    esp_http_client_config_t config = {
-        .url = upload_url,
-        .method = HTTP_METHOD_POST,
-        .event_handler = _http_event_handler,
-        .timeout_ms = 20000, // Increased timeout for potentially slower uploads
-    };
-    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (esp_http_client_fetch_headers(upload_client) < 0) {
+        ESP_LOGE(TAG, "HTTP client fetch headers failed");
+        return ESP_FAIL;
+    }
+    int status_code = esp_http_client_get_status_code(upload_client);
+    // Read the body to the end so the next request starts on a clean connection
+    esp_http_client_flush_response(upload_client, NULL);
+    if (!esp_http_client_is_complete_data_received(upload_client)) upload_client_disconnect();
+
+    if (status_code == 200 || status_code == 201 || status_code == 204) return ESP_OK;
+    ESP_LOGE(TAG, "Image upload failed with server status: %d", status_code);
+    if (status_code >= 400 && status_code < 500 && status_code != 408 && status_code != 429) {
+        return ESP_ERR_INVALID_ARG; // The server refused this request, sending it again won't help
+    }
+    return ESP_ERR_INVALID_RESPONSE;
+}
 
-    if (!client) {
-        ESP_LOGE(TAG, "Failed to initialise HTTP client");
-        free(post_data_buffer);
-        return ESP_FAIL; // Indicate failure
+// Uploads an event burst (header and frames) as one request
+esp_err_t upload_event(const uint8_t *burst, size_t len) {
+    const event_burst_hdr_t *hdr = burst_header(burst, len);
+    if (!hdr) {
+        ESP_LOGE(TAG, "Invalid event burst for upload");
+        return ESP_ERR_INVALID_ARG;
     }
+    esp_err_t res = upload_client_prepare();
+    if (res != ESP_OK) return res;
 
-    // Set headers
-    char content_type_header[128];
-    snprintf(content_type_header, sizeof(content_type_header), "multipart/form-data; boundary=%s", boundary);
-    esp_http_client_set_header(client, "Content-Type", content_type_header);
+    int64_t start = esp_timer_get_time();
+    if (upload_connected && start - upload_last_us > UPLOAD_KEEPALIVE_MS * 1000LL) {
+        upload_client_disconnect(); // The server has probably dropped it already
+    }
 
-    // Manually write the multipart body
-    res = esp_http_client_open(client, total_len);
-    if (res != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(res));
-    } else {
-        // Write header part
-        int written = esp_http_client_write(client, post_data_buffer, head_len);
-        vTaskDelay(pdMS_TO_TICKS(10));
-        if (written < 0 || written != head_len) {
-             ESP_LOGE(TAG, "Failed to write header part (written %d, expected %d)", written, head_len);
-             res = ESP_FAIL;
-        } else {
-             ESP_LOGD(TAG,"Wrote header: %d bytes", written);
-        }
+    bool reused = upload_connected;
+    res = upload_post_once(hdr);
+    if (res == ESP_FAIL && reused) {
+        // The kept-alive connection went away under us; the request never got
+        // an answer, so one retry on a fresh connection is safe
+        ESP_LOGW(TAG, "Kept-alive upload connection lost, reconnecting");
+        upload_client_disconnect();
+        reused = false;
+        res = upload_post_once(hdr);
+    }
+    if (res == ESP_FAIL) upload_client_disconnect();
 
-        // Write image data
-        if (res == ESP_OK) {
-            written = esp_http_client_write(client, (const char *)fb->buf, fb->len);
-            vTaskDelay(pdMS_TO_TICKS(10));
-            if (written < 0 || written != (int)fb->len) { // Cast fb->len safely
-                ESP_LOGE(TAG, "Failed to write image data (written %d, expected %zu)", written, fb->len);
-                res = ESP_FAIL;
-            } else {
-                 ESP_LOGD(TAG,"Wrote image: %d bytes", written);
-            }
-        }
+    upload_last_us = esp_timer_get_time();
+    if (res == ESP_OK) {
+        ESP_LOGI(TAG, "Event uploaded: %lu frames, %zu bytes in %lld ms (%s connection)", hdr->count, len,
+                 (upload_last_us - start) / 1000, reused ? "reused" : "new");
+    }
+    return res;
+}
 
-        // Write footer part
-        if (res == ESP_OK) {
-            written = esp_http_client_write(client, footer, foot_len);
-            vTaskDelay(pdMS_TO_TICKS(10));
-            if (written < 0 || written != foot_len) {
-                ESP_LOGE(TAG, "Failed to write footer part (written %d, expected %d)", written, foot_len);
-                res = ESP_FAIL;
-            } else {
-                 ESP_LOGD(TAG,"Wrote footer: %d bytes", written);
-            }
-        }
 
-        // Check response if all writes were successful
-        if (res == ESP_OK) {
-            ESP_LOGI(TAG, "HTTP POST multipart data written: %d bytes", total_len);
-            int status_code = esp_http_client_fetch_headers(client);
-             if (status_code < 0) {
-                 ESP_LOGE(TAG, "HTTP client fetch headers failed: %s", esp_err_to_name(status_code));
-                 res = ESP_FAIL; // Treat as failure
-             } else {
-                 status_code = esp_http_client_get_status_code(client);
-                 ESP_LOGI(TAG, "HTTP POST Status = %d", status_code);
-                 // Read response body via event handler
-                 // Check status code
-                 if (status_code == 200 || status_code == 201 || status_code == 204) {
-                     ESP_LOGI(TAG,"Image uploaded successfully!");
-                     res = ESP_OK; // Explicitly mark as success
-                 } else {
-                     ESP_LOGE(TAG,"Image upload failed with server status: %d", status_code);
-                     res = ESP_FAIL; // Mark as failure
-                 }
-             }
-        } else {
-             ESP_LOGE(TAG, "HTTP POST request failed during write phase");
+void upload_image_init(){
+    // PIR edges come in on interrupts, the camera and clip workers subscribe to them
+    if (pir_init() != ESP_OK) ESP_LOGE(TAG, "Failed to initialise the PIR sensor");
+}
+
+
+// --- Event Bursts ---
+// Filled by the camera task: the first frame opens a burst, the frame
+// scheduler grabs the rest over EVENT_BURST_WINDOW_MS, and the full arena is
+// handed to the upload worker. The camera task must never wait on the
+// network, so when the queue is full the oldest waiting burst is dropped in
+// favour of this one (the latest event is the useful one).
+static uint8_t *burst_arena = NULL; // Burst being filled, NULL if none
+static size_t burst_used = 0;
+static int64_t burst_start_us = 0;
+
+static void free_burst(uint8_t *burst) {
+    heap_caps_free(burst);
+}
+
+static size_t burst_len(const uint8_t *burst) {
+    const event_burst_hdr_t *hdr = (const event_burst_hdr_t *)burst;
+    size_t len = sizeof(event_burst_hdr_t);
+    for (uint32_t i = 0; i < hdr->count; i++) len += hdr->len[i];
+    return len;
+}
+
+static void queue_burst(void) {
+    uint8_t *burst = burst_arena;
+    burst_arena = NULL;
+    if (!burst) return;
+    // Give the unused tail of the arena back while the burst waits for the network
+    uint8_t *shrunk = (uint8_t *)heap_caps_realloc(burst, burst_used, MALLOC_CAP_SPIRAM);
+    if (shrunk) burst = shrunk;
+    if (eventQueue == NULL) {
+        free_burst(burst);
+        return;
+    }
+    if (xQueueSend(eventQueue, &burst, 0) != pdTRUE) {
+        uint8_t *stale = NULL;
+        if (xQueueReceive(eventQueue, &stale, 0) == pdTRUE && stale) {
+            free_burst(stale);
+            events_coalesced++;
+        }
+        if (xQueueSend(eventQueue, &burst, 0) != pdTRUE) { // Worker can't keep up at all
+            free_burst(burst);
+            events_coalesced++;
         }
+        ESP_LOGW(TAG, "Event upload backlog, %lu bursts coalesced so far", events_coalesced);
     }
+}
 
-    // Cleanup
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-    free(post_data_buffer);
+// Copies a frame into the open burst, ESP_ERR_NO_MEM if the arena is full
+static esp_err_t burst_append(camera_fb_t *fb) {
+    jpeg_info_t info;
+    int res = jpeg_inspect(fb->buf, fb->len, 0, &info);
+    if (res != JPEG_OK) {
+        ESP_LOGW(TAG, "Event frame skipped: %s", jpeg_inspect_err_name(res));
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+    event_burst_hdr_t *hdr = (event_burst_hdr_t *)burst_arena;
+    if (burst_used + info.len > EVENT_BURST_ARENA_BYTES) {
+        ESP_LOGW(TAG, "Event burst arena full after %lu frames", hdr->count);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(burst_arena + burst_used, fb->buf, info.len); // Without the driver's padding after EOI
+    burst_used += info.len;
+    hdr->len[hdr->count++] = info.len;
+    if (hdr->count == 1) {
+        // fb->timestamp is esp_timer time (since boot); move it onto the wall clock
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        int64_t fb_us = (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+        hdr->timestamp = tv.tv_sec - (esp_timer_get_time() - fb_us) / 1000000LL;
+    }
+    return ESP_OK;
+}
 
-    return res; // Return ESP_OK on success, ESP_FAIL or other error code on failure
+bool event_burst_open(void) {
+    return burst_arena != NULL;
 }
 
+// --- Event Filter ---
+// The first frame of a would-be burst is hashed (phash.c over its DC luma
+// image) and compared with the bursts started recently: a scene that hasn't
+// changed (someone standing still, a swaying branch) is sent again only
+// after EVENT_DEDUP_WINDOW_S. What gets through is then limited by a token
+// bucket, so a busy scene can't flood the server.
+#define EVENT_DEDUP_DISTANCE 3    // Hash bits that may differ for the same scene
+#define EVENT_DEDUP_HISTORY 4     // Recent bursts compared against
+#define EVENT_DEDUP_WINDOW_S 60   // A static scene is still sent this often
+#define EVENT_RATE_BURST 4        // Bursts that may start back to back
+#define EVENT_RATE_REFILL_S 15    // ...and one more every this many seconds
+#define EVENT_RATE_COST_US (EVENT_RATE_REFILL_S * 1000000LL)
+
+typedef struct {
+    uint64_t hash;
+    int64_t at_us; // 0 for an empty slot
+} recent_event_t;
+
+static recent_event_t recent_events[EVENT_DEDUP_HISTORY];
+static int recent_next = 0;
+static uint8_t *dedup_luma = NULL; // DC luma image, grown to the frame size
+static size_t dedup_luma_cap = 0;
+static int64_t rate_credit_us = 0; // Token bucket, one token is EVENT_RATE_COST_US of credit
+static int64_t rate_last_us = 0;
+
+static bool frame_hash(const camera_fb_t *fb, uint64_t *hash) {
+    uint16_t width, height;
+    int err = motion_dc_luma(fb->buf, fb->len, dedup_luma, dedup_luma_cap, &width, &height);
+    if (err == MOTION_ERR_NO_MEM && (size_t)width * height > dedup_luma_cap) {
+        uint8_t *grown = (uint8_t *)heap_caps_realloc(dedup_luma, (size_t)width * height, MALLOC_CAP_SPIRAM);
+        if (!grown) return false;
+        dedup_luma = grown;
+        dedup_luma_cap = (size_t)width * height;
+        err = motion_dc_luma(fb->buf, fb->len, dedup_luma, dedup_luma_cap, &width, &height);
+    }
+    if (err != MOTION_OK || width == 0 || height == 0) {
+        ESP_LOGW(TAG, "Event frame not hashed: %s", motion_err_name(err));
+        return false;
+    }
+    *hash = phash_luma(dedup_luma, width, height);
+    return true;
+}
 
-// --- PIR Sensor ISR ---
-static void IRAM_ATTR pir_isr_handler(void* arg) {
-    // Give the semaphore - signal that motion was detected
-    // Need to use the ISR version of the function
-    xSemaphoreGiveFromISR(pirSemaphore, NULL);
+// Distance to the closest recent burst, 64 (all bits) if there is none
+static int recent_distance(uint64_t hash, int64_t now) {
+    int best = 64;
+    for (int i = 0; i < EVENT_DEDUP_HISTORY; i++) {
+        const recent_event_t *r = &recent_events[i];
+        if (r->at_us == 0 || now - r->at_us > EVENT_DEDUP_WINDOW_S * 1000000LL) continue;
+        int d = phash_distance(hash, r->hash);
+        if (d < best) best = d;
+    }
+    return best;
 }
 
-// --- PIR Sensor Configuration ---
-static void configure_pir_sensor(void) {
-    gpio_config_t io_conf = {
-        .pin_bit_mask = (1ULL << PIR_SENSOR_PIN),
-        .mode = GPIO_MODE_INPUT,
-        .pull_down_en = GPIO_PULLDOWN_ENABLE,
-        .pull_up_en = GPIO_PULLUP_DISABLE,
-        .intr_type = GPIO_INTR_DISABLE // Disable interrupt
-    };
-    gpio_config(&io_conf);
-    ESP_LOGI(TAG, "PIR Sensor configured for polling on GPIO %d", PIR_SENSOR_PIN);
+// Whether a burst may start now. A frame that can't be hashed is let through.
+static bool event_filter_pass(camera_fb_t *fb, bool *hashed, uint64_t *hash) {
+    int64_t now = esp_timer_get_time();
+    *hashed = frame_hash(fb, hash);
+    if (*hashed) {
+        int d = recent_distance(*hash, now);
+        if (d <= EVENT_DEDUP_DISTANCE) {
+            events_suppressed++;
+            ESP_LOGI(TAG, "Event frame skipped, same scene as a recent upload (%d bits apart)", d);
+            return false;
+        }
+    }
+    rate_credit_us += now - rate_last_us;
+    if (rate_credit_us > EVENT_RATE_BURST * EVENT_RATE_COST_US) rate_credit_us = EVENT_RATE_BURST * EVENT_RATE_COST_US;
+    rate_last_us = now;
+    if (rate_credit_us < EVENT_RATE_COST_US) {
+        events_suppressed++;
+        ESP_LOGW(TAG, "Event frame skipped, over %d bursts per %d s", EVENT_RATE_BURST, EVENT_RATE_REFILL_S);
+        return false;
+    }
+    return true;
 }
 
+esp_err_t event_burst_begin(camera_fb_t *fb) {
+    if (eventQueue == NULL || fb == NULL) return ESP_ERR_INVALID_STATE;
+    queue_burst(); // A burst still open goes out as it is
 
-void upload_image_init(){
+    bool hashed;
+    uint64_t hash;
+    if (!event_filter_pass(fb, &hashed, &hash)) return ESP_ERR_NOT_ALLOWED;
 
-    pirSemaphore = xSemaphoreCreateBinary();
-    if (pirSemaphore == NULL) {
-        ESP_LOGE(TAG, "Failed to create PIR semaphore");
-        // Handle error - perhaps restart?
-        return;
+    burst_arena = (uint8_t *)heap_caps_malloc(EVENT_BURST_ARENA_BYTES, MALLOC_CAP_SPIRAM);
+    if (!burst_arena) return ESP_ERR_NO_MEM;
+    memset(burst_arena, 0, sizeof(event_burst_hdr_t));
+    burst_used = sizeof(event_burst_hdr_t);
+    burst_start_us = esp_timer_get_time();
+
+    esp_err_t res = burst_append(fb);
+    if (res != ESP_OK) {
+        free_burst(burst_arena);
+        burst_arena = NULL;
+        return res;
+    }
+    rate_credit_us -= EVENT_RATE_COST_US;
+    if (hashed) {
+        recent_events[recent_next].hash = hash;
+        recent_events[recent_next].at_us = burst_start_us;
+        recent_next = (recent_next + 1) % EVENT_DEDUP_HISTORY;
     }
+    if (EVENT_BURST_FRAMES == 1) queue_burst();
+    return ESP_OK;
+}
+
+esp_err_t event_burst_add(camera_fb_t *fb) {
+    if (!burst_arena || fb == NULL) return ESP_ERR_INVALID_STATE;
+    esp_err_t res = burst_append(fb);
+    const event_burst_hdr_t *hdr = (const event_burst_hdr_t *)burst_arena;
+    // The time limit only matters if the camera stalls; normally the scheduler
+    // delivers the last frame right at the end of the window
+    if (res == ESP_ERR_NO_MEM || hdr->count == EVENT_BURST_FRAMES ||
+        esp_timer_get_time() - burst_start_us > EVENT_BURST_WINDOW_MS * 2000LL) {
+        queue_burst();
+    }
+    return res == ESP_ERR_INVALID_RESPONSE ? ESP_OK : res; // A bad frame only costs that frame
+}
 
-   
- 
-  
-    // Configure PIR Sensor and ISR
-    configure_pir_sensor();
+void event_upload_stats(uint32_t *uploaded, uint32_t *failed, uint32_t *coalesced, uint32_t *suppressed) {
+    if (uploaded) *uploaded = events_uploaded;
+    if (failed) *failed = events_failed;
+    if (coalesced) *coalesced = events_coalesced;
+    if (suppressed) *suppressed = events_suppressed;
 }
 
+// --- Offline Spool ---
+// Bursts that fail to upload go to the SD card spool as they are and are
+// retried oldest first with exponential backoff. While anything is spooled,
+// new bursts are appended behind it so events reach the server in order. Delivery is at
+// least once: a reboot between a successful POST and the cursor update
+// uploads that event again.
+#define SPOOL_BACKOFF_MIN_MS 2000
+#define SPOOL_BACKOFF_MAX_MS (5 * 60 * 1000)
 
+static uint32_t spool_backoff_ms = 0; // 0 while the server is reachable
+static int64_t spool_retry_us = 0;
+
+static bool upload_retryable(esp_err_t res) {
+    return res != ESP_OK && res != ESP_ERR_INVALID_ARG;
+}
+
+static void spool_backoff(void) {
+    if (spool_backoff_ms == 0) {
+        spool_backoff_ms = SPOOL_BACKOFF_MIN_MS;
+    } else if (spool_backoff_ms < SPOOL_BACKOFF_MAX_MS / 2) {
+        spool_backoff_ms *= 2;
+    } else {
+        spool_backoff_ms = SPOOL_BACKOFF_MAX_MS;
+    }
+    uint32_t jitter = esp_random() % (spool_backoff_ms / 4 + 1); // Cameras sharing a server don't retry in step
+    spool_retry_us = esp_timer_get_time() + (int64_t)(spool_backoff_ms + jitter) * 1000;
+    ESP_LOGW(TAG, "Upload failed, %lu events spooled, retrying in %lu ms",
+             spool_pending(), spool_backoff_ms + jitter);
+}
 
+static void spool_burst(const uint8_t *burst) {
+    const event_burst_hdr_t *hdr = (const event_burst_hdr_t *)burst;
+    if (spool_append(burst, burst_len(burst), hdr->timestamp) != ESP_OK) {
+        events_failed++;
+        ESP_LOGE(TAG, "Failed to spool event burst, dropped");
+    }
+}
+
+// Retries the oldest spooled burst
+static void spool_drain_one(void) {
+    size_t len;
+    int64_t timestamp;
+    uint8_t *buf = spool_peek(&len, &timestamp);
+    if (!buf) {
+        // Nothing readable (or no memory for it right now), check back later
+        if (spool_pending() > 0) spool_backoff();
+        return;
+    }
+    event_recieved = true;
+    esp_err_t res = upload_event(buf, len);
+    event_recieved = false;
+    heap_caps_free(buf);
+
+    if (upload_retryable(res)) {
+        spool_backoff();
+        return;
+    }
+    spool_pop();
+    if (res == ESP_OK) {
+        events_uploaded++;
+        ESP_LOGI(TAG, "Spooled event from %lld delivered, %lu left", timestamp, spool_pending());
+    } else {
+        events_failed++;
+        ESP_LOGE(TAG, "Spooled event from %lld rejected by the server, dropped", timestamp);
+    }
+    spool_backoff_ms = 0;
+    spool_retry_us = 0;
+}
+
+// Upload worker: the only place the HTTP POST runs, so a slow or dead server
+// only ever delays other event uploads.
 void upload_image_task(void* pvParameters) {
-    ESP_LOGI(TAG, "Initialization complete. Waiting for motion...");
+    if (spool_init() != ESP_OK) {
+        ESP_LOGW(TAG, "No upload spool, events that fail to upload are lost");
+    }
+    ESP_LOGI(TAG, "Upload worker started. Waiting for event bursts...");
     while (1) {
-        if (gpio_get_level(PIR_SENSOR_PIN) == 1) {
-            ESP_LOGI(TAG, "Motion detected! Capturing and uploading image...");
-            event_recieved = true;
-
-            camera_fb_t *fb = NULL;
-            if (eventQueue == NULL) {
-                ESP_LOGE(TAG, "eventQueue is NULL, skipping upload");
-                vTaskDelay(pdMS_TO_TICKS(1000));
-                continue;
-            }
+        uint8_t *burst = NULL;
+        if (eventQueue == NULL) {
+            vTaskDelay(pdMS_TO_TICKS(1000));
+            continue;
+        }
 
-            if (xQueueReceive(eventQueue, &fb, portMAX_DELAY) == pdTRUE) {
-                event_recieved = false;
-                //if (xSemaphoreTake(xSemaphore, portMAX_DELAY)) {
-                    ESP_LOGI(TAG, "Streaming frame %d...", fb->len);
-                    esp_err_t upload_status = upload_image(fb);
-                    esp_task_wdt_reset(); // Reset watchdog after upload
-                    if (upload_status != ESP_OK) {
-                        ESP_LOGE(TAG, "Image upload failed.");
-                    }
-                    //xSemaphoreGive(xSemaphore);
-               // }
-                free(fb->buf);
-                free(fb);
-            }
+        TickType_t wait = portMAX_DELAY;
+        if (spool_pending() > 0) {
+            int64_t left_us = spool_retry_us - esp_timer_get_time();
+            wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) + 1 : 0;
+        }
+        if (xQueueReceive(eventQueue, &burst, wait) != pdTRUE || burst == NULL) {
+            if (spool_pending() > 0 && esp_timer_get_time() >= spool_retry_us) spool_drain_one();
+            continue;
+        }
 
+        if (spool_pending() > 0) {
+            spool_burst(burst); // Queue behind the older events
+        } else {
+            event_recieved = true;
+            ESP_LOGI(TAG, "Uploading event burst, %lu frames...", ((event_burst_hdr_t *)burst)->count);
+            esp_err_t res = upload_event(burst, burst_len(burst));
             event_recieved = false;
-
-            ESP_LOGI(TAG, "Cooldown period (%dms)...", MOTION_DETECT_COOLDOWN_MS);
-            for (int i = 0; i < MOTION_DETECT_COOLDOWN_MS / 100; i++) {
-                vTaskDelay(pdMS_TO_TICKS(100));
-                esp_task_wdt_reset(); // Reset watchdog during cooldown
+            if (res == ESP_OK) {
+                events_uploaded++;
+            } else if (upload_retryable(res) && spool_ready()) {
+                spool_burst(burst);
+                spool_backoff();
+            } else {
+                events_failed++;
+                ESP_LOGE(TAG, "Image upload failed.");
             }
         }
-        vTaskDelay(pdMS_TO_TICKS(1));
+        free_burst(burst);
     }
-}
\ No newline at end of file
+}
@@ -1,5 +1,33 @@
-#define PIR_SENSOR_PIN          43
 extern bool event_recieved;
 
-void upload_image_init();
-esp_err_t upload_image(camera_fb_t *fb);
\ No newline at end of file
+// Upload Server (event bursts and event clips)
+#define CONFIG_UPLOAD_SERVER_IP   "192.168.173.152"
+#define CONFIG_UPLOAD_SERVER_PORT 3001
+#define CONFIG_UPLOAD_PATH        "/upload"
+#define CONFIG_CLIP_UPLOAD_PATH   "/upload/clip" // Followed by /<clip file name>
+#define CONFIG_USER_ID            stored_user_id
+#define CONFIG_CAMERA_ID          stored_camera_id // Replace with ESP32 Cam ID
+
+#define EVENT_QUEUE_LEN         2  // Event bursts waiting for the upload worker
+
+// An event is a burst of frames over a short window, sent as one multipart
+// request with a `file` part per frame. The frames are copied back to back
+// into one PSRAM arena behind an event_burst_hdr_t; that arena is also what
+// the SD spool stores when the upload fails.
+#define EVENT_BURST_FRAMES      4                // Frames per event
+#define EVENT_BURST_WINDOW_MS   1500             // First to last frame of a burst
+#define EVENT_BURST_ARENA_BYTES (384 * 1024)     // A frame that doesn't fit ends the burst early
+
+typedef struct __attribute__((packed)) {
+    uint32_t count;                      // JPEGs that follow the header
+    int64_t timestamp;                   // First frame, seconds since the epoch
+    uint32_t len[EVENT_BURST_FRAMES];
+} event_burst_hdr_t;
+
+void upload_image_init(); // Starts the PIR sensor (pir.c)
+esp_err_t upload_event(const uint8_t *burst, size_t len); // event_burst_hdr_t and its JPEGs
+esp_err_t event_burst_begin(camera_fb_t *fb); // Starts a burst with this frame, never blocks; ESP_ERR_NOT_ALLOWED if filtered out
+esp_err_t event_burst_add(camera_fb_t *fb);   // Next frame of the open burst, queued for upload once complete
+bool event_burst_open(void);
+void event_upload_stats(uint32_t *uploaded, uint32_t *failed, uint32_t *coalesced, uint32_t *suppressed);
+void upload_image_task(void* pvParameters);
@@ -0,0 +1,99 @@
+// frame_proto.c
+
+#include <string.h>
+#include "frame_proto.h"
+
+#define PACER_BACKOFF_US 20000     // Pause after a failed send
+#define PACER_INCREASE_SHIFT 6     // Each successful fragment raises the rate by 1/64
+
+void frame_pacer_init(frame_pacer_t *p, uint32_t rate, uint32_t min_rate, uint32_t max_rate, uint32_t burst) {
+    memset(p, 0, sizeof(*p));
+    p->rate = rate;
+    p->min_rate = min_rate;
+    p->max_rate = max_rate;
+    p->burst = burst;
+    p->tokens = burst;
+}
+
+static void pacer_refill(frame_pacer_t *p, int64_t now_us) {
+    if (p->last_us == 0 || now_us < p->last_us) p->last_us = now_us;
+    p->tokens += (now_us - p->last_us) * (int64_t)p->rate / 1000000;
+    if (p->tokens > (int64_t)p->burst) p->tokens = p->burst;
+    p->last_us = now_us;
+}
+
+int64_t frame_pacer_wait_us(frame_pacer_t *p, size_t len, int64_t now_us) {
+    if (now_us < p->resume_us) return p->resume_us - now_us;
+    pacer_refill(p, now_us);
+    if (p->tokens >= (int64_t)len) return 0;
+    return ((int64_t)len - p->tokens) * 1000000 / p->rate + 1;
+}
+
+void frame_pacer_sent(frame_pacer_t *p, size_t len, bool ok, int64_t now_us) {
+    if (ok) {
+        uint32_t rate = p->rate + (p->rate >> PACER_INCREASE_SHIFT) + 1;
+        p->rate = (rate < p->max_rate) ? rate : p->max_rate;
+        p->tokens -= len;
+    } else {
+        p->rate = (p->rate / 2 > p->min_rate) ? p->rate / 2 : p->min_rate;
+        p->tokens = 0;
+        p->resume_us = now_us + PACER_BACKOFF_US;
+        p->failures++;
+    }
+}
+
+void frame_tx_init(frame_tx_t *tx, uint8_t stream_id) {
+    memset(tx, 0, sizeof(*tx));
+    tx->stream_id = stream_id;
+}
+
+void frame_tx_load(frame_tx_t *tx, const uint8_t *buf, size_t len, uint64_t timestamp_us, uint8_t flags) {
+    if (tx->buf && tx->offset < tx->len) frame_tx_abandon(tx); // Previous frame never finished
+    tx->seq++;
+    tx->buf = buf;
+    tx->len = len;
+    tx->offset = 0;
+    tx->timestamp_us = timestamp_us;
+    tx->flags = flags;
+    tx->frag_index = 0;
+    tx->frag_count = (len + FRAME_FRAG_PAYLOAD - 1) / FRAME_FRAG_PAYLOAD;
+}
+
+void frame_tx_abandon(frame_tx_t *tx) {
+    if (tx->buf && tx->offset < tx->len) tx->dropped++;
+    tx->buf = NULL;
+    tx->len = tx->offset = 0;
+}
+
+frame_tx_status_t frame_tx_pump(frame_tx_t *tx, frame_pacer_t *pacer, int64_t now_us, frame_send_fn send, void *ctx) {
+    while (tx->buf && tx->offset < tx->len) {
+        uint32_t payload = tx->len - tx->offset;
+        if (payload > FRAME_FRAG_PAYLOAD) payload = FRAME_FRAG_PAYLOAD;
+        size_t packet_len = sizeof(frame_hdr_t) + payload;
+        if (frame_pacer_wait_us(pacer, packet_len, now_us) > 0) return FRAME_TX_PENDING;
+
+        frame_hdr_t hdr = {
+            .version = FRAME_PROTO_VERSION,
+            .flags = tx->flags,
+            .stream_id = tx->stream_id,
+            .frag_index = tx->frag_index,
+            .frag_count = tx->frag_count,
+            .seq = tx->seq,
+            .frame_size = tx->len,
+            .frag_offset = tx->offset,
+            .timestamp_us = tx->timestamp_us,
+        };
+        if (tx->frag_index == 0) hdr.flags |= FRAME_FLAG_FIRST;
+        if (tx->offset + payload == tx->len) hdr.flags |= FRAME_FLAG_LAST;
+        memcpy(tx->packet, &hdr, sizeof(hdr));
+        memcpy(tx->packet + sizeof(hdr), tx->buf + tx->offset, payload);
+
+        bool ok = send(tx->packet, packet_len, ctx) >= 0;
+        frame_pacer_sent(pacer, packet_len, ok, now_us);
+        if (!ok) return FRAME_TX_PENDING; // Same fragment is retried after the backoff
+        tx->offset += payload;
+        tx->frag_index++;
+    }
+    tx->buf = NULL;
+    return FRAME_TX_DONE;
+}
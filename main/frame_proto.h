@@ -0,0 +1,94 @@
+// frame_proto.h
+// Framing for video sent over the data channel. Every message is one
+// fragment: a frame_hdr_t followed by up to FRAME_FRAG_PAYLOAD bytes of JPEG.
+// The client reassembles by (stream_id, seq), uses frag_offset/frame_size to
+// place the bytes, and detects loss from gaps in seq or missing fragments.
+// Plain C with no ESP-IDF dependencies.
+#ifndef FRAME_PROTO_H
+#define FRAME_PROTO_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define FRAME_PROTO_VERSION 1
+#define FRAME_FRAG_PAYLOAD 1100 // Keeps header + payload inside one SCTP/DTLS/UDP packet
+
+// frame_hdr_t.flags
+#define FRAME_FLAG_FIRST    0x01 // First fragment of the frame
+#define FRAME_FLAG_LAST     0x02 // Last fragment of the frame
+#define FRAME_FLAG_PLAYBACK 0x04 // Frame comes from a recording, not the live camera
+#define FRAME_FLAG_SNAPSHOT 0x08 // Still image answering a "snapshot" request
+
+// Stream ids: 0 is the live camera, playback session n is FRAME_STREAM_PLAYBACK + n
+#define FRAME_STREAM_LIVE     0
+#define FRAME_STREAM_PLAYBACK 1
+#define FRAME_STREAM_SNAPSHOT 0xFF
+
+typedef struct __attribute__((packed)) {
+    uint8_t  version;      // FRAME_PROTO_VERSION
+    uint8_t  flags;        // FRAME_FLAG_*
+    uint8_t  stream_id;    // FRAME_STREAM_*
+    uint8_t  reserved;
+    uint16_t frag_index;   // Fragment number within the frame
+    uint16_t frag_count;   // Fragments in the frame
+    uint32_t seq;          // Frame sequence number, per stream
+    uint32_t frame_size;   // Total JPEG bytes
+    uint32_t frag_offset;  // Offset of this fragment's payload in the frame
+    uint64_t timestamp_us; // Capture time (esp_timer clock)
+} frame_hdr_t;             // Little-endian on the wire, 28 bytes
+
+// Token bucket pacing the bytes handed to the data channel. libpeer has no
+// buffered-amount query, so send failures stand in for it: a failure halves
+// the rate and pauses briefly, each successful fragment raises it a little.
+typedef struct {
+    uint32_t rate;         // Bytes per second
+    uint32_t min_rate;
+    uint32_t max_rate;
+    uint32_t burst;        // Bucket depth in bytes
+    int64_t tokens;
+    int64_t last_us;       // Last refill
+    int64_t resume_us;     // No sending before this (after a failure)
+    uint32_t failures;
+} frame_pacer_t;
+
+// Cursor over one frame being sent
+typedef struct {
+    uint8_t stream_id;
+    uint8_t flags;
+    uint32_t seq;          // Sequence number of the loaded frame
+    const uint8_t *buf;
+    uint32_t len;
+    uint32_t offset;       // Next payload byte to send
+    uint64_t timestamp_us;
+    uint16_t frag_count;
+    uint16_t frag_index;
+    uint32_t dropped;      // Frames abandoned part-way
+    uint8_t packet[sizeof(frame_hdr_t) + FRAME_FRAG_PAYLOAD];
+} frame_tx_t;
+
+typedef enum {
+    FRAME_TX_DONE = 0,     // Whole frame sent (or nothing loaded)
+    FRAME_TX_PENDING,      // Pacer ran out of tokens, call again later
+} frame_tx_status_t;
+
+// Sends one message; returns < 0 on failure
+typedef int (*frame_send_fn)(const uint8_t *data, size_t len, void *ctx);
+
+void frame_pacer_init(frame_pacer_t *p, uint32_t rate, uint32_t min_rate, uint32_t max_rate, uint32_t burst);
+int64_t frame_pacer_wait_us(frame_pacer_t *p, size_t len, int64_t now_us); // 0 if len bytes may go now
+void frame_pacer_sent(frame_pacer_t *p, size_t len, bool ok, int64_t now_us); // Report a send (frame_tx_pump does this itself)
+
+void frame_tx_init(frame_tx_t *tx, uint8_t stream_id);
+void frame_tx_load(frame_tx_t *tx, const uint8_t *buf, size_t len, uint64_t timestamp_us, uint8_t flags);
+frame_tx_status_t frame_tx_pump(frame_tx_t *tx, frame_pacer_t *pacer, int64_t now_us, frame_send_fn send, void *ctx);
+void frame_tx_abandon(frame_tx_t *tx); // Drop the rest of the loaded frame
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_PROTO_H
@@ -0,0 +1,289 @@
+// journal.c
+
+#include "journal.h"
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "recorder.h"
+#include "pir.h"
+#include "audio.h"
+
+static const char *TAG = "journal";
+
+#define JOURNAL_PATH_LEN 48
+#define JOURNAL_DAY_LEN 11          // "YYYY-MM-DD"
+#define JOURNAL_SLACK_MS 10000      // Records are filed in arrival order, which may trail event order a little
+#define JOURNAL_READ_BATCH 32       // Records read per fread by a query
+#define JOURNAL_CLOCK_VALID 1577836800LL // 2020-01-01: anything earlier means SNTP has not synced yet
+
+typedef struct __attribute__((packed)) {
+    journal_event_t ev;
+    uint32_t crc;         // CRC32 of ev
+} journal_rec_t;          // 24 bytes
+
+typedef struct __attribute__((packed)) {
+    int64_t time_ms;      // Time of the record below
+    uint32_t record;      // Its number in the day file
+} journal_idx_t;          // 12 bytes
+
+static const char *type_names[JOURNAL_TYPE_COUNT] = { "pir", "motion", "sound" };
+
+static QueueHandle_t journalQueue = NULL;
+static volatile uint32_t dropped = 0; // Events lost to a full queue
+
+// Day file being appended, only touched by journal_task
+static char day[JOURNAL_DAY_LEN] = "";
+static FILE *rec_fp = NULL;
+static FILE *idx_fp = NULL;
+static uint32_t rec_count = 0;
+
+const char *journal_type_name(uint8_t type) {
+    return type < JOURNAL_TYPE_COUNT ? type_names[type] : "unknown";
+}
+
+int journal_type_parse(const char *name) {
+    for (int i = 0; i < JOURNAL_TYPE_COUNT; i++) {
+        if (strcmp(name, type_names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static void day_name(time_t t, char *out) {
+    struct tm tm;
+    localtime_r(&t, &tm);
+    strftime(out, JOURNAL_DAY_LEN, "%Y-%m-%d", &tm);
+}
+
+static void day_path(const char *d, const char *ext, char *path) {
+    snprintf(path, JOURNAL_PATH_LEN, "%s/%s.%s", JOURNAL_DIR, d, ext);
+}
+
+void journal_log(journal_type_t type, uint16_t score, int64_t at_us) {
+    if (journalQueue == NULL) return;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    if (tv.tv_sec < JOURNAL_CLOCK_VALID) return; // No wall clock to file it under
+    journal_event_t ev = {};
+    ev.time_ms = tv.tv_sec * 1000LL + tv.tv_usec / 1000 - (esp_timer_get_time() - at_us) / 1000;
+    ev.type = type;
+    ev.score = score;
+    if (xQueueSend(journalQueue, &ev, 0) != pdTRUE) dropped++;
+}
+
+// --- Writer ---
+// Opens a file for appending after cutting off a torn record at its end
+// (power lost mid-write). Returns the whole records it holds via count.
+static FILE *open_append(const char *path, size_t rec_len, uint32_t *count) {
+    struct stat st;
+    long size = stat(path, &st) == 0 ? (long)st.st_size : 0;
+    if (size % (long)rec_len != 0) {
+        ESP_LOGW(TAG, "Cutting a torn record off %s", path);
+        size -= size % (long)rec_len;
+        truncate(path, size);
+    }
+    if (count) *count = size / rec_len;
+    return fopen(path, "ab");
+}
+
+static void close_day(void) {
+    if (rec_fp) fclose(rec_fp);
+    if (idx_fp) fclose(idx_fp);
+    rec_fp = idx_fp = NULL;
+    day[0] = '\0';
+}
+
+// Deletes the day files older than JOURNAL_KEEP_DAYS. The names sort by date.
+static void prune_days(void) {
+    char cutoff[JOURNAL_DAY_LEN];
+    day_name(time(NULL) - (time_t)JOURNAL_KEEP_DAYS * 86400, cutoff);
+    DIR *dir = opendir(JOURNAL_DIR);
+    if (!dir) return;
+    struct dirent *entry;
+    char path[JOURNAL_PATH_LEN];
+    while ((entry = readdir(dir)) != NULL) {
+        if (strlen(entry->d_name) < JOURNAL_DAY_LEN - 1 || strncmp(entry->d_name, cutoff, JOURNAL_DAY_LEN - 1) >= 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", JOURNAL_DIR, entry->d_name);
+        ESP_LOGI(TAG, "Removing old journal file %s", path);
+        unlink(path);
+    }
+    closedir(dir);
+}
+
+static bool open_day(const char *d) {
+    close_day();
+    char path[JOURNAL_PATH_LEN];
+    day_path(d, "jnl", path);
+    rec_fp = open_append(path, sizeof(journal_rec_t), &rec_count);
+    day_path(d, "idx", path);
+    idx_fp = open_append(path, sizeof(journal_idx_t), NULL);
+    if (!rec_fp || !idx_fp) {
+        ESP_LOGE(TAG, "Failed to open journal files for %s", d);
+        close_day();
+        return false;
+    }
+    strcpy(day, d);
+    ESP_LOGI(TAG, "Journal for %s opened, %lu records", day, rec_count);
+    return true;
+}
+
+// The recording position is looked up here rather than in journal_log, so
+// the recorder's lock is never taken on the caller's task. It is a few ms
+// after the event, well inside one frame.
+static void write_event(journal_event_t *ev) {
+    time_t started;
+    uint16_t frame;
+    if (getRecordingPosition(&started, &frame)) {
+        ev->recording = (uint32_t)started;
+        ev->frame = frame;
+    }
+
+    char d[JOURNAL_DAY_LEN];
+    day_name((time_t)(ev->time_ms / 1000), d);
+    if (strcmp(d, day) != 0) {
+        if (!open_day(d)) return;
+        prune_days();
+    }
+
+    journal_rec_t rec = { .ev = *ev };
+    rec.crc = esp_rom_crc32_le(0, (const uint8_t *)&rec.ev, sizeof(rec.ev));
+    if (fwrite(&rec, sizeof(rec), 1, rec_fp) != 1) {
+        ESP_LOGE(TAG, "Journal write failed");
+        close_day(); // Reopened (and the torn record cut off) with the next event
+        return;
+    }
+    // The index is written after its record, so a crash can only leave it short, never pointing past the end
+    if (rec_count % JOURNAL_INDEX_STRIDE == 0) {
+        journal_idx_t idx = { .time_ms = ev->time_ms, .record = rec_count };
+        fwrite(&idx, sizeof(idx), 1, idx_fp);
+    }
+    rec_count++;
+}
+
+static void sync_day(void) {
+    if (!rec_fp) return;
+    fflush(rec_fp);
+    fsync(fileno(rec_fp)); // Makes the records visible to queries opening the file
+    fflush(idx_fp);
+    fsync(fileno(idx_fp));
+}
+
+static void pir_changed(bool active, int64_t at_us, void *arg) {
+    if (active) journal_log(JOURNAL_PIR, 0, at_us);
+}
+
+static void sound_changed(bool active, int64_t at_us, uint16_t score, void *arg) {
+    if (active) journal_log(JOURNAL_SOUND, score, at_us);
+}
+
+void journal_task(void *pvParameters) {
+    struct stat st;
+    if (stat(JOURNAL_DIR, &st) != 0 && mkdir(JOURNAL_DIR, 0755) != 0) {
+        ESP_LOGE(TAG, "Failed to create %s, events are not journaled", JOURNAL_DIR);
+        vTaskDelete(NULL);
+        return;
+    }
+    journalQueue = xQueueCreate(JOURNAL_QUEUE_LEN, sizeof(journal_event_t));
+    if (journalQueue == NULL) {
+        ESP_LOGE(TAG, "Failed to create the journal queue");
+        vTaskDelete(NULL);
+        return;
+    }
+    pir_subscribe(pir_changed, NULL);
+    sound_subscribe(sound_changed, NULL);
+    ESP_LOGI(TAG, "Event journal started in %s", JOURNAL_DIR);
+
+    uint32_t reported = 0;
+    while (1) {
+        journal_event_t ev;
+        if (xQueueReceive(journalQueue, &ev, portMAX_DELAY) != pdTRUE) continue;
+        do {
+            write_event(&ev);
+        } while (xQueueReceive(journalQueue, &ev, 0) == pdTRUE);
+        sync_day();
+        if (dropped != reported) {
+            ESP_LOGW(TAG, "%lu events not journaled, writer fell behind", dropped - reported);
+            reported = dropped;
+        }
+    }
+}
+
+// --- Queries ---
+// First record of a day file worth reading for events from from_ms on
+static uint32_t query_start(const char *d, int64_t from_ms) {
+    char path[JOURNAL_PATH_LEN];
+    day_path(d, "idx", path);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    uint32_t start = 0;
+    journal_idx_t idx;
+    while (fread(&idx, sizeof(idx), 1, fp) == 1 && idx.time_ms < from_ms - JOURNAL_SLACK_MS) {
+        start = idx.record;
+    }
+    fclose(fp);
+    return start;
+}
+
+// Returns false once the callback asked to stop
+static bool query_day(const char *d, int64_t from_ms, int64_t to_ms, uint32_t type_mask, journal_cb_t cb, void *arg) {
+    char path[JOURNAL_PATH_LEN];
+    day_path(d, "jnl", path);
+    uint32_t start = query_start(d, from_ms);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return true;
+    if (fseek(fp, (long)start * sizeof(journal_rec_t), SEEK_SET) != 0) {
+        fclose(fp);
+        return true;
+    }
+
+    journal_rec_t batch[JOURNAL_READ_BATCH];
+    bool more = true, past = false;
+    size_t n;
+    while (more && !past && (n = fread(batch, sizeof(journal_rec_t), JOURNAL_READ_BATCH, fp)) > 0) {
+        for (size_t i = 0; i < n && more; i++) {
+            const journal_event_t *ev = &batch[i].ev;
+            if (esp_rom_crc32_le(0, (const uint8_t *)ev, sizeof(*ev)) != batch[i].crc) continue; // Torn tail being written
+            if (ev->time_ms >= to_ms + JOURNAL_SLACK_MS) {
+                past = true;
+                break;
+            }
+            if (ev->time_ms >= from_ms && ev->time_ms < to_ms && ev->type < JOURNAL_TYPE_COUNT
+                && (type_mask & JOURNAL_TYPE_BIT(ev->type))) {
+                more = cb(ev, arg);
+            }
+        }
+    }
+    fclose(fp);
+    return more;
+}
+
+esp_err_t journal_query(time_t from, time_t to, uint32_t type_mask, journal_cb_t cb, void *arg) {
+    if (to <= from || cb == NULL) return ESP_ERR_INVALID_ARG;
+    time_t oldest = time(NULL) - (time_t)(JOURNAL_KEEP_DAYS + 1) * 86400; // Nothing is kept before it
+    int64_t from_ms = from * 1000LL, to_ms = to * 1000LL;
+    if (from < oldest) from = oldest;
+    if (to <= from) return ESP_OK;
+
+    char last[JOURNAL_DAY_LEN], d[JOURNAL_DAY_LEN];
+    day_name(to - 1, last);
+    struct tm tm;
+    localtime_r(&from, &tm);
+    tm.tm_hour = 12; // Midday, so stepping a day never lands on the same date across DST
+    tm.tm_min = tm.tm_sec = 0;
+    do {
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        day_name(t, d);
+        if (!query_day(d, from_ms, to_ms, type_mask, cb, arg)) break;
+        tm.tm_mday++;
+    } while (strcmp(d, last) < 0);
+    return ESP_OK;
+}
@@ -0,0 +1,61 @@
+// journal.h
+// On-device event journal: every PIR, vision motion or sound event is
+// appended to an SD file with its wall-clock time, a score, and the recording
+// and frame it landed in, so the app can list the events of a time range and
+// jump straight to them in playback. There is one record file per local day
+// (JOURNAL_DIR/YYYY-MM-DD.jnl) with a sparse index next to it (.idx, the
+// time of every JOURNAL_INDEX_STRIDE-th record). A query reads the index,
+// seeks to the record just before the range and reads forward from there.
+// journal_log never blocks: records are queued and written by journal_task.
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_err.h"
+
+#ifndef JOURNAL_DIR
+#define JOURNAL_DIR "/sdcard/journal"
+#endif
+#define JOURNAL_INDEX_STRIDE 64  // Records per sparse index entry
+#define JOURNAL_KEEP_DAYS 60     // Older day files are deleted
+#define JOURNAL_QUEUE_LEN 16     // Records waiting for the writer
+
+typedef enum {
+    JOURNAL_PIR = 0,     // PIR rise, score 0
+    JOURNAL_MOTION,      // Vision motion started, score = changed blocks per mille
+    JOURNAL_SOUND,       // Sound event started, score = dB over the noise floor
+    JOURNAL_TYPE_COUNT
+} journal_type_t;
+
+#define JOURNAL_TYPE_BIT(t) (1UL << (t))
+#define JOURNAL_ALL_TYPES (JOURNAL_TYPE_BIT(JOURNAL_TYPE_COUNT) - 1)
+
+typedef struct __attribute__((packed)) {
+    int64_t time_ms;      // Wall clock, ms since the epoch
+    uint32_t recording;   // Start of the recording in progress (epoch s, see find_recording), 0 if none
+    uint16_t frame;       // Frames that recording held at the event
+    uint16_t score;       // Type specific
+    uint8_t type;         // journal_type_t
+    uint8_t reserved[3];
+} journal_event_t;        // 20 bytes, little-endian; a CRC32 follows it on the card
+
+// Return false to end the query early
+typedef bool (*journal_cb_t)(const journal_event_t *ev, void *arg);
+
+void journal_log(journal_type_t type, uint16_t score, int64_t at_us); // at_us: esp_timer time of the event
+esp_err_t journal_query(time_t from, time_t to, uint32_t type_mask, journal_cb_t cb, void *arg); // [from, to), oldest first
+const char *journal_type_name(uint8_t type);
+int journal_type_parse(const char *name); // journal_type_t, -1 if unknown
+void journal_task(void *pvParameters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JOURNAL_H
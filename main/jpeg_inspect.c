@@ -0,0 +1,132 @@
+// jpeg_inspect.c
+
+#include <string.h>
+#include "jpeg_inspect.h"
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+
+static inline uint32_t load32(const uint8_t *p) {
+    uint32_t w;
+    memcpy(&w, p, 4); // Unaligned-safe, compiles to a plain load where allowed
+    return w;
+}
+
+// True if any byte of w is 0xFF (the classic has-zero-byte test on ~w)
+static inline bool has_ff(uint32_t w) {
+    uint32_t x = ~w;
+    return ((x - ONES) & ~x & HIGHS) != 0;
+}
+
+static inline uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Index just past FF D9, searching back from the end of buf down to start;
+// 0 if there is none. Zero padding is skipped a word at a time, then words
+// without an 0xFF byte are skipped whole.
+static size_t find_eoi(const uint8_t *buf, size_t start, size_t len) {
+    size_t i = len;
+    while (i >= start + 4 && load32(buf + i - 4) == 0) i -= 4;
+    while (i >= start + 4) {
+        if (has_ff(load32(buf + i - 4))) {
+            for (size_t n = 1; n <= 4; n++) {
+                size_t k = i - n;
+                if (buf[k] == 0xFF && k + 1 < len && buf[k + 1] == 0xD9) return k + 2;
+            }
+        }
+        i -= 4;
+    }
+    while (i > start) {
+        i--;
+        if (buf[i] == 0xFF && i + 1 < len && buf[i + 1] == 0xD9) return i + 2;
+    }
+    return 0;
+}
+
+// In entropy-coded data 0xFF is only ever followed by a stuffed 0x00 or RSTn
+static bool scan_valid(const uint8_t *buf, size_t start, size_t end) {
+    size_t i = start;
+    while (i < end) {
+        if (i + 4 <= end && !has_ff(load32(buf + i))) {
+            i += 4;
+            continue;
+        }
+        if (buf[i] == 0xFF) {
+            if (i + 1 >= end) return false;
+            uint8_t next = buf[i + 1];
+            if (next != 0x00 && (next < 0xD0 || next > 0xD7)) return false;
+            i += 2;
+        } else {
+            i++;
+        }
+    }
+    return true;
+}
+
+static bool is_sof(uint8_t marker) {
+    return marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+int jpeg_inspect(const uint8_t *buf, size_t len, unsigned flags, jpeg_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    if (len < 4 || buf[0] != 0xFF || buf[1] != 0xD8) return JPEG_ERR_NO_SOI;
+
+    bool have_sof = false;
+    size_t pos = 2;
+    for (;;) {
+        if (pos + 2 > len) return JPEG_ERR_HEADER;
+        if (buf[pos] != 0xFF) return JPEG_ERR_HEADER;
+        uint8_t marker = buf[pos + 1];
+        if (marker == 0xFF) { // Fill byte
+            pos++;
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) { // No length
+            pos += 2;
+            continue;
+        }
+        if (marker == 0xD8 || marker == 0xD9) return JPEG_ERR_HEADER; // SOI/EOI before any scan
+        if (pos + 4 > len) return JPEG_ERR_HEADER;
+        size_t seg_len = rd16(buf + pos + 2);
+        if (seg_len < 2 || pos + 2 + seg_len > len) return JPEG_ERR_HEADER;
+        const uint8_t *seg = buf + pos + 4;
+
+        if (is_sof(marker)) {
+            if (seg_len < 8 + 3) return JPEG_ERR_HEADER;
+            info->height = rd16(seg + 1);
+            info->width = rd16(seg + 3);
+            info->components = seg[5];
+            info->sampling = seg[7];
+            info->progressive = (marker & 0x03) == 0x02; // C2, C6, CA, CE
+            if (info->width == 0 || info->height == 0 || info->components == 0) return JPEG_ERR_HEADER;
+            have_sof = true;
+        } else if (marker == 0xDA) {
+            if (!have_sof) return JPEG_ERR_HEADER;
+            info->scan_offset = pos + 2 + seg_len;
+            break;
+        }
+        pos += 2 + seg_len;
+    }
+
+    size_t end = find_eoi(buf, info->scan_offset, len);
+    if (end == 0) return JPEG_ERR_TRUNCATED;
+    info->len = end;
+    info->trimmed = len - end;
+
+    if ((flags & JPEG_INSPECT_SCAN) && !info->progressive && !scan_valid(buf, info->scan_offset, end - 2)) {
+        return JPEG_ERR_SCAN;
+    }
+    return JPEG_OK;
+}
+
+const char *jpeg_inspect_err_name(int err) {
+    switch (err) {
+    case JPEG_OK: return "ok";
+    case JPEG_ERR_NO_SOI: return "no SOI";
+    case JPEG_ERR_HEADER: return "bad header";
+    case JPEG_ERR_TRUNCATED: return "truncated";
+    case JPEG_ERR_SCAN: return "corrupt scan";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,45 @@
+// jpeg_inspect.h
+// Quick structural check of camera JPEGs before they are recorded, streamed
+// or uploaded: SOI, header segments, SOF dimensions, EOI. EOI is searched
+// from the tail so driver padding after it can be trimmed, and a missing EOI
+// means the frame was truncated. Searches run a 32-bit word at a time.
+// Plain C with no ESP-IDF dependencies.
+#ifndef JPEG_INSPECT_H
+#define JPEG_INSPECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+typedef enum {
+    JPEG_OK = 0,
+    JPEG_ERR_NO_SOI = -1,    // Doesn't start with FF D8
+    JPEG_ERR_HEADER = -2,    // Segment runs past the buffer, bad marker, or no SOF/SOS
+    JPEG_ERR_TRUNCATED = -3, // No EOI after the scan
+    JPEG_ERR_SCAN = -4,      // Invalid marker inside the entropy-coded data (JPEG_INSPECT_SCAN)
+} jpeg_inspect_err_t;
+
+#define JPEG_INSPECT_SCAN 0x01 // Also check every 0xFF in the entropy-coded data
+
+typedef struct {
+    size_t len;            // Frame length up to and including EOI
+    size_t trimmed;        // Bytes after EOI
+    size_t scan_offset;    // First byte of entropy-coded data
+    uint16_t width;
+    uint16_t height;
+    uint8_t components;
+    uint8_t sampling;      // First component's sampling factors, 0x21 = 4:2:2, 0x22 = 4:2:0
+    bool progressive;
+} jpeg_info_t;
+
+int jpeg_inspect(const uint8_t *buf, size_t len, unsigned flags, jpeg_info_t *info); // JPEG_OK or a jpeg_inspect_err_t
+const char *jpeg_inspect_err_name(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JPEG_INSPECT_H
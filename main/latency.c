@@ -0,0 +1,92 @@
+// latency.c
+
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "latency.h"
+
+static const char *TAG = "latency";
+
+#define LAT_BUCKETS 24 // Bucket i holds [2^i, 2^(i+1)) us, the last one everything above ~8 s
+
+typedef struct {
+    uint32_t count;
+    uint64_t sum_us;
+    int64_t max_us;
+    uint32_t buckets[LAT_BUCKETS];
+} latency_hist_t;
+
+static latency_hist_t hist[LAT_STAGE_COUNT];
+static uint32_t trace_every = 0;
+static uint32_t trace_counter = 0;
+
+static const char *stage_names[LAT_STAGE_COUNT] = {
+    [LAT_STAGE_SENSOR] = "sensor",
+    [LAT_STAGE_PUBLISH] = "publish",
+    [LAT_STAGE_MAILBOX] = "mailbox",
+    [LAT_STAGE_PACING] = "pacing",
+    [LAT_STAGE_SEND] = "send",
+    [LAT_STAGE_TOTAL] = "total",
+};
+
+const char *latency_stage_name(latency_stage_t stage) {
+    return (stage < LAT_STAGE_COUNT) ? stage_names[stage] : "?";
+}
+
+static void hist_add(latency_hist_t *h, int64_t us) {
+    if (us < 0) us = 0; // Stamps from different clocks never happen, but don't poison the sum
+    int bucket = 0;
+    while (bucket < LAT_BUCKETS - 1 && (us >> (bucket + 1)) != 0) bucket++;
+    h->buckets[bucket]++;
+    h->count++;
+    h->sum_us += us;
+    if (us > h->max_us) h->max_us = us;
+}
+
+// Upper bound of the bucket holding the given percentile
+static uint64_t hist_percentile(const latency_hist_t *h, uint32_t pct) {
+    uint32_t target = (uint32_t)(((uint64_t)h->count * pct + 99) / 100);
+    uint32_t seen = 0;
+    for (int b = 0; b < LAT_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen >= target) return 1ULL << (b + 1);
+    }
+    return 1ULL << LAT_BUCKETS;
+}
+
+void latency_record(const frame_stamps_t *st) {
+    hist_add(&hist[LAT_STAGE_SENSOR], st->grab_us - st->capture_us);
+    hist_add(&hist[LAT_STAGE_PUBLISH], st->publish_us - st->grab_us);
+    hist_add(&hist[LAT_STAGE_MAILBOX], st->dequeue_us - st->publish_us);
+    hist_add(&hist[LAT_STAGE_PACING], st->send_start_us - st->dequeue_us);
+    hist_add(&hist[LAT_STAGE_SEND], st->send_done_us - st->send_start_us);
+    hist_add(&hist[LAT_STAGE_TOTAL], st->send_done_us - st->capture_us);
+
+    if (trace_every && ++trace_counter >= trace_every) {
+        trace_counter = 0;
+        ESP_LOGI(TAG, "frame sensor=%lld publish=%lld mailbox=%lld pacing=%lld send=%lld total=%lld us",
+                 st->grab_us - st->capture_us, st->publish_us - st->grab_us, st->dequeue_us - st->publish_us,
+                 st->send_start_us - st->dequeue_us, st->send_done_us - st->send_start_us,
+                 st->send_done_us - st->capture_us);
+    }
+}
+
+void latency_reset(void) {
+    memset(hist, 0, sizeof(hist));
+    trace_counter = 0;
+}
+
+void latency_set_trace(uint32_t every_n) {
+    trace_every = every_n;
+    trace_counter = 0;
+}
+
+int latency_format(latency_stage_t stage, char *buf, size_t len) {
+    if (stage >= LAT_STAGE_COUNT) return 0;
+    const latency_hist_t *h = &hist[stage];
+    if (h->count == 0) return snprintf(buf, len, "lat %s n=0", stage_names[stage]);
+    return snprintf(buf, len, "lat %s n=%lu avg=%llu p50<%llu p95<%llu max=%lld us", stage_names[stage],
+                    (unsigned long)h->count, (unsigned long long)(h->sum_us / h->count),
+                    (unsigned long long)hist_percentile(h, 50), (unsigned long long)hist_percentile(h, 95),
+                    (long long)h->max_us);
+}
@@ -0,0 +1,46 @@
+// latency.h
+// Per-stage latency of live frames, from the sensor to the last packet handed
+// to the data channel. Each frame carries its timestamps; when it has been
+// sent they are folded into one log2 histogram per stage. Only touched from
+// peer_connection_task (frames complete there and the stats command runs
+// there too), so there is no locking.
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+
+typedef enum {
+    LAT_STAGE_SENSOR = 0, // Captured by the driver -> grabbed by the camera task
+    LAT_STAGE_PUBLISH,    // Grabbed -> copied into the mailbox
+    LAT_STAGE_MAILBOX,    // In the mailbox -> picked up by the connection task
+    LAT_STAGE_PACING,     // Picked up -> first packet sent
+    LAT_STAGE_SEND,       // First packet -> last packet sent
+    LAT_STAGE_TOTAL,      // Captured -> last packet sent
+    LAT_STAGE_COUNT
+} latency_stage_t;
+
+// esp_timer microseconds
+typedef struct {
+    int64_t capture_us;    // fb->timestamp
+    int64_t grab_us;       // esp_camera_fb_get returned
+    int64_t publish_us;    // Copy in the mailbox
+    int64_t dequeue_us;    // Taken by the connection task
+    int64_t send_start_us;
+    int64_t send_done_us;
+} frame_stamps_t;
+
+void latency_record(const frame_stamps_t *st); // Frame fully sent
+void latency_reset(void);
+void latency_set_trace(uint32_t every_n);     // Log every n-th frame's stamps, 0 turns it off
+int latency_format(latency_stage_t stage, char *buf, size_t len); // One summary line, returns its length
+const char *latency_stage_name(latency_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // LATENCY_H
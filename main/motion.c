@@ -0,0 +1,466 @@
+// motion.c
+
+#include <stdlib.h>
+#include <string.h>
+#include "motion.h"
+
+// --- Huffman ---
+#define FAST_BITS 9
+
+typedef struct {
+    uint8_t fast_len[1 << FAST_BITS]; // Code length for the next FAST_BITS bits, 0 if longer
+    uint8_t fast_sym[1 << FAST_BITS];
+    uint8_t skip_len[1 << FAST_BITS]; // AC only: code plus value bits, 0 if they don't fit
+    uint8_t skip_adv[1 << FAST_BITS]; // ...and how far that moves k (64 for EOB)
+    int32_t maxcode[18];              // Largest code of each length, -1 if none
+    int32_t valoffset[17];            // Symbol index of a code = code + valoffset[length]
+    uint8_t vals[256];
+    bool defined;
+} huff_t;
+
+static bool huff_build(huff_t *h, const uint8_t counts[16], const uint8_t *vals, bool ac) {
+    int total = 0;
+    for (int l = 0; l < 16; l++) total += counts[l];
+    if (total > 256) return false;
+    memcpy(h->vals, vals, total);
+    memset(h->fast_len, 0, sizeof(h->fast_len));
+    memset(h->skip_len, 0, sizeof(h->skip_len));
+
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+        h->valoffset[l] = k - code;
+        for (int i = 0; i < counts[l - 1]; i++, k++, code++) {
+            if (l > FAST_BITS) continue;
+            int shift = FAST_BITS - l;
+            for (int j = 0; j < (1 << shift); j++) {
+                int idx = (code << shift) | j;
+                h->fast_len[idx] = (uint8_t)l;
+                h->fast_sym[idx] = vals[k];
+                if (!ac) continue;
+                uint8_t r = vals[k] >> 4, s = vals[k] & 0x0F;
+                if (s == 0) { // EOB or ZRL, no value bits
+                    h->skip_len[idx] = (uint8_t)l;
+                    h->skip_adv[idx] = (r == 15) ? 16 : 64;
+                } else if (l + s <= FAST_BITS) {
+                    h->skip_len[idx] = (uint8_t)(l + s);
+                    h->skip_adv[idx] = r + 1;
+                }
+            }
+        }
+        h->maxcode[l] = counts[l - 1] ? code - 1 : -1;
+        if (code > (1 << l)) return false; // Over-subscribed
+        code <<= 1;
+    }
+    h->maxcode[17] = INT32_MAX; // Sentinel
+    h->defined = true;
+    return true;
+}
+
+// --- Bits ---
+// Left-aligned accumulator. A marker ends the data: from there on zeros are
+// fed, so a truncated scan decodes to garbage blocks instead of overrunning.
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+    uint32_t acc;
+    int bits;
+    bool marker;
+} bits_t;
+
+static inline void bits_fill(bits_t *b) {
+    while (b->bits <= 24) {
+        uint32_t byte = 0;
+        if (!b->marker && b->p < b->end) {
+            byte = *b->p;
+            if (byte == 0xFF) {
+                uint8_t next = (b->p + 1 < b->end) ? b->p[1] : 0xD9;
+                if (next == 0x00) {
+                    b->p += 2;
+                } else {
+                    b->marker = true;
+                    byte = 0;
+                }
+            } else {
+                b->p++;
+            }
+        }
+        b->acc |= byte << (24 - b->bits);
+        b->bits += 8;
+    }
+}
+
+static inline void bits_skip(bits_t *b, int n) {
+    b->acc <<= n;
+    b->bits -= n;
+}
+
+static inline int bits_get(bits_t *b, int n) {
+    int v = (int)(b->acc >> (32 - n));
+    bits_skip(b, n);
+    return v;
+}
+
+// Caller has filled the accumulator
+static inline int huff_decode(bits_t *b, const huff_t *h) {
+    int idx = b->acc >> (32 - FAST_BITS);
+    int len = h->fast_len[idx];
+    if (len) {
+        bits_skip(b, len);
+        return h->fast_sym[idx];
+    }
+    uint32_t word = b->acc;
+    int l = FAST_BITS + 1;
+    while ((int32_t)(word >> (32 - l)) > h->maxcode[l]) l++;
+    if (l > 16) return -1;
+    bits_skip(b, l);
+    return h->vals[(int32_t)(word >> (32 - l)) + h->valoffset[l]];
+}
+
+static inline int extend(int v, int s) {
+    return (v < (1 << (s - 1))) ? v - (1 << s) + 1 : v;
+}
+
+// Resync at the RSTn marker the data stopped on
+static void bits_restart(bits_t *b) {
+    while (b->p + 1 < b->end && !(b->p[0] == 0xFF && b->p[1] >= 0xD0 && b->p[1] <= 0xD7)) b->p++;
+    if (b->p + 1 < b->end) b->p += 2;
+    b->acc = 0;
+    b->bits = 0;
+    b->marker = false;
+}
+
+// --- Decoder ---
+#define MAX_COMPONENTS 3
+
+// ITU T.81 Annex K.3 tables, for motion JPEG streams that leave out DHT
+static const uint8_t std_dc_luma_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t std_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t std_dc_vals[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8_t std_ac_luma_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t std_ac_luma_vals[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+static const uint8_t std_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t std_ac_chroma_vals[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa,
+};
+
+typedef struct {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t dc, ac; // Table numbers from SOS
+    int pred;
+} component_t;
+
+static inline uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+// Decodes one block, updating the DC predictor; -1 on a bad code
+static inline int decode_block(bits_t *b, const huff_t *dc, const huff_t *ac, int *pred) {
+    bits_fill(b);
+    int s = huff_decode(b, dc);
+    if (s < 0 || s > 11) return -1;
+    if (s) {
+        bits_fill(b);
+        *pred += extend(bits_get(b, s), s);
+    }
+    for (int k = 1; k < 64;) {
+        bits_fill(b);
+        int idx = b->acc >> (32 - FAST_BITS);
+        if (ac->skip_len[idx]) {
+            bits_skip(b, ac->skip_len[idx]);
+            k += ac->skip_adv[idx];
+            continue;
+        }
+        int rs = huff_decode(b, ac);
+        if (rs < 0) return -1;
+        int r = rs >> 4;
+        s = rs & 0x0F;
+        if (s) {
+            bits_fill(b);
+            bits_skip(b, s);
+            k += r + 1;
+        } else if (r == 15) {
+            k += 16;
+        } else {
+            break; // EOB
+        }
+    }
+    return 0;
+}
+
+int motion_dc_luma(const uint8_t *jpeg, size_t len, uint8_t *out, size_t cap, uint16_t *width, uint16_t *height) {
+    static huff_t dc_tables[2], ac_tables[2]; // Only ever called from one task
+    uint16_t q0 = 0;                          // DC quantizer of the luma table
+    uint8_t luma_q = 0;                        // Table number the luma component uses
+    uint16_t qdc[4] = { 0 };
+    component_t comp[MAX_COMPONENTS];
+    int ncomp = 0;
+    uint16_t img_w = 0, img_h = 0;
+    uint32_t restart = 0;
+    uint8_t hmax = 1, vmax = 1;
+
+    dc_tables[0].defined = dc_tables[1].defined = ac_tables[0].defined = ac_tables[1].defined = false;
+    if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) return MOTION_ERR_HEADER;
+
+    size_t pos = 2;
+    for (;;) {
+        if (pos + 4 > len || jpeg[pos] != 0xFF) return MOTION_ERR_HEADER;
+        uint8_t marker = jpeg[pos + 1];
+        if (marker == 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t seg_len = rd16(jpeg + pos + 2);
+        if (seg_len < 2 || pos + 2 + seg_len > len) return MOTION_ERR_HEADER;
+        const uint8_t *seg = jpeg + pos + 4;
+        const uint8_t *seg_end = jpeg + pos + 2 + seg_len;
+
+        if (marker == 0xC0 || marker == 0xC1) { // Baseline / extended Huffman
+            if (seg_len < 8 || seg[0] != 8) return MOTION_ERR_UNSUPPORTED;
+            img_h = rd16(seg + 1);
+            img_w = rd16(seg + 3);
+            ncomp = seg[5];
+            if (ncomp < 1 || ncomp > MAX_COMPONENTS || seg_len < 8 + 3 * (size_t)ncomp) return MOTION_ERR_UNSUPPORTED;
+            if (img_w == 0 || img_h == 0) return MOTION_ERR_HEADER;
+            for (int i = 0; i < ncomp; i++) {
+                comp[i].id = seg[6 + 3 * i];
+                comp[i].h = seg[7 + 3 * i] >> 4;
+                comp[i].v = seg[7 + 3 * i] & 0x0F;
+                if (comp[i].h < 1 || comp[i].h > 2 || comp[i].v < 1 || comp[i].v > 2) return MOTION_ERR_UNSUPPORTED;
+                if (comp[i].h > hmax) hmax = comp[i].h;
+                if (comp[i].v > vmax) vmax = comp[i].v;
+            }
+            luma_q = seg[8] & 0x03;
+        } else if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return MOTION_ERR_UNSUPPORTED; // Progressive, lossless or arithmetic
+        } else if (marker == 0xDB) {
+            const uint8_t *p = seg;
+            while (p < seg_end) {
+                uint8_t pq = *p >> 4, tq = *p & 0x03;
+                size_t n = pq ? 128 : 64;
+                if (p + 1 + n > seg_end) return MOTION_ERR_HEADER;
+                qdc[tq] = pq ? rd16(p + 1) : p[1]; // Zig-zag position 0 is DC
+                p += 1 + n;
+            }
+        } else if (marker == 0xC4) {
+            const uint8_t *p = seg;
+            while (p < seg_end) {
+                if (p + 17 > seg_end) return MOTION_ERR_HEADER;
+                uint8_t tc = *p >> 4, th = *p & 0x0F;
+                int total = 0;
+                for (int i = 0; i < 16; i++) total += p[1 + i];
+                if (th > 1 || tc > 1 || p + 17 + total > seg_end) return MOTION_ERR_HEADER;
+                huff_t *h = tc ? &ac_tables[th] : &dc_tables[th];
+                if (!huff_build(h, p + 1, p + 17, tc == 1)) return MOTION_ERR_HEADER;
+                p += 17 + total;
+            }
+        } else if (marker == 0xDD) {
+            if (seg_len < 4) return MOTION_ERR_HEADER;
+            restart = rd16(seg);
+        } else if (marker == 0xDA) {
+            if (ncomp == 0) return MOTION_ERR_HEADER;
+            if (!dc_tables[0].defined) huff_build(&dc_tables[0], std_dc_luma_bits, std_dc_vals, false);
+            if (!dc_tables[1].defined) huff_build(&dc_tables[1], std_dc_chroma_bits, std_dc_vals, false);
+            if (!ac_tables[0].defined) huff_build(&ac_tables[0], std_ac_luma_bits, std_ac_luma_vals, true);
+            if (!ac_tables[1].defined) huff_build(&ac_tables[1], std_ac_chroma_bits, std_ac_chroma_vals, true);
+            int ns = seg[0];
+            if (seg_len < 6 + 2 * (size_t)ns) return MOTION_ERR_HEADER;
+            if (ns != ncomp) return MOTION_ERR_UNSUPPORTED; // Multi-scan files, the camera never makes them
+            for (int i = 0; i < ns; i++) {
+                if (seg[1 + 2 * i] != comp[i].id) return MOTION_ERR_UNSUPPORTED;
+                comp[i].dc = seg[2 + 2 * i] >> 4;
+                comp[i].ac = seg[2 + 2 * i] & 0x0F;
+                if (comp[i].dc > 1 || comp[i].ac > 1) return MOTION_ERR_HEADER;
+                if (!dc_tables[comp[i].dc].defined || !ac_tables[comp[i].ac].defined) return MOTION_ERR_HEADER;
+                comp[i].pred = 0;
+            }
+            q0 = qdc[luma_q];
+            if (q0 == 0) return MOTION_ERR_HEADER;
+            pos += 2 + seg_len;
+            break;
+        } else if (marker == 0xD9 || marker == 0xD8) {
+            return MOTION_ERR_HEADER;
+        }
+        pos += 2 + seg_len;
+    }
+
+    // Block grid of the luma plane; a single-component scan has 1x1 MCUs
+    if (ncomp == 1) comp[0].h = comp[0].v = hmax = vmax = 1;
+    uint32_t mcu_w = 8 * hmax, mcu_h = 8 * vmax;
+    uint32_t mcus_x = (img_w + mcu_w - 1) / mcu_w, mcus_y = (img_h + mcu_h - 1) / mcu_h;
+    uint32_t bw = (img_w + 7) / 8, bh = (img_h + 7) / 8; // Blocks inside the picture
+    *width = (uint16_t)bw;
+    *height = (uint16_t)bh;
+    if ((size_t)bw * bh > cap) return MOTION_ERR_NO_MEM; // Size is set, so the caller can allocate
+
+    bits_t b = { .p = jpeg + pos, .end = jpeg + len };
+    uint32_t until_restart = restart;
+    for (uint32_t my = 0; my < mcus_y; my++) {
+        for (uint32_t mx = 0; mx < mcus_x; mx++) {
+            if (restart) {
+                if (until_restart == 0) {
+                    bits_restart(&b);
+                    for (int i = 0; i < ncomp; i++) comp[i].pred = 0;
+                    until_restart = restart;
+                }
+                until_restart--;
+            }
+            for (int c = 0; c < ncomp; c++) {
+                component_t *cp = &comp[c];
+                for (int by = 0; by < cp->v; by++) {
+                    for (int bx = 0; bx < cp->h; bx++) {
+                        if (decode_block(&b, &dc_tables[cp->dc], &ac_tables[cp->ac], &cp->pred) < 0) return MOTION_ERR_DATA;
+                        if (c != 0) continue;
+                        uint32_t x = mx * cp->h + bx, y = my * cp->v + by;
+                        if (x >= bw || y >= bh) continue; // Padding block
+                        int v = 128 + cp->pred * q0 / 8;  // DC is 8x the block mean
+                        out[y * bw + x] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+                    }
+                }
+            }
+        }
+    }
+    return MOTION_OK;
+}
+
+// --- Detector ---
+void motion_init(motion_detector_t *md, const motion_config_t *cfg) {
+    memset(md, 0, sizeof(*md));
+    md->cfg = *cfg;
+}
+
+void motion_reset(motion_detector_t *md) {
+    md->frames = 0;
+}
+
+void motion_free(motion_detector_t *md) {
+    free(md->luma);
+    free(md->changed);
+    free(md->background);
+    md->luma = md->changed = NULL;
+    md->background = NULL;
+    md->width = md->height = 0;
+    md->frames = 0;
+}
+
+static int grid_cell(const motion_detector_t *md, uint32_t x, uint32_t y) {
+    return (int)(y * MOTION_GRID_ROWS / md->height) * MOTION_GRID_COLS + (int)(x * MOTION_GRID_COLS / md->width);
+}
+
+int motion_process(motion_detector_t *md, const uint8_t *jpeg, size_t len, motion_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    uint16_t w = 0, h = 0;
+    int err = motion_dc_luma(jpeg, len, md->luma, (size_t)md->width * md->height, &w, &h);
+    if ((err == MOTION_OK || err == MOTION_ERR_NO_MEM) && (w != md->width || h != md->height)) {
+        // First frame or the frame size changed: size the buffers and relearn
+        motion_free(md);
+        if (w == 0 || h == 0) return err;
+        size_t n = (size_t)w * h;
+        md->luma = (uint8_t *)malloc(n);
+        md->changed = (uint8_t *)malloc(n);
+        md->background = (uint16_t *)malloc(n * sizeof(uint16_t));
+        if (!md->luma || !md->changed || !md->background) {
+            motion_free(md);
+            return MOTION_ERR_NO_MEM;
+        }
+        md->width = w;
+        md->height = h;
+        err = motion_dc_luma(jpeg, len, md->luma, n, &w, &h);
+    }
+    if (err != MOTION_OK) return err;
+
+    size_t n = (size_t)w * h;
+    const uint8_t *luma = md->luma;
+    uint16_t *bg = md->background;
+    if (md->frames == 0) {
+        for (size_t i = 0; i < n; i++) bg[i] = (uint16_t)(luma[i] << 8);
+        md->frames = 1;
+        return MOTION_OK;
+    }
+
+    // Auto exposure shifts every block at once, so compare against the mean shift
+    int64_t shift_sum = 0;
+    for (size_t i = 0; i < n; i++) shift_sum += (int)luma[i] - (bg[i] >> 8);
+    int shift = (int)(shift_sum / (int64_t)n);
+
+    int threshold = md->cfg.threshold;
+    for (size_t i = 0; i < n; i++) {
+        int d = (int)luma[i] - (bg[i] >> 8) - shift;
+        md->changed[i] = (d > threshold || d < -threshold);
+    }
+
+    // A changed block only counts with a changed 4-neighbour, single blocks are noise
+    uint32_t watched = 0, kept = 0;
+    uint8_t cell_hits[MOTION_GRID_COLS * MOTION_GRID_ROWS] = { 0 };
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            int cell = grid_cell(md, x, y);
+            if (md->cfg.ignore_mask & (1ULL << cell)) continue;
+            watched++;
+            size_t i = y * w + x;
+            if (!md->changed[i]) continue;
+            bool neighbour = (x > 0 && md->changed[i - 1]) || (x + 1 < w && md->changed[i + 1]) ||
+                             (y > 0 && md->changed[i - w]) || (y + 1 < h && md->changed[i + w]);
+            if (!neighbour) continue;
+            kept++;
+            if (cell_hits[cell] < 255) cell_hits[cell]++;
+        }
+    }
+    for (int c = 0; c < MOTION_GRID_COLS * MOTION_GRID_ROWS; c++) {
+        if (cell_hits[c] >= 2) res->mask |= 1ULL << c;
+    }
+    res->changed = kept;
+    res->score = watched ? (uint16_t)(kept * 1000 / watched) : 0;
+
+    // Changed blocks are learned 4x slower, so something that stopped is absorbed
+    // in a few seconds but a passer-by doesn't burn into the background
+    int learn = md->cfg.learn_shift;
+    for (size_t i = 0; i < n; i++) {
+        int target = (int)luma[i] << 8;
+        int k = md->changed[i] ? learn + 2 : learn;
+        bg[i] = (uint16_t)(bg[i] + ((target - (int)bg[i]) >> k));
+    }
+
+    if (md->frames <= md->cfg.warmup) {
+        md->frames++;
+        res->mask = 0;
+        return MOTION_OK;
+    }
+    md->frames++;
+    res->motion = res->score >= md->cfg.min_score && res->mask != 0;
+    return MOTION_OK;
+}
+
+const char *motion_err_name(int err) {
+    switch (err) {
+    case MOTION_OK: return "ok";
+    case MOTION_ERR_HEADER: return "bad header";
+    case MOTION_ERR_UNSUPPORTED: return "unsupported JPEG";
+    case MOTION_ERR_DATA: return "bad scan data";
+    case MOTION_ERR_NO_MEM: return "no memory";
+    default: return "unknown";
+    }
+}
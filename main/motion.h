@@ -0,0 +1,73 @@
+// motion.h
+// Vision motion detection on the camera's JPEGs without a full decode. Only
+// the Huffman stream is walked: the DC coefficient of every luma block gives
+// a 1/8-scale grey image, AC coefficients are skipped without dequantizing or
+// an IDCT. Each block is compared with a running background; changed blocks
+// that have a changed neighbour count as motion and are summarised on a
+// MOTION_GRID_COLS x MOTION_GRID_ROWS grid.
+// Plain C with no ESP-IDF dependencies.
+#ifndef MOTION_H
+#define MOTION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define MOTION_GRID_COLS 8
+#define MOTION_GRID_ROWS 6 // Grid cell (col, row) is bit row * MOTION_GRID_COLS + col of a mask
+
+typedef enum {
+    MOTION_OK = 0,
+    MOTION_ERR_HEADER = -1,      // Not a JPEG, or a table/segment is malformed
+    MOTION_ERR_UNSUPPORTED = -2, // Progressive, arithmetic, 12-bit or non-interleaved colour
+    MOTION_ERR_DATA = -3,        // Invalid Huffman code in the scan
+    MOTION_ERR_NO_MEM = -4,
+} motion_err_t;
+
+typedef struct {
+    uint8_t threshold;    // Luma step (0-255) of a block that counts as changed
+    uint8_t learn_shift;  // Background moves 1/2^n of the way to each analysed frame
+    uint16_t min_score;   // Changed blocks, per mille of the watched ones, that make motion
+    uint8_t warmup;       // Frames learned before anything is reported
+    uint64_t ignore_mask; // Grid cells never watched (trees, a busy road)
+} motion_config_t;
+
+#define MOTION_CONFIG_DEFAULT() { \
+    .threshold = 14, .learn_shift = 4, .min_score = 8, .warmup = 8, .ignore_mask = 0 }
+
+typedef struct {
+    bool motion;
+    uint16_t score;       // Changed blocks per mille of the watched ones
+    uint32_t changed;     // Changed blocks
+    uint64_t mask;        // Grid cells with motion
+} motion_result_t;
+
+typedef struct {
+    motion_config_t cfg;
+    uint16_t width;       // In 8x8 blocks
+    uint16_t height;
+    uint32_t frames;      // Analysed since the background was (re)started
+    uint8_t *luma;        // width * height, the latest DC image
+    uint8_t *changed;
+    uint16_t *background; // 8.8 fixed point
+} motion_detector_t;
+
+// Y DC image of a baseline JPEG, one byte per 8x8 block, at most cap bytes.
+// Returns MOTION_OK or a motion_err_t. The size in blocks is also set with
+// MOTION_ERR_NO_MEM, so calling with cap 0 reads it from the header.
+int motion_dc_luma(const uint8_t *jpeg, size_t len, uint8_t *out, size_t cap, uint16_t *width, uint16_t *height);
+
+void motion_init(motion_detector_t *md, const motion_config_t *cfg);
+int motion_process(motion_detector_t *md, const uint8_t *jpeg, size_t len, motion_result_t *res); // MOTION_OK or a motion_err_t
+void motion_reset(motion_detector_t *md); // Relearn the background, e.g. after the camera moved
+void motion_free(motion_detector_t *md);
+const char *motion_err_name(int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // MOTION_H
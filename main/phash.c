@@ -0,0 +1,88 @@
+// phash.c
+
+#include <math.h>
+#include <string.h>
+#include "phash.h"
+
+#define PHASH_COEFFS 8
+
+static float dct_cos[PHASH_COEFFS][PHASH_SIZE]; // cos((2x + 1) u pi / 2N), only the rows kept
+static int dct_ready = 0;
+
+static void dct_init(void) {
+    for (int u = 0; u < PHASH_COEFFS; u++) {
+        for (int x = 0; x < PHASH_SIZE; x++) {
+            dct_cos[u][x] = cosf((float)((2 * x + 1) * u) * (float)M_PI / (2.0f * PHASH_SIZE));
+        }
+    }
+    dct_ready = 1;
+}
+
+// Box filter to PHASH_SIZE x PHASH_SIZE; cells cover whole source pixels
+static void downscale(const uint8_t *luma, uint16_t width, uint16_t height, float out[PHASH_SIZE][PHASH_SIZE]) {
+    for (int j = 0; j < PHASH_SIZE; j++) {
+        int y0 = j * height / PHASH_SIZE;
+        int y1 = (j + 1) * height / PHASH_SIZE;
+        if (y1 <= y0) y1 = y0 + 1;
+        for (int i = 0; i < PHASH_SIZE; i++) {
+            int x0 = i * width / PHASH_SIZE;
+            int x1 = (i + 1) * width / PHASH_SIZE;
+            if (x1 <= x0) x1 = x0 + 1;
+            uint32_t sum = 0;
+            for (int y = y0; y < y1; y++) {
+                const uint8_t *row = luma + y * width;
+                for (int x = x0; x < x1; x++) sum += row[x];
+            }
+            out[j][i] = (float)sum / (float)((y1 - y0) * (x1 - x0));
+        }
+    }
+}
+
+uint64_t phash_luma(const uint8_t *luma, uint16_t width, uint16_t height) {
+    if (!dct_ready) dct_init();
+    float pixels[PHASH_SIZE][PHASH_SIZE];
+    downscale(luma, width, height, pixels);
+
+    // Separable DCT-II, keeping the 8 lowest frequencies each way
+    float rows[PHASH_SIZE][PHASH_COEFFS];
+    for (int y = 0; y < PHASH_SIZE; y++) {
+        for (int u = 0; u < PHASH_COEFFS; u++) {
+            float acc = 0;
+            for (int x = 0; x < PHASH_SIZE; x++) acc += pixels[y][x] * dct_cos[u][x];
+            rows[y][u] = acc;
+        }
+    }
+    float coeffs[PHASH_COEFFS * PHASH_COEFFS];
+    for (int v = 0; v < PHASH_COEFFS; v++) {
+        for (int u = 0; u < PHASH_COEFFS; u++) {
+            float acc = 0;
+            for (int y = 0; y < PHASH_SIZE; y++) acc += rows[y][u] * dct_cos[v][y];
+            coeffs[v * PHASH_COEFFS + u] = acc;
+        }
+    }
+
+    // Median of the AC terms; the DC term only says how bright the frame is
+    float sorted[PHASH_COEFFS * PHASH_COEFFS - 1];
+    memcpy(sorted, coeffs + 1, sizeof(sorted));
+    int n = (int)(sizeof(sorted) / sizeof(sorted[0]));
+    for (int i = 1; i < n; i++) {
+        float v = sorted[i];
+        int j = i - 1;
+        while (j >= 0 && sorted[j] > v) {
+            sorted[j + 1] = sorted[j];
+            j--;
+        }
+        sorted[j + 1] = v;
+    }
+    float median = sorted[n / 2];
+
+    uint64_t hash = 0;
+    for (int i = 1; i < PHASH_COEFFS * PHASH_COEFFS; i++) {
+        if (coeffs[i] > median) hash |= 1ULL << i;
+    }
+    return hash;
+}
+
+int phash_distance(uint64_t a, uint64_t b) {
+    return __builtin_popcountll(a ^ b);
+}
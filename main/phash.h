@@ -0,0 +1,25 @@
+// phash.h
+// 64-bit perceptual hash of a frame's DC luma image (see motion_dc_luma):
+// the image is box-filtered to PHASH_SIZE x PHASH_SIZE, the lowest 8x8 DCT
+// coefficients are taken and each bit says whether a coefficient is above
+// their median. Frames that look alike are a few bits apart whatever the
+// JPEG noise and small exposure changes; a new subject moves many bits.
+// Plain C with no ESP-IDF dependencies.
+#ifndef PHASH_H
+#define PHASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+
+#define PHASH_SIZE 32
+
+uint64_t phash_luma(const uint8_t *luma, uint16_t width, uint16_t height); // width/height at least 1
+int phash_distance(uint64_t a, uint64_t b); // Differing bits, 0-64
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PHASH_H
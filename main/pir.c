@@ -0,0 +1,158 @@
+// pir.c
+
+#include "pir.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "hal/gpio_ll.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+static const char *TAG = "pir";
+
+#define PIR_EDGE_QUEUE_LEN 16
+#define PIR_MAX_SUBSCRIBERS 4
+
+typedef struct {
+    int64_t at_us;
+    uint8_t level;
+} pir_edge_t;
+
+typedef struct {
+    pir_callback_t cb;
+    void *arg;
+} pir_subscriber_t;
+
+static QueueHandle_t edge_queue = NULL;
+static volatile bool pir_level = false;
+static portMUX_TYPE pir_lock = portMUX_INITIALIZER_UNLOCKED; // Guards the timeline and subscribers
+static pir_episode_t timeline[PIR_TIMELINE_LEN];
+static uint32_t episodes = 0; // Since boot, the newest is timeline[(episodes - 1) % PIR_TIMELINE_LEN]
+static pir_subscriber_t subscribers[PIR_MAX_SUBSCRIBERS];
+static uint32_t glitches = 0;
+
+static void IRAM_ATTR pir_isr_handler(void *arg) {
+    pir_edge_t edge = {
+        .at_us = esp_timer_get_time(),
+        .level = (uint8_t)gpio_ll_get_level(&GPIO, PIR_SENSOR_PIN), // gpio_get_level isn't in IRAM
+    };
+    BaseType_t woken = pdFALSE;
+    xQueueSendFromISR(edge_queue, &edge, &woken); // A full queue only loses bounces, the level is re-read
+    if (woken) portYIELD_FROM_ISR();
+}
+
+bool pir_active(void) {
+    return pir_level;
+}
+
+esp_err_t pir_subscribe(pir_callback_t cb, void *arg) {
+    esp_err_t res = ESP_ERR_NO_MEM;
+    taskENTER_CRITICAL(&pir_lock);
+    for (int i = 0; i < PIR_MAX_SUBSCRIBERS; i++) {
+        if (subscribers[i].cb == NULL) {
+            subscribers[i].cb = cb;
+            subscribers[i].arg = arg;
+            res = ESP_OK;
+            break;
+        }
+    }
+    taskEXIT_CRITICAL(&pir_lock);
+    return res;
+}
+
+size_t pir_timeline(pir_episode_t *out, size_t max) {
+    size_t n = 0;
+    taskENTER_CRITICAL(&pir_lock);
+    for (uint32_t e = episodes; e > 0 && n < max && n < PIR_TIMELINE_LEN; e--) {
+        out[n++] = timeline[(e - 1) % PIR_TIMELINE_LEN];
+    }
+    taskEXIT_CRITICAL(&pir_lock);
+    return n;
+}
+
+static void pir_commit(bool level, int64_t at_us) {
+    pir_subscriber_t subs[PIR_MAX_SUBSCRIBERS];
+    int64_t rise_us = 0;
+    taskENTER_CRITICAL(&pir_lock);
+    pir_level = level;
+    if (level) {
+        timeline[episodes % PIR_TIMELINE_LEN] = (pir_episode_t){ .rise_us = at_us, .fall_us = 0 };
+        episodes++;
+    } else if (episodes > 0) {
+        pir_episode_t *ep = &timeline[(episodes - 1) % PIR_TIMELINE_LEN];
+        ep->fall_us = at_us;
+        rise_us = ep->rise_us;
+    }
+    memcpy(subs, subscribers, sizeof(subs));
+    taskEXIT_CRITICAL(&pir_lock);
+
+    if (level) {
+        ESP_LOGI(TAG, "PIR rise (episode %lu)", episodes);
+    } else {
+        ESP_LOGI(TAG, "PIR fall after %lld ms, %lu glitches so far", (at_us - rise_us) / 1000, glitches);
+    }
+    for (int i = 0; i < PIR_MAX_SUBSCRIBERS; i++) {
+        if (subs[i].cb) subs[i].cb(level, at_us, subs[i].arg);
+    }
+}
+
+// Debounce: a run of edges ends once none came for PIR_DEBOUNCE_MS, then the
+// pin is read again. The run counts if the level differs from the debounced
+// one, timestamped with its first edge; otherwise it was a glitch.
+static void pir_task(void *arg) {
+    int64_t run_start_us = 0; // First edge of the current run, 0 when quiet
+    int64_t run_last_us = 0;
+    for (;;) {
+        TickType_t wait = portMAX_DELAY;
+        if (run_start_us) {
+            int64_t left_us = run_last_us + PIR_DEBOUNCE_MS * 1000LL - esp_timer_get_time();
+            wait = left_us > 0 ? pdMS_TO_TICKS(left_us / 1000) + 1 : 0;
+        }
+        pir_edge_t edge;
+        if (xQueueReceive(edge_queue, &edge, wait) == pdTRUE) {
+            if (!run_start_us) run_start_us = edge.at_us;
+            run_last_us = edge.at_us;
+            continue;
+        }
+        if (!run_start_us) continue;
+        bool level = gpio_get_level(PIR_SENSOR_PIN) == 1;
+        int64_t at_us = run_start_us;
+        run_start_us = 0;
+        if (level == pir_level) {
+            glitches++;
+            continue;
+        }
+        pir_commit(level, at_us);
+    }
+}
+
+esp_err_t pir_init(void) {
+    edge_queue = xQueueCreate(PIR_EDGE_QUEUE_LEN, sizeof(pir_edge_t));
+    if (!edge_queue) return ESP_ERR_NO_MEM;
+
+    gpio_config_t io_conf = {
+        .pin_bit_mask = (1ULL << PIR_SENSOR_PIN),
+        .mode = GPIO_MODE_INPUT,
+        .pull_down_en = GPIO_PULLDOWN_ENABLE,
+        .pull_up_en = GPIO_PULLUP_DISABLE,
+        .intr_type = GPIO_INTR_ANYEDGE,
+    };
+    esp_err_t res = gpio_config(&io_conf);
+    if (res != ESP_OK) return res;
+
+    // The camera driver may have installed the shared GPIO ISR service already
+    res = gpio_install_isr_service(0);
+    if (res != ESP_OK && res != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE(TAG, "Failed to install GPIO ISR service: %s", esp_err_to_name(res));
+        return res;
+    }
+    if (xTaskCreatePinnedToCore(pir_task, "pir", 3072, NULL, 6, NULL, 1) != pdPASS) return ESP_ERR_NO_MEM;
+    res = gpio_isr_handler_add(PIR_SENSOR_PIN, pir_isr_handler, NULL);
+    if (res != ESP_OK) return res;
+
+    if (gpio_get_level(PIR_SENSOR_PIN) == 1) pir_commit(true, esp_timer_get_time()); // Already high at boot
+    ESP_LOGI(TAG, "PIR sensor on GPIO %d, interrupt driven", PIR_SENSOR_PIN);
+    return ESP_OK;
+}
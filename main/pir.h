@@ -0,0 +1,38 @@
+// pir.h
+// PIR sensor on interrupts. The GPIO ISR timestamps every edge; a small task
+// debounces them (a level must hold PIR_DEBOUNCE_MS) and records each motion
+// episode in a timeline ring. Subscribers are called on every debounced edge,
+// so nobody has to poll the pin.
+#ifndef PIR_H
+#define PIR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define PIR_SENSOR_PIN          43
+#define PIR_DEBOUNCE_MS         50  // Shorter pulses are glitches
+#define PIR_TIMELINE_LEN        16  // Motion episodes kept
+
+typedef struct {
+    int64_t rise_us;    // esp_timer time of the first edge of the rise, from the ISR
+    int64_t fall_us;    // Same for the fall, 0 while the sensor is still high
+} pir_episode_t;
+
+// Runs on the PIR task; at_us is the ISR time of the edge. Keep it short.
+typedef void (*pir_callback_t)(bool active, int64_t at_us, void *arg);
+
+esp_err_t pir_init(void);
+bool pir_active(void); // Debounced level
+esp_err_t pir_subscribe(pir_callback_t cb, void *arg); // May be called before pir_init
+size_t pir_timeline(pir_episode_t *out, size_t max); // Newest first, returns the count copied
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PIR_H
@@ -0,0 +1,961 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <sys/stat.h>
+#include "recorder.h"
+#include "video_tx.h"
+#include <dirent.h> // For directory listing
+#include <vector>   // For storing filenames (requires C++)
+#include <string>   // For std::string (requires C++)
+#include <algorithm> // For std::sort (requires C++)
+
+static const char *TAG_PB = "playback";
+
+#define PLAYBACK_STACK_SIZE (6 * 1024) // C++ strings/vector in the reader
+#define PLAYBACK_PRIORITY 4
+
+// --- Playback Sessions ---
+playback_session_t playbackSessions[MAX_PLAYBACK_SESSIONS];
+
+
+esp_err_t playback_init() {
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        playback_session_t *s = &playbackSessions[i];
+        s->id = i;
+        if (s->control == NULL) s->control = xSemaphoreCreateBinary();
+        if (s->frameQueue == NULL) s->frameQueue = xQueueCreate(PLAYBACK_QUEUE_LEN, sizeof(camera_fb_t*));
+        if (s->control == NULL || s->frameQueue == NULL) {
+            ESP_LOGE(TAG_PB, "Failed to create resources for playback session %d", i);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    return ESP_OK;
+}
+
+// Frees any frames still queued for a session (reader side, after it stopped)
+static void drain_session_queue(playback_session_t *s) {
+    camera_fb_t *fb = NULL;
+    while (xQueueReceive(s->frameQueue, &fb, 0) == pdTRUE) {
+        if (fb) {
+            if (fb->buf) heap_caps_free(fb->buf);
+            heap_caps_free(fb);
+        }
+    }
+}
+
+// Picks a free slot. Sessions are independent, so starting one never stops another.
+static playback_session_t *claim_session() {
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (!playbackSessions[i].active && playbackSessions[i].control != NULL) {
+            return &playbackSessions[i];
+        }
+    }
+    ESP_LOGW(TAG_PB, "All %d playback sessions busy. Stop one first.", MAX_PLAYBACK_SESSIONS);
+    return NULL;
+}
+
+// Ensures the session's reader task exists and signals it to start
+static int launch_session(playback_session_t *s, uint16_t sid) {
+    s->sid = sid;
+    s->stop_request = false;
+    s->active = true; // Set flag before signaling
+
+    if (s->task == NULL) {
+        char taskName[16];
+        snprintf(taskName, sizeof(taskName), "playback%d", s->id);
+        BaseType_t taskCreated = xTaskCreatePinnedToCore(playback_task, taskName, PLAYBACK_STACK_SIZE, s,
+                                                         PLAYBACK_PRIORITY, &s->task, 1); // Core 1 for file I/O
+        if (taskCreated != pdPASS) {
+            ESP_LOGE(TAG_PB, "Failed to create reader task for session %d!", s->id);
+            s->task = NULL;
+            s->active = false; // Reset flag
+            return -1;
+        }
+    }
+
+    xSemaphoreGive(s->control); // Signal the task to start
+    return s->id;
+}
+
+int start_playback(const char *filename, uint16_t frame, uint16_t sid) {
+    playback_session_t *s = claim_session();
+    if (s == NULL) return -1;
+
+    if (filename && strlen(filename) > 0 && strlen(filename) < sizeof(s->file)) {
+        strncpy(s->file, filename, sizeof(s->file) - 1);
+        s->file[sizeof(s->file) - 1] = '\0';
+        ESP_LOGI(TAG_PB, "Session %d: requesting playback start for: %s (frame %u)", s->id, s->file, frame);
+    } else {
+        s->file[0] = '\0'; // Clear specific file request
+        ESP_LOGI(TAG_PB, "Session %d: requesting playback start from the beginning.", s->id);
+    }
+    s->startFrame = s->file[0] ? frame : 0;
+    s->timeshift = false;
+    return launch_session(s, sid);
+}
+
+int start_timeshift(uint16_t seconds, uint16_t sid) {
+    uint32_t generation;
+    uint16_t frames;
+    if (!getLiveRecording(&generation, &frames)) {
+        ESP_LOGW(TAG_PB, "Timeshift requested but nothing is being recorded.");
+        return -1;
+    }
+    playback_session_t *s = claim_session();
+    if (s == NULL) return -1;
+
+    s->file[0] = '\0';
+    s->timeshift = true;
+    s->rewindSecs = seconds;
+    ESP_LOGI(TAG_PB, "Session %d: requesting timeshift playback %u s behind live.", s->id, seconds);
+    return launch_session(s, sid);
+}
+
+void stop_playback(int session) {
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (session >= 0 && i != session) continue;
+        playback_session_t *s = &playbackSessions[i];
+        if (s->active) {
+            ESP_LOGI(TAG_PB, "Session %d: requesting playback stop.", i);
+            s->stop_request = true;
+            if (s->control != NULL) xSemaphoreGive(s->control); // Wake task if waiting
+            // Note: active is cleared by the reader task itself when it stops
+        } else if (session >= 0) {
+            ESP_LOGI(TAG_PB, "Stop requested for session %d, but it is not active.", i);
+        }
+    }
+}
+
+void stop_playback_sid(uint16_t sid) {
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (playbackSessions[i].active && playbackSessions[i].sid == sid) stop_playback(i);
+    }
+}
+
+int playback_active_count() {
+    int count = 0;
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (playbackSessions[i].active) count++;
+    }
+    return count;
+}
+
+void endPlaybackTasks() {
+    stop_playback(-1);
+    vTaskDelay(pdMS_TO_TICKS(200)); // Give readers time to stop
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        playback_session_t *s = &playbackSessions[i];
+        if (s->task != NULL) {
+            vTaskDelete(s->task);
+            s->task = NULL;
+        }
+        if (s->frameQueue != NULL) {
+            drain_session_queue(s);
+            vQueueDelete(s->frameQueue);
+            s->frameQueue = NULL;
+        }
+        if (s->control != NULL) vSemaphoreDelete(s->control);
+        s->control = NULL;
+        s->active = false;
+    }
+    ESP_LOGI(TAG_PB, "Playback sessions ended.");
+}
+
+// --- Helper Function to Get Sorted AVI Files ---
+bool get_sorted_avi_files(const char *dir_path_to_scan, const char *requested_start_file, std::vector<std::string> &files, int current_index_ref) {
+    files.clear();
+    current_index_ref = -1; // Initialize index before search
+
+    ESP_LOGI(TAG_PB, "Scanning directory: %s for AVI files", dir_path_to_scan);
+    DIR *dir = opendir(dir_path_to_scan);
+    if (!dir) {
+        ESP_LOGE(TAG_PB, "Failed to open directory: %s", dir_path_to_scan);
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string entry_name = entry->d_name;
+        std::string full_path = std::string(dir_path_to_scan) + "/" + entry_name;
+
+        // Skip "." and ".." entries
+        if (entry_name == "." || entry_name == "..") {
+            continue;
+        }
+
+        struct stat st;
+        if (stat(full_path.c_str(), &st) == 0) {
+            if (S_ISREG(st.st_mode)) { // It's a file
+                const char *dot = strrchr(entry->d_name, '.');
+                if (dot && strcasecmp(dot, ".avi") == 0) { // Case-insensitive check
+                    if (full_path != AVITEMP) { // Skip temporary file
+                        files.push_back(full_path);
+                        ESP_LOGD(TAG_PB, "Found AVI file: %s", full_path.c_str());
+                    } else {
+                        ESP_LOGD(TAG_PB, "Skipping temporary file: %s", full_path.c_str());
+                    }
+                }
+            } else if (S_ISDIR(st.st_mode) && full_path != CLIP_DIR) {
+                 // --- Recursive Call to Scan Subdirectories ---
+                 ESP_LOGD(TAG_PB,"Entering subdirectory: %s", full_path.c_str());
+                 // Note: current_index_ref passed here is not used by the recursive call result directly
+                 get_sorted_avi_files(full_path.c_str(), requested_start_file, files, current_index_ref);
+                 // The files vector is appended by the recursive call.
+                 // The current_index_ref might get overwritten, reset it after recursion if needed.
+                 current_index_ref = -1; // Reset index after recursion returns (will be found later)
+            }
+        } else {
+             ESP_LOGW(TAG_PB,"Failed to get stat for: %s", full_path.c_str());
+        }
+    }
+    closedir(dir);
+
+    // Only sort and proceed if we are at the top-level call (or handle sorting differently)
+    // For simplicity, let's sort the entire accumulated list here.
+    if (files.empty()) {
+        ESP_LOGW(TAG_PB, "No AVI files found in %s or subdirectories (excluding temp)", dir_path_to_scan);
+        return false;
+    }
+
+    std::sort(files.begin(), files.end());
+    ESP_LOGI(TAG_PB, "Found and sorted %d total AVI files.", files.size());
+    for(size_t i = 0; i < files.size(); ++i) {
+        ESP_LOGD(TAG_PB, "Sorted List [%zu]: %s", i, files[i].c_str());
+    }
+
+
+    // --- Find Index Logic (after collecting all files) ---
+    ESP_LOGI(TAG_PB, "Searching for starting file: %s", requested_start_file ? requested_start_file : "NULL (start from beginning)");
+    if (requested_start_file && strlen(requested_start_file) > 0) {
+        for (size_t i = 0; i < files.size(); ++i) {
+            if (files[i] == requested_start_file) {
+                current_index_ref = i; // Found it!
+                ESP_LOGI(TAG_PB, "Requested starting file found at index: %d", current_index_ref);
+                break;
+            }
+        }
+    }
+
+    // If not found or not requested, default to index 0
+    if (current_index_ref == -1) {
+        if (requested_start_file && strlen(requested_start_file) > 0) {
+            ESP_LOGW(TAG_PB, "Requested start file '%s' not found in collected list. Starting from index 0.", requested_start_file);
+        } else {
+            ESP_LOGI(TAG_PB, "No specific start file requested or file not found. Starting from index 0.");
+        }
+        if (!files.empty()) {
+            current_index_ref = 0;
+        } else {
+             ESP_LOGE(TAG_PB,"Cannot set index 0, file list is empty!");
+             return false; // Cannot proceed
+        }
+    }
+
+    // Final validation
+    if (current_index_ref < 0 || current_index_ref >= (int)files.size()) {
+        ESP_LOGE(TAG_PB, "Final calculated index %d is invalid for file list size %d", current_index_ref, files.size());
+        return false;
+    }
+
+    return true;
+}
+
+
+// --- Playback Task Implementation ---
+static bool find_first_avi_recursive(const char* dir_path, std::string& first_file_found) {
+    bool found_any = false;
+    ESP_LOGD(TAG_PB, "find_first: Scanning %s", dir_path);
+    DIR *dir = opendir(dir_path);
+    if (!dir) {
+        ESP_LOGE(TAG_PB, "find_first: Failed to open directory: %s", dir_path);
+        return false;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string entry_name = entry->d_name;
+        // Construct full path safely, avoid double slashes if dir_path is "/"
+        std::string full_path;
+        if (strcmp(dir_path, "/") == 0) {
+            full_path = std::string("/") + entry_name;
+        } else {
+            full_path = std::string(dir_path) + "/" + entry_name;
+        }
+
+
+        if (entry_name == "." || entry_name == "..") continue;
+
+        struct stat st;
+        // Add small delay to yield CPU during intensive scanning
+        // vTaskDelay(pdMS_TO_TICKS(1)); // Uncomment if needed, might slow down scan significantly
+
+        if (stat(full_path.c_str(), &st) == 0) {
+            if (S_ISREG(st.st_mode)) {
+                const char *dot = strrchr(entry->d_name, '.');
+                if (dot && strcasecmp(dot, ".avi") == 0 && full_path != AVITEMP) {
+                    // Check if this file is the first found OR lexicographically smaller than the current best
+                    if (first_file_found.empty() || full_path < first_file_found) {
+                        ESP_LOGD(TAG_PB, "find_first: Found candidate: %s", full_path.c_str());
+                        first_file_found = full_path;
+                        found_any = true;
+                    }
+                }
+            } else if (S_ISDIR(st.st_mode) && full_path != CLIP_DIR) {
+                // Recurse - update first_file_found if a smaller one is found in subdirectory
+                if (find_first_avi_recursive(full_path.c_str(), first_file_found)) {
+                    found_any = true; // Found something in the subdirectory tree
+                }
+            }
+        } else {
+            ESP_LOGW(TAG_PB, "find_first: Failed to get stat for %s (errno: %d)", full_path.c_str(), errno);
+            // Continue scanning other files
+        }
+    }
+    closedir(dir);
+    return found_any;
+}
+
+// --- Playback Frames ---
+static camera_fb_t *alloc_playback_frame(size_t len) {
+    camera_fb_t *fb = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_DEFAULT);
+    if (!fb) return NULL;
+    fb->buf = (uint8_t *)heap_caps_malloc(len, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!fb->buf) {
+        heap_caps_free(fb);
+        return NULL;
+    }
+    fb->len = len; fb->width = 0; fb->height = 0; fb->format = PIXFORMAT_JPEG; fb->timestamp.tv_sec = 0; fb->timestamp.tv_usec = 0;
+    return fb;
+}
+
+static void free_playback_frame(camera_fb_t *fb) {
+    heap_caps_free(fb->buf);
+    heap_caps_free(fb);
+}
+
+// Hands a frame to the connection task for sending, freeing it if the queue stays full
+static bool queue_playback_frame(playback_session_t *s, camera_fb_t *fb) {
+    if (xQueueSend(s->frameQueue, &fb, pdMS_TO_TICKS(200)) != pdTRUE) {
+        ESP_LOGW(TAG_PB, "Session %d queue full. Dropping playback frame.", s->id);
+        free_playback_frame(fb);
+        return false;
+    }
+    video_tx_kick();
+    return true;
+}
+
+// --- AVI Reader ---
+#define CHUNK_ID_LIST 0x5453494C // 'LIST' in little-endian
+#define CHUNK_ID_MOVI 0x69766F6D // 'movi' in little-endian
+#define CHUNK_ID_00DC 0x63643030 // '00dc' in little-endian
+#define CHUNK_ID_IDX1 0x31786469 // 'idx1' in little-endian
+
+#define PREFETCH_FRAMES 2 // Frames of the next file read ahead before the switch
+#define PREFETCH_DIR_ENTRIES 16 // Directory entries read per prefetch step
+#define RESYNC_SCAN_BLOCK 4096 // Bytes searched per read when scanning for the next frame
+
+// An open AVI file positioned inside its 'movi' data
+typedef struct {
+    FILE *pf;
+    std::string path;
+    uint32_t fps;        // From the strh header, 10 if missing
+    long pos;            // Offset of the next chunk header
+    long moviStart;      // Offset just after the 'movi' fourcc
+    long moviEnd;        // Start of idx1, or the file size without a usable index
+    uint32_t frames;     // Frames returned so far
+    uint8_t *index;      // idx1 entries, NULL if the file has none (or a broken one)
+    uint16_t indexFrames;
+    uint32_t skipped;    // Bytes skipped resynchronizing after corrupt chunks
+} avi_reader_t;
+
+uint8_t *load_avi_index(FILE *pf, uint16_t *frames) {
+    uint8_t header[AVI_HEADER_LEN];
+    if (fseek(pf, 0, SEEK_SET) != 0 || fread(header, 1, AVI_HEADER_LEN, pf) != AVI_HEADER_LEN) return NULL;
+    memcpy(frames, header + 0x30, 2);
+    size_t indexLen = (size_t)*frames * IDX_ENTRY;
+    long fileSize = STORAGE_size(pf);
+    if (*frames == 0 || fileSize < (long)(AVI_HEADER_LEN + CHUNK_HDR + indexLen)) return NULL;
+
+    uint8_t chunkHdr[CHUNK_HDR];
+    if (fseek(pf, fileSize - (long)(CHUNK_HDR + indexLen), SEEK_SET) != 0
+        || fread(chunkHdr, 1, CHUNK_HDR, pf) != CHUNK_HDR || memcmp(chunkHdr, "idx1", 4) != 0) {
+        return NULL;
+    }
+    uint8_t *index = (uint8_t *)heap_caps_malloc(indexLen, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (index && fread(index, 1, indexLen, pf) != indexLen) {
+        heap_caps_free(index);
+        index = NULL;
+    }
+    return index;
+}
+
+static void avi_reader_close(avi_reader_t *r) {
+    if (r->pf) fclose(r->pf);
+    r->pf = NULL;
+    if (r->index) heap_caps_free(r->index);
+    r->index = NULL;
+}
+
+// Opens a file, reads its FPS and index, and walks the RIFF chunks to the start of 'movi'
+static bool avi_reader_open(avi_reader_t *r, const std::string &path) {
+    r->path = path;
+    r->frames = 0;
+    r->skipped = 0;
+    r->fps = 10;
+    r->index = NULL;
+    r->pf = fopen(path.c_str(), "rb");
+    if (!r->pf) {
+        ESP_LOGE(TAG_PB, "Failed to open playback file: %s (errno: %d)", path.c_str(), errno);
+        return false;
+    }
+
+    // --- Read Header & Extract FPS ---
+    uint8_t header[AVI_HEADER_LEN];
+    size_t header_read = fread(header, 1, AVI_HEADER_LEN, r->pf);
+    if (header_read >= 0x84 + 1) { // Need at least offset 0x84 + 1 byte
+        r->fps = header[0x84]; // FPS byte from strh chunk
+        if (r->fps == 0 || r->fps > 60) { // Sanity check
+            ESP_LOGW(TAG_PB, "Invalid FPS %lu read from header of %s, using default 10", r->fps, path.c_str());
+            r->fps = 10;
+        }
+    } else {
+        ESP_LOGW(TAG_PB, "Could not read enough header bytes (%zu) to determine FPS. Using default 10.", header_read);
+    }
+
+    long file_size = STORAGE_size(r->pf);
+    r->index = load_avi_index(r->pf, &r->indexFrames);
+    r->moviEnd = r->index ? file_size - (long)(CHUNK_HDR + r->indexFrames * IDX_ENTRY) : file_size;
+
+    // --- Locate 'movi' chunk, starting after the RIFF 'AVI ' header (offset 12) ---
+    long current_pos = 12;
+    while (current_pos < file_size) {
+        uint32_t chunk_id = 0, chunk_size = 0, list_type = 0;
+        if (fseek(r->pf, current_pos, SEEK_SET) != 0
+            || fread(&chunk_id, 1, 4, r->pf) != 4
+            || fread(&chunk_size, 1, 4, r->pf) != 4) {
+            ESP_LOGE(TAG_PB, "Failed reading chunk at %ld in %s", current_pos, path.c_str());
+            break;
+        }
+        current_pos += 8; // Advance past ID and size
+        ESP_LOGD(TAG_PB, "Read Chunk: ID=0x%08lX, Size=%lu at offset %ld", chunk_id, chunk_size, current_pos - 8);
+
+        if (chunk_id == CHUNK_ID_LIST) {
+            if (fread(&list_type, 1, 4, r->pf) != 4) break;
+            current_pos += 4; // Advance past list type
+            if (list_type == CHUNK_ID_MOVI) {
+                r->pos = r->moviStart = current_pos; // Offset *after* 'LIST', size, and 'movi' ID
+                ESP_LOGI(TAG_PB, "Opened %s (%lu fps, %s), movi data at offset %ld", path.c_str(), r->fps,
+                         r->index ? "indexed" : "no index", r->pos);
+                return true;
+            }
+            current_pos += (chunk_size - 4); // Some other LIST (like 'hdrl'), size includes the list type
+        } else {
+            current_pos += chunk_size; // Regular chunk, skip its content
+        }
+        if (current_pos % 2 != 0) current_pos++; // Word align the next chunk
+    }
+
+    ESP_LOGE(TAG_PB, "'movi' chunk not found in %s. Skipping file.", path.c_str());
+    avi_reader_close(r);
+    return false;
+}
+
+// True if a plausible '00dc' chunk whose data starts with a JPEG SOI sits at pos
+static bool avi_frame_at(avi_reader_t *r, long pos) {
+    uint8_t probe[CHUNK_HDR + 2];
+    if (pos + (long)sizeof(probe) > r->moviEnd) return false;
+    if (fseek(r->pf, pos, SEEK_SET) != 0 || fread(probe, 1, sizeof(probe), r->pf) != sizeof(probe)) return false;
+    uint32_t chunk_size;
+    memcpy(&chunk_size, probe + 4, 4);
+    return memcmp(probe, "00dc", 4) == 0 && chunk_size > 2 && chunk_size <= MAX_JPEG
+        && pos + CHUNK_HDR + (long)chunk_size <= r->moviEnd
+        && probe[CHUNK_HDR] == 0xFF && probe[CHUNK_HDR + 1] == 0xD8;
+}
+
+// Scans forward from pos for the next '00dc' fourcc that starts an intact frame
+static long avi_scan_for_frame(avi_reader_t *r, long pos) {
+    uint8_t *block = (uint8_t *)heap_caps_malloc(RESYNC_SCAN_BLOCK, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!block) return -1;
+    long found = -1;
+    while (found < 0 && pos + CHUNK_HDR < r->moviEnd) {
+        size_t want = (size_t)std::min((long)RESYNC_SCAN_BLOCK, r->moviEnd - pos);
+        if (fseek(r->pf, pos, SEEK_SET) != 0) break;
+        size_t got = fread(block, 1, want, r->pf);
+        if (got < 4) break;
+        // memchr skips to candidate '0' bytes, then the fourcc and the chunk are checked
+        uint8_t *p = block;
+        uint8_t *end = block + got - 3;
+        while (found < 0 && (p = (uint8_t *)memchr(p, '0', end - p)) != NULL) {
+            if (p[1] == '0' && p[2] == 'd' && p[3] == 'c' && avi_frame_at(r, pos + (p - block))) {
+                found = pos + (p - block);
+            }
+            p++;
+        }
+        pos += got - 3; // Overlap so a fourcc across blocks is not missed
+    }
+    heap_caps_free(block);
+    return found;
+}
+
+// Positions the reader at a frame through idx1, e.g. an event from the journal
+static bool avi_reader_seek(avi_reader_t *r, uint16_t frame) {
+    if (!r->index || frame >= r->indexFrames) return false;
+    uint32_t offset;
+    memcpy(&offset, r->index + frame * IDX_ENTRY + 8, 4);
+    long chunk_pos = r->moviStart - 4 + offset; // idx1 offsets are relative to the 'movi' fourcc
+    if (!avi_frame_at(r, chunk_pos)) return false;
+    r->pos = chunk_pos;
+    return true;
+}
+
+// Moves past a corrupt chunk at badPos to the next intact frame: via idx1 when
+// the file has one, otherwise by scanning. Returns false if nothing is left.
+static bool avi_reader_resync(avi_reader_t *r, long badPos) {
+    long found = -1;
+    if (r->index) {
+        // idx1 offsets are relative to the 'movi' fourcc
+        for (uint16_t i = 0; i < r->indexFrames && found < 0; i++) {
+            uint32_t offset;
+            memcpy(&offset, r->index + i * IDX_ENTRY + 8, 4);
+            long chunk_pos = r->moviStart - 4 + offset;
+            if (chunk_pos > badPos && avi_frame_at(r, chunk_pos)) found = chunk_pos;
+        }
+    }
+    if (found < 0) found = avi_scan_for_frame(r, badPos + 1);
+
+    long skip = ((found < 0) ? r->moviEnd : found) - badPos;
+    r->skipped += skip;
+    if (found < 0) {
+        ESP_LOGW(TAG_PB, "Corrupt chunk at offset %ld in %s, no intact frame after it (%ld bytes lost)", badPos, r->path.c_str(), skip);
+        return false;
+    }
+    ESP_LOGW(TAG_PB, "Corrupt chunk at offset %ld in %s, resynced %ld bytes later", badPos, r->path.c_str(), skip);
+    r->pos = found;
+    return true;
+}
+
+// Reads the next video frame. ESP_ERR_NOT_FOUND at the end of the movi data,
+// ESP_ERR_NO_MEM if the frame had to be skipped. Corrupt chunks are skipped
+// by resynchronizing on the next intact frame.
+static esp_err_t avi_reader_next(avi_reader_t *r, camera_fb_t **fb) {
+    uint8_t chunk_header[CHUNK_HDR];
+    while (1) {
+        if (r->pos + CHUNK_HDR > r->moviEnd) return ESP_ERR_NOT_FOUND;
+        if (fseek(r->pf, r->pos, SEEK_SET) != 0
+            || fread(chunk_header, 1, CHUNK_HDR, r->pf) != CHUNK_HDR) {
+            ESP_LOGE(TAG_PB, "Read error reading chunk header at offset %ld in %s", r->pos, r->path.c_str());
+            if (!avi_reader_resync(r, r->pos)) return ESP_ERR_NOT_FOUND;
+            continue;
+        }
+
+        uint32_t chunk_id, chunk_size;
+        memcpy(&chunk_id, chunk_header, 4);
+        memcpy(&chunk_size, chunk_header + 4, 4);
+        long data_pos = r->pos + CHUNK_HDR;
+        long next_pos = data_pos + chunk_size + (chunk_size & 1); // Word aligned
+
+        if (chunk_id == CHUNK_ID_IDX1) return ESP_ERR_NOT_FOUND; // End of movi data
+        if (data_pos + (long)chunk_size > r->moviEnd
+            || (chunk_id == CHUNK_ID_00DC && (chunk_size <= 2 || chunk_size > MAX_JPEG))) {
+            ESP_LOGW(TAG_PB, "Invalid chunk [0x%08lX] size %lu at offset %ld in %s", chunk_id, chunk_size, r->pos, r->path.c_str());
+            if (!avi_reader_resync(r, r->pos)) return ESP_ERR_NOT_FOUND;
+            continue;
+        }
+        if (chunk_id != CHUNK_ID_00DC) {
+            // Audio ('01wb'), JUNK etc. are skipped for video playback
+            ESP_LOGD(TAG_PB, "Skipping chunk [0x%08lX] size %lu at offset %ld in %s", chunk_id, chunk_size, r->pos, r->path.c_str());
+            r->pos = next_pos;
+            continue;
+        }
+
+        camera_fb_t *fb_out = alloc_playback_frame(chunk_size);
+        if (!fb_out) {
+            ESP_LOGE(TAG_PB, "Failed alloc for %lu byte frame. Skipping it.", chunk_size);
+            r->pos = next_pos;
+            return ESP_ERR_NO_MEM;
+        }
+        if (fread(fb_out->buf, 1, chunk_size, r->pf) != chunk_size
+            || fb_out->buf[0] != 0xFF || fb_out->buf[1] != 0xD8) {
+            ESP_LOGW(TAG_PB, "Bad JPEG data (%lu bytes) at offset %ld in %s", chunk_size, data_pos, r->path.c_str());
+            free_playback_frame(fb_out);
+            if (!avi_reader_resync(r, r->pos)) return ESP_ERR_NOT_FOUND;
+            continue;
+        }
+        r->pos = next_pos;
+        r->frames++;
+        *fb = fb_out;
+        return ESP_OK;
+    }
+}
+
+// --- Timeshift Playback ---
+// Plays a closed recording from frameNum onwards through the AVI reader
+static void play_closed_recording(playback_session_t *s, const char *path, uint16_t frameNum, TickType_t frameTicks) {
+    avi_reader_t r = {};
+    if (!avi_reader_open(&r, path)) return;
+    if (frameNum > 0 && !avi_reader_seek(&r, frameNum)) {
+        if (r.index && frameNum >= r.indexFrames) { // Everything was played while it was live
+            avi_reader_close(&r);
+            return;
+        }
+        // No usable idx1: read past the frames before the start
+        ESP_LOGW(TAG_PB, "Timeshift: cannot seek to frame %u of %s, reading up to it", frameNum, path);
+        camera_fb_t *fb = NULL;
+        esp_err_t res;
+        for (uint16_t i = 0; i < frameNum && (res = avi_reader_next(&r, &fb)) != ESP_ERR_NOT_FOUND; i++) {
+            if (res == ESP_OK) free_playback_frame(fb);
+        }
+    }
+    uint32_t played = 0;
+    while (s->active && !s->stop_request) {
+        camera_fb_t *fb = NULL;
+        esp_err_t res = avi_reader_next(&r, &fb);
+        if (res == ESP_ERR_NOT_FOUND) break;
+        if (res == ESP_OK && queue_playback_frame(s, fb)) played++;
+        vTaskDelay(frameTicks);
+    }
+    ESP_LOGI(TAG_PB, "Timeshift: played %lu frames from closed recording %s (%lu corrupt bytes skipped)", played, path, r.skipped);
+    avi_reader_close(&r);
+}
+
+// Tails the recording in progress, starting rewindSecs behind the camera.
+// If that is before the recording began, the start comes from the recording
+// it rolled over from (no further back). Frames come from the recorder's
+// index and unflushed buffer, or through the session's own handle on the
+// file once flushed; when the recording is closed the rest is read from its
+// final file, then the session follows the next recording.
+static void timeshift_play(playback_session_t *s) {
+    TickType_t frameTicks = pdMS_TO_TICKS(1000 / (FPS ? FPS : 10));
+    uint32_t generation;
+    uint16_t frames;
+    if (!getLiveRecording(&generation, &frames)) {
+        ESP_LOGW(TAG_PB, "Session %d: no recording in progress for timeshift.", s->id);
+        return;
+    }
+    uint32_t behind = (uint32_t)s->rewindSecs * (FPS ? FPS : 10);
+    uint16_t next = (frames > behind) ? frames - behind : 0;
+    char prevPath[FILE_NAME_LEN];
+    uint16_t prevFrames;
+    if (behind > frames && getPreviousRecording(generation, prevPath, sizeof(prevPath), &prevFrames) == ESP_OK) {
+        uint32_t earlier = behind - frames;
+        uint16_t prevStart = (prevFrames > earlier) ? prevFrames - earlier : 0;
+        ESP_LOGI(TAG_PB, "Session %d: timeshift from frame %u of %u in %s", s->id, prevStart, prevFrames, prevPath);
+        play_closed_recording(s, prevPath, prevStart, frameTicks);
+    }
+    ESP_LOGI(TAG_PB, "Session %d: timeshift from frame %u of %u (recording %lu)", s->id, next, frames, generation);
+
+    live_reader_t live = {};
+    while (s->active && !s->stop_request) {
+        size_t len = 0;
+        esp_err_t res = readLiveFrame(&live, generation, next, NULL, 0, &len);
+        if (res == ESP_OK) {
+            camera_fb_t *fb_out = alloc_playback_frame(len);
+            if (!fb_out) {
+                ESP_LOGE(TAG_PB, "Timeshift: failed alloc for %zu byte frame. Delaying.", len);
+                vTaskDelay(pdMS_TO_TICKS(50));
+                continue;
+            }
+            res = readLiveFrame(&live, generation, next, fb_out->buf, len, &fb_out->len);
+            if (res != ESP_OK) {
+                free_playback_frame(fb_out);
+                if (res == ESP_FAIL) {
+                    ESP_LOGW(TAG_PB, "Timeshift: failed to read frame %u from the card. Skipping.", next);
+                    next++;
+                }
+                continue; // Otherwise the recording closed in between, handled below on the next pass
+            }
+            queue_playback_frame(s, fb_out);
+            next++;
+            vTaskDelay(frameTicks);
+        } else if (res == ESP_ERR_NOT_FINISHED) {
+            vTaskDelay(frameTicks); // Caught up with the camera
+        } else if (res == ESP_ERR_INVALID_STATE) {
+            // Recording closed: wait for the rename, finish it from the file, then follow the next one
+            closeLiveReader(&live);
+            char path[FILE_NAME_LEN];
+            while ((res = getClosedRecording(generation, path, sizeof(path))) == ESP_ERR_NOT_FINISHED
+                   && s->active && !s->stop_request) {
+                vTaskDelay(frameTicks);
+            }
+            if (res == ESP_OK) play_closed_recording(s, path, next, frameTicks);
+            while (s->active && !s->stop_request && !getLiveRecording(&generation, &frames)) {
+                vTaskDelay(frameTicks);
+            }
+            next = 0;
+        } else {
+            ESP_LOGW(TAG_PB, "Timeshift: failed to read frame %u (%s). Skipping.", next, esp_err_to_name(res));
+            next++;
+        }
+    }
+    closeLiveReader(&live);
+}
+
+// --- Next-File Prefetch ---
+// The following file is located, opened and its first frames read one step
+// per frame interval, so the switch at the end of a file costs nothing.
+// Recordings are named YYYY-MM-DD_HH-MM-SS_... in a YYYY-MM-DD directory, so
+// the next one is the smallest name after the current file in its own day
+// directory, else the first file of the next day directory. Directories are
+// read PREFETCH_DIR_ENTRIES entries per step, and only those two are read.
+typedef enum { PREFETCH_SEARCH, PREFETCH_SEARCH_DAYS, PREFETCH_OPEN, PREFETCH_FILL, PREFETCH_READY, PREFETCH_NONE } prefetch_stage_t;
+
+typedef struct {
+    prefetch_stage_t stage;
+    std::string after;   // Search for the file following this one
+    std::string path;    // Next file, once found
+    DIR *dir;            // Directory being searched, read across steps
+    std::string dirPath;
+    std::string day;     // Next day directory, once found
+    avi_reader_t reader;
+    camera_fb_t *frames[PREFETCH_FRAMES];
+    int count;
+} prefetch_t;
+
+static void prefetch_close_dir(prefetch_t *p) {
+    if (p->dir) closedir(p->dir);
+    p->dir = NULL;
+}
+
+static void prefetch_reset(prefetch_t *p, const std::string &after) {
+    prefetch_close_dir(p);
+    avi_reader_close(&p->reader);
+    for (int i = 0; i < p->count; i++) free_playback_frame(p->frames[i]);
+    p->count = 0;
+    p->after = after;
+    p->path.clear();
+    p->stage = PREFETCH_SEARCH;
+}
+
+// YYYY-MM-DD, the directories openAvi files recordings under
+static bool is_day_dir(const char *name) {
+    if (strlen(name) != 10) return false;
+    for (int i = 0; i < 10; i++) {
+        if ((i == 4 || i == 7) ? name[i] != '-' : (name[i] < '0' || name[i] > '9')) return false;
+    }
+    return true;
+}
+
+// Reads up to PREFETCH_DIR_ENTRIES entries of the directory holding p->after,
+// keeping the smallest AVI name after it. False until the directory is done.
+static bool prefetch_scan_dir(prefetch_t *p) {
+    if (p->dir == NULL) {
+        size_t slash = p->after.rfind('/');
+        p->dirPath = (slash == std::string::npos) ? MOUNT_POINT : p->after.substr(0, slash);
+        p->path.clear();
+        p->dir = opendir(p->dirPath.c_str());
+        if (p->dir == NULL) return true;
+    }
+    for (int i = 0; i < PREFETCH_DIR_ENTRIES; i++) {
+        struct dirent *entry = readdir(p->dir);
+        if (entry == NULL) {
+            prefetch_close_dir(p);
+            return true;
+        }
+        const char *dot = strrchr(entry->d_name, '.');
+        if (entry->d_type == DT_DIR || !dot || strcasecmp(dot, ".avi") != 0) continue;
+        std::string full_path = p->dirPath + "/" + entry->d_name;
+        if (full_path != AVITEMP && full_path > p->after && (p->path.empty() || full_path < p->path)) {
+            p->path = full_path;
+        }
+    }
+    return false;
+}
+
+// Same for the day directories under MOUNT_POINT after the one holding p->after
+static bool prefetch_scan_days(prefetch_t *p) {
+    if (p->dir == NULL) {
+        p->day.clear();
+        p->dir = opendir(MOUNT_POINT);
+        if (p->dir == NULL) return true;
+    }
+    size_t slash = p->dirPath.rfind('/');
+    std::string afterDay = (p->dirPath == MOUNT_POINT || slash == std::string::npos) ? "" : p->dirPath.substr(slash + 1);
+    for (int i = 0; i < PREFETCH_DIR_ENTRIES; i++) {
+        struct dirent *entry = readdir(p->dir);
+        if (entry == NULL) {
+            prefetch_close_dir(p);
+            return true;
+        }
+        if (entry->d_type == DT_REG || !is_day_dir(entry->d_name)) continue; // Skips clips/, spool/, journal/
+        if (entry->d_name > afterDay && (p->day.empty() || entry->d_name < p->day)) p->day = entry->d_name;
+    }
+    return false;
+}
+
+static void prefetch_step(prefetch_t *p) {
+    switch (p->stage) {
+        case PREFETCH_SEARCH:
+            if (!prefetch_scan_dir(p)) break;
+            if (!p->path.empty()) {
+                ESP_LOGD(TAG_PB, "Prefetch: next file is %s", p->path.c_str());
+                p->stage = PREFETCH_OPEN;
+            } else {
+                p->stage = PREFETCH_SEARCH_DAYS; // Last file of its day
+            }
+            break;
+        case PREFETCH_SEARCH_DAYS:
+            if (!prefetch_scan_days(p)) break;
+            if (!p->day.empty()) {
+                p->after = std::string(MOUNT_POINT) + "/" + p->day + "/"; // Every file in it comes after
+                p->stage = PREFETCH_SEARCH;
+            } else {
+                p->stage = PREFETCH_NONE; // Searched again at the end of the current file
+            }
+            break;
+        case PREFETCH_OPEN:
+            if (avi_reader_open(&p->reader, p->path)) {
+                p->stage = PREFETCH_FILL;
+            } else {
+                p->after = p->path; // Unplayable, look past it
+                p->stage = PREFETCH_SEARCH;
+            }
+            break;
+        case PREFETCH_FILL: {
+            camera_fb_t *fb = NULL;
+            esp_err_t res = avi_reader_next(&p->reader, &fb);
+            if (res == ESP_OK) p->frames[p->count++] = fb;
+            if (p->count == PREFETCH_FRAMES || res == ESP_ERR_NOT_FOUND) p->stage = PREFETCH_READY;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// --- Playback Task Implementation ---
+// Finds the file a new sequence starts with: the requested one if it is a valid AVI, else the first on the card
+static bool find_start_file(playback_session_t *s, std::string &file_to_play) {
+    file_to_play.clear();
+    if (s->file[0] != '\0') {
+        ESP_LOGI(TAG_PB, "Attempting to start playback from requested file: %s", s->file);
+        struct stat st;
+        const char *dot = strrchr(s->file, '.');
+        if (stat(s->file, &st) == 0 && S_ISREG(st.st_mode)
+            && dot && strcasecmp(dot, ".avi") == 0 && strcmp(s->file, AVITEMP) != 0) {
+            file_to_play = s->file;
+            return true;
+        }
+        ESP_LOGW(TAG_PB, "Requested start file '%s' is not a valid AVI file (errno: %d). Finding first.", s->file, errno);
+    } else {
+        ESP_LOGI(TAG_PB, "No specific start file, finding first AVI file...");
+    }
+    return find_first_avi_recursive(MOUNT_POINT, file_to_play) && !file_to_play.empty();
+}
+
+// Plays consecutive files as one timeline. Frames are paced against a single
+// schedule that carries across file boundaries, and the idle part of each
+// frame interval is used to prefetch the next file.
+static void play_sequence(playback_session_t *s) {
+    std::string start_file;
+    if (!find_start_file(s, start_file)) {
+        ESP_LOGE(TAG_PB, "Could not find any AVI file to start playback. Stopping sequence.");
+        return;
+    }
+
+    avi_reader_t cur = {};
+    prefetch_t next = {};
+    camera_fb_t *carry[PREFETCH_FRAMES]; // Prefetched frames of the file just switched to
+    int carry_count = 0, carry_idx = 0;
+
+    // A bad start file falls through to the prefetcher, which looks past it
+    if (!avi_reader_open(&cur, start_file)) {
+        prefetch_reset(&next, start_file);
+    } else {
+        if (s->startFrame > 0 && start_file == s->file && !avi_reader_seek(&cur, s->startFrame)) {
+            ESP_LOGW(TAG_PB, "Cannot seek to frame %u of %s, playing it from the start", s->startFrame, s->file);
+        }
+        prefetch_reset(&next, cur.path);
+    }
+
+    TickType_t frame_ticks = pdMS_TO_TICKS(1000 / cur.fps);
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (s->active && !s->stop_request) {
+        camera_fb_t *fb = NULL;
+        esp_err_t res = ESP_ERR_NOT_FOUND;
+        if (carry_idx < carry_count) {
+            fb = carry[carry_idx++];
+            res = ESP_OK;
+        } else if (cur.pf) {
+            res = avi_reader_next(&cur, &fb);
+        }
+
+        if (res == ESP_ERR_NO_MEM) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+            continue;
+        }
+        if (res != ESP_OK) {
+            // End of the current file: switch to the prefetched one, finishing the prefetch now if it is behind
+            if (cur.pf) {
+                ESP_LOGI(TAG_PB, "Finished playing file %s (%lu frames, %lu corrupt bytes skipped)", cur.path.c_str(), cur.frames, cur.skipped);
+                avi_reader_close(&cur);
+            }
+            if (next.stage == PREFETCH_NONE) next.stage = PREFETCH_SEARCH; // A recording may have closed since
+            while (next.stage != PREFETCH_READY && next.stage != PREFETCH_NONE && s->active && !s->stop_request) {
+                prefetch_step(&next);
+            }
+            if (next.stage != PREFETCH_READY) {
+                ESP_LOGI(TAG_PB, "No subsequent AVI file found. Ending playback sequence.");
+                break;
+            }
+
+            cur = next.reader;
+            next.reader.pf = NULL; // Now owned by cur
+            next.reader.index = NULL;
+            memcpy(carry, next.frames, sizeof(carry));
+            carry_count = next.count;
+            carry_idx = 0;
+            next.count = 0;
+            prefetch_reset(&next, cur.path);
+
+            strncpy(s->file, cur.path.c_str(), sizeof(s->file) - 1);
+            s->file[sizeof(s->file) - 1] = '\0';
+            frame_ticks = pdMS_TO_TICKS(1000 / cur.fps);
+            ESP_LOGI(TAG_PB, "Continuing with %s (%u frames prefetched)", s->file, carry_count);
+            continue;
+        }
+
+        queue_playback_frame(s, fb);
+        prefetch_step(&next); // Use the rest of this frame interval
+        vTaskDelayUntil(&last_wake, frame_ticks);
+    }
+
+    if (s->stop_request) ESP_LOGI(TAG_PB, "Playback sequence stopped by request.");
+    avi_reader_close(&cur);
+    while (carry_idx < carry_count) free_playback_frame(carry[carry_idx++]);
+    prefetch_reset(&next, "");
+}
+
+void playback_task(void *pvParameters) {
+    playback_session_t *s = (playback_session_t *)pvParameters;
+    ESP_LOGI(TAG_PB, "Playback session %d reader started on Core %d", s->id, xPortGetCoreID());
+
+    while (1) {
+        ESP_LOGD(TAG_PB, "Playback task waiting for signal...");
+        if (xSemaphoreTake(s->control, portMAX_DELAY) != pdTRUE) continue;
+
+        if (s->stop_request || !s->active) {
+            ESP_LOGI(TAG_PB, "Session %d stopping (stop_req=%d, active=%d).", s->id, s->stop_request, s->active);
+        } else {
+            ESP_LOGI(TAG_PB, "Session %d received start signal (sid %u).", s->id, s->sid);
+            if (s->timeshift) {
+                timeshift_play(s);
+            } else {
+                play_sequence(s);
+            }
+        }
+
+        drain_session_queue(s); // Don't leave frames behind for a stopped session
+        s->active = false; s->stop_request = false; // Ensure flags are clear
+    }
+}
@@ -24,23 +24,22 @@
 #include <algorithm> 
 #include <sys/stat.h> 
 #include "recorder.h"
+#include "camera.h"
+#include "jpeg_inspect.h"
+#include "trace.h"
 #include <dirent.h> // For directory listing
 #include <vector>   // For storing filenames (requires C++)
 #include <string>   // For std::string (requires C++)
 #include <algorithm> // For std::sort (requires C++)
 #include <sys/stat.h> // For stat
+#include <unistd.h> // For fsync
 
 #include "peer_connection.h"
 
 static const char *TAG_AVI = "recorder";
 
 // --- Define appGlobals.h equivalents - minimal for recording ---
-#define AVI_HEADER_LEN 310
-#define CHUNK_HDR 8
-#define FILE_NAME_LEN 64 // Ensure this is defined
-#define MAX_JPEG (1024 * 1024)
 #define RAMSIZE (128 * 1024) // Buffer size for recording
-#define AVITEMP "/sdcard/avi_temp.avi"
 #define AVI_EXT "avi"
 #define FB_BUFFERS 2 // If applicable
 #define CAPTURE_STACK_SIZE 4096
@@ -49,7 +48,6 @@ static const char *TAG_AVI = "recorder";
 #define FRAMESIZE_UXGA      (13)        /*!< UXGA 1600x1200   */ // Correct index might vary
 #define STARTUP_FAIL "Startup Failed: "
 #define SF_LEN 128
-#define IDX_ENTRY 16 // bytes per index entry
 
 // --- Global Recording Variables ---
 bool forceRecord = false; // Recording enabled by setting this to true
@@ -63,11 +61,12 @@ char camModel[10] = "OV5640";
 bool ready = false;
 static uint32_t vidSize;
 static uint16_t frameCnt;
+static uint16_t vidWidth = 0, vidHeight = 0; // From the SOF of the recording's first frame
 static uint32_t startTime;
 static uint32_t wTimeTot;
 static uint32_t oTime;
 static uint32_t cTime;
-static uint16_t frameInterval; // units of 0.1ms between frames
+static uint32_t frameInterval; // us between recorded frames
 static size_t idxPtr[2]; // Index buffer pointers
 static size_t idxOffset[2]; // Offset for index entries
 static size_t moviSize[2]; // Size of 'movi' chunk (movie data)
@@ -76,26 +75,24 @@ uint8_t* iSDbuffer = NULL; // Recording buffer
 static size_t highPoint;
 static FILE* aviFile_handle = NULL; // Recording file handle
 static char aviFileName[FILE_NAME_LEN]; // Recording final filename
+static size_t bufFileOffset; // File offset that iSDbuffer[0] will be written to
+static uint32_t recGeneration = 0; // Incremented for every recording opened
+static bool recOpen = false; // Recording generation is being written (readable for timeshift)
+static time_t recStarted = 0; // Wall clock when it was opened, identifies it in the event journal
+static uint32_t closedGeneration = 0; // Last generation fully closed
+static bool closedKept = false; // Whether that recording was renamed to aviFileName
+static uint16_t closedFrames = 0; // Frames it holds
+static time_t closedAt = 0; // Wall clock when it stopped taking frames
 TaskHandle_t captureHandle = NULL;
 static SemaphoreHandle_t readSemaphore; // Original recorder semaphore (if still needed)
 SemaphoreHandle_t aviMutex = NULL;     // Mutex for AVI header/index build
 bool isCapturing = false;
 
-// --- Global Playback Variables ---
-TaskHandle_t playbackTaskHandle = NULL;
-volatile bool playback_active = false; // Indicates if playback is running
-static char current_playback_file[FILE_NAME_LEN * 2] = {0}; // Path of the file being played
-static SemaphoreHandle_t playbackControlSemaphore = NULL; // To signal start/stop to playback task
-static bool stop_playback_request = false; // Flag to signal stop request
-
 #define PIN_NUM_MISO  8
 #define PIN_NUM_MOSI  9
 #define PIN_NUM_CLK   7
 #define PIN_NUM_CS    21
 
-
-#define PLAYBACK_BUFFER_SIZE (32 * 1024) // Read buffer size for playback
-
 // Dummy STORAGE structure
 typedef struct {
     bool (*exists)(const char* path);
@@ -116,6 +113,7 @@ const uint8_t dcBuf[4] = {0x30, 0x30, 0x64, 0x63};   // 00dc
 static const uint8_t idx1Buf[4] = {0x69, 0x64, 0x78, 0x31}; // idx1
 static const uint8_t zeroBuf[4] = {0x00, 0x00, 0x00, 0x00}; // 0000
 static uint8_t* idxBuf[2] = {NULL, NULL};
+static size_t idxCap[2] = {0, 0}; // Frames idxBuf[isTL] has room for
 extern PeerConnectionState eState;
 
 // aviHeader template - from avi_generator.cpp
@@ -179,10 +177,7 @@ void rc_decrement(rc_camera_fb_t *rc_fb) {
         esp_camera_fb_return(rc_fb->fb);
         vSemaphoreDelete(rc_fb->mutex);
         vPortFree(rc_fb); // free the wrapper structure if allocated dynamically
-        
-    
-   
-        ESP_LOGI(TAG_AVI, "Frame buffer free heap space: %d bytes", esp_get_free_heap_size());
+        trace(TRACE_FB_RELEASE, esp_get_free_heap_size(), 0);
     }
 }
 
@@ -238,15 +233,17 @@ esp_err_t recorder_init() {
     sdmmc_card_print_info(stdout, card);
 
 
-    if (playbackControlSemaphore == NULL) {
-        playbackControlSemaphore = xSemaphoreCreateBinary();
-        if (playbackControlSemaphore == NULL) {
-             ESP_LOGE(TAG_AVI, "Failed to create playback control semaphore!");
-             vSemaphoreDelete(aviMutex); // Clean up previous mutex
-             aviMutex = NULL;
-             return false;
-        }
-   }
+    ret = playback_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_AVI, "Failed to create playback session resources!");
+        return ret;
+    }
+
+    ret = clip_init();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG_AVI, "Failed to create clip export resources!");
+        return ret;
+    }
 
 
     // Frame queue is created in camera_init, not here.
@@ -267,17 +264,18 @@ static void deleteTask(TaskHandle_t thisTaskHandle) {
 }
 
 void endTasks() {
-    // Stop playback if active
-    stop_playback();
-    vTaskDelay(pdMS_TO_TICKS(200)); // Give time for task to potentially stop
+    // Stop playback sessions and delete their reader tasks
+    endPlaybackTasks();
 
     // Delete tasks
     deleteTask(captureHandle);
-    deleteTask(playbackTaskHandle); // Delete playback task
 
     // Free buffers and semaphores
     if (idxBuf[0] != NULL) heap_caps_free(idxBuf[0]);
     idxBuf[0] = NULL;
+    if (idxBuf[1] != NULL) heap_caps_free(idxBuf[1]); // Clip export index
+    idxBuf[1] = NULL;
+    idxCap[0] = idxCap[1] = 0;
     if (iSDbuffer != NULL) heap_caps_free(iSDbuffer); // Recording buffer
     iSDbuffer = NULL;
 
@@ -285,8 +283,6 @@ void endTasks() {
     aviMutex = NULL;
     if (readSemaphore != NULL) vSemaphoreDelete(readSemaphore); // If used by recorder
     readSemaphore = NULL;
-     if (playbackControlSemaphore != NULL) vSemaphoreDelete(playbackControlSemaphore);
-     playbackControlSemaphore = NULL;
 
     // ... potentially unmount SD card here if appropriate ...
     ESP_LOGI(TAG_AVI, "SD card related tasks ended and resources potentially freed.");
@@ -297,9 +293,18 @@ void endTasks() {
 
 
 // --- Implement minimal set of functions for recording --- (Function implementations - same as before, but corrected byte* to uint8_t*)
+// Resizes an index buffer to hold frames entries; clips can run past maxFrames
+bool sizeAviIndex(size_t frames, bool isTL) {
+    if (idxBuf[isTL] != NULL && idxCap[isTL] == frames) return true;
+    uint8_t *buf = (uint8_t*)heap_caps_realloc(idxBuf[isTL], (frames+1)*IDX_ENTRY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buf == NULL) return false;
+    idxBuf[isTL] = buf;
+    idxCap[isTL] = frames;
+    return true;
+}
+
 void prepAviIndex(bool isTL) {
-    if (idxBuf[isTL] == NULL) idxBuf[0] = (uint8_t*)heap_caps_malloc((maxFrames+1)*IDX_ENTRY, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (idxBuf[isTL] == NULL) {
+    if ((idxBuf[isTL] == NULL || idxCap[isTL] < (size_t)maxFrames) && !sizeAviIndex(maxFrames, isTL)) {
         ESP_LOGE(TAG_AVI, "Failed to allocate index buffer");
         return;
     }
@@ -311,10 +316,10 @@ void prepAviIndex(bool isTL) {
 
 void buildAviHdr(uint8_t theFPS, uint8_t frameTypeIndex, uint16_t frameCount, bool isTL) {
     // Ensure frameTypeIndex is valid
-     if (frameTypeIndex >= sizeof(frameSizeData)/sizeof(frameSizeData[0])) {
-        ESP_LOGE(TAG_AVI,"Invalid frameTypeIndex %d for buildAviHdr", frameTypeIndex);
-        frameTypeIndex = FRAMESIZE_SVGA; // Default to SVGA
-    }
+    // frameSizeData only holds vga / svga / uxga, map the frame size onto it
+    if (frameTypeIndex == FRAMESIZE_UXGA) frameTypeIndex = 2;
+    else if (frameTypeIndex == FRAMESIZE_SVGA) frameTypeIndex = 1;
+    else frameTypeIndex = 0;
     size_t total_index_size = frameCount * IDX_ENTRY + CHUNK_HDR; // 'idx1' + size + entries
     // Size of movi data (frames + headers) + 4 bytes for 'movi' LIST identifier itself
     size_t movi_list_content_size = moviSize[isTL]; // moviSize[isTL] should hold sum of (chunk_hdr + frame_data_size)
@@ -329,7 +334,7 @@ void buildAviHdr(uint8_t theFPS, uint8_t frameTypeIndex, uint16_t frameCount, bo
     // RIFF [SIZE] AVI  LIST [hdrl_list_size] hdrl [...] LIST [movi_list_size] movi [FRAME_DATA...] idx1 [idx_size] [INDEX_DATA...]
     // Size @ offset 4: Total file size - 8 (exclude RIFF and SIZE itself)
     // Size @ offset 0x12E ('movi' LIST size): Size of 'movi' content + 4 (for 'movi' ID) - This is movi_list_total_size
-    size_t riffSize = (AVI_HEADER_LEN - 8) // Size of header structure up to 'movi' list definition, excluding 'RIFF' and initial size field
+    size_t riffSize = (AVI_HEADER_LEN - 12) // Header up to the 'movi' LIST size field, excluding 'RIFF' and its size
                      + movi_list_total_size // Size of the 'movi' list (including 'movi' ID and data)
                      + total_index_size; // Size of the index chunk (including 'idx1' ID and size)
 
@@ -344,11 +349,18 @@ void buildAviHdr(uint8_t theFPS, uint8_t frameTypeIndex, uint16_t frameCount, bo
     // Size of the 'movi' LIST chunk (including the 'movi' type identifier)
     memcpy(aviHeader+0x12E, &movi_list_total_size, 4); // LIST size for 'movi'
 
-    // Frame dimensions
-    memcpy(aviHeader+0x40, frameSizeData[frameTypeIndex].frameWidth, 2); // Width (avih)
-    memcpy(aviHeader+0xA8, frameSizeData[frameTypeIndex].frameWidth, 2); // Width (strf)
-    memcpy(aviHeader+0x44, frameSizeData[frameTypeIndex].frameHeight, 2); // Height (avih)
-    memcpy(aviHeader+0xAC, frameSizeData[frameTypeIndex].frameHeight, 2); // Height (strf)
+    // Frame dimensions, from the frames themselves when recording (clips patch in their source's)
+    if (!isTL && vidWidth && vidHeight) {
+        memcpy(aviHeader+0x40, &vidWidth, 2); // Width (avih)
+        memcpy(aviHeader+0xA8, &vidWidth, 2); // Width (strf)
+        memcpy(aviHeader+0x44, &vidHeight, 2); // Height (avih)
+        memcpy(aviHeader+0xAC, &vidHeight, 2); // Height (strf)
+    } else {
+        memcpy(aviHeader+0x40, frameSizeData[frameTypeIndex].frameWidth, 2); // Width (avih)
+        memcpy(aviHeader+0xA8, frameSizeData[frameTypeIndex].frameWidth, 2); // Width (strf)
+        memcpy(aviHeader+0x44, frameSizeData[frameTypeIndex].frameHeight, 2); // Height (avih)
+        memcpy(aviHeader+0xAC, frameSizeData[frameTypeIndex].frameHeight, 2); // Height (strf)
+    }
 
     // Reset internal counters used only during header build
     // moviSize[isTL] = idxPtr[isTL] = 0; // NO! moviSize is needed for the calculation above. Don't reset here.
@@ -376,7 +388,7 @@ void buildAviHdr(uint8_t theFPS, uint8_t frameTypeIndex, uint16_t frameCount, bo
 // }
 
 void buildAviIdx(size_t dataSize, bool isVid, bool isTL) {
-    moviSize[isTL] += dataSize;
+    moviSize[isTL] += dataSize + CHUNK_HDR;
     memcpy(idxBuf[isTL]+idxPtr[isTL], dcBuf, 4);
     memcpy(idxBuf[isTL]+idxPtr[isTL]+4, zeroBuf, 4);
     memcpy(idxBuf[isTL]+idxPtr[isTL]+8, &idxOffset[isTL], 4);
@@ -429,37 +441,15 @@ void finalizeAviIndex(uint16_t frameCnt, bool isTL) {
     idxPtr[isTL] = 0;
 }
 
-static IRAM_ATTR void frameISR(void* arg) { // Removed IRAM_ATTR from the second definition
-    BaseType_t xHigherPriorityTaskWoken = pdFALSE;
-    vTaskNotifyGiveFromISR(captureHandle, &xHigherPriorityTaskWoken); // Corrected function name - removed assignment
-    if (xHigherPriorityTaskWoken == pdTRUE) portYIELD_FROM_ISR();
-}
-
+// Recording cadence is set on the camera task's frame scheduler, which
+// decimates the live capture to FPS for captureTask.
 void controlFrameTimer(bool restartTimer) {
-    static esp_timer_handle_t frameTimer = NULL;
-
-    if (frameTimer) {
-        esp_timer_stop(frameTimer);
-        esp_timer_delete(frameTimer);
-        frameTimer = NULL;
-    }
-
     if (restartTimer) {
-        esp_timer_create_args_t frame_timer_args = {
-            .callback = &frameISR,
-            .arg = NULL,
-            .dispatch_method = ESP_TIMER_TASK,
-            .name = "frame_timer",
-            .skip_unhandled_events = false,
-        };
-        ESP_ERROR_CHECK(esp_timer_create(&frame_timer_args, &frameTimer));
-
-        frameInterval = 10000 / FPS;
-        frameInterval *= 100;
-        ESP_LOGI(TAG_AVI, "Frame timer interval %llu us for FPS %u", (uint64_t)frameInterval, FPS);
-        ESP_ERROR_CHECK(esp_timer_start_periodic(frameTimer, frameInterval));
-
-
+        frameInterval = 1000000 / FPS;
+        ESP_LOGI(TAG_AVI, "Frame timer interval %lu us for FPS %u", frameInterval, FPS);
+        frame_scheduler_set_interval(FRAME_CONSUMER_RECORD, frameInterval);
+    } else {
+        frame_scheduler_set_interval(FRAME_CONSUMER_RECORD, 0);
     }
 }
 
@@ -487,7 +477,7 @@ static void openAvi() {
         STORAGE.remove(AVITEMP);
     }
 
-    aviFile_handle = STORAGE.open(AVITEMP, "wb");
+    aviFile_handle = STORAGE.open(AVITEMP, "wb"); // Timeshift readers open their own read-only handles
     if (aviFile_handle == NULL) { /* ... error handling ... */ return; }
 
     oTime = (esp_timer_get_time() / 1000) - oTime;
@@ -511,6 +501,7 @@ static void openAvi() {
 
     long current_pos = ftell(aviFile_handle);
     ESP_LOGI(TAG_AVI, "File position after header write: %ld (Expected %d)", current_pos, AVI_HEADER_LEN);
+    bufFileOffset = AVI_HEADER_LEN;
 
     highPoint = 0;
     ESP_LOGI(TAG_AVI, "iSDbuffer highPoint initialized to: %zu", highPoint);
@@ -525,14 +516,31 @@ static void openAvi() {
          ESP_LOGW(TAG_AVI,"File size mismatch after header write!");
     }
     ESP_LOGI(TAG_AVI, "AVI header placeholder written successfully.");
+
+    // Publish the new recording to timeshift readers
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    recGeneration++;
+    recStarted = time(NULL);
+    recOpen = true;
+    xSemaphoreGive(aviMutex);
 }
 
 
+// Pushes flushed recording data through stdio and FATFS, so the read-only
+// handles of timeshift readers see the new file size and sectors
+static void syncAvi() {
+    if (fflush(aviFile_handle) != 0 || fsync(fileno(aviFile_handle)) != 0) {
+        ESP_LOGW(TAG_AVI, "Sync of %s failed, timeshift readers may lag", AVITEMP);
+    }
+}
+
 static void saveFrame(camera_fb_t* fb) {
 
     bool is_first_frame = (frameCnt == 0);
     if (is_first_frame) {
-        ESP_LOGI(TAG_AVI, "*** Processing FIRST frame ***");
+        vidWidth = fb->width;
+        vidHeight = fb->height;
+        ESP_LOGI(TAG_AVI, "*** Processing FIRST frame *** (%ux%u)", vidWidth, vidHeight);
         ESP_LOGI(TAG_AVI, "    highPoint before saveFrame: %zu", highPoint);
     }
      ESP_LOGD(TAG_AVI, "Frame %u: highPoint=%zu, fb->len=%zu", frameCnt + 1, highPoint, fb->len);
@@ -569,9 +577,11 @@ static void saveFrame(camera_fb_t* fb) {
              // Handle error (e.g., stop recording)
              return;
          }
+         syncAvi();
          // Reset buffer pointer
+         bufFileOffset += data_written;
          highPoint = 0;
-         ESP_LOGD(TAG_AVI, "Buffer flushed. New highPoint = 0. File pos = %ld", ftell(aviFile_handle));
+         trace(TRACE_REC_FLUSH, data_written, bufFileOffset);
     }
 
     // --- Add Chunk Header to Buffer ---
@@ -602,9 +612,11 @@ static void saveFrame(camera_fb_t* fb) {
                  // Handle error
                  return;
              }
+             syncAvi();
              // Reset buffer pointer
+             bufFileOffset += data_written;
              highPoint = 0;
-             ESP_LOGD(TAG_AVI, "Buffer flushed mid-frame. New highPoint = 0. File pos = %ld", ftell(aviFile_handle));
+             trace(TRACE_REC_FLUSH, data_written, bufFileOffset);
         }
     }
 
@@ -627,9 +639,11 @@ static void saveFrame(camera_fb_t* fb) {
                  // Handle error
                  return;
              }
+             syncAvi();
              // Reset buffer pointer
+             bufFileOffset += data_written;
              highPoint = 0;
-             ESP_LOGD(TAG_AVI, "Buffer flushed mid-filler. New highPoint = 0. File pos = %ld", ftell(aviFile_handle));
+             trace(TRACE_REC_FLUSH, data_written, bufFileOffset);
         }
     }
 
@@ -637,7 +651,7 @@ static void saveFrame(camera_fb_t* fb) {
     buildAviIdx(jpegChunkSize, true, false); // Index uses size *with* padding
     vidSize += total_chunk_size; // Accumulate total size written for this frame
     frameCnt++;
-    ESP_LOGD(TAG_AVI, "Frame %u finished processing. Buffer highPoint=%zu", frameCnt, highPoint);
+    trace(TRACE_REC_SAVED, frameCnt, highPoint);
 }
 
 
@@ -728,6 +742,13 @@ static bool closeAvi() {
         return false;
     }
 
+    // Timeshift readers must not touch iSDbuffer or the file handle from here on
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    recOpen = false;
+    closedFrames = frameCnt;
+    closedAt = time(NULL);
+    xSemaphoreGive(aviMutex);
+
     uint32_t closeStartTime = esp_timer_get_time();
     uint32_t vidDuration = (closeStartTime / 1000) - startTime; // Duration in ms
     uint32_t vidDurationSecs = vidDuration / 1000;
@@ -770,9 +791,8 @@ static bool closeAvi() {
     if (actualFPSint == 0 && frameCnt > 0) actualFPSint = 1; // Avoid 0 FPS if frames exist
 
     // Update AVI header with final values (frame count, FPS, sizes)
-    xSemaphoreTake(aviMutex, portMAX_DELAY); // Protect header generation if needed elsewhere
+    xSemaphoreTake(aviMutex, portMAX_DELAY); // aviHeader is shared with clip export
     buildAviHdr(actualFPSint, fsizePtr, frameCnt, false);
-    xSemaphoreGive(aviMutex);
 
     // Seek to beginning and rewrite the header
     ESP_LOGI(TAG_AVI, "Seeking to file start to rewrite header...");
@@ -788,6 +808,7 @@ static bool closeAvi() {
             ESP_LOGI(TAG_AVI, "AVI header rewritten successfully.");
         }
     }
+    xSemaphoreGive(aviMutex);
 
     // Close the file handle
     ESP_LOGI(TAG_AVI, "Closing file handle.");
@@ -865,10 +886,129 @@ static bool closeAvi() {
     }
     if (!checkFreeStorage()) doRecording = false; // Check space after recording
 
+    // Tell timeshift readers where the rest of this recording went
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    closedGeneration = recGeneration;
+    closedKept = renamed;
+    xSemaphoreGive(aviMutex);
+
     return renamed; // Return true if file was successfully recorded and renamed
 }
 
 
+// --- Timeshift: reading the recording in progress ---
+bool getLiveRecording(uint32_t *generation, uint16_t *frames) {
+    if (aviMutex == NULL) return false;
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    bool open = recOpen;
+    if (open) {
+        *generation = recGeneration;
+        *frames = frameCnt;
+    }
+    xSemaphoreGive(aviMutex);
+    return open;
+}
+
+bool getRecordingPosition(time_t *started, uint16_t *frame) {
+    if (aviMutex == NULL) return false;
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    bool open = recOpen;
+    if (open) {
+        *started = recStarted;
+        *frame = frameCnt;
+    }
+    xSemaphoreGive(aviMutex);
+    return open;
+}
+
+esp_err_t readLiveFrame(live_reader_t *reader, uint32_t generation, uint16_t frameNum, uint8_t *buf, size_t bufSize, size_t *frameLen) {
+    if (aviMutex == NULL) return ESP_ERR_INVALID_STATE;
+    esp_err_t res = ESP_OK;
+    size_t dataPos = 0, fromFile = 0, synced = 0;
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    if (!recOpen || generation != recGeneration) {
+        res = ESP_ERR_INVALID_STATE; // Closed, rest is in the renamed file
+    } else if (frameNum >= frameCnt) {
+        res = ESP_ERR_NOT_FINISHED; // Caught up with the camera
+    } else {
+        // Locate the frame from its idx1 entry (offset is relative to the 'movi' fourcc)
+        uint32_t offset, size;
+        memcpy(&offset, idxBuf[0] + CHUNK_HDR + frameNum * IDX_ENTRY + 8, 4);
+        memcpy(&size, idxBuf[0] + CHUNK_HDR + frameNum * IDX_ENTRY + 12, 4);
+        *frameLen = size;
+        if (buf != NULL && size > bufSize) {
+            res = ESP_ERR_INVALID_SIZE;
+        } else if (buf != NULL) {
+            dataPos = AVI_HEADER_LEN - 4 + offset + CHUNK_HDR;
+            synced = bufFileOffset;
+            if (dataPos < bufFileOffset) fromFile = std::min((size_t)size, bufFileOffset - dataPos);
+            // Newest frames are still in the unflushed recording buffer
+            if (fromFile < size) {
+                memcpy(buf + fromFile, iSDbuffer + (dataPos + fromFile - bufFileOffset), size - fromFile);
+            }
+        }
+    }
+    xSemaphoreGive(aviMutex);
+    if (res != ESP_OK || buf == NULL || fromFile == 0) return res;
+
+    // The flushed part is read without the lock: bytes below bufFileOffset
+    // never change, and saveFrame syncs them before moving bufFileOffset
+    if (reader->pf && (reader->generation != generation || reader->readable < dataPos + fromFile)) {
+        closeLiveReader(reader); // Opened before these bytes were synced
+    }
+    if (reader->pf == NULL) {
+        reader->pf = fopen(AVITEMP, "rb");
+        // A close and a new openAvi may have replaced AVITEMP since the lock was released
+        xSemaphoreTake(aviMutex, portMAX_DELAY);
+        bool same = recOpen && generation == recGeneration;
+        xSemaphoreGive(aviMutex);
+        if (reader->pf == NULL || !same) {
+            closeLiveReader(reader);
+            return ESP_ERR_INVALID_STATE;
+        }
+        reader->generation = generation;
+        reader->readable = synced;
+    }
+    if (fseek(reader->pf, dataPos, SEEK_SET) != 0 || fread(buf, 1, fromFile, reader->pf) != fromFile) return ESP_FAIL;
+    return ESP_OK;
+}
+
+void closeLiveReader(live_reader_t *reader) {
+    if (reader->pf) fclose(reader->pf);
+    reader->pf = NULL;
+}
+
+esp_err_t getClosedRecording(uint32_t generation, char *path, size_t pathLen) {
+    if (aviMutex == NULL) return ESP_ERR_INVALID_STATE;
+    esp_err_t res = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    if (generation == recGeneration && recOpen) res = ESP_ERR_INVALID_STATE; // Still recording
+    else if (generation > closedGeneration) res = ESP_ERR_NOT_FINISHED; // Still closing
+    else if (generation < closedGeneration) res = ESP_ERR_NOT_FOUND; // A newer recording has closed since
+    else if (closedKept) {
+        snprintf(path, pathLen, "%s", aviFileName);
+        res = ESP_OK;
+    }
+    xSemaphoreGive(aviMutex);
+    return res;
+}
+
+esp_err_t getPreviousRecording(uint32_t generation, char *path, size_t pathLen, uint16_t *frames) {
+    if (aviMutex == NULL) return ESP_ERR_INVALID_STATE;
+    esp_err_t res = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(aviMutex, portMAX_DELAY);
+    // Only a rollover counts: the live recording must have opened as this one closed
+    if (recOpen && generation == recGeneration && closedGeneration == generation - 1 && closedKept
+        && recStarted - closedAt <= TIMESHIFT_ROLLOVER_GAP_S) {
+        snprintf(path, pathLen, "%s", aviFileName);
+        *frames = closedFrames;
+        res = ESP_OK;
+    }
+    xSemaphoreGive(aviMutex);
+    return res;
+}
+
+
 static bool processFrame(camera_fb_t* fb) {
     static bool wasCapturing = false;
     bool finishRecording = false;
@@ -878,10 +1018,15 @@ static bool processFrame(camera_fb_t* fb) {
         return false;
     }
 
-    if (fb->len < 4 || fb->buf[0] != 0xFF || fb->buf[1] != 0xD8) {
-        ESP_LOGE(TAG_AVI, "Corrupted JPEG: NO SOI marker");
+    jpeg_info_t info;
+    int jpegRes = jpeg_inspect(fb->buf, fb->len, JPEG_INSPECT_SCAN, &info);
+    if (jpegRes != JPEG_OK) {
+        ESP_LOGE(TAG_AVI, "Corrupted JPEG (%s), not recorded", jpeg_inspect_err_name(jpegRes));
         return false; // Do NOT call esp_camera_fb_return here
     }
+    fb->len = info.len; // Driver padding after EOI isn't worth SD space
+    fb->width = info.width;
+    fb->height = info.height;
 
     isCapturing = forceRecord || doRecording;
     if (isCapturing && !wasCapturing) {
@@ -890,7 +1035,9 @@ static bool processFrame(camera_fb_t* fb) {
         wasCapturing = true;
     }
     if (isCapturing) {
+        xSemaphoreTake(aviMutex, portMAX_DELAY); // Buffer and index are read by timeshift sessions
         saveFrame(fb);
+        xSemaphoreGive(aviMutex);
         if (frameCnt >= maxFrames) {
             ESP_LOGI(TAG_AVI, "Auto closed recording after %u frames", maxFrames);
             forceRecord = false;
@@ -908,46 +1055,25 @@ static bool processFrame(camera_fb_t* fb) {
     return true;
 }
 
+// Blocks on the recording queue; the camera task decides when frames arrive
 static void captureTask(void* parameter) {
     forceRecord = true;
-    const TickType_t EVENT_INTERVAL = pdMS_TO_TICKS(1000);  // e.g. 5 s between uploads
-    TickType_t         last_event_tick = 0;
 
-    
     while (true) {
-        TickType_t now = xTaskGetTickCount();
-        if(eState == PEER_CONNECTION_CONNECTED) {
-            last_event_tick = xTaskGetTickCount();
-        } else if (eState == PEER_CONNECTION_DISCONNECTED) {
-            last_event_tick = 0;
-        }
         camera_fb_t* fb = NULL;
-        ESP_LOGI(TAG_AVI, "captureTask waiting for frame");
-        
-        if((eState != PEER_CONNECTION_CHECKING)|| (eState == PEER_CONNECTION_CONNECTED && ((now - last_event_tick) >= EVENT_INTERVAL))) {   
-            if (xQueueReceive(recordingQueue, &fb, portMAX_DELAY) == pdTRUE) {
-             
-                    ESP_LOGI(TAG_AVI, "Frame received in captureTask");
-                    if (fb != NULL) {
-                        ESP_LOGI(TAG_AVI, "Received frame, len: %u", fb->len);
-                        if (processFrame(fb)) {
-                            ESP_LOGI(TAG_AVI, "Frame processed successfully");
-                        } else {
-                            ESP_LOGW(TAG_AVI, "Failed to process frame");
-                        }
-                        heap_caps_free(fb->buf); // Free only here
-                        heap_caps_free(fb);      // Free only here
-                    } else {
-                        ESP_LOGW(TAG_AVI, "Received NULL frame from queue");
-                    }
-                   // xSemaphoreGive(xSemaphore);
-                } else {
-                    ESP_LOGW(TAG_AVI, "Failed to take readSemaphore in captureTask");
-                }
-                
-            
+        trace(TRACE_REC_WAIT, 0, 0);
+        if (xQueueReceive(recordingQueue, &fb, portMAX_DELAY) != pdTRUE) continue;
+
+        if (fb != NULL) {
+            trace(TRACE_REC_FRAME, fb->len, 0);
+            if (!processFrame(fb)) {
+                ESP_LOGW(TAG_AVI, "Failed to process frame");
+            }
+            heap_caps_free(fb->buf); // Free only here
+            heap_caps_free(fb);      // Free only here
+        } else {
+            ESP_LOGW(TAG_AVI, "Received NULL frame from queue");
         }
-        vTaskDelay(pdMS_TO_TICKS(1)); // Avoid busy waiting
     }
     vTaskDelete(NULL);
 }
@@ -994,8 +1120,6 @@ bool prepRecording() {
         return false;
     }
 
-    // Initialize Playback Semaphore
-    
     // Allocate buffer used for *recording*
     if (iSDbuffer == NULL) { // Allocate only if not already allocated
         iSDbuffer = (uint8_t*)heap_caps_malloc((RAMSIZE + CHUNK_HDR) * 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
@@ -1003,8 +1127,6 @@ bool prepRecording() {
             ESP_LOGE(TAG_AVI, "Failed to allocate iSDbuffer for recording in PSRAM!");
             vSemaphoreDelete(aviMutex); // Clean up
             aviMutex = NULL;
-            vSemaphoreDelete(playbackControlSemaphore);
-            playbackControlSemaphore = NULL;
             return false; // Indicate failure
         }
         ESP_LOGI(TAG_AVI, "Recording iSDbuffer allocated in PSRAM");
@@ -1014,7 +1136,7 @@ bool prepRecording() {
 
 
     startSDtasks(); // Creates captureTask (which handles recording)
-    // Note: Playback task is created separately in app_main.c
+    // Note: Playback reader tasks are created on demand by start_playback()
 
     ESP_LOGI(TAG_AVI, "Camera model %s ready @ %uMHz", camModel, xclkMhz);
     debugMemory("prepRecording");
@@ -1109,611 +1231,3 @@ bool STORAGE_mkdir(const char* path) {
 }
 
 // Assign function pointers
-
-
-
-void start_playback(const char *filename) {
-    if (playback_active) {
-        ESP_LOGW(TAG_AVI, "Playback already active. Stop current playback first.");
-        // stop_playback(); // Consider adding stop here if desired behavior
-        // vTaskDelay(pdMS_TO_TICKS(100));
-         return; // Don't allow starting if already active
-    }
-
-    // Check if recording is active - potentially prevent playback?
-    // if (isCapturing) { ESP_LOGW(TAG_AVI,"Cannot start playback while recording is active."); return; }
-
-
-    if (filename && strlen(filename) > 0 && strlen(filename) < sizeof(current_playback_file)) {
-        strncpy(current_playback_file, filename, sizeof(current_playback_file) - 1);
-        current_playback_file[sizeof(current_playback_file) - 1] = '\0';
-        ESP_LOGI(TAG_AVI, "Requesting playback start specifically for: %s", current_playback_file);
-    } else {
-        current_playback_file[0] = '\0'; // Clear specific file request
-        ESP_LOGI(TAG_AVI, "Requesting playback start from the beginning.");
-    }
-
-    stop_playback_request = false;
-    playback_active = true; // Set flag before signaling
-
-    // Ensure playback task exists
-    if(playbackTaskHandle == NULL) {
-        ESP_LOGI(TAG_AVI,"Playback task not running, creating it.");
-        BaseType_t taskCreated = xTaskCreatePinnedToCore(
-                                        playback_task,
-                                        "playbackTask",
-                                        6 * 1024, // Increased stack size for C++ strings/vector etc.
-                                        NULL,
-                                        5, // Priority
-                                        &playbackTaskHandle,
-                                        1); // Core 1
-        if(taskCreated != pdPASS) {
-             ESP_LOGE(TAG_AVI,"Failed to create playback task!");
-             playback_active = false; // Reset flag
-             return;
-        }
-        vTaskDelay(pdMS_TO_TICKS(10)); // Small delay for task setup
-    }
-
-    if (playbackControlSemaphore != NULL) {
-        xSemaphoreGive(playbackControlSemaphore); // Signal the task to start/continue
-    } else {
-        ESP_LOGE(TAG_AVI, "Playback control semaphore not initialized! Cannot start.");
-        playback_active = false; // Reset flag on error
-    }
-}
-void stop_playback() {
-    if (playback_active) {
-        ESP_LOGI(TAG_AVI, "Requesting playback stop.");
-        stop_playback_request = true;
-        if (playbackControlSemaphore != NULL) {
-             xSemaphoreGive(playbackControlSemaphore); // Wake task if waiting
-        }
-        // Note: playback_active flag is cleared by the playback task itself when it stops
-    } else {
-        ESP_LOGI(TAG_AVI, "Stop playback requested, but not active.");
-    }
-}
-
-// --- Helper Function to Get Sorted AVI Files ---
-bool get_sorted_avi_files(const char *dir_path_to_scan, const char *requested_start_file, std::vector<std::string> &files, int current_index_ref) {
-    files.clear();
-    current_index_ref = -1; // Initialize index before search
-
-    ESP_LOGI(TAG_AVI, "Scanning directory: %s for AVI files", dir_path_to_scan);
-    DIR *dir = opendir(dir_path_to_scan);
-    if (!dir) {
-        ESP_LOGE(TAG_AVI, "Failed to open directory: %s", dir_path_to_scan);
-        return false;
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        std::string entry_name = entry->d_name;
-        std::string full_path = std::string(dir_path_to_scan) + "/" + entry_name;
-
-        // Skip "." and ".." entries
-        if (entry_name == "." || entry_name == "..") {
-            continue;
-        }
-
-        struct stat st;
-        if (stat(full_path.c_str(), &st) == 0) {
-            if (S_ISREG(st.st_mode)) { // It's a file
-                const char *dot = strrchr(entry->d_name, '.');
-                if (dot && strcasecmp(dot, ".avi") == 0) { // Case-insensitive check
-                    if (full_path != AVITEMP) { // Skip temporary file
-                        files.push_back(full_path);
-                        ESP_LOGD(TAG_AVI, "Found AVI file: %s", full_path.c_str());
-                    } else {
-                        ESP_LOGD(TAG_AVI, "Skipping temporary file: %s", full_path.c_str());
-                    }
-                }
-            } else if (S_ISDIR(st.st_mode)) {
-                 // --- Recursive Call to Scan Subdirectories ---
-                 ESP_LOGD(TAG_AVI,"Entering subdirectory: %s", full_path.c_str());
-                 // Note: current_index_ref passed here is not used by the recursive call result directly
-                 get_sorted_avi_files(full_path.c_str(), requested_start_file, files, current_index_ref);
-                 // The files vector is appended by the recursive call.
-                 // The current_index_ref might get overwritten, reset it after recursion if needed.
-                 current_index_ref = -1; // Reset index after recursion returns (will be found later)
-            }
-        } else {
-             ESP_LOGW(TAG_AVI,"Failed to get stat for: %s", full_path.c_str());
-        }
-    }
-    closedir(dir);
-
-    // Only sort and proceed if we are at the top-level call (or handle sorting differently)
-    // For simplicity, let's sort the entire accumulated list here.
-    if (files.empty()) {
-        ESP_LOGW(TAG_AVI, "No AVI files found in %s or subdirectories (excluding temp)", dir_path_to_scan);
-        return false;
-    }
-
-    std::sort(files.begin(), files.end());
-    ESP_LOGI(TAG_AVI, "Found and sorted %d total AVI files.", files.size());
-    for(size_t i = 0; i < files.size(); ++i) {
-        ESP_LOGD(TAG_AVI, "Sorted List [%zu]: %s", i, files[i].c_str());
-    }
-
-
-    // --- Find Index Logic (after collecting all files) ---
-    ESP_LOGI(TAG_AVI, "Searching for starting file: %s", requested_start_file ? requested_start_file : "NULL (start from beginning)");
-    if (requested_start_file && strlen(requested_start_file) > 0) {
-        for (size_t i = 0; i < files.size(); ++i) {
-            if (files[i] == requested_start_file) {
-                current_index_ref = i; // Found it!
-                ESP_LOGI(TAG_AVI, "Requested starting file found at index: %d", current_index_ref);
-                break;
-            }
-        }
-    }
-
-    // If not found or not requested, default to index 0
-    if (current_index_ref == -1) {
-        if (requested_start_file && strlen(requested_start_file) > 0) {
-            ESP_LOGW(TAG_AVI, "Requested start file '%s' not found in collected list. Starting from index 0.", requested_start_file);
-        } else {
-            ESP_LOGI(TAG_AVI, "No specific start file requested or file not found. Starting from index 0.");
-        }
-        if (!files.empty()) {
-            current_index_ref = 0;
-            // Update the global current_playback_file to reflect the actual start
-            strncpy(current_playback_file, files[0].c_str(), sizeof(current_playback_file) - 1);
-            current_playback_file[sizeof(current_playback_file) - 1] = '\0';
-            ESP_LOGI(TAG_AVI, "Set current_playback_file to: %s", current_playback_file);
-        } else {
-             ESP_LOGE(TAG_AVI,"Cannot set index 0, file list is empty!");
-             return false; // Cannot proceed
-        }
-    }
-
-    // Final validation
-    if (current_index_ref < 0 || current_index_ref >= (int)files.size()) {
-        ESP_LOGE(TAG_AVI, "Final calculated index %d is invalid for file list size %d", current_index_ref, files.size());
-        return false;
-    }
-
-    return true;
-}
-
-
-// --- Playback Task Implementation ---
-static bool find_first_avi_recursive(const char* dir_path, std::string& first_file_found) {
-    bool found_any = false;
-    ESP_LOGD(TAG_AVI, "find_first: Scanning %s", dir_path);
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        ESP_LOGE(TAG_AVI, "find_first: Failed to open directory: %s", dir_path);
-        return false;
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        std::string entry_name = entry->d_name;
-        // Construct full path safely, avoid double slashes if dir_path is "/"
-        std::string full_path;
-        if (strcmp(dir_path, "/") == 0) {
-            full_path = std::string("/") + entry_name;
-        } else {
-            full_path = std::string(dir_path) + "/" + entry_name;
-        }
-
-
-        if (entry_name == "." || entry_name == "..") continue;
-
-        struct stat st;
-        // Add small delay to yield CPU during intensive scanning
-        // vTaskDelay(pdMS_TO_TICKS(1)); // Uncomment if needed, might slow down scan significantly
-
-        if (stat(full_path.c_str(), &st) == 0) {
-            if (S_ISREG(st.st_mode)) {
-                const char *dot = strrchr(entry->d_name, '.');
-                if (dot && strcasecmp(dot, ".avi") == 0 && full_path != AVITEMP) {
-                    // Check if this file is the first found OR lexicographically smaller than the current best
-                    if (first_file_found.empty() || full_path < first_file_found) {
-                        ESP_LOGD(TAG_AVI, "find_first: Found candidate: %s", full_path.c_str());
-                        first_file_found = full_path;
-                        found_any = true;
-                    }
-                }
-            } else if (S_ISDIR(st.st_mode)) {
-                // Recurse - update first_file_found if a smaller one is found in subdirectory
-                if (find_first_avi_recursive(full_path.c_str(), first_file_found)) {
-                    found_any = true; // Found something in the subdirectory tree
-                }
-            }
-        } else {
-            ESP_LOGW(TAG_AVI, "find_first: Failed to get stat for %s (errno: %d)", full_path.c_str(), errno);
-            // Continue scanning other files
-        }
-    }
-    closedir(dir);
-    return found_any;
-}
-
-// --- Helper Function to Find the NEXT AVI File ---
-// Searches dir_path recursively for the smallest AVI file path that is lexicographically *greater than* current_file.
-// Updates next_file_found if such a file is discovered and is better than the current next_file_found.
-static bool find_next_avi_recursive(const char* dir_path, const std::string& current_file, std::string& next_file_found) {
-    bool found_candidate_in_this_level_or_below = false; // Found *any* valid candidate in this path or subdirs?
-    ESP_LOGD(TAG_AVI, "find_next: Scanning %s (current: %s, current_next: %s)",
-             dir_path, current_file.c_str(), next_file_found.empty() ? "<none>" : next_file_found.c_str());
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        ESP_LOGE(TAG_AVI, "find_next: Failed to open directory: %s", dir_path);
-        return false;
-    }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        std::string entry_name = entry->d_name;
-        std::string full_path;
-        if (strcmp(dir_path, "/") == 0) {
-            full_path = std::string("/") + entry_name;
-        } else {
-            full_path = std::string(dir_path) + "/" + entry_name;
-        }
-
-        if (entry_name == "." || entry_name == "..") continue;
-
-        struct stat st;
-        // vTaskDelay(pdMS_TO_TICKS(1)); // Optional delay
-
-        if (stat(full_path.c_str(), &st) == 0) {
-            if (S_ISREG(st.st_mode)) {
-                const char *dot = strrchr(entry->d_name, '.');
-                if (dot && strcasecmp(dot, ".avi") == 0 && full_path != AVITEMP) {
-                    // Condition: Found file must be > current_file
-                    // AND it must be better than the current best 'next_file_found'
-                    // (i.e., < next_file_found OR next_file_found is still empty)
-                    if (full_path > current_file && (next_file_found.empty() || full_path < next_file_found)) {
-                         ESP_LOGD(TAG_AVI, "find_next: Found new candidate: %s", full_path.c_str());
-                         next_file_found = full_path; // Update the best candidate found so far
-                         found_candidate_in_this_level_or_below = true;
-                    }
-                }
-            } else if (S_ISDIR(st.st_mode)) {
-                // Recurse - next_file_found is passed by reference and updated if a better candidate exists in the subtree
-                 if (find_next_avi_recursive(full_path.c_str(), current_file, next_file_found)) {
-                    // If the recursive call found/updated the candidate, mark it for the return value
-                    found_candidate_in_this_level_or_below = true;
-                 }
-            }
-        } else {
-             ESP_LOGW(TAG_AVI, "find_next: Failed to get stat for %s (errno: %d)", full_path.c_str(), errno);
-        }
-    }
-    closedir(dir);
-    // Return true if 'next_file_found' was potentially updated (or already held a valid candidate)
-    // during the scan of this directory level or its subdirectories.
-    return found_candidate_in_this_level_or_below || !next_file_found.empty();
-}
-
-
-// --- Playback Task Implementation (Modified to Find 'movi') ---
-void playback_task(void *pvParameters) {
-    ESP_LOGI(TAG_AVI, "Playback Task Started (Header Read, Iterative Find) on Core %d", xPortGetCoreID());
-
-    // Use a smaller buffer just for reading headers/chunks initially. Frame data read directly later.
-    uint8_t *temp_buffer = (uint8_t *)heap_caps_malloc(1024, MALLOC_CAP_DEFAULT); // Smaller buffer for headers
-    if (!temp_buffer) {
-        ESP_LOGE(TAG_AVI, "Failed alloc temp_buffer!"); playbackTaskHandle = NULL; vTaskDelete(NULL); return;
-    }
-
-    std::string file_to_play_str; // Current file being processed
-    bool first_file_in_sequence = true; // Is this the first file after a start signal?
-
-    while (1) {
-        ESP_LOGD(TAG_AVI, "Playback task waiting for signal...");
-        if (xSemaphoreTake(playbackControlSemaphore, portMAX_DELAY) == pdTRUE) {
-            if (stop_playback_request || !playback_active) {
-                ESP_LOGI(TAG_AVI, "Playback task stopping (stop_req=%d, active=%d).", stop_playback_request, playback_active);
-                playback_active = false; stop_playback_request = false;
-                file_to_play_str.clear(); // Clear current file on stop
-                first_file_in_sequence = true; // Reset for next start
-                continue;
-            }
-
-            ESP_LOGI(TAG_AVI, "Playback task received start signal.");
-
-            // --- File Sequencing Loop (Iterative) ---
-            while (playback_active && !stop_playback_request) {
-
-                // --- Find the file to play for this iteration ---
-                if (first_file_in_sequence) {
-                    // Logic to find the starting file (first available or specific requested)
-                    first_file_in_sequence = false;
-                    bool file_found;
-                    file_to_play_str.clear();
-
-                    if (current_playback_file[0] != '\0') {
-                         ESP_LOGI(TAG_AVI,"Attempting to start playback from requested file: %s", current_playback_file);
-                         struct stat st;
-                         if (stat(current_playback_file, &st) == 0 && S_ISREG(st.st_mode)) {
-                             const char *dot = strrchr(current_playback_file, '.');
-                              if (dot && strcasecmp(dot, ".avi") == 0 && strcmp(current_playback_file, AVITEMP) != 0) {
-                                 file_to_play_str = current_playback_file;
-                                 file_found = true;
-                              } else {
-                                  ESP_LOGW(TAG_AVI, "Requested start file '%s' is not a valid AVI file. Finding first.", current_playback_file);
-                                  file_found = find_first_avi_recursive(MOUNT_POINT, file_to_play_str);
-                              }
-                         } else {
-                              ESP_LOGW(TAG_AVI, "Requested start file '%s' not found or not a file (errno: %d). Finding first.", current_playback_file, errno);
-                              file_found = find_first_avi_recursive(MOUNT_POINT, file_to_play_str);
-                         }
-                     } else {
-                         ESP_LOGI(TAG_AVI, "No specific start file, finding first AVI file...");
-                         file_found = find_first_avi_recursive(MOUNT_POINT, file_to_play_str);
-                     }
-
-                     if (!file_found || file_to_play_str.empty()) {
-                         ESP_LOGE(TAG_AVI, "Could not find any AVI file to start playback. Stopping sequence.");
-                         playback_active = false; stop_playback_request = false;
-                         first_file_in_sequence = true;
-                         break; // Exit file sequencing loop
-                     }
-                     // Update global current_playback_file if search was used or requested file was invalid
-                     if (strcmp(current_playback_file, file_to_play_str.c_str()) != 0) {
-                          strncpy(current_playback_file, file_to_play_str.c_str(), sizeof(current_playback_file) - 1);
-                          current_playback_file[sizeof(current_playback_file) - 1] = '\0';
-                     }
-                     ESP_LOGI(TAG_AVI, "Actual playback starting with file: %s", current_playback_file);
-
-                } else {
-                    // Find the *next* file after the one just played (file_to_play_str)
-                    std::string next_file = "";
-                    ESP_LOGI(TAG_AVI, "Finding next AVI file after: %s", file_to_play_str.c_str());
-                    if (find_next_avi_recursive(MOUNT_POINT, file_to_play_str, next_file) && !next_file.empty()) {
-                        file_to_play_str = next_file;
-                        strncpy(current_playback_file, file_to_play_str.c_str(), sizeof(current_playback_file) - 1);
-                        current_playback_file[sizeof(current_playback_file) - 1] = '\0';
-                        ESP_LOGI(TAG_AVI, "Found next file: %s", file_to_play_str.c_str());
-                    } else {
-                        ESP_LOGI(TAG_AVI, "No subsequent AVI file found. Ending playback sequence.");
-                        playback_active = false; stop_playback_request = false;
-                        first_file_in_sequence = true;
-                        break; // Exit file sequencing loop
-                    }
-                }
-
-                // --- Current File Playback Logic ---
-                ESP_LOGI(TAG_AVI, "Attempting to play: %s", file_to_play_str.c_str());
-                FILE *pf = fopen(file_to_play_str.c_str(), "rb");
-                if (!pf) {
-                    ESP_LOGE(TAG_AVI, "Failed to open playback file: %s (errno: %d). Skipping.", file_to_play_str.c_str(), errno);
-                    // Loop continues to find the *next* file after this one
-                    continue;
-                }
-                ESP_LOGI(TAG_AVI, "Successfully opened: %s", file_to_play_str.c_str());
-                uint32_t frame_count_in_file = 0; // Reset frame counter for this file
-
-                // --- Read Header & Extract FPS ---
-                uint32_t recorded_fps = 10; // Default FPS
-                uint32_t frame_delay_ms = 100; // Default delay
-                size_t header_read = fread(temp_buffer, 1, AVI_HEADER_LEN, pf);
-                if (header_read >= 0x84 + 1) { // Need at least offset 0x84 + 1 byte
-                    recorded_fps = temp_buffer[0x84]; // Read FPS byte from strh chunk
-                    if (recorded_fps == 0 || recorded_fps > 60) { // Sanity check
-                        ESP_LOGW(TAG_AVI, "Invalid FPS %u read from header, using default 10", recorded_fps);
-                        recorded_fps = 10;
-                    }
-                    frame_delay_ms = (recorded_fps > 0) ? (1000 / recorded_fps) : 100;
-                    ESP_LOGI(TAG_AVI, "FPS from header: %u, Frame delay: %lu ms", recorded_fps, frame_delay_ms);
-                } else {
-                    ESP_LOGW(TAG_AVI, "Could not read enough header bytes (%zu) to determine FPS. Using default %u.", header_read, recorded_fps);
-                }
-
-                // --- Locate 'movi' chunk ---
-                bool movi_found = false;
-                long movi_start_offset = -1;
-                uint32_t chunk_id = 0;
-                uint32_t chunk_size = 0;
-                uint32_t list_type = 0;
-
-                // Start searching after the RIFF 'AVI ' header (offset 12)
-                if (fseek(pf, 12, SEEK_SET) != 0) {
-                    ESP_LOGE(TAG_AVI, "Failed to seek past RIFF header in %s", file_to_play_str.c_str());
-                    fclose(pf); continue; // Try next file
-                }
-                ESP_LOGD(TAG_AVI,"Searching for 'movi' LIST chunk starting at offset 12...");
-                long current_pos = 12;
-
-                while (current_pos < STORAGE_size(pf)) { // Avoid reading past EOF
-                     ESP_LOGD(TAG_AVI, "Current file position for chunk search: %ld", current_pos);
-                     if (fseek(pf, current_pos, SEEK_SET) != 0) {
-                         ESP_LOGE(TAG_AVI, "Seek error during movi search to pos %ld", current_pos);
-                         break;
-                     }
-
-                     if (fread(&chunk_id, 1, 4, pf) != 4) { ESP_LOGE(TAG_AVI,"Failed read chunk ID at %ld", current_pos); break; }
-                     if (fread(&chunk_size, 1, 4, pf) != 4) { ESP_LOGE(TAG_AVI,"Failed read chunk size at %ld", current_pos+4); break; }
-                     current_pos += 8; // Advance past ID and size
-
-                    // AVI uses little-endian, ESP32 is little-endian. Direct comparison *should* work if constants are defined correctly.
-                    // Let's define constants as little-endian numerical values.
-                    #define CHUNK_ID_LIST 0x5453494C // 'LIST' in little-endian
-                    #define CHUNK_ID_MOVI 0x69766F6D // 'movi' in little-endian
-                    #define CHUNK_ID_HDRL 0x6C726468 // 'hdrl' in little-endian
-                    #define CHUNK_ID_00DC 0x63643030 // '00dc' in little-endian
-
-                    ESP_LOGD(TAG_AVI, "Read Chunk: ID=0x%08lX, Size=%lu at offset %ld", chunk_id, chunk_size, current_pos - 8);
-
-                    if (chunk_id == CHUNK_ID_LIST) { // "LIST"
-                        if (fread(&list_type, 1, 4, pf) != 4) { ESP_LOGE(TAG_AVI,"Failed read LIST type at %ld", current_pos); break; }
-                        current_pos += 4; // Advance past list type
-
-                        ESP_LOGD(TAG_AVI, "  List Type: 0x%08lX", list_type);
-                        if (list_type == CHUNK_ID_MOVI) { // "movi"
-                            ESP_LOGI(TAG_AVI, "'movi' LIST chunk found! Header size: %lu. Data starts at offset %ld", chunk_size, current_pos);
-                            movi_found = true;
-                            movi_start_offset = current_pos; // This is the offset *after* 'LIST', size, and 'movi' ID
-                            break; // Exit search loop
-                        } else {
-                            // It's some other LIST (like 'hdrl'). Skip its content.
-                            // The size (chunk_size) includes the 4 bytes for the list_type we just read.
-                            ESP_LOGD(TAG_AVI, "Skipping content of LIST type 0x%08lX (size %lu bytes)", list_type, chunk_size - 4);
-                            current_pos += (chunk_size - 4); // Move pointer to the end of this LIST's data
-                        }
-                    } else {
-                        // It's a regular chunk (not a LIST). Skip its content.
-                        ESP_LOGD(TAG_AVI, "Skipping content of Chunk ID 0x%08lX (size %lu bytes)", chunk_id, chunk_size);
-                        current_pos += chunk_size; // Move pointer to the end of this chunk's data
-                    }
-
-                     // Word align the position for the next chunk read
-                     if (current_pos % 2 != 0) {
-                         ESP_LOGD(TAG_AVI, "Adjusting position by 1 byte for word alignment from %ld", current_pos);
-                         current_pos++;
-                     }
-                } // End while searching for movi
-
-                if (!movi_found || movi_start_offset < 0) {
-                    ESP_LOGE(TAG_AVI, "'movi' chunk not found or error occurred in %s. Skipping file.", file_to_play_str.c_str());
-                    fclose(pf);
-                    continue; // Try next file
-                }
-
-                // --- Frame Reading Loop ---
-                ESP_LOGI(TAG_AVI,"Starting frame reading from file offset %ld", movi_start_offset);
-                if(fseek(pf, movi_start_offset, SEEK_SET) != 0) {
-                     ESP_LOGE(TAG_AVI, "Failed to seek to movi start offset %ld!", movi_start_offset);
-                     fclose(pf); continue; // Try next file
-                }
-                current_pos = movi_start_offset; // Track position within movi data
-
-                while (playback_active && !stop_playback_request) {
-                    uint8_t frame_chunk_header[CHUNK_HDR];
-                    long frame_header_offset = current_pos; // Record offset for logging
-
-                    size_t bytes_read = fread(frame_chunk_header, 1, CHUNK_HDR, pf);
-                    if (bytes_read == 0 && feof(pf)) {
-                         ESP_LOGI(TAG_AVI, "EOF reached within movi data for %s (Offset: %ld)", file_to_play_str.c_str(), frame_header_offset);
-                         break; // End of file normally
-                     }
-                    if (bytes_read < CHUNK_HDR) {
-                         ESP_LOGE(TAG_AVI, "Read error reading frame chunk header at offset %ld in %s (read %zu bytes)", frame_header_offset, file_to_play_str.c_str(), bytes_read);
-                         break; // Error reading header
-                     }
-                     current_pos += CHUNK_HDR;
-
-                    uint32_t frame_chunk_id = 0;
-                    uint32_t jpeg_size = 0;
-                    memcpy(&frame_chunk_id, frame_chunk_header, 4);
-                    memcpy(&jpeg_size, frame_chunk_header + 4, 4);
-
-                    ESP_LOGD(TAG_AVI,"Read frame chunk: ID=0x%08lX, Size=%lu at offset %ld", frame_chunk_id, jpeg_size, frame_header_offset);
-
-                    // Check if it's a video frame chunk ('00dc')
-                    if (frame_chunk_id == CHUNK_ID_00DC) {
-                        if (jpeg_size == 0 || jpeg_size > MAX_JPEG) {
-                            ESP_LOGW(TAG_AVI, "Invalid JPEG size (%lu) in frame chunk at offset %ld in %s.", jpeg_size, frame_header_offset, file_to_play_str.c_str());
-                            // Try to skip this chunk and continue? Risky. Let's break.
-                            break;
-                        }
-
-                        // Allocate Frame Buffer (Use PSRAM for image data)
-                        // Allocate dynamically each time to handle varying frame sizes
-                        camera_fb_t *fb_out = (camera_fb_t*)heap_caps_malloc(sizeof(camera_fb_t), MALLOC_CAP_DEFAULT);
-                        if (!fb_out) { ESP_LOGE(TAG_AVI, "Failed alloc fb_out! Delaying."); vTaskDelay(pdMS_TO_TICKS(50)); continue; } // Skip frame on alloc failure
-
-                        fb_out->buf = (uint8_t *)heap_caps_malloc(jpeg_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-                        if (!fb_out->buf) {
-                             ESP_LOGE(TAG_AVI, "Failed alloc fb_out->buf (%lu)! Freeing fb_out, delaying.", jpeg_size);
-                             heap_caps_free(fb_out);
-                             vTaskDelay(pdMS_TO_TICKS(50));
-                             continue; // Skip frame on alloc failure
-                         }
-                        fb_out->len = 0; // Initialize length
-
-                        // Read JPEG Data
-                        ESP_LOGD(TAG_AVI,"Reading %lu bytes of JPEG data from offset %ld", jpeg_size, current_pos);
-                        size_t jpeg_bytes_read = fread(fb_out->buf, 1, jpeg_size, pf);
-                        current_pos += jpeg_bytes_read; // Advance position by amount actually read
-
-                        if (jpeg_bytes_read == jpeg_size) {
-                            fb_out->len = jpeg_size; fb_out->width = 0; fb_out->height = 0; fb_out->format = PIXFORMAT_JPEG; fb_out->timestamp.tv_sec = 0; fb_out->timestamp.tv_usec = 0;
-                            ESP_LOGD(TAG_AVI, "Queueing playback frame: %lu bytes (File frame %u)", fb_out->len, frame_count_in_file + 1);
-
-                            
-
-                            if (xQueueSend(streamingQueue, &fb_out, pdMS_TO_TICKS(200)) != pdTRUE) { // Increased timeout slightly
-                                ESP_LOGW(TAG_AVI, "Streaming queue full. Dropping playback frame.");
-                                // Free everything if queue fails
-                                heap_caps_free(fb_out->buf);
-                                heap_caps_free(fb_out);
-                                
-                               
-                            } else {
-                                // Frame successfully queued, increment counter
-                                frame_count_in_file++;
-                                // Delay for the correct frame rate AFTER successfully queueing
-                                vTaskDelay(pdMS_TO_TICKS(frame_delay_ms));
-                            }
-                        } else {
-                             ESP_LOGE(TAG_AVI, "Failed read JPEG data (%zu/%lu) from offset %ld in %s", jpeg_bytes_read, jpeg_size, current_pos - jpeg_bytes_read, file_to_play_str.c_str());
-                             heap_caps_free(fb_out->buf); heap_caps_free(fb_out);
-                             break; // Exit frame reading loop on error
-                        }
-
-                         // Word align the position *after* reading the chunk data
-                         if (current_pos % 2 != 0) {
-                             ESP_LOGD(TAG_AVI, "Seeking 1 byte for word alignment after frame data from %ld", current_pos);
-                             if (fseek(pf, 1, SEEK_CUR) != 0) { // Use SEEK_CUR
-                                  ESP_LOGE(TAG_AVI,"Failed seek alignment byte after frame!");
-                                  break; // Exit loop on seek error
-                             }
-                             current_pos++; // Update our tracked position
-                         }
-
-                    } else {
-                         // Found a chunk ID other than '00dc' inside 'movi'
-                         // Could be audio ('01wb'), index ('ix00'), JUNK, etc.
-                         // For simple video playback, we can try to skip it.
-                         ESP_LOGW(TAG_AVI, "Unexpected chunk ID [0x%08lX] size %lu inside 'movi' at offset %ld in %s. Skipping.", frame_chunk_id, jpeg_size, frame_header_offset, file_to_play_str.c_str());
-                         if (fseek(pf, jpeg_size, SEEK_CUR) != 0) { // Skip the data
-                             ESP_LOGE(TAG_AVI, "Failed to seek past unexpected chunk data!");
-                             break; // Exit loop on seek error
-                         }
-                         current_pos += jpeg_size; // Update position
-                         // Word align after skipping
-                         if (current_pos % 2 != 0) {
-                              ESP_LOGD(TAG_AVI, "Seeking 1 byte for word alignment after skipping chunk from %ld", current_pos);
-                              if (fseek(pf, 1, SEEK_CUR) != 0) { ESP_LOGE(TAG_AVI,"Failed seek alignment byte after skip!"); break; }
-                              current_pos++;
-                         }
-                         // Continue to the next chunk within movi
-                    }
-                } // End frame reading loop (while playback_active)
-
-                fclose(pf); // Close the current file
-                ESP_LOGI(TAG_AVI, "Finished playing file %s (%u frames)", file_to_play_str.c_str(), frame_count_in_file);
-
-                // Check if playback was stopped *during* file playback
-                if (!playback_active || stop_playback_request) {
-                    ESP_LOGI(TAG_AVI, "Playback stopped during file %s.", file_to_play_str.c_str());
-                    playback_active = false; stop_playback_request = false;
-                    first_file_in_sequence = true; // Need to find first/requested next time
-                    break; // Exit file sequencing loop
-                }
-                // Otherwise, loop continues to find the next file
-
-            } // End file sequencing loop (while playback_active)
-
-            // --- Log Reason for Exiting File Sequencing Loop ---
-            if (stop_playback_request) ESP_LOGI(TAG_AVI, "Playback sequence stopped by request.");
-            if (!playback_active && !first_file_in_sequence) ESP_LOGI(TAG_AVI, "Playback sequence finished (no more files or stopped internally).");
-            playback_active = false; stop_playback_request = false; // Ensure flags are clear
-            first_file_in_sequence = true; // Reset for next start signal
-
-        } // End if semaphore taken
-    } // End main task loop (while 1)
-
-    // --- Task Cleanup ---
-    ESP_LOGI(TAG_AVI,"Playback Task Exiting.");
-    if (temp_buffer) heap_caps_free(temp_buffer);
-    playbackTaskHandle = NULL;
-    vTaskDelete(NULL);
-}
\ No newline at end of file
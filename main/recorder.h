@@ -11,9 +11,21 @@ extern "C" {
 #include <stdbool.h>      // Added for bool type
 #include <stdint.h>       // Added for uint types
 #include <stddef.h>       // Added for size_t
+#include <time.h>
 
 #define AVI_HEADER_LEN 310
 #define MOUNT_POINT "/sdcard"
+#define CHUNK_HDR 8
+#define FILE_NAME_LEN 64
+#define MAX_JPEG (1024 * 1024)
+#define AVITEMP "/sdcard/avi_temp.avi"
+#define CLIP_DIR "/sdcard/clips" // Exported clips, kept out of the playback sequence
+#define CLIP_MAX_FRAMES 18000 // Longest clip export_clip writes, 30 min at 10 fps (288 KB of index in PSRAM)
+#define IDX_ENTRY 16 // bytes per index entry
+
+#define MAX_PLAYBACK_SESSIONS 3 // Concurrent playback cursors (each has its own reader task)
+#define PLAYBACK_QUEUE_LEN 3    // Frames read ahead per session
+#define TIMESHIFT_ROLLOVER_GAP_S 5 // Longest close-to-open gap for a rewind to reach back into the previous recording
 
 typedef struct {
     camera_fb_t *fb;       // Pointer to the camera frame buffer
@@ -21,9 +33,24 @@ typedef struct {
     SemaphoreHandle_t mutex; // Mutex for thread-safe operations
 } rc_camera_fb_t;
 
+// One playback cursor. Each session has its own reader task and frame queue,
+// so several sessions can run next to the live stream.
+typedef struct {
+    int id;                          // Slot index, reported back to the client
+    volatile bool active;            // Reader is playing
+    volatile bool stop_request;      // Ask the reader to stop at the next frame
+    uint16_t sid;                    // Data channel stream the frames are sent on
+    char file[FILE_NAME_LEN * 2];    // Requested start file / file being played
+    bool timeshift;                  // Tail the recording in progress instead of playing files
+    uint16_t rewindSecs;             // Timeshift: how far behind the camera to start
+    uint16_t startFrame;             // Frame of the requested file to start at (needs its idx1)
+    QueueHandle_t frameQueue;        // Frames read ahead, sent by peer_connection_task (video_tx.c)
+    SemaphoreHandle_t control;       // Start/stop signal to the reader task
+    TaskHandle_t task;               // Reader task
+} playback_session_t;
+
 // Declare queues (already present but ensure extern)
 extern QueueHandle_t recordingQueue; // Queue for recording frames
-extern QueueHandle_t streamingQueue; // Queue for streaming frames
 extern QueueHandle_t eventQueue;     // Queue for event frames (if used)
 extern SemaphoreHandle_t xSemaphore; // Semaphore for WebRTC access
 
@@ -39,14 +66,14 @@ extern bool doRecording;
 extern uint8_t xclkMhz;
 extern char camModel[10];
 extern TaskHandle_t captureHandle;
-extern TaskHandle_t playbackTaskHandle; // Add handle for playback task
-extern volatile bool playback_active; // Flag to indicate playback state
+extern playback_session_t playbackSessions[MAX_PLAYBACK_SESSIONS];
 
 
 // --- Function Declarations ---
 esp_err_t recorder_init(); // Initialization function
 // void recorder_task(void *parameter); // Recorder task function (integrated into captureTask now)
 void prepAviIndex(bool isTL);
+bool sizeAviIndex(size_t frames, bool isTL); // Room for exactly frames index entries (prepAviIndex only grows it to maxFrames)
 void buildAviHdr(uint8_t FPS, uint8_t frameType, uint16_t frameCnt, bool isTL);
 void buildAviIdx(size_t dataSize, bool isVid, bool isTL);
 size_t writeAviIndex(uint8_t* clientBuf, size_t buffSize, bool isTL);
@@ -68,6 +95,22 @@ bool checkFreeStorage();
 void checkMemory();
 void debugMemory(const char* tag);
 
+// --- Timeshift (reading the recording in progress) ---
+// Each timeshift reader keeps its own read-only handle on the recording, so
+// frames already flushed to the card are read without holding up saveFrame
+typedef struct {
+    FILE *pf;              // NULL until the first flushed frame is read
+    uint32_t generation;   // Recording pf was opened on
+    size_t readable;       // Bytes synced to the card when pf was opened
+} live_reader_t;
+
+bool getLiveRecording(uint32_t *generation, uint16_t *frames); // False if nothing is being recorded
+esp_err_t readLiveFrame(live_reader_t *reader, uint32_t generation, uint16_t frameNum, uint8_t *buf, size_t bufSize, size_t *frameLen); // buf NULL: size only
+void closeLiveReader(live_reader_t *reader);
+esp_err_t getClosedRecording(uint32_t generation, char *path, size_t pathLen); // Final file of a closed recording
+esp_err_t getPreviousRecording(uint32_t generation, char *path, size_t pathLen, uint16_t *frames); // Recording the live one rolled over from
+bool getRecordingPosition(time_t *started, uint16_t *frame); // Start time and frames so far, false if nothing is being recorded
+
 // --- Storage Abstraction (already declared, ensure prototypes match) ---
 bool STORAGE_exists(const char* path);
 FILE* STORAGE_open(const char* path, const char* mode);
@@ -84,9 +127,20 @@ bool STORAGE_mkdir(const char* path);
 void rc_decrement(rc_camera_fb_t *rc_fb); // Ensure this is correct
 
 // --- Playback Functions ---
-void start_playback(const char *filename); // Function to initiate playback
-void stop_playback();                      // Function to stop playback
-void playback_task(void *pvParameters);    // The playback task itself
+esp_err_t playback_init();                               // Create per-session queues and semaphores
+int start_playback(const char *filename, uint16_t frame, uint16_t sid); // Returns the session id, or -1 if none is free
+int start_timeshift(uint16_t seconds, uint16_t sid);     // Play the live recording from <seconds> ago
+void stop_playback(int session);                         // Stop one session, or all of them with -1
+void stop_playback_sid(uint16_t sid);                    // Stop every session sending on this stream
+int playback_active_count();                             // Number of sessions currently playing
+void endPlaybackTasks();                                 // Stop and delete all reader tasks
+void playback_task(void *pvParameters);                  // Reader task, pvParameters is the playback_session_t
+uint8_t *load_avi_index(FILE *pf, uint16_t *frames);     // idx1 entries of a recording (heap, caller frees), NULL if unusable
+
+// --- Clip Export ---
+esp_err_t clip_init();
+esp_err_t export_clip(time_t from, time_t to, char *outPath, size_t outLen, time_t *clipEnd); // Copies [from, to) into a new AVI in CLIP_DIR; *clipEnd < to if it was cut at CLIP_MAX_FRAMES
+esp_err_t find_recording(time_t started, char *path, size_t pathLen); // File of the recording opened at started (getRecordingPosition)
 
 
 #ifdef __cplusplus
@@ -0,0 +1,179 @@
+// rtp_jpeg.c
+
+#include <string.h>
+#include "rtp_jpeg.h"
+
+#define RTP_JPEG_MAX_DIM 2040 // Width/height are sent in units of 8 pixels in one byte
+
+static uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint8_t *wr16(uint8_t *p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+    return p + 2;
+}
+
+static uint8_t *wr32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+    return p + 4;
+}
+
+static int parse_dqt(const uint8_t *seg, size_t len, rtp_jpeg_info_t *info, uint8_t *have) {
+    while (len > 0) {
+        uint8_t precision = seg[0] >> 4, id = seg[0] & 0x0F;
+        if (precision != 0 || id > 1) return RTP_JPEG_ERR_UNSUPPORTED; // Only 8-bit tables 0 and 1 can be sent
+        if (len < 65) return RTP_JPEG_ERR_TRUNCATED;
+        memcpy(info->qtable[id], seg + 1, 64);
+        *have |= 1 << id;
+        seg += 65;
+        len -= 65;
+    }
+    return RTP_JPEG_OK;
+}
+
+// RFC 2435 types 0/1: three components, Y 2x1 or 2x2, Cb/Cr 1x1, Y on
+// table 0 and Cb/Cr on table 1
+static int parse_sof(const uint8_t *seg, size_t len, rtp_jpeg_info_t *info) {
+    if (len < 6 || len < 6 + 3 * (size_t)seg[5]) return RTP_JPEG_ERR_TRUNCATED;
+    if (seg[0] != 8 || seg[5] != 3) return RTP_JPEG_ERR_UNSUPPORTED;
+    info->height = rd16(seg + 1);
+    info->width = rd16(seg + 3);
+    const uint8_t *comp = seg + 6;
+    if (comp[1] == 0x21) info->type = 0;
+    else if (comp[1] == 0x22) info->type = 1;
+    else return RTP_JPEG_ERR_UNSUPPORTED;
+    if (comp[2] != 0 || comp[4] != 0x11 || comp[5] != 1 || comp[7] != 0x11 || comp[8] != 1) return RTP_JPEG_ERR_UNSUPPORTED;
+    if (info->width == 0 || info->height == 0 || info->width > RTP_JPEG_MAX_DIM || info->height > RTP_JPEG_MAX_DIM ||
+        (info->width & 7) || (info->height & 7)) return RTP_JPEG_ERR_UNSUPPORTED;
+    return RTP_JPEG_OK;
+}
+
+int rtp_jpeg_parse(const uint8_t *jpeg, size_t len, rtp_jpeg_info_t *info) {
+    memset(info, 0, sizeof(*info));
+    if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) return RTP_JPEG_ERR_UNSUPPORTED;
+
+    uint8_t have_tables = 0;
+    bool have_sof = false;
+    size_t pos = 2;
+    for (;;) {
+        if (pos + 4 > len) return RTP_JPEG_ERR_TRUNCATED;
+        if (jpeg[pos] != 0xFF) return RTP_JPEG_ERR_UNSUPPORTED;
+        uint8_t marker = jpeg[pos + 1];
+        if (marker == 0xFF) { // Fill byte
+            pos++;
+            continue;
+        }
+        size_t seg_len = rd16(jpeg + pos + 2);
+        if (seg_len < 2 || pos + 2 + seg_len > len) return RTP_JPEG_ERR_TRUNCATED;
+        const uint8_t *seg = jpeg + pos + 4;
+        size_t body = seg_len - 2;
+        int res = RTP_JPEG_OK;
+
+        switch (marker) {
+        case 0xDB: // DQT
+            res = parse_dqt(seg, body, info, &have_tables);
+            break;
+        case 0xC0: // SOF0, baseline
+            res = parse_sof(seg, body, info);
+            have_sof = true;
+            break;
+        case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            return RTP_JPEG_ERR_UNSUPPORTED; // Progressive, lossless, arithmetic...
+        case 0xDD: // DRI
+            if (body < 2) return RTP_JPEG_ERR_TRUNCATED;
+            info->restart_interval = rd16(seg);
+            break;
+        case 0xDA: { // SOS, the entropy-coded data follows the header
+            if (!have_sof) return RTP_JPEG_ERR_NO_SCAN;
+            if (have_tables != 0x03) return RTP_JPEG_ERR_UNSUPPORTED;
+            size_t start = pos + 2 + seg_len;
+            size_t end = len;
+            while (end >= start + 2 && !(jpeg[end - 2] == 0xFF && jpeg[end - 1] == 0xD9)) end--; // Frames may be padded after EOI
+            if (end < start + 2) return RTP_JPEG_ERR_TRUNCATED;
+            info->scan = jpeg + start;
+            info->scan_len = end - 2 - start;
+            if (info->restart_interval) info->type += 64;
+            return RTP_JPEG_OK;
+        }
+        case 0xD9: // EOI before any scan
+            return RTP_JPEG_ERR_NO_SCAN;
+        default: // APPn, COM, DHT (the receiver uses the standard tables)
+            break;
+        }
+        if (res != RTP_JPEG_OK) return res;
+        pos += 2 + seg_len;
+    }
+}
+
+void rtp_jpeg_tx_init(rtp_jpeg_tx_t *tx, uint32_t ssrc) {
+    memset(tx, 0, sizeof(*tx));
+    tx->ssrc = ssrc;
+}
+
+int rtp_jpeg_tx_load(rtp_jpeg_tx_t *tx, const uint8_t *jpeg, size_t len, uint32_t timestamp) {
+    if (tx->loaded) rtp_jpeg_tx_abandon(tx); // Previous frame never finished
+    int res = rtp_jpeg_parse(jpeg, len, &tx->info);
+    if (res != RTP_JPEG_OK) {
+        tx->dropped++;
+        return res;
+    }
+    tx->timestamp = timestamp;
+    tx->offset = 0;
+    tx->loaded = true;
+    return RTP_JPEG_OK;
+}
+
+void rtp_jpeg_tx_abandon(rtp_jpeg_tx_t *tx) {
+    if (tx->loaded) tx->dropped++;
+    tx->loaded = false;
+}
+
+size_t rtp_jpeg_tx_next(rtp_jpeg_tx_t *tx) {
+    if (!tx->loaded) return 0;
+    const rtp_jpeg_info_t *info = &tx->info;
+    uint8_t *p = tx->packet + RTP_HDR_LEN;
+
+    // Main JPEG header: type-specific, 24-bit fragment offset, type, Q, width/8, height/8
+    p = wr32(p, tx->offset & 0x00FFFFFF);
+    *p++ = info->type;
+    *p++ = 255; // Tables in-band
+    *p++ = info->width / 8;
+    *p++ = info->height / 8;
+    if (info->type >= 64) {
+        p = wr16(p, info->restart_interval);
+        p = wr16(p, 0xFFFF); // F = L = 1, restart count 0x3FFF: the packet isn't aligned to restart intervals
+    }
+    if (tx->offset == 0) {
+        *p++ = 0; // MBZ
+        *p++ = 0; // 8-bit precision for both tables
+        p = wr16(p, sizeof(info->qtable));
+        memcpy(p, info->qtable, sizeof(info->qtable));
+        p += sizeof(info->qtable);
+    }
+
+    size_t room = RTP_JPEG_MAX_PACKET - (p - tx->packet);
+    size_t payload = info->scan_len - tx->offset;
+    if (payload > room) payload = room;
+    memcpy(p, info->scan + tx->offset, payload);
+    tx->offset += payload;
+    bool last = tx->offset >= info->scan_len;
+
+    uint8_t *h = tx->packet;
+    *h++ = 0x80; // V=2, no padding, extension or CSRCs
+    *h++ = RTP_JPEG_PAYLOAD_TYPE | (last ? 0x80 : 0); // Marker on the last packet of the frame
+    h = wr16(h, tx->seq++);
+    h = wr32(h, tx->timestamp);
+    wr32(h, tx->ssrc);
+
+    if (last) {
+        tx->loaded = false;
+        tx->frames++;
+    }
+    return (p - tx->packet) + payload;
+}
@@ -0,0 +1,68 @@
+// rtp_jpeg.h
+// RTP/JPEG packetizer (RFC 2435). The JFIF headers of a baseline JPEG are
+// replaced by the 8-byte RTP/JPEG header; the quantization tables travel in
+// the first packet of each frame (Q = 255) and the receiver rebuilds the
+// headers from them and the standard Huffman tables. A lost packet loses
+// only the frame it belongs to.
+// Plain C with no ESP-IDF dependencies.
+#ifndef RTP_JPEG_H
+#define RTP_JPEG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define RTP_JPEG_PAYLOAD_TYPE 26     // Static payload type for JPEG
+#define RTP_JPEG_CLOCK_HZ 90000
+#define RTP_JPEG_MAX_PACKET 1200     // Whole RTP packet, fits one SCTP/DTLS/UDP datagram
+#define RTP_HDR_LEN 12
+#define RTP_JPEG_HDR_LEN 8
+#define RTP_JPEG_RESTART_HDR_LEN 4
+#define RTP_JPEG_QUANT_HDR_LEN 4
+
+typedef enum {
+    RTP_JPEG_OK = 0,
+    RTP_JPEG_ERR_TRUNCATED = -1,     // Ran off the end of the buffer / no EOI
+    RTP_JPEG_ERR_UNSUPPORTED = -2,   // Not baseline 4:2:2 or 4:2:0 with 8-bit tables
+    RTP_JPEG_ERR_NO_SCAN = -3,       // No SOF/SOS before the end of the headers
+} rtp_jpeg_err_t;
+
+// What RFC 2435 needs from the JFIF headers
+typedef struct {
+    uint8_t type;                // 0: 4:2:2, 1: 4:2:0, +64 when restart markers are used
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart_interval;   // DRI, 0 if absent
+    uint8_t qtable[2][64];       // Luma, chroma (zigzag order, as in DQT)
+    const uint8_t *scan;         // Entropy-coded data, up to but not including EOI
+    size_t scan_len;
+} rtp_jpeg_info_t;
+
+// Cursor over one frame being packetized
+typedef struct {
+    uint32_t ssrc;
+    uint16_t seq;                // Sequence number of the next packet
+    uint32_t timestamp;          // 90 kHz timestamp of the loaded frame
+    rtp_jpeg_info_t info;
+    size_t offset;               // Next scan byte to send (the RFC 2435 fragment offset)
+    bool loaded;
+    uint32_t frames;             // Frames fully packetized
+    uint32_t dropped;            // Frames abandoned part-way or rejected by the parser
+    uint8_t packet[RTP_JPEG_MAX_PACKET];
+} rtp_jpeg_tx_t;
+
+int rtp_jpeg_parse(const uint8_t *jpeg, size_t len, rtp_jpeg_info_t *info); // RTP_JPEG_OK or an rtp_jpeg_err_t
+
+void rtp_jpeg_tx_init(rtp_jpeg_tx_t *tx, uint32_t ssrc);
+int rtp_jpeg_tx_load(rtp_jpeg_tx_t *tx, const uint8_t *jpeg, size_t len, uint32_t timestamp); // Parses the frame
+size_t rtp_jpeg_tx_next(rtp_jpeg_tx_t *tx); // Builds the next packet in tx->packet, 0 when the frame is done
+void rtp_jpeg_tx_abandon(rtp_jpeg_tx_t *tx); // Drop the rest of the loaded frame
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RTP_JPEG_H
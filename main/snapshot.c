@@ -0,0 +1,133 @@
+// snapshot.c
+
+#include "snapshot.h"
+#include "camera.h"
+#include <string.h>
+#include "freertos/task.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "jpeg_inspect.h"
+
+static const char *TAG = "snapshot";
+
+#define SNAPSHOT_FRESH_BIT BIT0 // Set whenever a new frame is cached
+#define SNAPSHOT_MIN_AGE_MS 250 // A capture made on request is already this old when cached
+
+static portMUX_TYPE snap_lock = portMUX_INITIALIZER_UNLOCKED; // Guards latest, refs and request_until_us
+static snapshot_t *latest = NULL;      // The cache holds one reference
+static int64_t request_until_us = 0;   // A fresh capture is wanted until then
+static EventGroupHandle_t snap_events = NULL;
+
+esp_err_t snapshot_init(void) {
+    snap_events = xEventGroupCreate();
+    return snap_events ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+static void snapshot_free(snapshot_t *snap) {
+    heap_caps_free(snap->buf);
+    heap_caps_free(snap);
+}
+
+uint32_t snapshot_age_ms(const snapshot_t *snap) {
+    return (uint32_t)((esp_timer_get_time() - snap->capture_us) / 1000);
+}
+
+bool snapshot_wanted(void) {
+    return esp_timer_get_time() < request_until_us;
+}
+
+bool snapshot_offer(const camera_fb_t *fb) {
+    int64_t now = esp_timer_get_time();
+    bool wanted = now < request_until_us;
+    snapshot_t *cur = latest; // Only this task replaces it, reading without the lock is fine
+    if (!wanted && cur && now - cur->capture_us < SNAPSHOT_REFRESH_MS * 1000LL) return false;
+
+    jpeg_info_t info;
+    int res = jpeg_inspect(fb->buf, fb->len, 0, &info);
+    if (res != JPEG_OK) {
+        ESP_LOGW(TAG, "Frame not cached: %s", jpeg_inspect_err_name(res));
+        return false;
+    }
+    snapshot_t *snap = (snapshot_t*)heap_caps_calloc(1, sizeof(snapshot_t), MALLOC_CAP_SPIRAM);
+    if (!snap) {
+        ESP_LOGE(TAG, "Failed to allocate snapshot struct!");
+        return false;
+    }
+    snap->buf = (uint8_t*)heap_caps_malloc(info.len, MALLOC_CAP_SPIRAM);
+    if (!snap->buf) {
+        ESP_LOGE(TAG, "Failed to allocate snapshot buffer (%zu bytes)", info.len);
+        heap_caps_free(snap);
+        return false;
+    }
+    memcpy(snap->buf, fb->buf, info.len);
+    snap->len = info.len;
+    snap->width = info.width;
+    snap->height = info.height;
+    snap->capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    snap->refs = 1;
+
+    snapshot_t *old;
+    taskENTER_CRITICAL(&snap_lock);
+    old = latest;
+    latest = snap;
+    request_until_us = 0;
+    if (old && --old->refs != 0) old = NULL; // Still held by a reader, the last release frees it
+    taskEXIT_CRITICAL(&snap_lock);
+
+    if (old) snapshot_free(old);
+    xEventGroupSetBits(snap_events, SNAPSHOT_FRESH_BIT);
+    return wanted;
+}
+
+// Takes a reference to the cached frame if it is young enough
+static snapshot_t *take_latest(uint32_t max_age_ms, bool request) {
+    int64_t now = esp_timer_get_time();
+    snapshot_t *snap = NULL;
+    taskENTER_CRITICAL(&snap_lock);
+    if (latest && now - latest->capture_us <= max_age_ms * 1000LL) {
+        snap = latest;
+        snap->refs++;
+    } else if (request) {
+        int64_t until = now + SNAPSHOT_WAIT_MS * 1000LL;
+        if (until > request_until_us) request_until_us = until;
+    }
+    taskEXIT_CRITICAL(&snap_lock);
+    return snap;
+}
+
+snapshot_t *snapshot_acquire(uint32_t max_age_ms, TickType_t wait) {
+    if (!snap_events) return NULL; // Camera not initialised
+    if (max_age_ms < SNAPSHOT_MIN_AGE_MS) max_age_ms = SNAPSHOT_MIN_AGE_MS;
+    snapshot_t *snap = take_latest(max_age_ms, false);
+    if (snap) return snap;
+
+    // Clear before asking, so a capture landing before we block still wakes us
+    xEventGroupClearBits(snap_events, SNAPSHOT_FRESH_BIT);
+    snap = take_latest(max_age_ms, true);
+    if (snap) return snap; // Cached meanwhile
+    frame_scheduler_wake();
+    if (wait == 0) return NULL; // Caller polls again once the camera had a chance
+
+    TickType_t start = xTaskGetTickCount();
+    TickType_t waited = 0;
+    while (waited < wait) {
+        xEventGroupWaitBits(snap_events, SNAPSHOT_FRESH_BIT, pdFALSE, pdFALSE, wait - waited);
+        snap = take_latest(max_age_ms, false);
+        if (snap) return snap;
+        waited = xTaskGetTickCount() - start;
+        xEventGroupClearBits(snap_events, SNAPSHOT_FRESH_BIT);
+    }
+    ESP_LOGW(TAG, "No frame younger than %lu ms within %lu ms", max_age_ms, pdTICKS_TO_MS(wait));
+    return NULL;
+}
+
+void snapshot_release(snapshot_t *snap) {
+    if (!snap) return;
+    bool last;
+    taskENTER_CRITICAL(&snap_lock);
+    last = --snap->refs == 0;
+    taskEXIT_CRITICAL(&snap_lock);
+    if (last) snapshot_free(snap);
+}
@@ -0,0 +1,44 @@
+// snapshot.h
+// Still images served from a cached copy of the latest frame. The camera task
+// refreshes the cache from frames it grabs anyway, at most once per
+// SNAPSHOT_REFRESH_MS, and grabs one just for a snapshot only when the cached
+// frame is older than the caller accepts. Snapshots are refcounted, so a slow
+// HTTP client keeps its frame alive while the cache moves on.
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_camera.h"
+
+#define SNAPSHOT_MAX_AGE_MS 2000 // Default age a cached frame may have when served
+#define SNAPSHOT_REFRESH_MS 1000 // Cache refresh from frames grabbed for other consumers
+#define SNAPSHOT_WAIT_MS 1500    // How long a blocking request waits for a fresh capture
+
+typedef struct {
+    uint8_t *buf;          // JPEG, trimmed after EOI
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    int64_t capture_us;    // esp_timer clock
+    uint32_t refs;         // Owned by snapshot.c
+} snapshot_t;
+
+esp_err_t snapshot_init(void);
+bool snapshot_wanted(void);                       // Camera task: someone waits for a fresh frame
+bool snapshot_offer(const camera_fb_t *fb);       // Camera task: caches fb if wanted or due, true if a waiter was served
+snapshot_t *snapshot_acquire(uint32_t max_age_ms, TickType_t wait); // NULL if nothing fresh enough arrived in time
+void snapshot_release(snapshot_t *snap);
+uint32_t snapshot_age_ms(const snapshot_t *snap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,160 @@
+// sound_detect.c
+
+#include <math.h>
+#include <string.h>
+#include "sound_detect.h"
+
+#define LOG2_ONE 256                  // log2 units per octave of power
+#define LOG2_FULL_SCALE (30 * LOG2_ONE) // Power of a full-scale square wave, 32768^2
+#define DB_TO_LOG2(db) ((int32_t)(db) * 8504 / 100) // 256 / (10 log10 2) = 85.04 units per dB
+#define LOG2_TO_DB(l) ((l) * 100 / 8504)
+#define WARMUP_SHIFT 2                // Floor follows every block closely while warming up
+#define FLOOR_FRAC 8                  // Extra fraction bits of the floor, so slow steps don't round to 0
+
+// log2(x) in 1/256 steps. The fraction uses log2(1 + f) ~ f + 0.34 f (1 - f),
+// which is within 0.01 octave (0.03 dB).
+static int32_t log2_q8(uint32_t x) {
+    if (x == 0) return 0;
+    int msb = 31 - __builtin_clz(x);
+    uint32_t f = (msb >= 8 ? x >> (msb - 8) : x << (8 - msb)) & 0xFF;
+    return msb * LOG2_ONE + (int32_t)(f + ((f * (256 - f) * 87) >> 16));
+}
+
+void sound_detect_init(sound_detector_t *sd, const sound_config_t *cfg, uint32_t sample_rate) {
+    memset(sd, 0, sizeof(*sd));
+    sd->cfg = *cfg;
+    sd->sample_rate = sample_rate;
+    sd->trigger = DB_TO_LOG2(cfg->trigger_db);
+    sd->release = DB_TO_LOG2(cfg->release_db);
+    sd->min_level = LOG2_FULL_SCALE + DB_TO_LOG2(cfg->min_level_dbfs);
+    for (int i = 0; i < SOUND_FFT_SIZE; i++) {
+        sd->window[i] = (int16_t)(16383.5f * (1.0f - cosf(2.0f * (float)M_PI * i / SOUND_FFT_SIZE)));
+    }
+    for (int k = 0; k < SOUND_FFT_SIZE / 2; k++) {
+        sd->twiddle_cos[k] = (int16_t)(32767.0f * cosf(2.0f * (float)M_PI * k / SOUND_FFT_SIZE));
+        sd->twiddle_sin[k] = (int16_t)(32767.0f * sinf(2.0f * (float)M_PI * k / SOUND_FFT_SIZE));
+    }
+}
+
+void sound_detect_reset(sound_detector_t *sd) {
+    sd->blocks = 0;
+    sd->floor = 0;
+    sd->above = 0;
+    sd->below = 0;
+    sd->active = false;
+}
+
+// In-place radix-2 FFT on sd->re/im, Q15, halved at every stage so nothing overflows
+static void fft_q15(sound_detector_t *sd) {
+    int16_t *re = sd->re, *im = sd->im;
+    for (int i = 1, j = 0; i < SOUND_FFT_SIZE; i++) {
+        int bit = SOUND_FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+            int16_t t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for (int len = 2; len <= SOUND_FFT_SIZE; len <<= 1) {
+        int half = len >> 1, step = SOUND_FFT_SIZE / len;
+        for (int i = 0; i < SOUND_FFT_SIZE; i += len) {
+            for (int k = 0; k < half; k++) {
+                int32_t wr = sd->twiddle_cos[k * step], wi = -sd->twiddle_sin[k * step];
+                int a = i + k, b = a + half;
+                int32_t tr = (re[b] * wr - im[b] * wi) >> 15;
+                int32_t ti = (re[b] * wi + im[b] * wr) >> 15;
+                re[b] = (int16_t)((re[a] - tr) >> 1);
+                im[b] = (int16_t)((im[a] - ti) >> 1);
+                re[a] = (int16_t)((re[a] + tr) >> 1);
+                im[a] = (int16_t)((im[a] + ti) >> 1);
+            }
+        }
+    }
+}
+
+// Percentage of the energy of the block's first SOUND_FFT_SIZE samples
+// (zero-padded if shorter) that falls inside the configured band
+static uint8_t band_share(sound_detector_t *sd, const int16_t *pcm, size_t n, int32_t mean) {
+    size_t m = n < SOUND_FFT_SIZE ? n : SOUND_FFT_SIZE;
+    // Block floating point: scale the block up to use 14 bits before windowing
+    int32_t peak = 1;
+    for (size_t i = 0; i < m; i++) {
+        int32_t v = pcm[i] - mean;
+        if (v < 0) v = -v;
+        if (v > peak) peak = v;
+    }
+    int shift = 0;
+    while ((peak << (shift + 1)) < 16384) shift++;
+    for (size_t i = 0; i < SOUND_FFT_SIZE; i++) {
+        int32_t v = 0;
+        if (i < m) {
+            v = (pcm[i] - mean) << shift;
+            if (v > 32767) v = 32767; else if (v < -32768) v = -32768;
+        }
+        sd->re[i] = (int16_t)((v * sd->window[i]) >> 15);
+        sd->im[i] = 0;
+    }
+    fft_q15(sd);
+
+    uint32_t lo = (uint32_t)sd->cfg.band_lo_hz * SOUND_FFT_SIZE / sd->sample_rate;
+    uint32_t hi = (uint32_t)sd->cfg.band_hi_hz * SOUND_FFT_SIZE / sd->sample_rate;
+    uint64_t total = 0, band = 0;
+    for (uint32_t k = 1; k < SOUND_FFT_SIZE / 2; k++) {
+        uint32_t p = (uint32_t)(sd->re[k] * sd->re[k]) + (uint32_t)(sd->im[k] * sd->im[k]);
+        total += p;
+        if (k >= lo && k <= hi) band += p;
+    }
+    return total ? (uint8_t)(band * 100 / total) : 0;
+}
+
+void sound_detect_process(sound_detector_t *sd, const int16_t *pcm, size_t n, sound_result_t *res) {
+    memset(res, 0, sizeof(*res));
+    if (n == 0) return;
+
+    int64_t sum = 0;
+    for (size_t i = 0; i < n; i++) sum += pcm[i];
+    int32_t mean = (int32_t)(sum / (int64_t)n);
+    uint64_t energy = 0;
+    for (size_t i = 0; i < n; i++) {
+        int32_t v = pcm[i] - mean;
+        energy += (uint64_t)((int64_t)v * v);
+    }
+    uint64_t power = energy / n;
+    int32_t level = log2_q8(power > UINT32_MAX ? UINT32_MAX : (uint32_t)power);
+
+    int32_t floor = sd->floor >> FLOOR_FRAC;
+    if (sd->blocks < sd->cfg.warmup_blocks) {
+        int32_t target = level << FLOOR_FRAC;
+        sd->floor = sd->blocks == 0 ? target : sd->floor + ((target - sd->floor) >> WARMUP_SHIFT);
+        sd->blocks++;
+    } else {
+        sd->blocks++;
+        bool candidate = level >= floor + sd->trigger && level >= sd->min_level;
+        if (candidate && sd->cfg.band_check) {
+            res->band_pct = band_share(sd, pcm, n, mean);
+            candidate = res->band_pct >= sd->cfg.band_min_pct;
+        }
+        sd->above = candidate ? (sd->above < UINT8_MAX ? sd->above + 1 : UINT8_MAX) : 0;
+
+        if (!sd->active && sd->above >= sd->cfg.attack_blocks) {
+            sd->active = true;
+            sd->below = 0;
+            res->started = true;
+        } else if (sd->active) {
+            sd->below = level < floor + sd->release ? sd->below + 1 : 0;
+            if (sd->below >= sd->cfg.hold_blocks) {
+                sd->active = false;
+                res->ended = true;
+            }
+        }
+        // A sound that goes on for many seconds slowly becomes the floor
+        int32_t target = level << FLOOR_FRAC;
+        int shift = target > sd->floor ? sd->cfg.floor_rise_shift : sd->cfg.floor_fall_shift;
+        sd->floor += (target - sd->floor) >> shift;
+    }
+
+    res->active = sd->active;
+    res->level_dbfs = (int16_t)LOG2_TO_DB(level - LOG2_FULL_SCALE);
+    res->floor_dbfs = (int16_t)LOG2_TO_DB((sd->floor >> FLOOR_FRAC) - LOG2_FULL_SCALE);
+}
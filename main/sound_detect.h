@@ -0,0 +1,81 @@
+// sound_detect.h
+// Sound events from blocks of 16-bit PCM. Each block's RMS level (after
+// removing its DC offset) is compared with an adaptive noise floor that
+// follows quiet levels quickly and loud ones slowly, so a fan or steady
+// traffic becomes background while a bang or a voice stands out. An event
+// starts once attack_blocks blocks in a row are trigger_db over the floor and
+// ends after hold_blocks blocks under release_db. Optionally a candidate must
+// also have band_min_pct of its energy between band_lo_hz and band_hi_hz,
+// taken from a fixed-point FFT that only runs on blocks already loud enough.
+// Levels are kept as log2 of the power in 1/256 steps, so there is no
+// floating point per block. Plain C with no ESP-IDF dependencies, so it can
+// be run on WAV files on a PC.
+#ifndef SOUND_DETECT_H
+#define SOUND_DETECT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define SOUND_FFT_BITS 8
+#define SOUND_FFT_SIZE (1 << SOUND_FFT_BITS) // Samples of a block the band check looks at
+
+typedef struct {
+    uint8_t trigger_db;       // Over the floor that makes a block a candidate
+    uint8_t release_db;       // Under floor + this, a block counts towards the end of an event
+    uint8_t attack_blocks;    // Candidate blocks in a row that start an event
+    uint16_t hold_blocks;     // Quiet blocks in a row that end it
+    uint8_t floor_rise_shift; // Floor moves 1/2^n of the way up to a louder block
+    uint8_t floor_fall_shift; // ...and down to a quieter one
+    uint8_t warmup_blocks;    // Learned before anything is reported
+    int8_t min_level_dbfs;    // Quieter blocks never trigger, whatever the floor
+    bool band_check;          // Also require band energy (FFT)
+    uint16_t band_lo_hz;
+    uint16_t band_hi_hz;
+    uint8_t band_min_pct;     // Share of the block's energy (DC excluded) inside the band
+} sound_config_t;
+
+#define SOUND_CONFIG_DEFAULT() { \
+    .trigger_db = 12, .release_db = 6, .attack_blocks = 1, .hold_blocks = 50, \
+    .floor_rise_shift = 8, .floor_fall_shift = 3, .warmup_blocks = 25, .min_level_dbfs = -70, \
+    .band_check = true, .band_lo_hz = 300, .band_hi_hz = 4000, .band_min_pct = 40 }
+
+typedef struct {
+    bool active;          // Event in progress
+    bool started;         // ...since this block
+    bool ended;           // Ended with this block
+    int16_t level_dbfs;   // This block's RMS
+    int16_t floor_dbfs;   // Noise floor after this block
+    uint8_t band_pct;     // 0 unless the FFT ran for this block
+} sound_result_t;
+
+typedef struct {
+    sound_config_t cfg;
+    uint32_t sample_rate;
+    int32_t floor;        // log2 power, 1/65536 steps
+    int32_t trigger;      // cfg thresholds, log2 power in 1/256 steps
+    int32_t release;
+    int32_t min_level;
+    uint32_t blocks;      // Processed since init
+    uint8_t above;        // Candidate blocks in a row
+    uint16_t below;       // Quiet blocks in a row during an event
+    bool active;
+    int16_t window[SOUND_FFT_SIZE]; // Hann, Q15
+    int16_t twiddle_cos[SOUND_FFT_SIZE / 2];
+    int16_t twiddle_sin[SOUND_FFT_SIZE / 2];
+    int16_t re[SOUND_FFT_SIZE];
+    int16_t im[SOUND_FFT_SIZE];
+} sound_detector_t;
+
+void sound_detect_init(sound_detector_t *sd, const sound_config_t *cfg, uint32_t sample_rate);
+void sound_detect_process(sound_detector_t *sd, const int16_t *pcm, size_t n, sound_result_t *res);
+void sound_detect_reset(sound_detector_t *sd); // Relearn the floor, e.g. after the gain changed
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SOUND_DETECT_H
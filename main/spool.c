@@ -0,0 +1,298 @@
+// spool.c
+
+#include "spool.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_rom_crc.h"
+
+static const char *TAG = "spool";
+
+#define SPOOL_MAGIC 0x314C5053u // "SPL1"
+#define SPOOL_MAX_RECORD (1024 * 1024) // Larger than any event burst
+#define SPOOL_CURSOR SPOOL_DIR "/cursor"
+#define SPOOL_PATH_LEN 64
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;       // SPOOL_MAGIC
+    uint32_t len;         // Payload bytes that follow
+    int64_t timestamp;    // Capture time, seconds since the epoch
+    uint32_t crc;         // CRC32 of timestamp and payload
+} spool_rec_t;            // 20 bytes, little-endian
+
+typedef struct __attribute__((packed)) {
+    uint32_t segment;
+    uint32_t offset;
+} spool_cursor_t;
+
+static bool spool_ok = false;
+static uint32_t read_seg = 0;    // Oldest segment with undelivered records
+static uint32_t read_off = 0;    // Next record in it
+static uint32_t write_seg = 0;   // Segment appended to, never the one being read once it has data
+static FILE *write_fp = NULL;
+static uint32_t write_size = 0;
+static uint32_t write_count = 0; // Records in the write segment
+static uint32_t pending = 0;
+static uint64_t total_bytes = 0;
+static uint32_t dropped = 0;
+static uint32_t peeked_len = 0;  // Record handed out by spool_peek, removed by spool_pop
+
+static void segment_path(uint32_t seg, char *path) {
+    snprintf(path, SPOOL_PATH_LEN, "%s/%08lx.jnl", SPOOL_DIR, (unsigned long)seg);
+}
+
+static long segment_size(uint32_t seg) {
+    char path[SPOOL_PATH_LEN];
+    struct stat st;
+    segment_path(seg, path);
+    return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// Valid records in a segment from offset on. A torn record (power lost during
+// an append) ends the segment.
+static uint32_t count_records(uint32_t seg, uint32_t offset) {
+    char path[SPOOL_PATH_LEN];
+    segment_path(seg, path);
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    long size = segment_size(seg);
+    uint32_t n = 0;
+    spool_rec_t rec;
+    while (fseek(fp, offset, SEEK_SET) == 0 && fread(&rec, sizeof(rec), 1, fp) == 1) {
+        if (rec.magic != SPOOL_MAGIC || rec.len > SPOOL_MAX_RECORD) break;
+        offset += sizeof(rec) + rec.len;
+        if ((long)offset > size) break;
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+static void save_cursor(void) {
+    spool_cursor_t cur = { .segment = read_seg, .offset = read_off };
+    FILE *fp = fopen(SPOOL_CURSOR, "wb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to write the spool cursor");
+        return;
+    }
+    fwrite(&cur, sizeof(cur), 1, fp);
+    fclose(fp);
+}
+
+// Drops the read segment and moves on to the next existing one
+static void retire_read_segment(void) {
+    char path[SPOOL_PATH_LEN];
+    long size = segment_size(read_seg);
+    segment_path(read_seg, path);
+    if (size >= 0) {
+        remove(path);
+        total_bytes -= (uint64_t)size < total_bytes ? (uint64_t)size : total_bytes;
+    }
+    do {
+        read_seg++;
+    } while (read_seg < write_seg && segment_size(read_seg) < 0);
+    read_off = 0;
+    save_cursor();
+}
+
+// Closes the write segment, the next append starts a new one
+static void roll_write_segment(void) {
+    if (write_fp) {
+        fclose(write_fp);
+        write_fp = NULL;
+    }
+    if (write_size > 0) {
+        write_seg++;
+        write_size = 0;
+        write_count = 0;
+    }
+}
+
+esp_err_t spool_init(void) {
+    struct stat st;
+    if (stat(SPOOL_DIR, &st) != 0 && mkdir(SPOOL_DIR, 0777) != 0) {
+        ESP_LOGE(TAG, "Cannot create %s, failed uploads will be lost", SPOOL_DIR);
+        return ESP_FAIL;
+    }
+    DIR *dir = opendir(SPOOL_DIR);
+    if (!dir) return ESP_FAIL;
+
+    uint32_t min_seg = UINT32_MAX, max_seg = 0;
+    total_bytes = 0;
+    struct dirent *ent;
+    while ((ent = readdir(dir)) != NULL) {
+        char *end;
+        unsigned long seg = strtoul(ent->d_name, &end, 16);
+        if (end != ent->d_name + 8 || strcasecmp(end, ".jnl") != 0) continue;
+        if (seg < min_seg) min_seg = seg;
+        if (seg > max_seg) max_seg = seg;
+        long size = segment_size(seg);
+        if (size > 0) total_bytes += size;
+    }
+    closedir(dir);
+
+    // Appends after a reboot always go to a fresh segment, so a record torn
+    // by a power cut can only ever be the last one of a sealed segment
+    write_seg = max_seg + 1;
+    write_size = 0;
+    write_count = 0;
+    read_seg = (min_seg == UINT32_MAX) ? write_seg : min_seg;
+    read_off = 0;
+
+    spool_cursor_t cur;
+    FILE *fp = fopen(SPOOL_CURSOR, "rb");
+    if (fp) {
+        if (fread(&cur, sizeof(cur), 1, fp) == 1 && cur.segment >= read_seg && cur.segment < write_seg) {
+            read_seg = cur.segment;
+            read_off = cur.offset;
+        }
+        fclose(fp);
+    }
+
+    pending = 0;
+    for (uint32_t seg = read_seg; seg < write_seg; seg++) {
+        pending += count_records(seg, seg == read_seg ? read_off : 0);
+    }
+    spool_ok = true;
+    ESP_LOGI(TAG, "Spool ready: %lu events waiting, %llu bytes", pending, total_bytes);
+    return ESP_OK;
+}
+
+bool spool_ready(void) {
+    return spool_ok;
+}
+
+uint32_t spool_pending(void) {
+    return pending;
+}
+
+void spool_get_stats(spool_stats_t *stats) {
+    stats->pending = pending;
+    stats->bytes = total_bytes;
+    stats->dropped = dropped;
+}
+
+static uint32_t record_crc(const spool_rec_t *rec, const uint8_t *buf) {
+    int64_t ts = rec->timestamp; // Packed member, don't take its address
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t *)&ts, sizeof(ts));
+    return esp_rom_crc32_le(crc, buf, rec->len);
+}
+
+esp_err_t spool_append(const uint8_t *buf, size_t len, int64_t timestamp) {
+    if (!spool_ok) return ESP_ERR_INVALID_STATE;
+    size_t need = sizeof(spool_rec_t) + len;
+    if (len == 0 || len > SPOOL_MAX_RECORD || need > SPOOL_MAX_BYTES) return ESP_ERR_INVALID_SIZE;
+
+    // Make room by dropping whole segments, oldest first
+    while (total_bytes + need > SPOOL_MAX_BYTES) {
+        if (read_seg == write_seg) roll_write_segment();
+        if (read_seg == write_seg) break; // Nothing left to drop
+        uint32_t lost = count_records(read_seg, read_off);
+        pending -= lost < pending ? lost : pending;
+        dropped += lost;
+        ESP_LOGW(TAG, "Spool full, dropped %lu oldest events", lost);
+        retire_read_segment();
+    }
+
+    if (write_size >= SPOOL_SEGMENT_BYTES) roll_write_segment();
+    if (!write_fp) {
+        char path[SPOOL_PATH_LEN];
+        segment_path(write_seg, path);
+        write_fp = fopen(path, "ab");
+        if (!write_fp) {
+            ESP_LOGE(TAG, "Failed to open %s", path);
+            return ESP_FAIL;
+        }
+    }
+
+    spool_rec_t rec = {
+        .magic = SPOOL_MAGIC,
+        .len = (uint32_t)len,
+        .timestamp = timestamp,
+    };
+    rec.crc = record_crc(&rec, buf);
+    bool ok = fwrite(&rec, sizeof(rec), 1, write_fp) == 1 && fwrite(buf, 1, len, write_fp) == len;
+    ok = ok && fflush(write_fp) == 0 && fsync(fileno(write_fp)) == 0;
+    if (!ok) {
+        // Whatever made it to the card is a torn record; seal the segment there
+        ESP_LOGE(TAG, "Failed to append %zu bytes to the spool", len);
+        write_size = SPOOL_SEGMENT_BYTES; // Seal it even if this was its first record
+        roll_write_segment();
+        return ESP_FAIL;
+    }
+    write_size += need;
+    write_count++;
+    total_bytes += need;
+    pending++;
+    return ESP_OK;
+}
+
+static void advance(uint32_t rec_len) {
+    read_off += sizeof(spool_rec_t) + rec_len;
+    pending--;
+    if ((long)read_off >= segment_size(read_seg) && read_seg < write_seg) {
+        retire_read_segment();
+    } else {
+        save_cursor();
+    }
+}
+
+uint8_t *spool_peek(size_t *len, int64_t *timestamp) {
+    while (spool_ok && pending > 0) {
+        if (read_seg == write_seg) roll_write_segment(); // Never read the file being appended to
+
+        char path[SPOOL_PATH_LEN];
+        segment_path(read_seg, path);
+        FILE *fp = fopen(path, "rb");
+        spool_rec_t rec;
+        bool framed = fp && fseek(fp, read_off, SEEK_SET) == 0 && fread(&rec, sizeof(rec), 1, fp) == 1 &&
+                      rec.magic == SPOOL_MAGIC && rec.len > 0 && rec.len <= SPOOL_MAX_RECORD;
+        if (framed) {
+            uint8_t *buf = (uint8_t *)heap_caps_malloc(rec.len, MALLOC_CAP_SPIRAM);
+            if (!buf) {
+                fclose(fp);
+                return NULL; // Try again later
+            }
+            bool ok = fread(buf, 1, rec.len, fp) == rec.len;
+            fclose(fp);
+            if (ok && record_crc(&rec, buf) == rec.crc) {
+                *len = rec.len;
+                *timestamp = rec.timestamp;
+                peeked_len = rec.len;
+                return buf;
+            }
+            heap_caps_free(buf);
+            if (ok) { // Damaged payload, the framing still holds: skip just this record
+                ESP_LOGW(TAG, "Skipping corrupt event in %s", path);
+                dropped++;
+                advance(rec.len);
+                continue;
+            }
+        } else if (fp) {
+            fclose(fp);
+        }
+
+        // End of a sealed segment, or a torn/corrupt tail: move to the next one
+        if (read_seg >= write_seg) break;
+        uint32_t before = pending;
+        retire_read_segment();
+        pending = write_count;
+        for (uint32_t seg = read_seg; seg < write_seg; seg++) pending += count_records(seg, 0);
+        if (pending < before) {
+            dropped += before - pending;
+            ESP_LOGW(TAG, "Skipped %lu unreadable events in %s", before - pending, path);
+        }
+    }
+    return NULL;
+}
+
+void spool_pop(void) {
+    if (!spool_ok || pending == 0 || peeked_len == 0) return;
+    advance(peeked_len);
+    peeked_len = 0;
+}
@@ -0,0 +1,48 @@
+// spool.h
+// Event bursts that could not be uploaded, kept on the SD card until the
+// server is reachable again. The spool is an append-only journal of opaque
+// records split into segment files; records are read back strictly in the
+// order they were written. A cursor file remembers how far the upload
+// worker got, and a segment is deleted once it has been fully delivered.
+// When the spool outgrows SPOOL_MAX_BYTES the oldest segment is dropped.
+// Only the upload worker uses it, so there is no locking.
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#ifndef SPOOL_DIR
+#define SPOOL_DIR "/sdcard/spool"
+#endif
+#ifndef SPOOL_MAX_BYTES
+#define SPOOL_MAX_BYTES (64 * 1024 * 1024)  // Whole spool, oldest events are dropped beyond it
+#endif
+#ifndef SPOOL_SEGMENT_BYTES
+#define SPOOL_SEGMENT_BYTES (1024 * 1024)   // A new segment file is started past this size
+#endif
+
+typedef struct {
+    uint32_t pending;   // Records waiting
+    uint64_t bytes;     // On the card, headers included
+    uint32_t dropped;   // Records lost to the size cap or corruption
+} spool_stats_t;
+
+esp_err_t spool_init(void);   // Scans SPOOL_DIR, needs the SD card mounted
+bool spool_ready(void);
+esp_err_t spool_append(const uint8_t *buf, size_t len, int64_t timestamp);
+uint8_t *spool_peek(size_t *len, int64_t *timestamp); // Oldest record in a PSRAM buffer the caller frees, NULL if none
+void spool_pop(void);         // Oldest record was delivered
+uint32_t spool_pending(void);
+void spool_get_stats(spool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // SPOOL_H
@@ -0,0 +1,157 @@
+// trace.c
+
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+static const char *TAG = "trace";
+
+#define TRACE_MAGIC "CTRC"
+#define TRACE_VERSION 1
+
+// Dump file: this header, the name table (per event "name\0arg_a\0arg_b\0"),
+// then the records, oldest first
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t rec_size;
+    uint32_t records;
+    uint32_t overwritten;  // Records lost to the ring wrapping since boot
+    uint32_t lost;         // Records dropped during dumps
+    int64_t dump_us;       // esp_timer time of the dump, to extend the 32-bit record times
+    int64_t dump_ms;       // Wall clock at the same moment, 0 if never synced
+    uint16_t event_count;
+    uint16_t names_len;
+} trace_file_hdr_t;
+
+typedef struct {
+    const char *name;
+    const char *a;
+    const char *b;
+} trace_names_t;
+
+static const trace_names_t event_names[TRACE_EVENT_COUNT] = {
+    [TRACE_CAM_GRAB] = { "cam_grab", "len", "due" },
+    [TRACE_CAM_MOTION] = { "cam_motion", "us", "score" },
+    [TRACE_REC_QUEUED] = { "rec_queued", "len", "waiting" },
+    [TRACE_REC_WAIT] = { "rec_wait", "", "" },
+    [TRACE_REC_FRAME] = { "rec_frame", "len", "" },
+    [TRACE_REC_FLUSH] = { "rec_flush", "bytes", "offset" },
+    [TRACE_REC_SAVED] = { "rec_saved", "frame", "fill" },
+    [TRACE_FB_RELEASE] = { "fb_release", "free_heap", "" },
+    [TRACE_LIVE_LOAD] = { "live_load", "len", "rtp" },
+    [TRACE_LIVE_SENT] = { "live_sent", "len", "total_us" },
+    [TRACE_PB_FRAME] = { "pb_frame", "len", "session" },
+    [TRACE_OPUS_ENC] = { "opus_enc", "us", "bytes" },
+    [TRACE_MARK] = { "mark", "a", "b" },
+};
+
+static trace_rec_t *ring = NULL;
+static uint32_t head = 0;             // Records reserved since boot, the next goes to ring[head % TRACE_RECORDS]
+static volatile bool enabled = true;
+static volatile bool paused = false;  // A dump is reading the ring
+static volatile uint32_t lost = 0;
+
+esp_err_t trace_init(void) {
+    if (ring) return ESP_OK;
+    ring = (trace_rec_t *)heap_caps_calloc(TRACE_RECORDS, sizeof(trace_rec_t), MALLOC_CAP_SPIRAM);
+    if (!ring) {
+        ESP_LOGE(TAG, "No PSRAM for the trace ring, tracing off");
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "Trace ring of %d records", TRACE_RECORDS);
+    return ESP_OK;
+}
+
+// Writers only race on head; a slot belongs to whoever reserved it
+void trace(trace_event_t event, uint32_t a, uint32_t b) {
+    if (!ring || !enabled) return;
+    if (paused) {
+        lost++; // Not atomic, an estimate is enough
+        return;
+    }
+    uint32_t n = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    trace_rec_t *rec = &ring[n & (TRACE_RECORDS - 1)];
+    rec->time_us = (uint32_t)esp_timer_get_time();
+    rec->event = (uint16_t)event;
+    rec->core = (uint8_t)xPortGetCoreID();
+    rec->a = a;
+    rec->b = b;
+}
+
+void trace_set_enabled(bool on) {
+    enabled = on;
+}
+
+void trace_get_stats(trace_stats_t *out) {
+    out->written = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    out->lost = lost;
+    out->enabled = enabled;
+}
+
+static bool write_names(FILE *fp, uint16_t *len) {
+    *len = 0;
+    for (int i = 0; i < TRACE_EVENT_COUNT; i++) {
+        const char *s[3] = { event_names[i].name, event_names[i].a, event_names[i].b };
+        for (int j = 0; j < 3; j++) {
+            size_t n = strlen(s[j]) + 1;
+            if (fwrite(s[j], 1, n, fp) != n) return false;
+            *len += n;
+        }
+    }
+    return true;
+}
+
+esp_err_t trace_dump(uint32_t *records) {
+    if (!ring) return ESP_ERR_INVALID_STATE;
+    FILE *fp = fopen(TRACE_DUMP_PATH, "wb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to open %s", TRACE_DUMP_PATH);
+        return ESP_FAIL;
+    }
+
+    // Writers that passed the paused check before it was set finish within a tick
+    paused = true;
+    vTaskDelay(pdMS_TO_TICKS(10));
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    uint32_t count = end < TRACE_RECORDS ? end : TRACE_RECORDS;
+    uint32_t first = (end - count) & (TRACE_RECORDS - 1);
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    trace_file_hdr_t hdr = {
+        .magic = TRACE_MAGIC, // No terminating NUL
+        .version = TRACE_VERSION,
+        .rec_size = sizeof(trace_rec_t),
+        .records = count,
+        .overwritten = end - count,
+        .lost = lost,
+        .dump_us = esp_timer_get_time(),
+        .dump_ms = tv.tv_sec > 1577836800 ? tv.tv_sec * 1000LL + tv.tv_usec / 1000 : 0,
+        .event_count = TRACE_EVENT_COUNT,
+    };
+    // The name table length goes in the header, so it is rewritten once known
+    uint16_t names_len = 0;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && write_names(fp, &names_len);
+    hdr.names_len = names_len;
+    uint32_t tail = TRACE_RECORDS - first < count ? TRACE_RECORDS - first : count; // Up to the end of the ring
+    if (ok) ok = fwrite(&ring[first], sizeof(trace_rec_t), tail, fp) == tail;
+    if (ok && count > tail) ok = fwrite(ring, sizeof(trace_rec_t), count - tail, fp) == count - tail;
+    paused = false;
+
+    if (ok) ok = fseek(fp, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+    if (fclose(fp) != 0) ok = false;
+    if (!ok) {
+        ESP_LOGE(TAG, "Trace dump to %s failed", TRACE_DUMP_PATH);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Dumped %lu trace records to %s", count, TRACE_DUMP_PATH);
+    if (records) *records = count;
+    return ESP_OK;
+}
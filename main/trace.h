@@ -0,0 +1,63 @@
+// trace.h
+// Binary trace log for the per-frame hot paths. trace() stores one fixed-size
+// record (event, esp_timer time, core, two arguments) in a ring in PSRAM:
+// no formatting, no locks, no UART. The ring keeps the last TRACE_RECORDS
+// records; "trace dump" writes them to TRACE_DUMP_PATH, and
+// tools/trace_decode.py turns that file into text on the host. The dump file
+// carries the event and argument names, so the tool needs no copy of this list.
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define TRACE_RECORDS 8192 // 128 KB of PSRAM, a power of two
+#define TRACE_DUMP_PATH "/sdcard/trace.bin"
+
+typedef enum {
+    TRACE_CAM_GRAB = 0,   // Camera task got a frame: len, consumers due
+    TRACE_CAM_MOTION,     // Motion analysis: us, score
+    TRACE_REC_QUEUED,     // Copy queued for captureTask: len, frames waiting
+    TRACE_REC_WAIT,       // captureTask waiting for a frame
+    TRACE_REC_FRAME,      // captureTask received one: len
+    TRACE_REC_FLUSH,      // SD buffer written: bytes, file offset
+    TRACE_REC_SAVED,      // Frame added to the AVI: frame number, buffer fill
+    TRACE_FB_RELEASE,     // Shared camera buffer returned: free heap
+    TRACE_LIVE_LOAD,      // Live frame taken from the mailbox: len, RTP
+    TRACE_LIVE_SENT,      // Live frame fully sent: len, capture to sent us
+    TRACE_PB_FRAME,       // Playback frame loaded: len, session
+    TRACE_OPUS_ENC,       // Opus frame encoded: us, bytes
+    TRACE_MARK,           // Ad hoc
+    TRACE_EVENT_COUNT
+} trace_event_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t time_us;     // Low 32 bits of esp_timer_get_time()
+    uint16_t event;       // trace_event_t
+    uint8_t core;
+    uint8_t reserved;
+    uint32_t a;
+    uint32_t b;
+} trace_rec_t;            // 16 bytes, little-endian
+
+typedef struct {
+    uint32_t written;     // Since boot
+    uint32_t lost;        // Dropped while a dump was running
+    bool enabled;
+} trace_stats_t;
+
+esp_err_t trace_init(void);   // Allocates the ring; trace() is a no-op before
+void trace(trace_event_t event, uint32_t a, uint32_t b); // Any task or core; not from ISRs
+void trace_set_enabled(bool on);
+esp_err_t trace_dump(uint32_t *records); // Writes the ring, oldest first, to TRACE_DUMP_PATH. Blocks on the SD card
+void trace_get_stats(trace_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_H
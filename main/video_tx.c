@@ -0,0 +1,367 @@
+// video_tx.c
+
+#include "video_tx.h"
+#include "recorder.h" // Playback sessions
+#include "camera.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_random.h"
+
+#include "peer_connection.h"
+#include "frame_proto.h"
+#include "rtp_jpeg.h"
+#include "latency.h"
+#include "jpeg_inspect.h"
+#include "trace.h"
+
+extern PeerConnection *g_pc;
+extern int gDataChannelOpened;
+extern int gRtpVideoOpened;
+extern PeerConnectionState eState;
+static const char *TAG = "video_tx";
+
+// Frames go out through one token bucket, shared by live and playback
+// because they share the SCTP association.
+#define PACER_START_RATE (800 * 1024) // Bytes/s
+#define PACER_MIN_RATE (64 * 1024)
+#define PACER_MAX_RATE (2500 * 1024)
+#define PACER_FRAG (sizeof(frame_hdr_t) + FRAME_FRAG_PAYLOAD)
+#define PACER_BURST MAX(4 * PACER_FRAG, PACER_MAX_RATE / configTICK_RATE_HZ) // The sender wakes at most once per tick
+#define FRAME_SEND_BUDGET_US 66000 // About one live frame interval
+
+typedef struct {
+    bool use_sid; // Framed live frames go on the default stream
+    uint16_t sid;
+} dc_target_t;
+
+static frame_pacer_t pacer;
+static TaskHandle_t sender_task = NULL; // Task calling video_tx_service
+
+// --- Live ---
+// A copy of a live frame plus its latency stamps
+typedef struct {
+    camera_fb_t fb;
+    frame_stamps_t stamps;
+} live_frame_t;
+
+// Latest-wins mailbox: the camera swaps its copy in, the connection task
+// swaps it out. Whatever was still in the slot is stale and freed.
+static _Atomic(live_frame_t *) live_mailbox = NULL;
+static uint32_t live_published = 0;  // Written by the camera task only
+static uint32_t live_superseded = 0; // Camera task only
+static uint32_t live_rejected = 0;   // Camera task only
+static uint32_t live_sent = 0;       // Connection task only
+
+static live_frame_t *live_frame = NULL; // Frame being sent
+static bool live_rtp = false;          // ...as RTP/JPEG, otherwise framed
+static int64_t live_started_us = 0;
+static frame_tx_t live_tx;
+static rtp_jpeg_tx_t rtp_tx;
+
+// --- Playback ---
+static camera_fb_t *playback_frame[MAX_PLAYBACK_SESSIONS];
+static int64_t playback_started_us[MAX_PLAYBACK_SESSIONS];
+static dc_target_t playback_target[MAX_PLAYBACK_SESSIONS];
+static frame_tx_t playback_tx[MAX_PLAYBACK_SESSIONS];
+
+// --- Snapshot ---
+// One data channel request at a time. It waits here, without blocking the
+// connection task, until the camera has cached a young enough frame.
+#define SNAPSHOT_SEND_BUDGET_US 1000000 // A still is worth more patience than a live frame
+static bool snapshot_pending = false;
+static uint32_t snapshot_max_age_ms;
+static int64_t snapshot_deadline_us;
+static dc_target_t snapshot_target;
+static snapshot_t *snapshot_frame = NULL; // Being sent
+static int64_t snapshot_started_us;
+static frame_tx_t snapshot_tx;
+
+static void free_frame(camera_fb_t *fb) {
+    if (!fb) return;
+    heap_caps_free(fb->buf);
+    heap_caps_free(fb);
+}
+
+static void free_live_frame(live_frame_t *lf) {
+    if (!lf) return;
+    heap_caps_free(lf->fb.buf);
+    heap_caps_free(lf);
+}
+
+// Caller holds xSemaphore
+static int dc_send(const uint8_t *data, size_t len, void *ctx) {
+    dc_target_t *target = (dc_target_t *)ctx;
+    if (target->use_sid) return peer_connection_datachannel_send_sid(g_pc, (char*)data, len, target->sid);
+    return peer_connection_datachannel_send(g_pc, (char*)data, len);
+}
+
+esp_err_t video_tx_init(void) {
+    frame_pacer_init(&pacer, PACER_START_RATE, PACER_MIN_RATE, PACER_MAX_RATE, PACER_BURST);
+    frame_tx_init(&live_tx, FRAME_STREAM_LIVE);
+    rtp_jpeg_tx_init(&rtp_tx, esp_random());
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) frame_tx_init(&playback_tx[i], FRAME_STREAM_PLAYBACK + i);
+    frame_tx_init(&snapshot_tx, FRAME_STREAM_SNAPSHOT);
+    return ESP_OK;
+}
+
+void video_tx_publish(const camera_fb_t *fb, int64_t grab_us) {
+    jpeg_info_t info;
+    int res = jpeg_inspect(fb->buf, fb->len, 0, &info);
+    if (res != JPEG_OK) {
+        live_rejected++;
+        ESP_LOGW(TAG, "Live frame not sent: %s", jpeg_inspect_err_name(res));
+        return;
+    }
+
+    live_frame_t *copy = (live_frame_t*)heap_caps_calloc(1, sizeof(live_frame_t), MALLOC_CAP_SPIRAM);
+    if (!copy) {
+        ESP_LOGE(TAG, "Failed to allocate live frame struct!");
+        return;
+    }
+    copy->fb = *fb;
+    copy->fb.len = info.len; // Without the driver's padding after EOI
+    copy->fb.buf = (uint8_t*)heap_caps_malloc(info.len, MALLOC_CAP_SPIRAM);
+    if (!copy->fb.buf) {
+        ESP_LOGE(TAG, "Failed to allocate live frame buffer (%zu bytes)", info.len);
+        heap_caps_free(copy);
+        return;
+    }
+    memcpy(copy->fb.buf, fb->buf, info.len);
+    copy->stamps.capture_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+    copy->stamps.grab_us = grab_us;
+    copy->stamps.publish_us = esp_timer_get_time();
+
+    live_frame_t *stale = atomic_exchange(&live_mailbox, copy);
+    live_published++;
+    if (stale) {
+        live_superseded++;
+        free_live_frame(stale);
+    }
+    video_tx_kick();
+}
+
+void video_tx_kick(void) {
+    if (sender_task) xTaskNotifyGive(sender_task);
+}
+
+static void live_release(void) {
+    free_live_frame(live_frame);
+    live_frame = NULL;
+}
+
+// Nothing of the in-flight frame has reached the channel yet
+static bool live_untouched(void) {
+    return live_rtp ? (rtp_tx.loaded && rtp_tx.offset == 0) : (live_tx.buf && live_tx.offset == 0);
+}
+
+static bool live_load(int64_t now) {
+    live_frame = atomic_exchange(&live_mailbox, NULL);
+    if (!live_frame) return false;
+    live_started_us = now;
+    live_frame->stamps.dequeue_us = esp_timer_get_time();
+    camera_fb_t *fb = &live_frame->fb;
+    uint64_t captured_us = live_frame->stamps.capture_us;
+    live_rtp = gRtpVideoOpened;
+    trace(TRACE_LIVE_LOAD, fb->len, live_rtp);
+    if (live_rtp) {
+        uint32_t rtp_ts = (uint32_t)(captured_us * (RTP_JPEG_CLOCK_HZ / 10000) / 100);
+        int res = rtp_jpeg_tx_load(&rtp_tx, fb->buf, fb->len, rtp_ts);
+        if (res != RTP_JPEG_OK) {
+            ESP_LOGW(TAG, "Frame not sendable as RTP/JPEG (%d)", res);
+            live_release();
+            return false;
+        }
+    } else { // Client without the RTP channel, fall back to framed data-channel fragments
+        frame_tx_load(&live_tx, fb->buf, fb->len, captured_us, 0);
+    }
+    return true;
+}
+
+// RTP packets go on the unordered, no-retransmit channel. A failed send drops
+// the rest of the frame instead of retrying: the client discards the
+// incomplete frame and the next one starts clean.
+static bool pump_rtp(int64_t now) {
+    static dc_target_t target = { .use_sid = true, .sid = RTP_VIDEO_SID };
+    while (rtp_tx.loaded) {
+        if (frame_pacer_wait_us(&pacer, RTP_JPEG_MAX_PACKET, now) > 0) return false;
+        size_t len = rtp_jpeg_tx_next(&rtp_tx);
+        bool ok = dc_send(rtp_tx.packet, len, &target) >= 0;
+        frame_pacer_sent(&pacer, len, ok, now);
+        if (!ok) {
+            rtp_jpeg_tx_abandon(&rtp_tx);
+            ESP_LOGW(TAG, "RTP frame dropped (%lu of %lu)", rtp_tx.dropped, rtp_tx.dropped + rtp_tx.frames);
+        } else if (!rtp_tx.loaded) {
+            live_sent++;
+        }
+    }
+    return true;
+}
+
+static void service_live(int64_t now) {
+    static dc_target_t target = { .use_sid = false };
+
+    // A frame still waiting for its first packet is replaced by a newer one
+    if (live_frame && live_untouched() && atomic_load(&live_mailbox) != NULL) {
+        if (live_rtp) rtp_jpeg_tx_abandon(&rtp_tx);
+        else frame_tx_abandon(&live_tx);
+        live_release();
+    }
+    if (!live_frame && !live_load(now)) return;
+
+    frame_stamps_t *st = &live_frame->stamps;
+    int64_t pump_start = esp_timer_get_time();
+    uint32_t sent_before = live_sent;
+    bool done;
+    if (live_rtp) {
+        done = pump_rtp(now);
+    } else {
+        done = frame_tx_pump(&live_tx, &pacer, now, dc_send, &target) == FRAME_TX_DONE;
+        if (done) live_sent++;
+    }
+    if (st->send_start_us == 0 && (done || !live_untouched())) st->send_start_us = pump_start;
+    if (live_sent != sent_before) {
+        st->send_done_us = esp_timer_get_time();
+        latency_record(st);
+        trace(TRACE_LIVE_SENT, live_frame->fb.len, (uint32_t)(st->send_done_us - st->capture_us));
+    }
+    if (!done && now - live_started_us > FRAME_SEND_BUDGET_US) {
+        if (live_rtp) rtp_jpeg_tx_abandon(&rtp_tx);
+        else frame_tx_abandon(&live_tx);
+        ESP_LOGW(TAG, "Live frame cut short after %lld us", now - live_started_us);
+        done = true;
+    }
+    if (done) live_release();
+}
+
+// One frame in flight per playback session. The starting session rotates on
+// each call so a fast reader can't starve the others.
+static void service_playback(int64_t now) {
+    static int next_session = 0;
+
+    for (int n = 0; n < MAX_PLAYBACK_SESSIONS; n++) {
+        int i = (next_session + n) % MAX_PLAYBACK_SESSIONS;
+        playback_session_t *s = &playbackSessions[i];
+        if (!playback_frame[i]) {
+            if (s->frameQueue == NULL || xQueueReceive(s->frameQueue, &playback_frame[i], 0) != pdTRUE) continue;
+            camera_fb_t *fb = playback_frame[i];
+            if (!fb || !fb->buf || fb->len == 0) {
+                ESP_LOGW(TAG, "Received invalid frame from playback queue.");
+                if (fb) heap_caps_free(fb); // Free struct if buf was null
+                playback_frame[i] = NULL;
+                continue;
+            }
+            trace(TRACE_PB_FRAME, fb->len, s->id);
+            playback_target[i] = (dc_target_t){ .use_sid = true, .sid = s->sid };
+            playback_started_us[i] = now;
+            frame_tx_load(&playback_tx[i], fb->buf, fb->len, now, FRAME_FLAG_PLAYBACK);
+        }
+        if (frame_tx_pump(&playback_tx[i], &pacer, now, dc_send, &playback_target[i]) == FRAME_TX_PENDING) {
+            if (now - playback_started_us[i] <= FRAME_SEND_BUDGET_US) continue;
+            frame_tx_abandon(&playback_tx[i]);
+            ESP_LOGW(TAG, "Playback frame cut short (session %d, %lu dropped)", i, playback_tx[i].dropped);
+        }
+        free_frame(playback_frame[i]);
+        playback_frame[i] = NULL;
+    }
+    next_session = (next_session + 1) % MAX_PLAYBACK_SESSIONS;
+}
+
+esp_err_t video_tx_snapshot(uint16_t sid, uint32_t max_age_ms) {
+    if (snapshot_pending || snapshot_frame) return ESP_ERR_INVALID_STATE;
+    snapshot_pending = true;
+    snapshot_max_age_ms = max_age_ms;
+    snapshot_deadline_us = esp_timer_get_time() + SNAPSHOT_WAIT_MS * 1000LL;
+    snapshot_target = (dc_target_t){ .use_sid = true, .sid = sid };
+    video_tx_kick();
+    return ESP_OK;
+}
+
+static void snapshot_done(void) {
+    snapshot_release(snapshot_frame);
+    snapshot_frame = NULL;
+}
+
+static void service_snapshot(int64_t now) {
+    if (snapshot_pending) {
+        snapshot_frame = snapshot_acquire(snapshot_max_age_ms, 0); // Asks the camera for a capture if needed
+        if (!snapshot_frame) {
+            if (now < snapshot_deadline_us) return;
+            static const char reply[] = "error:snapshot unavailable";
+            dc_send((const uint8_t *)reply, sizeof(reply) - 1, &snapshot_target);
+            snapshot_pending = false;
+            return;
+        }
+        snapshot_pending = false;
+        snapshot_started_us = now;
+        frame_tx_load(&snapshot_tx, snapshot_frame->buf, snapshot_frame->len, snapshot_frame->capture_us,
+                      FRAME_FLAG_SNAPSHOT);
+    }
+    if (!snapshot_frame) return;
+    if (frame_tx_pump(&snapshot_tx, &pacer, now, dc_send, &snapshot_target) == FRAME_TX_PENDING) {
+        if (now - snapshot_started_us <= SNAPSHOT_SEND_BUDGET_US) return;
+        frame_tx_abandon(&snapshot_tx);
+        ESP_LOGW(TAG, "Snapshot cut short");
+    }
+    snapshot_done();
+}
+
+static bool playback_pending(void) {
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (playback_frame[i]) return true;
+        QueueHandle_t q = playbackSessions[i].frameQueue;
+        if (q && uxQueueMessagesWaiting(q) > 0) return true;
+    }
+    return false;
+}
+
+int64_t video_tx_service(void) {
+    sender_task = xTaskGetCurrentTaskHandle();
+    if (eState != PEER_CONNECTION_COMPLETED || !gDataChannelOpened) return -1;
+    int64_t now = esp_timer_get_time();
+    service_live(now);
+    service_playback(now);
+    service_snapshot(now);
+
+    // A snapshot waiting for its capture is woken by video_tx_kick from the camera task
+    if (!live_frame && atomic_load(&live_mailbox) == NULL && !playback_pending() && !snapshot_frame) return -1;
+    return frame_pacer_wait_us(&pacer, PACER_FRAG, esp_timer_get_time());
+}
+
+void video_tx_reset(void) {
+    if (live_frame) {
+        rtp_jpeg_tx_abandon(&rtp_tx);
+        frame_tx_abandon(&live_tx);
+        live_release();
+    }
+    free_live_frame(atomic_exchange(&live_mailbox, NULL));
+    for (int i = 0; i < MAX_PLAYBACK_SESSIONS; i++) {
+        if (!playback_frame[i]) continue;
+        frame_tx_abandon(&playback_tx[i]);
+        free_frame(playback_frame[i]);
+        playback_frame[i] = NULL;
+    }
+    if (snapshot_frame) {
+        frame_tx_abandon(&snapshot_tx);
+        snapshot_done();
+    }
+    snapshot_pending = false;
+}
+
+void video_tx_get_stats(video_tx_stats_t *stats) {
+    stats->published = live_published;
+    stats->superseded = live_superseded;
+    stats->sent = live_sent;
+    stats->dropped = live_tx.dropped + rtp_tx.dropped + live_rejected;
+    stats->pacer_rate = pacer.rate;
+    stats->pacer_failures = pacer.failures;
+}
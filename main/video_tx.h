@@ -0,0 +1,39 @@
+// video_tx.h
+// Live and playback video sending. The camera task only publishes into a
+// one-slot mailbox; peer_connection_task drains it between
+// peer_connection_loop calls, while it already holds the WebRTC mutex, and
+// sends as much as the pacer allows without ever blocking. Publishing wakes
+// the connection task, so it doesn't have to poll for frames.
+#ifndef VIDEO_TX_H
+#define VIDEO_TX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+#include "snapshot.h"
+
+typedef struct {
+    uint32_t published;      // Live frames handed over by the camera task
+    uint32_t superseded;     // ...replaced in the mailbox before being picked up
+    uint32_t sent;           // ...sent completely
+    uint32_t dropped;        // ...abandoned part-way, not packetizable or corrupt
+    uint32_t pacer_rate;     // Bytes/s
+    uint32_t pacer_failures; // Refused sends
+} video_tx_stats_t;
+
+esp_err_t video_tx_init(void);
+void video_tx_publish(const camera_fb_t *fb, int64_t grab_us); // Camera task: copies fb, replacing a frame nobody picked up yet
+int64_t video_tx_service(void);               // Connection task, xSemaphore held. Returns us until it can send more, -1 if idle
+void video_tx_kick(void);                     // Wake the connection task, new frames are waiting
+void video_tx_reset(void);                    // Connection task: drop everything in flight
+void video_tx_get_stats(video_tx_stats_t *stats); // Connection task
+esp_err_t video_tx_snapshot(uint16_t sid, uint32_t max_age_ms); // Connection task: send a cached still on sid
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VIDEO_TX_H
@@ -20,6 +20,7 @@
 #include "esp_timer.h"
 
 #include "wifimanager.h"
+#include "snapshot.h"
 
 // ---------- Definitions and Globals ----------
 
@@ -70,6 +71,7 @@ void uart_request_task(void *pvParameters);
 // HTTP Handlers
 static esp_err_t root_get_handler(httpd_req_t *req);
 static esp_err_t save_post_handler(httpd_req_t *req);
+static esp_err_t snapshot_get_handler(httpd_req_t *req);
 
 
 
@@ -826,6 +828,74 @@ static esp_err_t delete_get_handler(httpd_req_t *req)
     return ESP_OK;
 }
 
+// The snapshot server answers on the home network, so a request has to carry
+// the camera id, either as an X-Camera-Id header or ?camera_id=. Compared in
+// constant time; nothing is served until a camera id has been configured.
+static bool snapshot_authorized(httpd_req_t *req, const char *query)
+{
+    char given[sizeof(stored_camera_id) * 3]; // Room for a URL-encoded id
+    char decoded[sizeof(given)];
+    size_t id_len = strlen(stored_camera_id);
+    if (id_len == 0) return false;
+    if (httpd_req_get_hdr_value_str(req, "X-Camera-Id", given, sizeof(given)) == ESP_OK) {
+        strcpy(decoded, given);
+    } else if (query && httpd_query_key_value(query, "camera_id", given, sizeof(given)) == ESP_OK) {
+        urldecode(decoded, given);
+    } else {
+        return false;
+    }
+    if (strlen(decoded) != id_len) return false;
+    uint8_t diff = 0;
+    for (size_t i = 0; i < id_len; i++) diff |= decoded[i] ^ stored_camera_id[i];
+    return diff == 0;
+}
+
+// GET /snapshot?camera_id=<id>[&max_age=ms]: latest cached JPEG, no older
+// than max_age (SNAPSHOT_MAX_AGE_MS by default). Only a stale cache costs a
+// capture.
+static esp_err_t snapshot_get_handler(httpd_req_t *req)
+{
+    uint32_t max_age_ms = SNAPSHOT_MAX_AGE_MS;
+    char query[160], value[12];
+    bool have_query = httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+    if (!snapshot_authorized(req, have_query ? query : NULL)) {
+        ESP_LOGW(TAG, "Snapshot refused: missing or wrong camera id");
+        httpd_resp_set_status(req, "401 Unauthorized");
+        httpd_resp_send(req, "Camera id required", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    if (have_query && httpd_query_key_value(query, "max_age", value, sizeof(value)) == ESP_OK) {
+        max_age_ms = strtoul(value, NULL, 10);
+    }
+
+    snapshot_t *snap = snapshot_acquire(max_age_ms, pdMS_TO_TICKS(SNAPSHOT_WAIT_MS));
+    if (!snap) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_send(req, "No frame available", HTTPD_RESP_USE_STRLEN);
+        return ESP_OK;
+    }
+    char age[12];
+    snprintf(age, sizeof(age), "%lu", snapshot_age_ms(snap));
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    httpd_resp_set_hdr(req, "X-Frame-Age-Ms", age);
+    esp_err_t err = httpd_resp_send(req, (const char *)snap->buf, snap->len);
+    snapshot_release(snap);
+    return err;
+}
+
+static void register_snapshot_handler(httpd_handle_t server)
+{
+    httpd_uri_t snapshot_uri = {
+        .uri       = "/snapshot",
+        .method    = HTTP_GET,
+        .handler   = snapshot_get_handler,
+        .user_ctx  = NULL
+    };
+    httpd_register_uri_handler(server, &snapshot_uri);
+}
+
 // -----------------------------------------
 // Webserver Startup
 // -----------------------------------------
@@ -872,6 +942,24 @@ static httpd_handle_t start_webserver(void)
             .user_ctx  = NULL
         };
         httpd_register_uri_handler(server, &bootstrap_uri);
+
+        register_snapshot_handler(server);
+    }
+    return server;
+}
+
+// Station mode serves snapshots only, the configuration pages stay on the AP
+static httpd_handle_t start_snapshot_server(void)
+{
+    httpd_handle_t server = NULL;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = 80;
+    config.stack_size = 4096;
+
+    if (httpd_start(&server, &config) == ESP_OK) {
+        register_snapshot_handler(server);
+    } else {
+        ESP_LOGE(TAG, "Failed to start snapshot server");
     }
     return server;
 }
@@ -955,6 +1043,7 @@ static void wifi_connect_task(void) {
                 connected = true;
                 memcpy(&current_wifi, &stored_wifi[i], sizeof(wifi_credentials_t));
                 ESP_LOGI(TAG, "Connected to %s", stored_wifi[i].ssid);
+                start_snapshot_server();
                 break;
             }
             ESP_LOGI(TAG, "Timeout connecting to %s, disconnecting", stored_wifi[i].ssid);
@@ -0,0 +1,221 @@
+// frame_bench.c
+// Host benchmark for the frame analysis code that runs on the camera:
+// jpeg_inspect (quick and deep checks, tail search on a truncated frame),
+// the DC-luma motion detector and the perceptual hash. It reads the frames
+// of recorded AVIs (copied off the SD card) or loose JPEG files, in the
+// order given, and runs them through the detector as the camera task would.
+//
+// Build and run from the repository root:
+//   cc -O2 -Imain -o frame_bench tools/frame_bench.c main/motion.c main/phash.c main/jpeg_inspect.c -lm
+//   ./frame_bench [-v] [-r reps] /path/to/sdcard/2026-10-18/*.avi
+//
+// -v prints the motion result of every frame, not only the frames where it
+// changes. Timings are the average over reps passes (default 10) of all
+// frames. Host numbers are for comparing changes, not ESP32-S3 timings.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "jpeg_inspect.h"
+#include "motion.h"
+#include "phash.h"
+
+#define MAX_DC_BLOCKS (400 * 300) // 3200x2400, larger than any sensor mode
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} frame_t;
+
+static frame_t *frames = NULL;
+static size_t frame_count = 0, frame_cap = 0;
+
+static double now_s(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static uint8_t *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc(size) : NULL;
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = buf ? (size_t)size : 0;
+    return buf;
+}
+
+static void add_frame(const uint8_t *data, size_t len) {
+    if (frame_count == frame_cap) {
+        frame_cap = frame_cap ? frame_cap * 2 : 256;
+        frames = realloc(frames, frame_cap * sizeof(frame_t));
+    }
+    frames[frame_count].buf = malloc(len);
+    memcpy(frames[frame_count].buf, data, len);
+    frames[frame_count].len = len;
+    frame_count++;
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// Video chunks ("00dc"/"00db") of the movi list, in file order. Walks the
+// RIFF structure; a file whose header doesn't parse (a recording cut off
+// before closeAvi) is scanned for chunk headers instead.
+static size_t add_avi_frames(const uint8_t *avi, size_t len) {
+    size_t before = frame_count;
+    size_t pos = 12, movi_end = 0;
+    if (len > 12 && memcmp(avi, "RIFF", 4) == 0 && memcmp(avi + 8, "AVI ", 4) == 0) {
+        while (pos + 12 <= len) {
+            uint32_t size = rd32(avi + pos + 4);
+            if (memcmp(avi + pos, "LIST", 4) == 0 && memcmp(avi + pos + 8, "movi", 4) == 0) {
+                movi_end = pos + 8 + (size_t)size;
+                pos += 12;
+                break;
+            }
+            pos += 8 + (size_t)size + (size & 1);
+        }
+    }
+    if (movi_end) {
+        if (movi_end > len) movi_end = len;
+        while (pos + 8 <= movi_end) {
+            uint32_t size = rd32(avi + pos + 4);
+            if (pos + 8 + size > len) break;
+            if (memcmp(avi + pos, "00dc", 4) == 0 || memcmp(avi + pos, "00db", 4) == 0) add_frame(avi + pos + 8, size);
+            pos += 8 + (size_t)size + (size & 1);
+        }
+    } else {
+        for (pos = 0; pos + 8 <= len; pos++) {
+            if (memcmp(avi + pos, "00dc", 4) != 0) continue;
+            uint32_t size = rd32(avi + pos + 4);
+            if (size < 4 || pos + 8 + size > len || avi[pos + 8] != 0xFF || avi[pos + 9] != 0xD8) continue;
+            add_frame(avi + pos + 8, size);
+            pos += 8 + size - 1;
+        }
+    }
+    return frame_count - before;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcasecmp(s + n - m, suffix) == 0;
+}
+
+int main(int argc, char **argv) {
+    bool verbose = false;
+    int reps = 10;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-v") == 0) verbose = true;
+        else if (strcmp(argv[arg], "-r") == 0 && arg + 1 < argc) reps = atoi(argv[++arg]);
+        else break;
+    }
+    if (arg >= argc || reps < 1) {
+        fprintf(stderr, "usage: %s [-v] [-r reps] file.avi|file.jpg ...\n", argv[0]);
+        return 2;
+    }
+    for (; arg < argc; arg++) {
+        size_t len;
+        uint8_t *data = load_file(argv[arg], &len);
+        if (!data) {
+            fprintf(stderr, "%s: cannot read\n", argv[arg]);
+            continue;
+        }
+        if (ends_with(argv[arg], ".jpg") || ends_with(argv[arg], ".jpeg")) {
+            add_frame(data, len);
+        } else {
+            size_t n = add_avi_frames(data, len);
+            fprintf(stderr, "%s: %zu frames\n", argv[arg], n);
+        }
+        free(data);
+    }
+    if (frame_count == 0) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+
+    // --- Detection, one pass in order ---
+    static uint8_t luma[MAX_DC_BLOCKS];
+    motion_config_t cfg = MOTION_CONFIG_DEFAULT();
+    motion_detector_t md;
+    motion_init(&md, &cfg);
+    size_t total = 0, bad = 0, motion_frames = 0;
+    bool was_motion = false;
+    uint64_t prev_hash = 0;
+    for (size_t i = 0; i < frame_count; i++) {
+        jpeg_info_t info;
+        int res = jpeg_inspect(frames[i].buf, frames[i].len, JPEG_INSPECT_SCAN, &info);
+        total += frames[i].len;
+        if (res != JPEG_OK) {
+            printf("frame %zu: %s\n", i, jpeg_inspect_err_name(res));
+            bad++;
+            continue;
+        }
+        motion_result_t mr;
+        res = motion_process(&md, frames[i].buf, info.len, &mr);
+        if (res != MOTION_OK) {
+            printf("frame %zu: motion %s\n", i, motion_err_name(res));
+            bad++;
+            continue;
+        }
+        uint16_t w, h;
+        uint64_t hash = 0;
+        if (motion_dc_luma(frames[i].buf, info.len, luma, sizeof(luma), &w, &h) == MOTION_OK) hash = phash_luma(luma, w, h);
+        if (mr.motion) motion_frames++;
+        if (verbose || mr.motion != was_motion) {
+            printf("frame %zu: %ux%u motion=%d score=%u changed=%u mask=%012llx phash=%016llx (%d bits from previous)\n",
+                   i, info.width, info.height, mr.motion, mr.score, mr.changed, (unsigned long long)mr.mask,
+                   (unsigned long long)hash, i ? phash_distance(hash, prev_hash) : 0);
+        }
+        was_motion = mr.motion;
+        prev_hash = hash;
+    }
+    printf("%zu frames, average %zu bytes, %zu unusable, motion on %zu\n", frame_count, total / frame_count, bad, motion_frames);
+
+    // --- Timings ---
+    jpeg_info_t info;
+    double t0 = now_s();
+    for (int r = 0; r < reps; r++)
+        for (size_t i = 0; i < frame_count; i++) jpeg_inspect(frames[i].buf, frames[i].len, 0, &info);
+    double t1 = now_s();
+    for (int r = 0; r < reps; r++)
+        for (size_t i = 0; i < frame_count; i++) jpeg_inspect(frames[i].buf, frames[i].len, JPEG_INSPECT_SCAN, &info);
+    double t2 = now_s();
+    // Truncated frames: the last quarter is lost, so the EOI search runs the whole tail
+    for (int r = 0; r < reps; r++)
+        for (size_t i = 0; i < frame_count; i++) jpeg_inspect(frames[i].buf, frames[i].len - frames[i].len / 4, 0, &info);
+    double t3 = now_s();
+    uint16_t w, h;
+    for (int r = 0; r < reps; r++)
+        for (size_t i = 0; i < frame_count; i++) motion_dc_luma(frames[i].buf, frames[i].len, luma, sizeof(luma), &w, &h);
+    double t4 = now_s();
+    motion_reset(&md);
+    motion_result_t mr;
+    for (int r = 0; r < reps; r++)
+        for (size_t i = 0; i < frame_count; i++) motion_process(&md, frames[i].buf, frames[i].len, &mr);
+    double t5 = now_s();
+
+    double n = (double)reps * frame_count;
+    printf("jpeg_inspect quick     %9.3f us/frame\n", (t1 - t0) * 1e6 / n);
+    printf("jpeg_inspect deep      %9.3f us/frame (%.0f MB/s)\n", (t2 - t1) * 1e6 / n, total * reps / (t2 - t1) / 1e6);
+    printf("jpeg_inspect truncated %9.3f us/frame\n", (t3 - t2) * 1e6 / n);
+    printf("motion_dc_luma         %9.3f ms/frame (%.0f MB/s)\n", (t4 - t3) * 1e3 / n, total * reps / (t4 - t3) / 1e6);
+    printf("motion_process         %9.3f ms/frame\n", (t5 - t4) * 1e3 / n);
+
+    motion_free(&md);
+    for (size_t i = 0; i < frame_count; i++) free(frames[i].buf);
+    free(frames);
+    return 0;
+}
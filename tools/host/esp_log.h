@@ -0,0 +1,14 @@
+// esp_log.h
+// Host shim for the tools/ tests: logs go to stderr. Format warnings about
+// %lu with uint32_t are expected, uint32_t is unsigned long on the target.
+#ifndef HOST_ESP_LOG_H
+#define HOST_ESP_LOG_H
+#include <stdio.h>
+
+#define HOST_LOG(level, tag, fmt, ...) fprintf(stderr, level " (%s) " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) HOST_LOG("E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) HOST_LOG("W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) HOST_LOG("I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+
+#endif // HOST_ESP_LOG_H
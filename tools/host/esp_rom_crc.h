@@ -0,0 +1,17 @@
+// esp_rom_crc.h
+// Host shim for the tools/ tests: bitwise CRC-32 (IEEE 802.3, reflected),
+// chained like the ROM version: pass the previous result as crc.
+#ifndef HOST_ESP_ROM_CRC_H
+#define HOST_ESP_ROM_CRC_H
+#include <stdint.h>
+
+static inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+#endif // HOST_ESP_ROM_CRC_H
@@ -0,0 +1,453 @@
+// rtp_jpeg_test.c
+// Host test for the RTP/JPEG packetizer (rtp_jpeg.c). Every frame of the
+// recorded AVIs (copied off the SD card) or loose JPEG files given is
+// packetized the way video_tx.c sends it and reassembled as a receiver
+// would. The packets are checked against the frame's own headers, walked
+// here independently of rtp_jpeg_parse: RTP header and sequence numbers,
+// fragment offsets, the marker bit, Q = 255 with the quantization tables in
+// the first packet only, the restart header when there is a DRI, and the
+// reassembled scan against the original bytes.
+//
+// Build and run from the repository root:
+//   cc -O2 -Imain -o rtp_jpeg_test tools/rtp_jpeg_test.c main/rtp_jpeg.c
+//   ./rtp_jpeg_test [-v] [-o outdir] /path/to/sdcard/2026-10-18/*.avi snapshot.jpg
+//
+// Each captured frame is also tried as variants: padded after EOI, with a
+// DRI segment added, re-marked with the other supported subsampling (4:2:2
+// and 4:2:0 must both go through), re-marked 4:4:4 and cut short (both must
+// be rejected). -o writes each captured frame rebuilt from its packets with
+// the standard Huffman tables (RFC 2435 appendix B), to compare with the
+// original in any viewer. Exits 1 if any check fails.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rtp_jpeg.h"
+
+#define TEST_SSRC 0x5EEDCAFE
+#define TEST_SEQ 65530 // Starts just below the wrap
+#define TEST_DRI 8     // Restart interval of the DRI variant
+#define PAD_LEN 61     // Zero bytes added after EOI by the padded variant
+#define MAX_SCAN (1024 * 1024) // MAX_JPEG in recorder.h
+
+typedef struct {
+    uint8_t *buf;
+    size_t len;
+} frame_t;
+
+static frame_t *frames = NULL;
+static size_t frame_count = 0, frame_cap = 0;
+static bool verbose = false;
+static size_t checks = 0, failures = 0;
+
+// The frame as its JFIF headers describe it
+typedef struct {
+    uint8_t ysamp;          // Luma sampling factors from SOF0
+    size_t ysamp_pos;       // Where they are, for the re-marked variants
+    uint16_t width, height;
+    uint16_t dri;
+    uint8_t qtable[2][64];
+    size_t scan, scan_end;  // Entropy-coded data, up to EOI
+} ref_t;
+
+static uint8_t *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc(size) : NULL;
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = buf ? (size_t)size : 0;
+    return buf;
+}
+
+static void add_frame(const uint8_t *data, size_t len) {
+    if (frame_count == frame_cap) {
+        frame_cap = frame_cap ? frame_cap * 2 : 256;
+        frames = realloc(frames, frame_cap * sizeof(frame_t));
+    }
+    frames[frame_count].buf = malloc(len);
+    memcpy(frames[frame_count].buf, data, len);
+    frames[frame_count].len = len;
+    frame_count++;
+}
+
+static uint32_t rd32le(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Video chunks ("00dc"/"00db") of the movi list, in file order (as in frame_bench.c)
+static size_t add_avi_frames(const uint8_t *avi, size_t len) {
+    size_t before = frame_count;
+    size_t pos = 12, movi_end = 0;
+    if (len > 12 && memcmp(avi, "RIFF", 4) == 0 && memcmp(avi + 8, "AVI ", 4) == 0) {
+        while (pos + 12 <= len) {
+            uint32_t size = rd32le(avi + pos + 4);
+            if (memcmp(avi + pos, "LIST", 4) == 0 && memcmp(avi + pos + 8, "movi", 4) == 0) {
+                movi_end = pos + 8 + (size_t)size;
+                pos += 12;
+                break;
+            }
+            pos += 8 + (size_t)size + (size & 1);
+        }
+    }
+    if (movi_end) {
+        if (movi_end > len) movi_end = len;
+        while (pos + 8 <= movi_end) {
+            uint32_t size = rd32le(avi + pos + 4);
+            if (pos + 8 + size > len) break;
+            if (memcmp(avi + pos, "00dc", 4) == 0 || memcmp(avi + pos, "00db", 4) == 0) add_frame(avi + pos + 8, size);
+            pos += 8 + (size_t)size + (size & 1);
+        }
+    } else {
+        for (pos = 0; pos + 8 <= len; pos++) {
+            if (memcmp(avi + pos, "00dc", 4) != 0) continue;
+            uint32_t size = rd32le(avi + pos + 4);
+            if (size < 4 || pos + 8 + size > len || avi[pos + 8] != 0xFF || avi[pos + 9] != 0xD8) continue;
+            add_frame(avi + pos + 8, size);
+            pos += 8 + size - 1;
+        }
+    }
+    return frame_count - before;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcasecmp(s + n - m, suffix) == 0;
+}
+
+static const char *err_name(int res) {
+    switch (res) {
+    case RTP_JPEG_OK: return "ok";
+    case RTP_JPEG_ERR_TRUNCATED: return "truncated";
+    case RTP_JPEG_ERR_UNSUPPORTED: return "unsupported";
+    case RTP_JPEG_ERR_NO_SCAN: return "no scan";
+    default: return "?";
+    }
+}
+
+#define CHECK(cond, ...) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        printf("FAIL %s: ", name); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        return false; \
+    } \
+} while (0)
+
+// Walks the markers up to SOS, then forward through the scan to the first
+// EOI (0xFF 0xD9 can't occur inside entropy-coded data). False if the frame
+// has no SOF0, SOS or EOI.
+static bool ref_parse(const uint8_t *j, size_t len, ref_t *r) {
+    memset(r, 0, sizeof(*r));
+    if (len < 4 || j[0] != 0xFF || j[1] != 0xD8) return false;
+    size_t pos = 2;
+    bool have_sof = false;
+    while (pos + 4 <= len && j[pos] == 0xFF) {
+        uint8_t marker = j[pos + 1];
+        size_t seg_len = rd16(j + pos + 2);
+        const uint8_t *seg = j + pos + 4;
+        if (pos + 2 + seg_len > len) return false;
+        if (marker == 0xDB) {
+            for (size_t t = 0; t + 65 <= seg_len - 2; t += 65)
+                if ((seg[t] & 0x0F) < 2) memcpy(r->qtable[seg[t] & 0x0F], seg + t + 1, 64);
+        } else if (marker == 0xC0) {
+            r->height = rd16(seg + 1);
+            r->width = rd16(seg + 3);
+            r->ysamp = seg[7];
+            r->ysamp_pos = pos + 4 + 7;
+            have_sof = true;
+        } else if (marker == 0xDD) {
+            r->dri = rd16(seg);
+        } else if (marker == 0xDA) {
+            r->scan = pos + 2 + seg_len;
+            for (size_t i = r->scan; i + 1 < len; i++) {
+                if (j[i] == 0xFF && j[i + 1] == 0xD9) {
+                    r->scan_end = i;
+                    return have_sof;
+                }
+            }
+            return false;
+        }
+        pos += 2 + seg_len;
+    }
+    return false;
+}
+
+// --- Receiver side (RFC 2435 appendix B) ---
+
+static const uint8_t lum_dc_codelens[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const uint8_t lum_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t lum_ac_codelens[16] = {0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const uint8_t lum_ac_symbols[162] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+static const uint8_t chm_dc_codelens[16] = {0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const uint8_t chm_dc_symbols[12] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const uint8_t chm_ac_codelens[16] = {0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const uint8_t chm_ac_symbols[162] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+
+static void put16(FILE *f, uint16_t v) {
+    fputc(v >> 8, f);
+    fputc(v & 0xFF, f);
+}
+
+static void put_dht(FILE *f, uint8_t cls_id, const uint8_t *codelens, const uint8_t *symbols, size_t nsymbols) {
+    put16(f, 0xFFC4);
+    put16(f, 3 + 16 + nsymbols);
+    fputc(cls_id, f);
+    fwrite(codelens, 1, 16, f);
+    fwrite(symbols, 1, nsymbols, f);
+}
+
+// JFIF headers from the RTP/JPEG header fields; the reassembled scan and EOI follow
+static void write_headers(FILE *f, uint8_t type, uint8_t w8, uint8_t h8, uint16_t dri, const uint8_t *qtables) {
+    put16(f, 0xFFD8);
+    put16(f, 0xFFDB);
+    put16(f, 2 + 2 * 65);
+    for (int t = 0; t < 2; t++) {
+        fputc(t, f);
+        fwrite(qtables + 64 * t, 1, 64, f);
+    }
+    if (dri) {
+        put16(f, 0xFFDD);
+        put16(f, 4);
+        put16(f, dri);
+    }
+    put16(f, 0xFFC0);
+    put16(f, 17);
+    fputc(8, f);
+    put16(f, h8 * 8);
+    put16(f, w8 * 8);
+    fputc(3, f);
+    const uint8_t comps[9] = {0, (type & 63) == 0 ? 0x21 : 0x22, 0, 1, 0x11, 1, 2, 0x11, 1};
+    fwrite(comps, 1, sizeof(comps), f);
+    put_dht(f, 0x00, lum_dc_codelens, lum_dc_symbols, sizeof(lum_dc_symbols));
+    put_dht(f, 0x10, lum_ac_codelens, lum_ac_symbols, sizeof(lum_ac_symbols));
+    put_dht(f, 0x01, chm_dc_codelens, chm_dc_symbols, sizeof(chm_dc_symbols));
+    put_dht(f, 0x11, chm_ac_codelens, chm_ac_symbols, sizeof(chm_ac_symbols));
+    put16(f, 0xFFDA);
+    put16(f, 12);
+    const uint8_t sos[10] = {3, 0, 0x00, 1, 0x11, 2, 0x11, 0, 63, 0};
+    fwrite(sos, 1, sizeof(sos), f);
+}
+
+// --- Checks ---
+
+// Packetizes one frame and checks every packet against ref
+static bool check_frame(const char *name, const uint8_t *jpeg, size_t len, const ref_t *ref, FILE *out) {
+    static rtp_jpeg_tx_t tx;
+    static uint8_t rebuilt[MAX_SCAN];
+    size_t scan_len = ref->scan_end - ref->scan;
+    CHECK(scan_len <= sizeof(rebuilt), "scan of %zu bytes too large for the test", scan_len);
+    uint8_t want_type = (ref->ysamp == 0x21 ? 0 : 1) + (ref->dri ? 64 : 0);
+    uint32_t ts = 0x01020304;
+
+    rtp_jpeg_tx_init(&tx, TEST_SSRC);
+    tx.seq = TEST_SEQ;
+    int res = rtp_jpeg_tx_load(&tx, jpeg, len, ts);
+    CHECK(res == RTP_JPEG_OK, "load: %s", err_name(res));
+
+    size_t received = 0, packets = 0;
+    uint16_t seq = TEST_SEQ;
+    bool marker = false;
+    while (!marker) {
+        size_t n = rtp_jpeg_tx_next(&tx);
+        const uint8_t *p = tx.packet;
+        CHECK(n > RTP_HDR_LEN + RTP_JPEG_HDR_LEN && n <= RTP_JPEG_MAX_PACKET, "packet %zu: length %zu", packets, n);
+        CHECK(p[0] == 0x80 && (p[1] & 0x7F) == RTP_JPEG_PAYLOAD_TYPE, "packet %zu: RTP header %02x %02x", packets, p[0], p[1]);
+        CHECK(rd16(p + 2) == seq, "packet %zu: seq %u, expected %u", packets, rd16(p + 2), seq);
+        CHECK(rd32(p + 4) == ts && rd32(p + 8) == TEST_SSRC, "packet %zu: timestamp/SSRC", packets);
+        marker = p[1] & 0x80;
+
+        const uint8_t *h = p + RTP_HDR_LEN;
+        uint32_t offset = rd32(h) & 0x00FFFFFF;
+        CHECK(h[0] == 0, "packet %zu: type-specific %u", packets, h[0]);
+        CHECK(offset == received, "packet %zu: fragment offset %u, %zu bytes received", packets, offset, received);
+        CHECK(h[4] == want_type, "packet %zu: type %u, expected %u", packets, h[4], want_type);
+        CHECK(h[5] == 255, "packet %zu: Q %u", packets, h[5]);
+        CHECK(h[6] * 8 == ref->width && h[7] * 8 == ref->height, "packet %zu: %ux%u, expected %ux%u",
+              packets, h[6] * 8, h[7] * 8, ref->width, ref->height);
+        h += RTP_JPEG_HDR_LEN;
+        if (want_type >= 64) {
+            CHECK(rd16(h) == ref->dri && rd16(h + 2) == 0xFFFF, "packet %zu: restart header %u/%04x, DRI %u",
+                  packets, rd16(h), rd16(h + 2), ref->dri);
+            h += RTP_JPEG_RESTART_HDR_LEN;
+        }
+        if (offset == 0) {
+            CHECK(h[0] == 0 && h[1] == 0 && rd16(h + 2) == 128, "quantization header %u %u %u", h[0], h[1], rd16(h + 2));
+            CHECK(memcmp(h + 4, ref->qtable, 128) == 0, "quantization tables differ from DQT");
+            h += RTP_JPEG_QUANT_HDR_LEN + 128;
+            if (out) write_headers(out, want_type, p[RTP_HDR_LEN + 6], p[RTP_HDR_LEN + 7],
+                                   want_type >= 64 ? rd16(p + RTP_HDR_LEN + RTP_JPEG_HDR_LEN) : 0, h - 128);
+        }
+        size_t payload = n - (h - p);
+        CHECK(payload > 0 && received + payload <= scan_len, "packet %zu: %zu payload bytes at %zu of %zu",
+              packets, payload, received, scan_len);
+        memcpy(rebuilt + received, h, payload);
+        received += payload;
+        CHECK(marker == (received == scan_len), "packet %zu: marker %d with %zu of %zu bytes", packets, marker, received, scan_len);
+        CHECK(marker || n == RTP_JPEG_MAX_PACKET, "packet %zu: short packet (%zu) before the last", packets, n);
+        seq++;
+        packets++;
+    }
+    CHECK(rtp_jpeg_tx_next(&tx) == 0, "packet after the marker");
+    CHECK(memcmp(rebuilt, jpeg + ref->scan, scan_len) == 0, "reassembled scan differs");
+    CHECK(tx.frames == 1 && tx.dropped == 0, "counters frames=%u dropped=%u", tx.frames, tx.dropped);
+    if (out) {
+        fwrite(rebuilt, 1, scan_len, out);
+        put16(out, 0xFFD9);
+    }
+    if (verbose) printf("%s: %ux%u type %u, %zu scan bytes in %zu packets\n", name, ref->width, ref->height, want_type, scan_len, packets);
+    return true;
+}
+
+static bool check_reject(const char *name, const uint8_t *jpeg, size_t len, int want) {
+    static rtp_jpeg_tx_t tx;
+    rtp_jpeg_tx_init(&tx, TEST_SSRC);
+    int res = rtp_jpeg_tx_load(&tx, jpeg, len, 0);
+    CHECK(res == want, "load: %s, expected %s", err_name(res), err_name(want));
+    CHECK(rtp_jpeg_tx_next(&tx) == 0, "packet from a rejected frame");
+    CHECK(tx.dropped == 1 && tx.frames == 0, "counters frames=%u dropped=%u", tx.frames, tx.dropped);
+    if (verbose) printf("%s: rejected (%s)\n", name, err_name(res));
+    return true;
+}
+
+static bool check_variant(const char *name, const uint8_t *jpeg, size_t len) {
+    ref_t ref;
+    CHECK(ref_parse(jpeg, len, &ref), "test variant doesn't parse");
+    return check_frame(name, jpeg, len, &ref, NULL);
+}
+
+// The captured frame, then the variants derived from it
+static void check_captured(size_t i, const char *outdir) {
+    const uint8_t *jpeg = frames[i].buf;
+    size_t len = frames[i].len;
+    char name[64];
+    ref_t ref;
+    snprintf(name, sizeof(name), "frame %zu", i);
+    if (!ref_parse(jpeg, len, &ref)) {
+        printf("%s: no SOF0/SOS/EOI, skipped\n", name);
+        return;
+    }
+    if (ref.ysamp != 0x21 && ref.ysamp != 0x22) { // A 4:4:4 file given on the command line
+        check_reject(name, jpeg, len, RTP_JPEG_ERR_UNSUPPORTED);
+        return;
+    }
+    FILE *out = NULL;
+    char path[512];
+    if (outdir) {
+        snprintf(path, sizeof(path), "%s/frame%04zu.jpg", outdir, i);
+        out = fopen(path, "wb");
+        if (!out) fprintf(stderr, "%s: cannot write\n", path);
+    }
+    check_frame(name, jpeg, len, &ref, out);
+    if (out) fclose(out);
+
+    uint8_t *v = malloc(len + PAD_LEN + 6);
+    memcpy(v, jpeg, len);
+    memset(v + len, 0, PAD_LEN);
+    snprintf(name, sizeof(name), "frame %zu padded", i);
+    check_frame(name, v, len + PAD_LEN, &ref, NULL);
+
+    if (!ref.dri) {
+        const uint8_t dri[6] = {0xFF, 0xDD, 0x00, 0x04, TEST_DRI >> 8, TEST_DRI & 0xFF};
+        memcpy(v, jpeg, 2);
+        memcpy(v + 2, dri, sizeof(dri));
+        memcpy(v + 2 + sizeof(dri), jpeg + 2, len - 2);
+        snprintf(name, sizeof(name), "frame %zu with DRI", i);
+        check_variant(name, v, len + sizeof(dri));
+    }
+
+    memcpy(v, jpeg, len);
+    v[ref.ysamp_pos] = ref.ysamp == 0x21 ? 0x22 : 0x21;
+    snprintf(name, sizeof(name), "frame %zu as %s", i, ref.ysamp == 0x21 ? "4:2:0" : "4:2:2");
+    check_variant(name, v, len);
+
+    v[ref.ysamp_pos] = 0x11;
+    snprintf(name, sizeof(name), "frame %zu as 4:4:4", i);
+    check_reject(name, v, len, RTP_JPEG_ERR_UNSUPPORTED);
+
+    size_t cut = ref.scan + (ref.scan_end - ref.scan) * 3 / 4;
+    snprintf(name, sizeof(name), "frame %zu truncated", i);
+    check_reject(name, jpeg, cut, RTP_JPEG_ERR_TRUNCATED);
+    free(v);
+}
+
+int main(int argc, char **argv) {
+    const char *outdir = NULL;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-v") == 0) verbose = true;
+        else if (strcmp(argv[arg], "-o") == 0 && arg + 1 < argc) outdir = argv[++arg];
+        else break;
+    }
+    if (arg >= argc) {
+        fprintf(stderr, "usage: %s [-v] [-o outdir] file.avi|file.jpg ...\n", argv[0]);
+        return 2;
+    }
+    for (; arg < argc; arg++) {
+        size_t len;
+        uint8_t *data = load_file(argv[arg], &len);
+        if (!data) {
+            fprintf(stderr, "%s: cannot read\n", argv[arg]);
+            continue;
+        }
+        if (ends_with(argv[arg], ".jpg") || ends_with(argv[arg], ".jpeg")) {
+            add_frame(data, len);
+        } else {
+            size_t n = add_avi_frames(data, len);
+            fprintf(stderr, "%s: %zu frames\n", argv[arg], n);
+        }
+        free(data);
+    }
+    if (frame_count == 0) {
+        fprintf(stderr, "no frames\n");
+        return 1;
+    }
+
+    for (size_t i = 0; i < frame_count; i++) check_captured(i, outdir);
+    printf("%zu frames, %zu checks, %zu failed\n", frame_count, checks, failures);
+
+    for (size_t i = 0; i < frame_count; i++) free(frames[i].buf);
+    free(frames);
+    return failures ? 1 : 0;
+}
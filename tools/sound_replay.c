@@ -0,0 +1,158 @@
+// sound_replay.c
+// Host driver for the sound event detector (sound_detect.c). Feeds a WAV
+// file through sound_detect_process in the same 20 ms blocks the audio task
+// reads from the microphone, and prints where events start and end with
+// their levels against the noise floor. Recordings of the room the camera
+// sits in make changes to SOUND_CONFIG_DEFAULT reproducible.
+//
+// Build and run from the repository root:
+//   cc -O2 -Imain -o sound_replay tools/sound_replay.c main/sound_detect.c -lm
+//   ./sound_replay [-v] [-t trigger_db] [-r release_db] [-a attack_blocks] [-H hold_blocks]
+//                  [-m min_level_dbfs] [-b 0|1] room.wav
+//
+// The WAV must be 16-bit PCM; only the first channel of a stereo file is
+// used. The camera samples at 16 kHz (AUDIO_SAMPLE_RATE), other rates are
+// accepted but the band check then sees a different spectrum resolution.
+// Options override the matching SOUND_CONFIG_DEFAULT fields. -v prints
+// every block.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "sound_detect.h"
+
+#define CAMERA_SAMPLE_RATE 16000 // AUDIO_SAMPLE_RATE in audio.h
+#define BLOCK_MS 20              // AUDIO_BLOCK_SAMPLES at AUDIO_SAMPLE_RATE
+
+static uint8_t *load_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *buf = size > 0 ? malloc(size) : NULL;
+    if (buf && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = buf ? (size_t)size : 0;
+    return buf;
+}
+
+static uint32_t rd32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t rd16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+// First channel of a 16-bit PCM WAV, in a new buffer
+static int16_t *read_wav(const uint8_t *wav, size_t len, uint32_t *rate, size_t *samples) {
+    if (len < 12 || memcmp(wav, "RIFF", 4) != 0 || memcmp(wav + 8, "WAVE", 4) != 0) return NULL;
+    uint16_t channels = 0, bits = 0, format = 0;
+    for (size_t pos = 12; pos + 8 <= len; ) {
+        uint32_t size = rd32(wav + pos + 4);
+        const uint8_t *body = wav + pos + 8;
+        if (size > len - pos - 8) size = (uint32_t)(len - pos - 8); // Recorders that never patched the size
+        if (memcmp(wav + pos, "fmt ", 4) == 0 && size >= 16) {
+            format = rd16(body);
+            channels = rd16(body + 2);
+            *rate = rd32(body + 4);
+            bits = rd16(body + 14);
+        } else if (memcmp(wav + pos, "data", 4) == 0) {
+            if ((format != 1 && format != 0xFFFE) || bits != 16 || channels == 0) return NULL;
+            *samples = size / (2 * channels);
+            int16_t *pcm = malloc(*samples * sizeof(int16_t) + 1);
+            for (size_t i = 0; i < *samples; i++) pcm[i] = (int16_t)rd16(body + i * 2 * channels);
+            return pcm;
+        }
+        pos += 8 + (size_t)size + (size & 1);
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    sound_config_t cfg = SOUND_CONFIG_DEFAULT();
+    bool verbose = false;
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        const char *opt = argv[arg];
+        if (strcmp(opt, "-v") == 0) {
+            verbose = true;
+            continue;
+        }
+        if (arg + 1 >= argc) break;
+        int val = atoi(argv[++arg]);
+        if (strcmp(opt, "-t") == 0) cfg.trigger_db = val;
+        else if (strcmp(opt, "-r") == 0) cfg.release_db = val;
+        else if (strcmp(opt, "-a") == 0) cfg.attack_blocks = val;
+        else if (strcmp(opt, "-H") == 0) cfg.hold_blocks = val;
+        else if (strcmp(opt, "-m") == 0) cfg.min_level_dbfs = val;
+        else if (strcmp(opt, "-b") == 0) cfg.band_check = val != 0;
+        else break;
+    }
+    if (arg != argc - 1 || cfg.attack_blocks < 1) {
+        fprintf(stderr, "usage: %s [-v] [-t trigger_db] [-r release_db] [-a attack_blocks] [-H hold_blocks]\n"
+                        "       [-m min_level_dbfs] [-b 0|1] file.wav\n", argv[0]);
+        return 2;
+    }
+    size_t len;
+    uint8_t *data = load_file(argv[arg], &len);
+    if (!data) {
+        fprintf(stderr, "%s: cannot read\n", argv[arg]);
+        return 1;
+    }
+    uint32_t rate = 0;
+    size_t samples = 0;
+    int16_t *pcm = read_wav(data, len, &rate, &samples);
+    free(data);
+    if (!pcm || rate == 0) {
+        fprintf(stderr, "%s: not a 16-bit PCM WAV\n", argv[arg]);
+        return 1;
+    }
+    if (rate != CAMERA_SAMPLE_RATE) fprintf(stderr, "%s: %lu Hz, the camera samples at %d Hz\n", argv[arg], (unsigned long)rate, CAMERA_SAMPLE_RATE);
+
+    size_t block = rate * BLOCK_MS / 1000;
+    printf("%s: %.1f s at %lu Hz, %zu-sample blocks\n", argv[arg], (double)samples / rate, (unsigned long)rate, block);
+    printf("trigger %u dB, release %u dB, attack %u, hold %u, warmup %u blocks, min %d dBFS, band check %s (%u-%u Hz, %u%%)\n",
+           cfg.trigger_db, cfg.release_db, cfg.attack_blocks, cfg.hold_blocks, cfg.warmup_blocks, cfg.min_level_dbfs,
+           cfg.band_check ? "on" : "off", cfg.band_lo_hz, cfg.band_hi_hz, cfg.band_min_pct);
+
+    static sound_detector_t sd;
+    sound_detect_init(&sd, &cfg, rate);
+    size_t events = 0, blocks = 0, active_blocks = 0;
+    int16_t peak = -32768, level_min = 32767, level_max = -32768;
+    double started_s = 0;
+    sound_result_t r = {0};
+    for (size_t pos = 0; pos + block <= samples; pos += block, blocks++) {
+        sound_detect_process(&sd, pcm + pos, block, &r);
+        double t = (double)pos / rate;
+        if (r.level_dbfs < level_min) level_min = r.level_dbfs;
+        if (r.level_dbfs > level_max) level_max = r.level_dbfs;
+        if (r.active) active_blocks++;
+        if (r.active && r.level_dbfs > peak) peak = r.level_dbfs;
+        if (verbose) {
+            printf("%8.2f s  level %4d dBFS  floor %4d dBFS  band %3u%%%s%s%s\n", t, r.level_dbfs, r.floor_dbfs, r.band_pct,
+                   r.active ? "  active" : "", r.started ? "  started" : "", r.ended ? "  ended" : "");
+        }
+        if (r.started) {
+            // As audio.c reports it: the sound began with the first of the attack blocks
+            started_s = t - (double)BLOCK_MS / 1000 * (cfg.attack_blocks - 1);
+            peak = r.level_dbfs;
+            events++;
+            printf("%8.2f s  started: level %d dBFS, floor %d dBFS (+%d dB), band %u%%\n", started_s, r.level_dbfs,
+                   r.floor_dbfs, r.level_dbfs - r.floor_dbfs, r.band_pct);
+        } else if (r.ended) {
+            printf("%8.2f s  ended after %.2f s: peak %d dBFS, floor %d dBFS\n", t, t - started_s, peak, r.floor_dbfs);
+        }
+    }
+    if (r.active) printf("%8.2f s  still active at the end of the file\n", (double)blocks * block / rate);
+    printf("%zu blocks, %zu events, active %.1f s, level %d to %d dBFS, final floor %d dBFS\n", blocks, events,
+           active_blocks * (double)block / rate, level_min, level_max, r.floor_dbfs);
+    free(pcm);
+    return 0;
+}
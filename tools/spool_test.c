@@ -0,0 +1,222 @@
+// spool_test.c
+// Host test for the event upload spool (spool.c), with segments and the cap
+// shrunk so a few small records exercise them. spool.c is compiled into this
+// file so a reboot can be simulated by clearing its state and running
+// spool_init again. Covers append/peek/pop across segment rolls, restart
+// from the cursor, a peeked but unpopped record surviving a reboot, the size
+// cap dropping the oldest segment, a corrupt payload, a corrupt header and
+// a record torn by a power cut.
+//
+// Build and run from the repository root:
+//   cc -O2 -Imain -Itools/host -o spool_test tools/spool_test.c
+//   ./spool_test
+//
+// Works in /tmp/spool_test, which is emptied first. Exits 1 if any check
+// fails.
+
+#define SPOOL_DIR "/tmp/spool_test"
+#define SPOOL_SEGMENT_BYTES 4096
+#define SPOOL_MAX_BYTES (6 * SPOOL_SEGMENT_BYTES)
+#include "../main/spool.c"
+
+#define REC_LEN (SPOOL_SEGMENT_BYTES / 4 - sizeof(spool_rec_t)) // Four records fill a segment
+
+static size_t checks = 0, failures = 0;
+
+#define CHECK(cond, ...) do { \
+    checks++; \
+    if (!(cond)) { \
+        failures++; \
+        printf("FAIL %s:%d: ", __func__, __LINE__); \
+        printf(__VA_ARGS__); \
+        printf("\n"); \
+        return; \
+    } \
+} while (0)
+
+static void make_record(uint32_t n, uint8_t *buf) {
+    for (size_t i = 0; i < REC_LEN; i++) buf[i] = (uint8_t)(n * 31 + i * 7);
+}
+
+static void wipe(void) {
+    DIR *dir = opendir(SPOOL_DIR);
+    if (dir) {
+        struct dirent *ent;
+        char path[300];
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] == '.') continue;
+            snprintf(path, sizeof(path), "%s/%s", SPOOL_DIR, ent->d_name);
+            remove(path);
+        }
+        closedir(dir);
+    }
+}
+
+static int segment_files(void) {
+    DIR *dir = opendir(SPOOL_DIR);
+    int n = 0;
+    struct dirent *ent;
+    while (dir && (ent = readdir(dir)) != NULL) {
+        if (strstr(ent->d_name, ".jnl")) n++;
+    }
+    if (dir) closedir(dir);
+    return n;
+}
+
+// What a power cycle leaves: the files, nothing in RAM
+static esp_err_t reboot(void) {
+    if (write_fp) fclose(write_fp);
+    write_fp = NULL;
+    spool_ok = false;
+    peeked_len = 0;
+    dropped = 0;
+    return spool_init();
+}
+
+static esp_err_t append(uint32_t n) {
+    uint8_t buf[REC_LEN];
+    make_record(n, buf);
+    return spool_append(buf, sizeof(buf), 1000 + n);
+}
+
+// Peeks the next record, checks it is record n, pops it unless told not to
+static bool expect(uint32_t n, bool pop, const char *func, int line) {
+    size_t len = 0;
+    int64_t ts = 0;
+    uint8_t want[REC_LEN];
+    make_record(n, want);
+    uint8_t *buf = spool_peek(&len, &ts);
+    bool ok = buf && len == REC_LEN && ts == 1000 + n && memcmp(buf, want, REC_LEN) == 0;
+    checks++;
+    if (!ok) {
+        failures++;
+        printf("FAIL %s:%d: expected record %u, got %s ts=%lld len=%zu\n", func, line, n, buf ? "a record" : "none",
+               (long long)ts, len);
+    }
+    free(buf);
+    if (ok && pop) spool_pop();
+    return ok;
+}
+#define EXPECT(n) do { if (!expect(n, true, __func__, __LINE__)) return; } while (0)
+
+static void test_rolls(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    CHECK(spool_pending() == 0 && spool_peek(&(size_t){0}, &(int64_t){0}) == NULL, "empty spool has records");
+    for (uint32_t n = 0; n < 10; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    CHECK(spool_pending() == 10, "pending %u", spool_pending());
+    CHECK(segment_files() == 3, "%d segments for 10 records", segment_files());
+    for (uint32_t n = 0; n < 6; n++) EXPECT(n);
+    CHECK(segment_files() == 2, "%d segments after draining the first", segment_files());
+    for (uint32_t n = 10; n < 12; n++) CHECK(append(n) == ESP_OK, "append %u", n); // Behind the records being read
+    for (uint32_t n = 6; n < 12; n++) EXPECT(n);
+    CHECK(spool_pending() == 0 && spool_peek(&(size_t){0}, &(int64_t){0}) == NULL, "drained spool has records");
+    spool_stats_t st;
+    spool_get_stats(&st);
+    CHECK(st.dropped == 0, "dropped %u", st.dropped);
+}
+
+static void test_cursor_restart(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    for (uint32_t n = 0; n < 10; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    for (uint32_t n = 0; n < 5; n++) EXPECT(n);
+    CHECK(reboot() == ESP_OK, "reboot");
+    CHECK(spool_pending() == 5, "pending %u after reboot", spool_pending());
+    if (!expect(5, false, __func__, __LINE__)) return; // Peeked, upload in flight, power lost
+    CHECK(reboot() == ESP_OK, "reboot");
+    CHECK(spool_pending() == 5, "pending %u after reboot", spool_pending());
+    CHECK(append(10) == ESP_OK, "append after reboot");
+    for (uint32_t n = 5; n < 11; n++) EXPECT(n);
+    CHECK(spool_pending() == 0, "pending %u", spool_pending());
+}
+
+static void test_size_cap(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    uint32_t total = 40; // Ten segments' worth against a cap of six
+    for (uint32_t n = 0; n < total; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    spool_stats_t st;
+    spool_get_stats(&st);
+    CHECK(st.bytes <= SPOOL_MAX_BYTES, "%llu bytes over the cap", (unsigned long long)st.bytes);
+    CHECK(st.dropped > 0 && st.dropped % 4 == 0, "dropped %u, expected whole segments", st.dropped);
+    CHECK(st.pending + st.dropped == total, "pending %u + dropped %u != %u", st.pending, st.dropped, total);
+    for (uint32_t n = st.dropped; n < total; n++) EXPECT(n); // Oldest gone, the rest in order
+}
+
+// Offset of record n in its segment
+static long record_offset(uint32_t n) {
+    return (long)(n % 4) * (sizeof(spool_rec_t) + REC_LEN);
+}
+
+static void poke(uint32_t seg, long offset, uint8_t xor) {
+    char path[SPOOL_PATH_LEN];
+    segment_path(seg, path);
+    FILE *fp = fopen(path, "r+b");
+    if (!fp) return;
+    fseek(fp, offset, SEEK_SET);
+    int c = fgetc(fp);
+    fseek(fp, offset, SEEK_SET);
+    fputc(c ^ xor, fp);
+    fclose(fp);
+}
+
+static void test_corrupt_payload(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    for (uint32_t n = 0; n < 6; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    poke(read_seg, record_offset(1) + sizeof(spool_rec_t) + 500, 0x01);
+    EXPECT(0);
+    EXPECT(2); // 1 skipped, the framing still holds
+    EXPECT(3);
+    EXPECT(4);
+    EXPECT(5);
+    spool_stats_t st;
+    spool_get_stats(&st);
+    CHECK(st.dropped == 1 && st.pending == 0, "dropped %u pending %u", st.dropped, st.pending);
+}
+
+static void test_corrupt_header(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    for (uint32_t n = 0; n < 6; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    poke(read_seg, record_offset(1), 0xFF); // Magic of record 1
+    EXPECT(0);
+    EXPECT(4); // The rest of the first segment can't be framed
+    EXPECT(5);
+    spool_stats_t st;
+    spool_get_stats(&st);
+    CHECK(st.dropped == 3 && st.pending == 0, "dropped %u pending %u", st.dropped, st.pending);
+    CHECK(segment_files() <= 1, "%d segments left after draining", segment_files()); // At most the empty write segment
+}
+
+static void test_torn_record(void) {
+    wipe();
+    CHECK(reboot() == ESP_OK, "init");
+    for (uint32_t n = 0; n < 3; n++) CHECK(append(n) == ESP_OK, "append %u", n);
+    char path[SPOOL_PATH_LEN];
+    segment_path(write_seg, path);
+    fclose(write_fp);
+    write_fp = NULL;
+    CHECK(truncate(path, record_offset(2) + sizeof(spool_rec_t) + 100) == 0, "truncate"); // Power lost mid-append
+    CHECK(reboot() == ESP_OK, "reboot");
+    CHECK(spool_pending() == 2, "pending %u after a torn record", spool_pending());
+    CHECK(append(3) == ESP_OK, "append after reboot");
+    EXPECT(0);
+    EXPECT(1);
+    EXPECT(3);
+    CHECK(spool_pending() == 0, "pending %u", spool_pending());
+}
+
+int main(void) {
+    mkdir(SPOOL_DIR, 0777);
+    test_rolls();
+    test_cursor_restart();
+    test_size_cap();
+    test_corrupt_payload();
+    test_corrupt_header();
+    test_torn_record();
+    wipe();
+    printf("%zu checks, %zu failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,128 @@
+#!/usr/bin/env python3
+"""Decode a trace dump written by "trace dump" (main/trace.c).
+
+Usage:
+    trace_decode.py trace.bin                  one line per record, oldest first
+    trace_decode.py trace.bin --event rec_saved --event rec_flush
+    trace_decode.py trace.bin --summary        count, rate and argument ranges per event
+
+The dump carries the event and argument names, so this tool does not need
+updating when events are added on the device.
+"""
+
+import argparse
+import datetime
+import struct
+import sys
+
+HEADER = struct.Struct("<4sHHIIIqqHH")
+RECORD = struct.Struct("<IHBBII")
+MAGIC = b"CTRC"
+
+
+def load(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < HEADER.size:
+        sys.exit(f"{path}: too short for a trace dump")
+    (magic, version, rec_size, records, overwritten, lost,
+     dump_us, dump_ms, event_count, names_len) = HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != 1 or rec_size != RECORD.size:
+        sys.exit(f"{path}: not a version 1 trace dump")
+
+    strings = data[HEADER.size:HEADER.size + names_len].split(b"\0")
+    events = []
+    for i in range(event_count):
+        name, a, b = (s.decode() for s in strings[3 * i:3 * i + 3])
+        events.append((name, a, b))
+
+    # Record times are the low 32 bits of esp_timer; none is older than the
+    # dump, so each one is extended backwards from dump_us
+    recs = []
+    offset = HEADER.size + names_len
+    available = (len(data) - offset) // RECORD.size
+    if available < records:
+        print(f"warning: {records} records announced, {available} present", file=sys.stderr)
+    for i in range(min(records, available)):
+        time_lo, event, core, _, a, b = RECORD.unpack_from(data, offset + i * RECORD.size)
+        time_us = dump_us - ((dump_us - time_lo) & 0xFFFFFFFF)
+        recs.append((time_us, event, core, a, b))
+    recs.sort(key=lambda r: r[0])  # Cores reserve slots and stamp them in slightly different orders
+
+    info = {"overwritten": overwritten, "lost": lost, "dump_us": dump_us, "dump_ms": dump_ms}
+    return events, recs, info
+
+
+def event_name(events, event):
+    return events[event][0] if event < len(events) else f"event{event}"
+
+
+def wall(info, time_us):
+    if not info["dump_ms"]:
+        return f"{time_us / 1e6:12.6f}"
+    ms = info["dump_ms"] - (info["dump_us"] - time_us) / 1000
+    return datetime.datetime.fromtimestamp(ms / 1000).strftime("%H:%M:%S.%f")
+
+
+def print_records(events, recs, info, wanted):
+    prev = None
+    for time_us, event, core, a, b in recs:
+        name = event_name(events, event)
+        if wanted and name not in wanted:
+            continue
+        delta = "" if prev is None else f"+{(time_us - prev) / 1000:.3f}ms"
+        prev = time_us
+        args = []
+        labels = events[event][1:] if event < len(events) else ("a", "b")
+        for label, value in zip(labels, (a, b)):
+            if label:
+                args.append(f"{label}={value}")
+        print(f"{wall(info, time_us)} {delta:>12} c{core} {name:<12} {' '.join(args)}")
+
+
+def print_summary(events, recs):
+    if not recs:
+        return
+    span_s = max((recs[-1][0] - recs[0][0]) / 1e6, 1e-6)
+    by_event = {}
+    for time_us, event, core, a, b in recs:
+        by_event.setdefault(event, []).append((a, b))
+    print(f"{len(recs)} records over {span_s:.3f} s")
+    for event in sorted(by_event):
+        values = by_event[event]
+        line = f"{event_name(events, event):<12} {len(values):6d}  {len(values) / span_s:8.1f}/s"
+        labels = events[event][1:] if event < len(events) else ("a", "b")
+        for i, label in enumerate(labels):
+            if label:
+                col = [v[i] for v in values]
+                line += f"  {label} {min(col)}/{sum(col) // len(col)}/{max(col)}"
+        print(line)
+    print("(argument ranges are min/avg/max)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("dump", help="trace.bin copied from the SD card")
+    parser.add_argument("--event", action="append", default=[], help="only this event (repeatable)")
+    parser.add_argument("--summary", action="store_true", help="per-event statistics instead of records")
+    args = parser.parse_args()
+
+    events, recs, info = load(args.dump)
+    if args.event:
+        known = {e[0] for e in events}
+        for name in args.event:
+            if name not in known:
+                sys.exit(f"unknown event {name}, the dump has: {', '.join(sorted(known))}")
+    if info["overwritten"] or info["lost"]:
+        print(f"# {info['overwritten']} older records overwritten, {info['lost']} lost during dumps", file=sys.stderr)
+    if args.summary:
+        print_summary(events, [r for r in recs if not args.event or event_name(events, r[1]) in args.event])
+    else:
+        print_records(events, recs, info, set(args.event))
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except BrokenPipeError:  # Piped into head
+        sys.stderr.close()